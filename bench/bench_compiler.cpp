@@ -0,0 +1,193 @@
+// compiler throughput benchmark: generates synthetic .tl programs of growing
+// size, times each compiler phase separately and checks that every phase
+// scales near-linearly with input size. results are written as JSON so runs
+// from different commits can be diffed.
+//
+//   bin/bench_compiler [--min-size BYTES] [--max-size BYTES] [--max-slope S] [--out FILE]
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include "../src/lexing.hpp"
+#include "../src/parsing.hpp"
+#include "../src/codegen.hpp"
+
+struct generator_t {
+    const char * name;
+    std::function<void(std::string &, size_t)> emit_unit; // appends one self-contained chunk
+};
+
+// x = 1 + 2 + ... , 64 terms per statement
+static void gen_expression_chain(std::string & out, size_t n) {
+    out += "x" + std::to_string(n % 8) + " = " + std::to_string(n);
+    for(int i = 1; i < 64; i++) {
+        out += i % 3 == 0 ? " * " : " + ";
+        out += std::to_string(i);
+    }
+    out += "\n";
+}
+
+// blocks and ifs nested 32 deep
+static void gen_deep_nesting(std::string & out, size_t n) {
+    if(n == 0) out += "d = 1\n";
+    std::string indent;
+    for(int i = 0; i < 32; i++) {
+        out += indent + (i % 2 ? "{\n" : "if(d == 1) {\n");
+        indent += "  ";
+    }
+    out += indent + "write(d)\n";
+    for(int i = 0; i < 32; i++) {
+        indent.resize(indent.size() - 2);
+        out += indent + "}\n";
+    }
+}
+
+// a fresh variable per statement, each reading the previous one
+static void gen_many_variables(std::string & out, size_t n) {
+    if(n == 0) out += "v0 = 0\n";
+    out += "v" + std::to_string(n + 1) + " = v" + std::to_string(n) + " + " + std::to_string(n % 97) + "\n";
+}
+
+// else-if ladders of 48 arms on one variable
+static void gen_if_else_ladder(std::string & out, size_t n) {
+    if(n == 0) out += "k = 17\n";
+    for(int i = 0; i < 48; i++) {
+        out += i == 0 ? "if(k == " : " else if(k == ";
+        out += std::to_string(i) + ") {\n  write(" + std::to_string(n * 48 + i) + ")\n}";
+    }
+    out += " else {\n  write(0)\n}\n";
+}
+
+static std::string generate(const generator_t & gen, size_t target) {
+    std::string src;
+    src.reserve(target + 4096);
+    for(size_t n = 0; src.size() < target; n++) gen.emit_unit(src, n);
+    return src;
+}
+
+struct phase_result_t {
+    double seconds = 0;
+    size_t iterations = 0;
+};
+
+// repeats `fn` until at least 50ms have elapsed and reports the mean
+static phase_result_t time_phase(const std::function<void()> & fn) {
+    using clock = std::chrono::steady_clock;
+    phase_result_t r;
+    auto start = clock::now();
+    double elapsed = 0;
+    do {
+        fn();
+        r.iterations++;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while(elapsed < 0.05);
+    r.seconds = elapsed / r.iterations;
+    return r;
+}
+
+static const char * phase_names[] = {"lex", "parse", "codegen", "emit"};
+
+int main(int argc, char ** argv) {
+    size_t min_size = 1 << 10;
+    size_t max_size = 10 << 20;
+    double max_slope = 1.2;
+    const char * out_path = nullptr;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--min-size" && i + 1 < argc) min_size = strtoull(argv[++i], nullptr, 10);
+        else if(arg == "--max-size" && i + 1 < argc) max_size = strtoull(argv[++i], nullptr, 10);
+        else if(arg == "--max-slope" && i + 1 < argc) max_slope = atof(argv[++i]);
+        else if(arg == "--out" && i + 1 < argc) out_path = argv[++i];
+        else {
+            fprintf(stderr, "usage: bench_compiler [--min-size BYTES] [--max-size BYTES] [--max-slope S] [--out FILE]\n");
+            return 1;
+        }
+    }
+
+    std::vector<generator_t> generators = {
+        {"expression_chain", gen_expression_chain},
+        {"deep_nesting", gen_deep_nesting},
+        {"many_variables", gen_many_variables},
+        {"if_else_ladder", gen_if_else_ladder},
+    };
+
+    std::string json = "{\n  \"version\": \"" TOYLANG_VERSION "\",\n  \"results\": [\n";
+    std::string scaling = "  \"scaling\": [\n";
+    bool all_linear = true;
+    bool first_result = true, first_scaling = true;
+
+    for(auto & gen : generators) {
+        // per phase: (bytes, seconds) samples for the slope fit
+        std::vector<std::pair<double, double>> samples[4];
+        for(size_t size = min_size; size <= max_size; size *= 10) {
+            std::string src = generate(gen, size);
+            size_t tokens = 0;
+            phase_result_t r[4];
+            try {
+                r[0] = time_phase([&] {
+                    lexer_t lexer;
+                    lexer.init(src.c_str(), src.size());
+                    tokens = 0;
+                    while(lexer.has_token()) { lexer.next_token(); tokens++; }
+                });
+                parser_t parser;
+                ast_t ast = parser.parse(src.c_str(), src.size());
+                r[1] = time_phase([&] { parser_t p; ast_t a = p.parse(src.c_str(), src.size()); });
+                program_data_t program = code_generator_t().gen_program(ast);
+                r[2] = time_phase([&] { code_generator_t cg; program_data_t p = cg.gen_program(ast); });
+                r[3] = time_phase([&] { asm_emitter_t out; program.emit_asm(out, true); });
+            } catch(utils::error_t & e) {
+                fprintf(stderr, "%s @ %zu bytes: %s\n", gen.name, src.size(), e.what());
+                return 1;
+            }
+            for(int p = 0; p < 4; p++) {
+                samples[p].push_back({(double)src.size(), r[p].seconds});
+                char line[512];
+                snprintf(line, sizeof(line),
+                         "%s    {\"generator\": \"%s\", \"phase\": \"%s\", \"bytes\": %zu, \"tokens\": %zu, "
+                         "\"seconds\": %.9f, \"ns_per_byte\": %.3f, \"mb_per_s\": %.2f, \"iterations\": %zu}",
+                         first_result ? "" : ",\n", gen.name, phase_names[p], src.size(), tokens, r[p].seconds,
+                         r[p].seconds * 1e9 / src.size(), src.size() / r[p].seconds / (1 << 20), r[p].iterations);
+                json += line;
+                first_result = false;
+                fprintf(stderr, "%-18s %-8s %10zu B  %9.3f ms  %8.2f MB/s\n", gen.name, phase_names[p], src.size(),
+                        r[p].seconds * 1e3, src.size() / r[p].seconds / (1 << 20));
+            }
+        }
+        // log-log slope between the smallest sample above 64 KiB (below that
+        // fixed costs dominate) and the largest one; 1.0 is perfectly linear
+        for(int p = 0; p < 4; p++) {
+            auto & s = samples[p];
+            size_t lo = 0;
+            while(lo + 1 < s.size() && s[lo].first < 65536) lo++;
+            size_t hi = s.size() - 1;
+            if(hi <= lo) continue;
+            double slope = log(s[hi].second / s[lo].second) / log(s[hi].first / s[lo].first);
+            bool linear = slope <= max_slope;
+            all_linear = all_linear && linear;
+            char line[256];
+            snprintf(line, sizeof(line), "%s    {\"generator\": \"%s\", \"phase\": \"%s\", \"slope\": %.3f, \"linear\": %s}",
+                     first_scaling ? "" : ",\n", gen.name, phase_names[p], slope, linear ? "true" : "false");
+            scaling += line;
+            first_scaling = false;
+            if(!linear) fprintf(stderr, "superlinear: %s/%s slope %.3f\n", gen.name, phase_names[p], slope);
+        }
+    }
+    json += "\n  ],\n" + scaling + "\n  ]\n}\n";
+
+    if(out_path) {
+        FILE * f = fopen(out_path, "w");
+        if(!f) {
+            fprintf(stderr, "Failed to open %s\n", out_path);
+            return 1;
+        }
+        fputs(json.c_str(), f);
+        fclose(f);
+    } else {
+        fputs(json.c_str(), stdout);
+    }
+    return all_linear ? 0 : 2;
+}
@@ -0,0 +1,102 @@
+// embedding benchmark: compiles a set of generated scripts through the
+// library API on 1, 2, 4, ... threads and reports throughput against one
+// thread. every compile is checked against a single-threaded reference, so
+// shared state between compiles shows up as a mismatch rather than a
+// speedup. with --run the scripts are also linked and executed, which
+// mostly measures gcc and process startup.
+//
+//   bin/bench_embed [--scripts N] [--threads "1 2 4"] [--run]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "../src/toylang.h"
+
+// a few hundred lines of loops, ifs and arithmetic that differ per script
+static std::string make_script(size_t n) {
+    std::string src = "total = " + std::to_string(n) + "\n";
+    for(int f = 0; f < 40; f++) {
+        std::string v = "v" + std::to_string(f);
+        src += v + " = " + std::to_string((n * 31 + f) % 97) + "\n";
+        src += "for i = 0, " + std::to_string(10 + f) + " {\n";
+        src += "  if i % 3 == " + std::to_string(f % 3) + " { " + v + " += i * " + std::to_string(f + 1) + " }\n";
+        src += "  else { " + v + " = " + v + " ^ (i << 2) }\n";
+        src += "}\n";
+        src += "total = total + (" + v + " & 1023)\n";
+    }
+    src += "write(total)\n";
+    return src;
+}
+
+int main(int argc, char ** argv) {
+    size_t scripts = 2000;
+    std::vector<size_t> threads;
+    bool run = false;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--scripts" && i + 1 < argc) scripts = strtoull(argv[++i], nullptr, 10);
+        else if(arg == "--threads" && i + 1 < argc) {
+            char * p = argv[++i];
+            while(*p) {
+                char * end;
+                size_t t = strtoull(p, &end, 10);
+                if(end == p) break;
+                if(t) threads.push_back(t);
+                p = end;
+            }
+        }
+        else if(arg == "--run") run = true;
+        else {
+            fprintf(stderr, "usage: bench_embed [--scripts N] [--threads \"1 2 4\"] [--run]\n");
+            return 1;
+        }
+    }
+    if(threads.empty()) {
+        size_t max = std::thread::hardware_concurrency();
+        for(size_t t = 1; t < max; t *= 2) threads.push_back(t);
+        threads.push_back(max ? max : 1);
+    }
+    if(run && scripts > 200) scripts = 200;
+
+    std::vector<std::string> sources;
+    std::vector<std::string> expected;
+    size_t bytes = 0;
+    for(size_t n = 0; n < scripts; n++) {
+        sources.push_back(make_script(n));
+        bytes += sources.back().size();
+        toy::program_t p = toy::compile(sources.back());
+        if(!p.ok()) {
+            fprintf(stderr, "script %zu: line %zu: %s\n", n, p.diagnostics[0].line, p.diagnostics[0].message.c_str());
+            return 1;
+        }
+        expected.push_back(run ? toy::run(p).output : p.assembly);
+    }
+
+    double base = 0;
+    bool all_match = true;
+    for(size_t t : threads) {
+        std::atomic<size_t> next{0}, mismatches{0};
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for(size_t w = 0; w < t; w++) {
+            workers.emplace_back([&] {
+                for(size_t n; (n = next.fetch_add(1)) < scripts;) {
+                    toy::program_t p = toy::compile(sources[n]);
+                    std::string got = run ? toy::run(p).output : p.assembly;
+                    if(got != expected[n]) mismatches++;
+                }
+            });
+        }
+        for(auto & w : workers) w.join();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double rate = scripts / secs;
+        if(!base) base = rate / t;
+        all_match = all_match && mismatches == 0;
+        printf("threads=%-3zu %8.1f scripts/s %8.2f MB/s  speedup=%.2f  efficiency=%3.0f%%  mismatches=%zu\n", t,
+               rate, bytes / secs / (1 << 20), rate / base, 100.0 * rate / base / t, mismatches.load());
+    }
+    return all_match ? 0 : 2;
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+# wall time of the built-in map (map_ops.tl) next to std::unordered_map
+# running the same operations (map_ops.cpp); both print the same results
+set -e
+TOY=${TOY:-./bin/toy}
+CXX=${CXX:-g++}
+OUT=${OUT:-bin/bench_map}
+mkdir -p "$OUT"
+"$TOY" --no-cache -o "$OUT/map_ops" bench/map_ops.tl > /dev/null
+"$CXX" -O2 -std=c++17 bench/map_ops.cpp -o "$OUT/map_ops_std"
+for exe in "$OUT/map_ops" "$OUT/map_ops_std"; do
+    start=$(date +%s%N)
+    result=$("$exe" | tr '\n' ' ')
+    end=$(date +%s%N)
+    echo "$(basename "$exe") $(( (end - start) / 1000000 )) ms result=$result"
+done
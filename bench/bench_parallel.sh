@@ -0,0 +1,26 @@
+#!/bin/sh
+# wall time of the parallel benchmarks for 1, 2, 4, ... workers up to the
+# number of cpus (or $THREADS, e.g. THREADS="1 2 4 8")
+set -e
+TOY=${TOY:-./bin/toy}
+OUT=${OUT:-bin/bench_parallel}
+mkdir -p "$OUT"
+if [ -z "$THREADS" ]; then
+    n=1
+    max=$(nproc)
+    while [ "$n" -lt "$max" ]; do THREADS="$THREADS $n"; n=$((n * 2)); done
+    THREADS="$THREADS $max"
+fi
+for src in bench/parallel_sum.tl bench/mandelbrot.tl; do
+    exe="$OUT/$(basename "$src" .tl)"
+    "$TOY" --no-cache -o "$exe" "$src" > /dev/null
+    base=""
+    for t in $THREADS; do
+        start=$(date +%s%N)
+        result=$(TOY_THREADS=$t "$exe")
+        end=$(date +%s%N)
+        ms=$(( (end - start) / 1000000 ))
+        [ -n "$base" ] || base=$ms
+        echo "$(basename "$src" .tl) threads=$t ${ms} ms speedup=$(awk "BEGIN { printf \"%.2f\", $base / ($ms ? $ms : 1) }") result=$result"
+    done
+done
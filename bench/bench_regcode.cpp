@@ -0,0 +1,468 @@
+// the register bytecode against the stack bytecode it is translated from,
+// on small scalar kernels. for each kernel it reports
+//   static   instructions in the stack and the register code
+//   dynamic  instructions executed by an interpreter of each format
+//   interp   wall time of those interpreters, best of --runs
+//   native   wall time of a `toy` and a `toy --regcode` build, best of --runs
+// and checks that both formats print the same and exit the same way. the
+// stack interpreter here is the register executor's twin: one switch
+// dispatch per instruction, labels resolved up front, cold blocks moved
+// after main, so the counts differ only by the instruction set.
+//
+//   bin/bench_regcode [--toy bin/toy] [--dir tmpdir] [--runs N] [--interp-n N] [--native-n N] [-O0|-O1|-O2]
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <chrono>
+#include <algorithm>
+#include "../src/lexing.hpp"
+#include "../src/parsing.hpp"
+#include "../src/passes.hpp"
+#include "../src/regcode.hpp"
+
+extern char ** environ;
+
+struct kernel_t {
+    const char * name;
+    std::string (*source)(size_t n);
+};
+
+// modulo, division by constants and a clamp in one loop
+static std::string kernel_arith(size_t n) {
+    return "s = 0\n"
+           "for i = 0, " + std::to_string(n) + " {\n"
+           "    s = s + i % 7 + i / 3 * 5\n"
+           "    if s > 1000000 { s = s - 1000000 }\n"
+           "}\n"
+           "write(s)\n"
+           "status = s & 127\n";
+}
+
+static std::string kernel_collatz(size_t n) {
+    return "steps = 0\n"
+           "for k = 1, " + std::to_string(n / 100 + 2) + " {\n"
+           "    c = k\n"
+           "    while c != 1 {\n"
+           "        if c % 2 == 0 { c = c / 2 } else { c = 3 * c + 1 }\n"
+           "        steps += 1\n"
+           "    }\n"
+           "}\n"
+           "write(steps)\n"
+           "status = steps & 127\n";
+}
+
+static std::string kernel_sieve(size_t n) {
+    std::string size = std::to_string(n / 4 + 16);
+    return "composite = array(" + size + ")\n"
+           "primes = 0\n"
+           "for i = 2, " + size + " {\n"
+           "    if composite[i] == 0 {\n"
+           "        primes += 1\n"
+           "        j = i * i\n"
+           "        while j < " + size + " {\n"
+           "            composite[j] = 1\n"
+           "            j = j + i\n"
+           "        }\n"
+           "    }\n"
+           "}\n"
+           "write(primes)\n"
+           "status = primes & 127\n";
+}
+
+static std::string kernel_dispatch(size_t n) {
+    return "acc = 0\n"
+           "for i = 0, " + std::to_string(n) + " {\n"
+           "    match i & 7 {\n"
+           "        0 { acc += 3 }\n"
+           "        1 { acc = acc ^ i }\n"
+           "        2, 3 { acc -= 1 }\n"
+           "        5 { acc = acc + (i >> 2) }\n"
+           "        else { acc = acc & 65535 }\n"
+           "    }\n"
+           "}\n"
+           "write(acc)\n"
+           "status = acc & 127\n";
+}
+
+static std::string kernel_nested(size_t n) {
+    return "s = 0\n"
+           "for i = 0, " + std::to_string(n / 1000 + 1) + " {\n"
+           "    for j = 0, 1000 {\n"
+           "        s = s + ((i ^ j) & 15) * (j < i ? 1 : 2)\n"
+           "    }\n"
+           "}\n"
+           "write(s)\n"
+           "status = s & 127\n";
+}
+
+// the stack bytecode decoded for execution: operands unpacked, labels and
+// line markers gone, jumps and switch cases resolved to indices
+struct stack_insn_t {
+    uint8_t op;
+    int64_t a, b;
+    int32_t target;
+};
+
+struct stack_program_t {
+    std::vector<stack_insn_t> code;
+    std::vector<reg_case_t> cases;
+    size_t slots = 0;
+};
+
+enum { LBL_LOOP, LBL_LOOP_END, LBL_IF_FALSE, LBL_IF_TRUE, LBL_IF_END, LBL_MATCH };
+
+static stack_program_t decode_stack(const std::vector<uint8_t> & bytecode) {
+    bytecode_check_t check = verify_bytecode(bytecode);
+    if(!check.ok()) throw utils::error_t(0, "Invalid bytecode: " + check.errors[0]);
+    stack_program_t program;
+    program.slots = check.bodies[0].max_depth / 8;
+    std::vector<stack_insn_t> sections[2];
+    int section = 0, cold = 0;
+    std::map<std::tuple<int, int64_t, int64_t>, std::pair<int, size_t>> labels;
+    std::vector<std::tuple<int, size_t, int, int64_t, int64_t>> fixups; // section, index, label
+    auto define = [&](int kind, int64_t id, int64_t n = 0) { labels[{kind, id, n}] = {section, sections[section].size()}; };
+    auto emit = [&](uint8_t op, int64_t a = 0, int64_t b = 0) { sections[section].push_back({op, a, b, 0}); };
+    auto jump_to = [&](uint8_t op, int kind, int64_t id, int64_t n = 0) {
+        fixups.push_back({section, sections[section].size(), kind, id, n});
+        emit(op, id);
+    };
+    for(size_t i = 0; i < bytecode.size(); i += bytecode_size(&bytecode[i])) {
+        const uint8_t * op = &bytecode[i];
+        int64_t a = opcode_info[*op].operands > 0 ? bytecode_operand(op, 0) : 0;
+        int64_t b = opcode_info[*op].operands > 1 ? bytecode_operand(op, 1) : 0;
+        switch(*op) {
+        case BC_LINE: break;
+        case BC_COLD_BEGIN: cold++; section = 1; break;
+        case BC_COLD_END: section = --cold > 0; break;
+        case BC_LOOP_LABEL: define(LBL_LOOP, a); break;
+        case BC_TEST_FALSE_LABEL: define(LBL_IF_FALSE, a); break;
+        case BC_TRUE_LABEL: define(LBL_IF_TRUE, a); break;
+        case BC_TEST_END_END_LABEL: define(LBL_IF_END, a); break;
+        case BC_CASE_LABEL: define(LBL_MATCH, a, b); break;
+        case BC_IF: jump_to(*op, LBL_IF_FALSE, a); break;
+        case BC_IF_NOT: jump_to(*op, LBL_IF_TRUE, a); break;
+        case BC_WHILE_TEST:
+        case BC_FOR_TEST: jump_to(*op, LBL_LOOP_END, a); break;
+        case BC_JUMP_END: jump_to(*op, LBL_IF_END, a); break;
+        case BC_BREAK: jump_to(*op, LBL_LOOP_END, a); break;
+        case BC_CONTINUE:
+        case BC_FOR_CONTINUE: jump_to(*op, LBL_LOOP, a); break;
+        case BC_ELSE:
+            jump_to(*op, LBL_IF_END, a);
+            define(LBL_IF_FALSE, a);
+            break;
+        case BC_FOR_NEXT:
+        case BC_LOOP_END:
+            jump_to(*op, LBL_LOOP, a);
+            define(LBL_LOOP_END, a);
+            break;
+        case BC_SWITCH_TABLE:
+        case BC_SWITCH_TREE: {
+            bool table = *op == BC_SWITCH_TABLE;
+            int64_t count = bytecode_operand(op, table ? 3 : 2);
+            size_t first = program.cases.size();
+            for(int64_t k = 0; k < count; k++) {
+                int64_t value = table ? bytecode_operand(op, 2) + k : bytecode_operand(op, 3 + 2 * k);
+                int64_t target = bytecode_operand(op, table ? 4 + k : 4 + 2 * k);
+                // the target holds the case number until the fixups run
+                program.cases.push_back({value, (int32_t)target});
+            }
+            std::sort(program.cases.begin() + first, program.cases.end(),
+                      [](const reg_case_t & x, const reg_case_t & y) { return x.value < y.value; });
+            fixups.push_back({section, sections[section].size(), LBL_MATCH, a, b});
+            emit(BC_SWITCH_TREE, (int64_t)first, count);
+            break;
+        }
+        case BC_SYSCALL: emit(*op, op[1]); break;
+        case BC_FRAME:
+        case BC_PUSH_INT:
+        case BC_COPY_INT:
+        case BC_SET_INT:
+        case BC_STORE_INT:
+        case BC_SHRINK_STACK:
+        case BC_FREE_ARRAY:
+        case BC_ARENA_RELEASE:
+        case BC_HALT:
+        case BC_SELECT:
+        case BC_ALLOC_ARRAY:
+        case BC_LOAD_INDEX:
+        case BC_STORE_INDEX:
+        case BC_ARENA_MARK:
+            emit(*op, a);
+            break;
+        default:
+            if(*op >= BC_ADD_INT_INT && *op <= BC_LE_INT_INT) {
+                emit(*op);
+                break;
+            }
+            throw utils::error_t(0, std::string("The benchmark interpreter has no ") + opcode_info[*op].name);
+        }
+    }
+    emit(BC_SYSCALL, BC_SYS_EXIT);  // the exit status is left on top
+    size_t main_size = sections[0].size();
+    program.code = std::move(sections[0]);
+    program.code.insert(program.code.end(), sections[1].begin(), sections[1].end());
+    auto resolve = [&](int kind, int64_t id, int64_t n) {
+        auto it = labels.find({kind, id, n});
+        if(it == labels.end()) throw utils::error_t(0, "Label without a definition");
+        return (int32_t)(it->second.first ? main_size + it->second.second : it->second.second);
+    };
+    for(auto & [sec, index, kind, id, n] : fixups) {
+        stack_insn_t & in = program.code[sec ? main_size + index : index];
+        in.target = resolve(kind, id, n);
+        if(in.op != BC_SWITCH_TREE) continue;
+        for(int64_t k = 0; k < in.b; k++) {
+            reg_case_t & c = program.cases[in.a + k];
+            c.target = resolve(LBL_MATCH, id, c.target);
+        }
+    }
+    return program;
+}
+
+// runs the decoded stack code the way run_regcode runs the register code
+static int run_stack(const stack_program_t & program, std::string & output, uint64_t & steps) {
+    std::vector<int64_t> stack(std::max<size_t>(program.slots, 1) + 1, 0);
+    std::vector<int64_t *> arrays;
+    auto release = [&](size_t mark) {
+        for(size_t k = mark; k < arrays.size(); k++) free(arrays[k]);
+        arrays.resize(std::min(mark, arrays.size()));
+    };
+    int64_t * s = stack.data();
+    size_t sp = 0, pc = 0;
+    uint64_t executed = 0;
+    int64_t status = 0;
+    for(bool running = true; running;) {
+        const stack_insn_t & in = program.code[pc++];
+        executed++;
+        switch(in.op) {
+        case BC_FRAME:
+            for(int64_t k = 0; k < in.a / 8; k++) s[sp++] = 0;
+            break;
+        case BC_PUSH_INT: s[sp++] = in.a; break;
+        case BC_COPY_INT: s[sp] = s[sp - 1 - in.a / 8]; sp++; break;
+        case BC_SET_INT: s[sp - 1 - in.a / 8] = s[sp - 1]; break;
+        case BC_STORE_INT: sp--; s[sp - 1 - in.a / 8] = s[sp]; break;
+        case BC_SHRINK_STACK: sp -= in.a / 8; break;
+        case BC_ADD_INT_INT: sp--; s[sp - 1] = (int64_t)((uint64_t)s[sp - 1] + (uint64_t)s[sp]); break;
+        case BC_SUB_INT_INT: sp--; s[sp - 1] = (int64_t)((uint64_t)s[sp - 1] - (uint64_t)s[sp]); break;
+        case BC_MUL_INT_INT: sp--; s[sp - 1] = (int64_t)((uint64_t)s[sp - 1] * (uint64_t)s[sp]); break;
+        case BC_DIV_INT_INT:
+        case BC_MOD_INT_INT:
+            sp--;
+            if(s[sp] == 0 || (s[sp - 1] == INT64_MIN && s[sp] == -1)) {
+                release(0);
+                throw utils::error_t(0, "Division by zero");
+            }
+            s[sp - 1] = in.op == BC_DIV_INT_INT ? s[sp - 1] / s[sp] : s[sp - 1] % s[sp];
+            break;
+        case BC_AND: sp--; s[sp - 1] &= s[sp]; break;
+        case BC_OR: sp--; s[sp - 1] |= s[sp]; break;
+        case BC_XOR: sp--; s[sp - 1] ^= s[sp]; break;
+        case BC_SHL: sp--; s[sp - 1] = (int64_t)((uint64_t)s[sp - 1] << (s[sp] & 63)); break;
+        case BC_SHR: sp--; s[sp - 1] = (int64_t)((uint64_t)s[sp - 1] >> (s[sp] & 63)); break;
+        case BC_EQ_INT_INT: sp--; s[sp - 1] = s[sp - 1] == s[sp]; break;
+        case BC_NE_INT_INT: sp--; s[sp - 1] = s[sp - 1] != s[sp]; break;
+        case BC_GT_INT_INT: sp--; s[sp - 1] = s[sp - 1] > s[sp]; break;
+        case BC_LT_INT_INT: sp--; s[sp - 1] = s[sp - 1] < s[sp]; break;
+        case BC_GE_INT_INT: sp--; s[sp - 1] = s[sp - 1] >= s[sp]; break;
+        case BC_LE_INT_INT: sp--; s[sp - 1] = s[sp - 1] <= s[sp]; break;
+        case BC_SELECT: sp -= 2; s[sp - 1] = s[sp + 1] ? s[sp - 1] : s[sp]; break;
+        case BC_IF:
+        case BC_WHILE_TEST: if(s[--sp] == 0) pc = in.target; break;
+        case BC_IF_NOT: if(s[--sp] != 0) pc = in.target; break;
+        case BC_FOR_TEST: if(s[sp - 2] >= s[sp - 1]) pc = in.target; break;
+        case BC_FOR_NEXT:
+        case BC_FOR_CONTINUE: s[sp - 2]++; pc = in.target; break;
+        case BC_ELSE:
+        case BC_JUMP_END:
+        case BC_LOOP_END:
+        case BC_BREAK:
+        case BC_CONTINUE: pc = in.target; break;
+        case BC_SWITCH_TREE: {
+            int64_t v = s[--sp];
+            const reg_case_t * first = program.cases.data() + in.a, * last = first + in.b;
+            const reg_case_t * hit = std::lower_bound(first, last, v, [](const reg_case_t & x, int64_t y) { return x.value < y; });
+            pc = hit != last && hit->value == v ? hit->target : in.target;
+            break;
+        }
+        case BC_SYSCALL:
+            if(in.a == BC_SYS_WRITE_INT) {
+                output += std::to_string(s[sp - 1]);
+                output += '\n';
+                break;
+            }
+            status = s[--sp];
+            running = false;
+            break;
+        case BC_HALT: running = false; break;
+        case BC_ALLOC_ARRAY: {
+            int64_t * p = (uint64_t)s[sp - 1] >> 59 ? nullptr : (int64_t *)calloc(s[sp - 1] + 1, sizeof(int64_t));
+            if(!p) throw std::bad_alloc();
+            p[0] = s[sp - 1];
+            arrays.push_back(p);
+            s[sp - 1] = (int64_t)p;
+            break;
+        }
+        case BC_LOAD_INDEX: sp--; s[sp - 1] = ((int64_t *)s[sp - 1])[s[sp] + 1]; break;
+        case BC_STORE_INDEX: sp -= 2; ((int64_t *)s[sp])[s[sp + 1] + 1] = s[sp - 1]; break;
+        case BC_FREE_ARRAY: break;
+        case BC_ARENA_MARK: s[sp++] = (int64_t)arrays.size(); break;
+        case BC_ARENA_RELEASE: release((size_t)s[sp - 1 - in.a / 8]); break;
+        }
+    }
+    release(0);
+    steps = executed;
+    return (int)(status & 0xff);
+}
+
+// runs `args` with stdout into `out` and stderr on /dev/null; the exit status, or -1 if it did not
+// exit normally. `secs` gets the wall time
+static int spawn_timed(const std::vector<std::string> & args, const std::string & out, double & secs) {
+    std::vector<char *> argv;
+    for(auto & a : args) argv.push_back((char *)a.c_str());
+    argv.push_back(nullptr);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid;
+    int rc = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if(rc != 0) return -1;
+    int status;
+    if(waitpid(pid, &status, 0) < 0) return -1;
+    secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+template<typename F>
+static double best_of(size_t runs, F && f) {
+    double best = 1e30;
+    for(size_t k = 0; k < runs; k++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+struct config_t {
+    std::string toy = "bin/toy";
+    std::string dir = "/tmp";
+    std::string level = "-O2";
+    size_t runs = 5;
+    size_t interp_n = 2000000;
+    size_t native_n = 100000000;
+};
+
+int main(int argc, char ** argv) {
+    config_t cfg;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--toy" && i + 1 < argc) cfg.toy = argv[++i];
+        else if(arg == "--dir" && i + 1 < argc) cfg.dir = argv[++i];
+        else if(arg == "--runs" && i + 1 < argc) cfg.runs = strtoull(argv[++i], nullptr, 10);
+        else if(arg == "--interp-n" && i + 1 < argc) cfg.interp_n = strtoull(argv[++i], nullptr, 10);
+        else if(arg == "--native-n" && i + 1 < argc) cfg.native_n = strtoull(argv[++i], nullptr, 10);
+        else if(arg == "-O0" || arg == "-O1" || arg == "-O2") cfg.level = arg;
+        else {
+            fprintf(stderr, "usage: bench_regcode [--toy bin/toy] [--dir tmpdir] [--runs N] [--interp-n N] [--native-n N] [-O0|-O1|-O2]\n");
+            return 1;
+        }
+    }
+    if(!cfg.runs) cfg.runs = 1;
+
+    std::vector<kernel_t> kernels = {
+        {"arith", kernel_arith},
+        {"collatz", kernel_collatz},
+        {"sieve", kernel_sieve},
+        {"dispatch", kernel_dispatch},
+        {"nested", kernel_nested},
+    };
+
+    printf("%-9s %15s %23s %23s %23s\n", "", "static insns", "dynamic M insns", "interp ms", "native ms");
+    printf("%-9s %7s %7s %7s %7s %7s %7s %7s %7s %7s %7s %7s\n", "kernel", "stack", "reg", "stack", "reg", "ratio",
+           "stack", "reg", "speedup", "stack", "reg", "speedup");
+    bool all_ok = true;
+    for(auto & kernel : kernels) {
+        std::string src = kernel.source(cfg.interp_n);
+        stack_program_t stack_code;
+        reg_program_t reg_code;
+        size_t stack_static = 0;
+        try {
+            parser_t parser;
+            ast_t ast = parser.parse(src.c_str(), src.size());
+            code_generator_t codegen;
+            pass_manager_t passes;
+            passes.level = cfg.level[2] - '0';
+            program_data_t data = passes.run(ast, codegen);
+            for(size_t i = 0; i < data.bytecode.size(); i += bytecode_size(&data.bytecode[i])) {
+                uint8_t op = data.bytecode[i];
+                bool marker = op == BC_LINE || op == BC_COLD_BEGIN || op == BC_COLD_END ||
+                              (opcode_info[op].flags & OPF_LABEL && !(opcode_info[op].flags & OPF_JUMP));
+                if(!marker) stack_static++;
+            }
+            stack_code = decode_stack(data.bytecode);
+            reg_code = translate_to_regcode(data.bytecode);
+        } catch(utils::error_t & e) {
+            fprintf(stderr, "%s: %s\n", kernel.name, e.what());
+            return 1;
+        }
+
+        std::string stack_out, reg_out;
+        uint64_t stack_steps = 0, reg_steps = 0;
+        int stack_rc = 0, reg_rc = 0;
+        double stack_interp = best_of(cfg.runs, [&] {
+            stack_out.clear();
+            stack_rc = run_stack(stack_code, stack_out, stack_steps);
+        });
+        double reg_interp = best_of(cfg.runs, [&] {
+            reg_out.clear();
+            reg_rc = run_regcode(reg_code, reg_out, &reg_steps);
+        });
+        bool ok = stack_out == reg_out && stack_rc == reg_rc;
+
+        // the native builds run the same kernel at a size worth timing
+        std::string path = cfg.dir + "/bench_regcode_" + kernel.name;
+        double native[2] = {0, 0};
+        std::string outputs[2];
+        int codes[2] = {0, 0};
+        if(!utils::write_string_to_file(path + ".tl", kernel.source(cfg.native_n))) {
+            fprintf(stderr, "cannot write to %s\n", cfg.dir.c_str());
+            return 1;
+        }
+        for(int regcode = 0; regcode < 2; regcode++) {
+            std::string exe = path + (regcode ? "_reg" : "_stack");
+            std::vector<std::string> args = {cfg.toy, "--no-cache", cfg.level, "-o", exe};
+            if(regcode) args.push_back("--regcode");
+            args.push_back(path + ".tl");
+            double secs;
+            if(spawn_timed(args, "/dev/null", secs) != 0) {
+                fprintf(stderr, "%s: %s failed\n", kernel.name, cfg.toy.c_str());
+                return 1;
+            }
+            native[regcode] = 1e30;
+            for(size_t k = 0; k < cfg.runs; k++) {
+                codes[regcode] = spawn_timed({exe}, exe + ".out", secs);
+                native[regcode] = std::min(native[regcode], secs);
+            }
+            utils::read_file(exe + ".out", outputs[regcode]);
+        }
+        ok = ok && codes[0] >= 0 && codes[0] == codes[1] && outputs[0] == outputs[1];
+        all_ok = all_ok && ok;
+
+        printf("%-9s %7zu %7zu %7.2f %7.2f %7.2f %7.1f %7.1f %7.2f %7.1f %7.1f %7.2f%s\n", kernel.name, stack_static,
+               reg_code.code.size(), stack_steps / 1e6, reg_steps / 1e6,
+               (double)reg_steps / stack_steps, stack_interp * 1e3, reg_interp * 1e3, stack_interp / reg_interp,
+               native[0] * 1e3, native[1] * 1e3, native[0] / native[1], ok ? "" : "  MISMATCH");
+        fflush(stdout);
+    }
+    return all_ok ? 0 : 2;
+}
@@ -0,0 +1,89 @@
+// process startup benchmark in the manner of hyperfine: runs each command
+// a few times to warm up, then --runs times with stdout on /dev/null, and
+// reports mean, standard deviation and range of the wall time plus how
+// each command compares with the fastest.
+//
+//   bin/bench_startup [--runs N] [--warmup N] exe...
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+extern char ** environ;
+
+// wall time of one run in seconds, or -1 if it failed
+static double run_once(const char * exe) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    char * argv[] = {(char *)exe, nullptr};
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid;
+    int rc = posix_spawn(&pid, exe, &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if(rc != 0) return -1;
+    int status;
+    if(waitpid(pid, &status, 0) < 0) return -1;
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return WIFEXITED(status) ? secs : -1;
+}
+
+struct summary_t {
+    std::string exe;
+    double mean = 0, stddev = 0, min = 0, max = 0;
+};
+
+int main(int argc, char ** argv) {
+    size_t runs = 1000, warmup = 20;
+    std::vector<std::string> exes;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--runs" && i + 1 < argc) runs = strtoull(argv[++i], nullptr, 10);
+        else if(arg == "--warmup" && i + 1 < argc) warmup = strtoull(argv[++i], nullptr, 10);
+        else if(arg[0] != '-') exes.push_back(arg);
+        else exes.clear(), i = argc;
+    }
+    if(exes.empty() || runs < 2) {
+        fprintf(stderr, "usage: bench_startup [--runs N] [--warmup N] exe...\n");
+        return 1;
+    }
+
+    std::vector<summary_t> results;
+    for(auto & exe : exes) {
+        for(size_t k = 0; k < warmup; k++) run_once(exe.c_str());
+        std::vector<double> times;
+        for(size_t k = 0; k < runs; k++) {
+            double t = run_once(exe.c_str());
+            if(t < 0) {
+                fprintf(stderr, "%s failed\n", exe.c_str());
+                return 1;
+            }
+            times.push_back(t);
+        }
+        summary_t s{exe};
+        for(double t : times) s.mean += t;
+        s.mean /= times.size();
+        for(double t : times) s.stddev += (t - s.mean) * (t - s.mean);
+        s.stddev = sqrt(s.stddev / (times.size() - 1));
+        s.min = *std::min_element(times.begin(), times.end());
+        s.max = *std::max_element(times.begin(), times.end());
+        printf("%s\n  Time (mean ± σ):   %8.1f µs ± %6.1f µs    [%zu runs]\n  Range (min … max): %8.1f µs … %8.1f µs\n\n",
+               exe.c_str(), s.mean * 1e6, s.stddev * 1e6, runs, s.min * 1e6, s.max * 1e6);
+        results.push_back(s);
+    }
+    if(results.size() > 1) {
+        auto fastest = std::min_element(results.begin(), results.end(),
+                                        [](const summary_t & a, const summary_t & b) { return a.mean < b.mean; });
+        printf("Summary\n  %s ran\n", fastest->exe.c_str());
+        for(auto & s : results) {
+            if(&s != &*fastest) printf("  %6.2f × faster than %s\n", s.mean / fastest->mean, s.exe.c_str());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,201 @@
+// load generator for the compile server: --clients threads issue requests
+// back to back and the latency of every request is recorded. each scenario
+// runs three ways:
+//   direct  spawns `toy` per request, the way builds invoke it today
+//   client  spawns `toy --connect` per request, the thin client
+//   socket  keeps one connection per thread and sends requests on it
+// scenarios: hot compiles of one script (a cache hit after the first),
+// cold compiles of a script that differs in every request, and runs of
+// the hot script. expects a daemon on --socket; bench_toyd.sh starts one.
+//
+//   bin/bench_toyd [--toy bin/toy] [--socket path] [--dir tmpdir] [--clients N] [--requests N]
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "../src/server.hpp"
+#include "../src/utils.hpp"
+
+// a few hundred lines of loops, ifs and arithmetic that exits with 0;
+// `seed` makes it unique
+static std::string make_script(size_t seed) {
+    std::string src = "total = " + std::to_string(seed) + "\n";
+    for(int f = 0; f < 40; f++) {
+        std::string v = "v" + std::to_string(f);
+        src += v + " = " + std::to_string((f * 31 + 7) % 97) + "\n";
+        src += "for i = 0, " + std::to_string(10 + f) + " {\n";
+        src += "  if i % 3 == " + std::to_string(f % 3) + " { " + v + " += i * " + std::to_string(f + 1) + " }\n";
+        src += "  else { " + v + " = " + v + " ^ (i << 2) }\n";
+        src += "}\n";
+        src += "total = total + (" + v + " & 1023)\n";
+    }
+    src += "write(total)\n";
+    src += "status = 0\n";  // the exit status is the last value assigned
+    return src;
+}
+
+// runs argv in `cwd` with stdout and stderr on /dev/null; true if it exited
+// with 0. the driver writes asm_code.s to its working directory, so
+// concurrent compiles each need their own
+static bool spawn_quiet(const std::string & cwd, const std::vector<std::string> & args) {
+    std::vector<char *> argv;
+    for(auto & a : args) argv.push_back((char *)a.c_str());
+    argv.push_back(nullptr);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addchdir_np(&actions, cwd.c_str());
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, 1, 2);
+    pid_t pid;
+    int rc = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if(rc != 0) return false;
+    int status;
+    while(waitpid(pid, &status, 0) < 0) {
+        if(errno != EINTR) return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+enum Scenario { HOT, COLD, RUN };
+enum Mode { DIRECT, CLIENT, SOCKET };
+static const char * const scenario_names[] = {"hot", "cold", "run"};
+static const char * const mode_names[] = {"direct", "client", "socket"};
+
+struct config_t {
+    std::string toy = "bin/toy";
+    std::string socket = toyd::default_socket();
+    std::string dir = "/tmp";
+    size_t clients = 4;
+    size_t requests = 200;
+};
+
+// one request as `client` would issue it; false if it failed
+static bool issue(const config_t & cfg, Scenario scenario, Mode mode, size_t client, size_t n, int & conn) {
+    static std::atomic<size_t> unique{1000000};
+    std::string src_path = cfg.dir + "/hot.tl";
+    std::string cwd = cfg.dir + "/client" + std::to_string(client);
+    std::string out = cwd + "/out";
+    toyd_request_t req;
+    if(scenario == COLD) {
+        req.source = make_script(unique++);
+        src_path = cwd + "/cold" + std::to_string(n) + ".tl";
+        if(mode != SOCKET && !utils::write_string_to_file(src_path, req.source)) return false;
+    } else if(mode == SOCKET) {
+        req.source = make_script(0);
+    }
+    if(mode == DIRECT) {
+        if(scenario == RUN) return spawn_quiet(cwd, {cfg.toy, "--run", src_path});
+        return spawn_quiet(cwd, {cfg.toy, "-o", out, src_path});
+    }
+    if(mode == CLIENT) {
+        std::vector<std::string> args = {cfg.toy, "--connect", "--socket", cfg.socket};
+        if(scenario == RUN) args.push_back("--run");
+        else args.insert(args.end(), {"-o", out});
+        args.push_back(src_path);
+        return spawn_quiet(cwd, args);
+    }
+    req.kind = scenario == RUN ? TOYD_RUN : TOYD_COMPILE;
+    req.source_path = src_path;
+    if(scenario != RUN) req.output = out;
+    if(conn < 0) conn = toyd::connect_to(cfg.socket);
+    toyd_reply_t reply;
+    if(conn < 0 || !toyd::call(conn, req, reply)) return false;
+    return reply.ok && (scenario != RUN || reply.exit_code == 0);
+}
+
+static double percentile(const std::vector<double> & sorted, double p) {
+    return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+int main(int argc, char ** argv) {
+    config_t cfg;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--toy" && i + 1 < argc) cfg.toy = argv[++i];
+        else if(arg == "--socket" && i + 1 < argc) cfg.socket = argv[++i];
+        else if(arg == "--dir" && i + 1 < argc) cfg.dir = argv[++i];
+        else if(arg == "--clients" && i + 1 < argc) cfg.clients = strtoull(argv[++i], nullptr, 10);
+        else if(arg == "--requests" && i + 1 < argc) cfg.requests = strtoull(argv[++i], nullptr, 10);
+        else {
+            fprintf(stderr, "usage: bench_toyd [--toy bin/toy] [--socket path] [--dir tmpdir] [--clients N] [--requests N]\n");
+            return 1;
+        }
+    }
+    if(!cfg.clients || cfg.requests < cfg.clients) {
+        fprintf(stderr, "need at least one request per client\n");
+        return 1;
+    }
+    char * abs = realpath(cfg.dir.c_str(), nullptr);
+    if(abs) cfg.dir = abs;
+    free(abs);
+    if(!cfg.toy.empty() && cfg.toy[0] != '/' && (abs = realpath(cfg.toy.c_str(), nullptr))) {
+        cfg.toy = abs;
+        free(abs);
+    }
+    int probe = toyd::connect_to(cfg.socket);
+    if(probe < 0) {
+        fprintf(stderr, "no toyd listening on %s\n", cfg.socket.c_str());
+        return 1;
+    }
+    close(probe);
+    for(size_t c = 0; c < cfg.clients; c++) mkdir((cfg.dir + "/client" + std::to_string(c)).c_str(), 0755);
+    if(!utils::write_string_to_file(cfg.dir + "/hot.tl", make_script(0))) {
+        fprintf(stderr, "cannot write to %s\n", cfg.dir.c_str());
+        return 1;
+    }
+
+    printf("%-5s %-7s %8s %9s %9s %9s %9s %9s\n", "", "", "requests", "p50 ms", "p99 ms", "mean ms", "max ms", "req/s");
+    bool all_ok = true;
+    for(Scenario scenario : {HOT, COLD, RUN}) {
+        for(Mode mode : {DIRECT, CLIENT, SOCKET}) {
+            // cold scripts are unique per request, so the cold rows are
+            // measured against an equally cold cache
+            size_t requests = scenario == COLD ? std::max(cfg.clients, cfg.requests / 4) : cfg.requests;
+            if(scenario != COLD) {
+                int conn = -1;
+                issue(cfg, scenario, mode, 0, 0, conn);  // warm the cache and the connection path
+                if(conn >= 0) close(conn);
+            }
+            std::vector<std::vector<double>> latencies(cfg.clients);
+            std::atomic<size_t> next{0}, failed{0};
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::thread> workers;
+            for(size_t c = 0; c < cfg.clients; c++) {
+                workers.emplace_back([&, c] {
+                    int conn = -1;
+                    for(size_t n; (n = next.fetch_add(1)) < requests;) {
+                        auto t0 = std::chrono::steady_clock::now();
+                        if(!issue(cfg, scenario, mode, c, n, conn)) failed++;
+                        latencies[c].push_back(
+                            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+                    }
+                    if(conn >= 0) close(conn);
+                });
+            }
+            for(auto & w : workers) w.join();
+            double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::vector<double> all;
+            for(auto & l : latencies) all.insert(all.end(), l.begin(), l.end());
+            std::sort(all.begin(), all.end());
+            double mean = 0;
+            for(double t : all) mean += t;
+            mean /= all.size();
+            printf("%-5s %-7s %8zu %9.2f %9.2f %9.2f %9.2f %9.1f", scenario_names[scenario], mode_names[mode],
+                   all.size(), percentile(all, 0.50), percentile(all, 0.99), mean, all.back(), all.size() / secs);
+            if(failed) printf("  failed=%zu", failed.load());
+            printf("\n");
+            fflush(stdout);
+            all_ok = all_ok && failed == 0;
+        }
+    }
+    return all_ok ? 0 : 2;
+}
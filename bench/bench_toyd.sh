@@ -0,0 +1,15 @@
+#!/bin/sh
+# request latency through a private toyd next to spawning the compiler for
+# every request; the daemon, its socket and its cache live in a temporary
+# directory that is removed afterwards
+set -e
+TOY=${TOY:-./bin/toy}
+CXX=${CXX:-g++}
+"$CXX" -O2 -std=c++17 -pthread bench/bench_toyd.cpp -o bin/bench_toyd
+dir=$(mktemp -d)
+export TOYLANG_CACHE_DIR="$dir/cache" TOYD_SOCKET="$dir/toyd.sock"
+"$TOY" --daemon > /dev/null &
+pid=$!
+trap 'kill $pid 2>/dev/null; rm -rf "$dir"' EXIT
+while [ ! -S "$TOYD_SOCKET" ]; do sleep 0.05; done
+./bin/bench_toyd --toy "$TOY" --dir "$dir" "$@"
@@ -0,0 +1,35 @@
+// the workload of map_ops.tl against std::unordered_map, for comparison
+// with the built-in map; prints the same three lines
+#include <stdint.h>
+#include <stdio.h>
+#include <unordered_map>
+
+int main()
+{
+    const int64_t n = 10000000;
+    std::unordered_map<int64_t, int64_t> m;
+    uint64_t x = 1;
+    for (int64_t i = 0; i < n; i++)
+    {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        m[(int64_t)(x >> 16)] += i;
+    }
+    int64_t hits = 0;
+    x = 1;
+    for (int64_t i = 0; i < n; i++)
+    {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        auto it = m.find(((int64_t)(x >> 16)) + (i & 1));
+        hits += it == m.end() ? 0 : it->second;
+    }
+    x = 1;
+    for (int64_t i = 0; i < n; i++)
+    {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        if (i & 1) m.erase((int64_t)(x >> 16));
+    }
+    uint64_t sum = 0;
+    for (auto &e : m) sum += (uint64_t)(e.first ^ e.second);
+    printf("%zu\n%lld\n%lld\n", m.size(), (long long)hits, (long long)sum);
+    return 0;
+}
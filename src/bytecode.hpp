@@ -0,0 +1,570 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+// the stack bytecode between code_generator_t and the emitter. an
+// instruction is one opcode byte followed by its little-endian int64
+// operands; values on the operand stack are 8 bytes, and operands that
+// address the stack count bytes from its top
+enum BytecodeOp
+{
+    BC_HALT = 0,
+    BC_SHRINK_STACK,
+    BC_PUSH_INT,
+    BC_SET_INT,
+    BC_COPY_INT,
+    BC_ADD_INT_INT,
+    BC_SUB_INT_INT,
+    BC_MUL_INT_INT,
+    BC_DIV_INT_INT,
+    BC_MOD_INT_INT,
+    BC_AND,
+    BC_OR,
+    BC_XOR,
+    BC_SHL,
+    BC_SHR,
+    BC_EQ_INT_INT,
+    BC_NE_INT_INT,
+    BC_GT_INT_INT,
+    BC_LT_INT_INT,
+    BC_GE_INT_INT,
+    BC_LE_INT_INT,
+    BC_IF,
+    BC_ELSE,
+    BC_TEST_FALSE_LABEL,
+    BC_TEST_END_END_LABEL,
+    BC_SYSCALL,
+    BC_ALLOC_ARRAY,
+    BC_LOAD_INDEX,
+    BC_STORE_INDEX,
+    BC_FREE_ARRAY,
+    BC_ARENA_MARK,
+    BC_ARENA_RELEASE,
+    BC_LINE,
+    BC_IF_NOT,
+    BC_JUMP_END,
+    BC_TRUE_LABEL,
+    BC_COLD_BEGIN,
+    BC_COLD_END,
+    BC_LOOP_LABEL,
+    BC_FOR_TEST,
+    BC_FOR_NEXT,
+    BC_WHILE_TEST,
+    BC_LOOP_END,
+    BC_PARALLEL_FOR,
+    BC_SPAWN,
+    BC_JOIN,
+    BC_TASK_BEGIN,
+    BC_PAR_TASK_BEGIN,
+    BC_TASK_END,
+    BC_GEN_BEGIN,
+    BC_GEN_END,
+    BC_YIELD,
+    BC_GEN_NEW,
+    BC_GEN_ARG,
+    BC_GEN_NEXT,
+    BC_GEN_FREE,
+    BC_FRAME,
+    BC_STORE_INT,
+    BC_SELECT,
+    BC_SWITCH_TABLE,
+    BC_SWITCH_TREE,
+    BC_CASE_LABEL,
+    BC_ALLOC_RECORD,
+    BC_ALLOC_RECORDS,
+    BC_LOAD_FIELD,
+    BC_STORE_FIELD,
+    BC_RECORD_ELEM,
+    BC_ALLOC_MAP,
+    BC_MAP_GET,
+    BC_MAP_SLOT,
+    BC_MAP_HAS,
+    BC_MAP_DEL,
+    BC_MAP_NEXT,
+    BC_PROF_BRANCH,
+    BC_BREAK,
+    BC_CONTINUE,
+    BC_FOR_CONTINUE,
+    BC_OPCODE_COUNT
+};
+
+enum SystemCallType
+{
+    BC_SYS_EXIT = 0,
+    BC_SYS_WRITE_INT,
+};
+
+enum OpcodeFlags : uint8_t
+{
+    OPF_JUMP = 1,      // never falls through; what follows is reached from a label
+    OPF_BRANCH = 2,    // may jump to a label
+    OPF_LABEL = 4,     // defines a label, after its jump if it has one
+    OPF_SLOT = 8,      // operand 0 is a live slot, counted from the top after the pops
+    OPF_VARIABLE = 16, // the stack effect depends on the operands, see stack_effect
+    OPF_ENTRY = 32,    // starts a task or generator body, which is emitted out of line
+    OPF_RETURN = 64,   // ends one
+};
+
+// everything the tools below know about an opcode, by opcode value: its
+// name, fixed int64 operand count, and stack effect in 8-byte values (it
+// needs `uses` on the stack, pops `pops` of them, then pushes `pushes`).
+// BC_SYSCALL is followed by a one-byte call number instead, and the switches
+// by their case operands after the fixed ones; see bytecode_size
+struct opcode_info_t
+{
+    const char *name;
+    uint8_t operands;
+    uint8_t uses;
+    uint8_t pops;
+    uint8_t pushes;
+    uint8_t flags;
+};
+
+static constexpr opcode_info_t opcode_info[] = {
+    {"halt", 0, 0, 0, 0, OPF_JUMP},
+    {"shrink_stack", 1, 0, 0, 0, OPF_VARIABLE},
+    {"push_int", 1, 0, 0, 1, 0},
+    {"set_int", 1, 1, 0, 0, OPF_SLOT},
+    {"copy_int", 1, 0, 0, 1, OPF_SLOT},
+    {"add_int_int", 0, 2, 2, 1, 0},
+    {"sub_int_int", 0, 2, 2, 1, 0},
+    {"mul_int_int", 0, 2, 2, 1, 0},
+    {"div_int_int", 0, 2, 2, 1, 0},
+    {"mod_int_int", 0, 2, 2, 1, 0},
+    {"and", 0, 2, 2, 1, 0},
+    {"or", 0, 2, 2, 1, 0},
+    {"xor", 0, 2, 2, 1, 0},
+    {"shl", 0, 2, 2, 1, 0},
+    {"shr", 0, 2, 2, 1, 0},
+    {"eq_int_int", 0, 2, 2, 1, 0},
+    {"ne_int_int", 0, 2, 2, 1, 0},
+    {"gt_int_int", 0, 2, 2, 1, 0},
+    {"lt_int_int", 0, 2, 2, 1, 0},
+    {"ge_int_int", 0, 2, 2, 1, 0},
+    {"le_int_int", 0, 2, 2, 1, 0},
+    {"if", 1, 1, 1, 0, OPF_BRANCH},
+    {"else", 1, 0, 0, 0, OPF_JUMP | OPF_LABEL},
+    {"test_false_label", 1, 0, 0, 0, OPF_LABEL},
+    {"test_end_end_label", 1, 0, 0, 0, OPF_LABEL},
+    {"syscall", 0, 1, 0, 0, OPF_VARIABLE},
+    {"alloc_array", 0, 1, 1, 1, 0},
+    {"load_index", 0, 2, 2, 1, 0},
+    {"store_index", 0, 3, 2, 0, 0},
+    {"free_array", 1, 0, 0, 0, OPF_SLOT},
+    {"arena_mark", 0, 0, 0, 1, 0},
+    {"arena_release", 1, 0, 0, 0, OPF_SLOT},
+    {"line", 1, 0, 0, 0, 0},
+    {"if_not", 1, 1, 1, 0, OPF_BRANCH},
+    {"jump_end", 1, 0, 0, 0, OPF_JUMP},
+    {"true_label", 1, 0, 0, 0, OPF_LABEL},
+    {"cold_begin", 0, 0, 0, 0, 0},
+    {"cold_end", 0, 0, 0, 0, 0},
+    {"loop_label", 1, 0, 0, 0, OPF_LABEL},
+    {"for_test", 1, 2, 0, 0, OPF_BRANCH},
+    {"for_next", 1, 2, 0, 0, OPF_JUMP | OPF_LABEL},
+    {"while_test", 1, 1, 1, 0, OPF_BRANCH},
+    {"loop_end", 1, 0, 0, 0, OPF_JUMP | OPF_LABEL},
+    {"parallel_for", 1, 2, 2, 0, 0},
+    {"spawn", 2, 0, 0, 0, 0},
+    {"join", 0, 0, 0, 0, 0},
+    {"task_begin", 2, 0, 0, 0, OPF_ENTRY},
+    {"par_task_begin", 2, 0, 0, 0, OPF_ENTRY},
+    {"task_end", 1, 0, 0, 0, OPF_RETURN},
+    {"gen_begin", 2, 0, 0, 0, OPF_ENTRY},
+    {"gen_end", 2, 0, 0, 0, OPF_RETURN},
+    {"yield", 2, 1, 1, 0, 0},
+    {"gen_new", 2, 0, 0, 1, 0},
+    {"gen_arg", 1, 2, 1, 0, 0},
+    {"gen_next", 2, 2, 0, 0, OPF_BRANCH},
+    {"gen_free", 1, 2, 0, 0, 0},
+    {"frame", 1, 0, 0, 0, OPF_VARIABLE},
+    {"store_int", 1, 1, 1, 0, OPF_SLOT},
+    {"select", 0, 3, 3, 1, 0},
+    {"switch_table", 4, 1, 1, 0, OPF_JUMP},
+    {"switch_tree", 3, 1, 1, 0, OPF_JUMP},
+    {"case_label", 2, 0, 0, 0, OPF_LABEL},
+    {"alloc_record", 1, 0, 0, 1, 0},
+    {"alloc_records", 1, 1, 1, 1, 0},
+    {"load_field", 2, 1, 1, 1, 0},
+    {"store_field", 2, 2, 1, 0, 0},
+    {"record_elem", 2, 2, 2, 1, 0},
+    {"alloc_map", 0, 0, 0, 1, 0},
+    {"map_get", 0, 2, 2, 1, 0},
+    {"map_slot", 0, 2, 2, 1, 0},
+    {"map_has", 0, 2, 2, 1, 0},
+    {"map_del", 0, 2, 2, 1, 0},
+    {"map_next", 2, 0, 0, 0, OPF_BRANCH | OPF_VARIABLE},
+    {"prof_branch", 1, 1, 0, 0, 0},
+    {"break", 1, 0, 0, 0, OPF_JUMP},
+    {"continue", 1, 0, 0, 0, OPF_JUMP},
+    {"for_continue", 1, 2, 0, 0, OPF_JUMP},
+};
+static_assert(sizeof(opcode_info) / sizeof(opcode_info[0]) == BC_OPCODE_COUNT, "opcode_info is out of date");
+
+inline int64_t bytecode_operand(const uint8_t *op, size_t k) { return ((const int64_t *)(op + 1))[k]; }
+
+// bytes taken by the instruction at `op`; 1 for an unknown opcode
+inline size_t bytecode_size(const uint8_t *op)
+{
+    if (*op >= BC_OPCODE_COUNT) return 1;
+    switch (*op)
+    {
+    case BC_SYSCALL: return 2;
+    case BC_SWITCH_TABLE: return 33 + 8 * bytecode_operand(op, 3);
+    case BC_SWITCH_TREE: return 25 + 16 * bytecode_operand(op, 2);
+    default: return 1 + 8 * opcode_info[*op].operands;
+    }
+}
+
+// the stack effect of a valid instruction in bytes, with the operands
+// filled in for the OPF_VARIABLE opcodes
+inline void stack_effect(const uint8_t *op, int64_t &uses, int64_t &pops, int64_t &pushes)
+{
+    const opcode_info_t &info = opcode_info[*op];
+    uses = 8 * info.uses;
+    pops = 8 * info.pops;
+    pushes = 8 * info.pushes;
+    if (*op == BC_SHRINK_STACK) uses = pops = bytecode_operand(op, 0);
+    else if (*op == BC_FRAME) pushes = bytecode_operand(op, 0);
+    else if (*op == BC_SYSCALL && op[1] == BC_SYS_EXIT) pops = 8;
+    else if (*op == BC_MAP_NEXT) uses = 8 * bytecode_operand(op, 1) + 16; // the map, the cursor and the loop variables
+}
+
+// what verify_bytecode found: every problem, and for main and each task or
+// generator body the deepest its operand stack gets, so that an executor can
+// reserve that much up front instead of checking on every push
+struct bytecode_body_t
+{
+    const char *kind; // "main", "task" or "gen"
+    int64_t id;
+    int64_t max_depth; // bytes
+};
+
+struct bytecode_check_t
+{
+    std::vector<std::string> errors;
+    std::vector<bytecode_body_t> bodies; // main first
+    std::vector<int32_t> depth; // with record_depth: bytes on the stack before each instruction, -1 elsewhere or where unreachable
+
+    bool ok() const { return errors.empty(); }
+};
+
+// checks that every instruction is complete and its operands in range, that
+// every jump has its label and every label is defined once, and that the
+// stack depth agrees wherever control flow meets: a single forward pass, as
+// the code generator only jumps backwards to loop heads it has already seen
+inline bytecode_check_t verify_bytecode(const std::vector<uint8_t> &bytecode, bool record_depth = false)
+{
+    enum LabelKind
+    {
+        LBL_IF_FALSE,
+        LBL_IF_TRUE,
+        LBL_IF_END,
+        LBL_LOOP,
+        LBL_LOOP_END,
+        LBL_MATCH,
+        LBL_TASK,
+        LBL_PAR_TASK,
+        LBL_GEN,
+    };
+    static const char *const label_names[] = {".if_false", ".if_true", ".if_end", ".loop", ".loop_end",
+                                              ".match", ".task", ".task", ".gen"};
+    struct label_t
+    {
+        int64_t depth = -1; // -1 until a jump or the definition fixes it
+        bool defined = false;
+        size_t first_use = SIZE_MAX;
+    };
+    // a body or cold block is emitted elsewhere, so the code after it
+    // continues from the state before it
+    struct saved_t
+    {
+        uint8_t opcode;
+        int64_t depth;
+        bool live;
+        size_t body;
+    };
+
+    bytecode_check_t check;
+    std::map<std::tuple<int, int64_t, int64_t>, label_t> labels;
+    std::vector<saved_t> saved;
+    int64_t depth = 0;
+    bool live = true;
+    size_t body = 0;
+    check.bodies.push_back({"main", 0, 0});
+    if (record_depth) check.depth.assign(bytecode.size(), -1);
+
+    size_t at = 0;
+    const char *name = "";
+    auto fail = [&](const std::string &msg) {
+        if (check.errors.size() < 100) check.errors.push_back(std::to_string(at) + " " + name + ": " + msg);
+    };
+    auto label_text = [&](int kind, int64_t id, int64_t n) {
+        std::string text = label_names[kind] + std::to_string(id);
+        if (kind == LBL_MATCH) text += "_" + std::to_string(n);
+        return text;
+    };
+    auto jump = [&](int kind, int64_t id, int64_t n = 0) {
+        label_t &l = labels[{kind, id, n}];
+        if (l.first_use == SIZE_MAX) l.first_use = at;
+        if (!live) return;
+        if (l.depth < 0) l.depth = depth;
+        else if (l.depth != depth)
+            fail("jumps to " + label_text(kind, id, n) + " at depth " + std::to_string(depth) + ", expected " + std::to_string(l.depth));
+    };
+    // task and generator labels are functions, not places on this stack
+    auto call = [&](int kind, int64_t id) {
+        label_t &l = labels[{kind, id, 0}];
+        if (l.first_use == SIZE_MAX) l.first_use = at;
+    };
+    auto define = [&](int kind, int64_t id, int64_t n = 0) {
+        label_t &l = labels[{kind, id, n}];
+        if (l.defined) fail(label_text(kind, id, n) + " is defined twice");
+        l.defined = true;
+        if (live && l.depth >= 0 && l.depth != depth)
+            fail(label_text(kind, id, n) + " is reached at depth " + std::to_string(depth) + " and " + std::to_string(l.depth));
+        else if (!live && l.depth >= 0)
+        {
+            depth = l.depth;
+            live = true;
+        }
+        else if (live)
+        {
+            l.depth = depth;
+        }
+    };
+
+    for (size_t i = 0; i < bytecode.size(); i += bytecode_size(&bytecode[i]))
+    {
+        const uint8_t *op = &bytecode[i];
+        at = i;
+        name = *op < BC_OPCODE_COUNT ? opcode_info[*op].name : "?";
+        if (*op >= BC_OPCODE_COUNT)
+        {
+            fail("unknown opcode " + std::to_string(*op));
+            return check;
+        }
+        size_t fixed = *op == BC_SYSCALL ? 2 : 1 + 8 * opcode_info[*op].operands;
+        if (bytecode.size() - i < fixed)
+        {
+            fail("truncated");
+            return check;
+        }
+        if ((*op == BC_SWITCH_TABLE && (bytecode_operand(op, 3) <= 0 || bytecode_operand(op, 3) > (1 << 24))) ||
+            (*op == BC_SWITCH_TREE && (bytecode_operand(op, 2) < 0 || bytecode_operand(op, 2) > (1 << 24))))
+        {
+            fail("bad case count");
+            return check;
+        }
+        if (bytecode.size() - i < bytecode_size(op))
+        {
+            fail("truncated");
+            return check;
+        }
+        uint8_t flags = opcode_info[*op].flags;
+        int64_t a = opcode_info[*op].operands > 0 ? bytecode_operand(op, 0) : 0;
+        int64_t b = opcode_info[*op].operands > 1 ? bytecode_operand(op, 1) : 0;
+        if (*op == BC_SYSCALL && op[1] != BC_SYS_EXIT && op[1] != BC_SYS_WRITE_INT) fail("unknown system call " + std::to_string(op[1]));
+        if ((*op == BC_LOAD_FIELD || *op == BC_STORE_FIELD) && b != 1 && b != 2 && b != 4 && b != 8)
+            fail("field width " + std::to_string(b));
+        if (*op == BC_MAP_NEXT && b != 1 && b != 2) fail(std::to_string(b) + " loop variables");
+
+        if (flags & OPF_ENTRY)
+        {
+            saved.push_back({*op, depth, live, body});
+            label_t &l = labels[{*op == BC_TASK_BEGIN ? LBL_TASK : *op == BC_PAR_TASK_BEGIN ? LBL_PAR_TASK : LBL_GEN, a, 0}];
+            if (l.defined) fail(std::string(label_names[*op == BC_GEN_BEGIN ? LBL_GEN : LBL_TASK]) + std::to_string(a) + " is defined twice");
+            l.defined = true;
+            body = check.bodies.size();
+            check.bodies.push_back({*op == BC_GEN_BEGIN ? "gen" : "task", a, 0});
+            depth = b + (*op == BC_PAR_TASK_BEGIN ? 16 : 0); // the copied frame, and a chunk's bounds
+            live = true;
+        }
+        else if (*op == BC_COLD_BEGIN)
+        {
+            // the block may be moved out of line, so nothing falls into it
+            if (live) fail("falls into a cold block");
+            saved.push_back({*op, depth, live, body});
+            live = false; // entered only through its labels
+        }
+        auto define_label = [&] {
+            switch (*op)
+            {
+            case BC_ELSE:
+            case BC_TEST_FALSE_LABEL: define(LBL_IF_FALSE, a); break;
+            case BC_TRUE_LABEL: define(LBL_IF_TRUE, a); break;
+            case BC_TEST_END_END_LABEL: define(LBL_IF_END, a); break;
+            case BC_LOOP_LABEL: define(LBL_LOOP, a); break;
+            case BC_FOR_NEXT:
+            case BC_LOOP_END: define(LBL_LOOP_END, a); break;
+            case BC_CASE_LABEL: define(LBL_MATCH, a, b); break;
+            default: break;
+            }
+        };
+        // a plain label is where the code after it starts; one that follows
+        // a jump (else, for_next, loop_end) is defined once the jump is made
+        if ((flags & OPF_LABEL) && !(flags & OPF_JUMP)) define_label();
+        if (record_depth && live) check.depth[i] = (int32_t)depth;
+        check.bodies[body].max_depth = std::max(check.bodies[body].max_depth, depth);
+
+        if (live)
+        {
+            int64_t uses, pops, pushes;
+            stack_effect(op, uses, pops, pushes);
+            if (uses < 0 || pops < 0 || pushes < 0 || (uses | pops | pushes) % 8)
+            {
+                fail("operand is not a whole number of values");
+            }
+            else if (uses > depth)
+            {
+                fail("needs " + std::to_string(uses) + " bytes of stack, has " + std::to_string(depth));
+            }
+            else
+            {
+                depth -= pops;
+                if ((flags & OPF_SLOT) && (a < 0 || a % 8 || a + 8 > depth))
+                    fail("slot " + std::to_string(a) + " is outside the " + std::to_string(depth) + " bytes of stack");
+                depth += pushes;
+            }
+            check.bodies[body].max_depth = std::max(check.bodies[body].max_depth, depth);
+            if (*op == BC_SPAWN && (b < 0 || b % 8 || b > depth))
+                fail("frame of " + std::to_string(b) + " bytes with " + std::to_string(depth) + " on the stack");
+            if (*op == BC_YIELD && depth != b)
+                fail("saves " + std::to_string(b) + " bytes with " + std::to_string(depth) + " on the stack");
+        }
+
+        switch (*op)
+        {
+        case BC_IF: jump(LBL_IF_FALSE, a); break;
+        case BC_IF_NOT: jump(LBL_IF_TRUE, a); break;
+        case BC_ELSE: jump(LBL_IF_END, a); break;
+        case BC_JUMP_END: jump(LBL_IF_END, a); break;
+        case BC_FOR_TEST:
+        case BC_WHILE_TEST:
+        case BC_MAP_NEXT: jump(LBL_LOOP_END, a); break;
+        case BC_FOR_NEXT:
+        case BC_LOOP_END:
+        case BC_CONTINUE:
+        case BC_FOR_CONTINUE: jump(LBL_LOOP, a); break;
+        case BC_BREAK: jump(LBL_LOOP_END, a); break;
+        case BC_GEN_NEXT:
+            call(LBL_GEN, a);
+            jump(LBL_LOOP_END, b);
+            break;
+        case BC_SPAWN: call(LBL_TASK, a); break;
+        case BC_PARALLEL_FOR: call(LBL_PAR_TASK, a); break;
+        case BC_SWITCH_TABLE:
+        case BC_SWITCH_TREE:
+        {
+            bool table = *op == BC_SWITCH_TABLE;
+            int64_t n = bytecode_operand(op, table ? 3 : 2);
+            jump(LBL_MATCH, a, b);
+            for (int64_t k = 0; k < n; k++)
+            {
+                int64_t target = table ? bytecode_operand(op, 4 + k) : bytecode_operand(op, 4 + 2 * k);
+                if (!table && k > 0 && bytecode_operand(op, 3 + 2 * k) <= bytecode_operand(op, 1 + 2 * k)) fail("case values are not sorted");
+                jump(LBL_MATCH, a, target);
+            }
+            break;
+        }
+        default: break;
+        }
+
+        if (flags & OPF_JUMP || (*op == BC_SYSCALL && op[1] == BC_SYS_EXIT)) live = false;
+        if ((flags & OPF_LABEL) && (flags & OPF_JUMP)) define_label();
+
+        if ((flags & OPF_RETURN) || *op == BC_COLD_END)
+        {
+            uint8_t opener = saved.empty() ? BC_HALT : saved.back().opcode;
+            bool matches = *op == BC_COLD_END ? opener == BC_COLD_BEGIN
+                         : *op == BC_GEN_END  ? opener == BC_GEN_BEGIN
+                                              : opener == BC_TASK_BEGIN || opener == BC_PAR_TASK_BEGIN;
+            if (!matches)
+            {
+                fail("does not close a " + std::string(saved.empty() ? "body" : opcode_info[opener].name));
+                return check;
+            }
+            int64_t frame = *op == BC_GEN_END ? b : a;
+            if (*op == BC_COLD_END && live) fail("falls through the end of a cold block");
+            else if (*op != BC_COLD_END && live && depth != frame)
+                fail("returns with " + std::to_string(depth) + " bytes on the stack, expected " + std::to_string(frame));
+            if (*op == BC_GEN_END && b < 8) fail("generator frame of " + std::to_string(b) + " bytes");
+            depth = saved.back().depth;
+            live = saved.back().live;
+            body = saved.back().body;
+            saved.pop_back();
+        }
+    }
+
+    at = bytecode.size();
+    name = "end";
+    if (!saved.empty()) fail(std::string(opcode_info[saved.back().opcode].name) + " is never closed");
+    else if (live && depth < 8) fail("no exit status on the stack");
+    for (auto &[key, l] : labels)
+    {
+        if (l.defined) continue;
+        at = l.first_use;
+        name = opcode_info[bytecode[at]].name;
+        fail("jumps to " + label_text(std::get<0>(key), std::get<1>(key), std::get<2>(key)) + ", which is never defined");
+    }
+    return check;
+}
+
+// one instruction per line: offset, stack depth in bytes when `check` was
+// run with record_depth, name and operands. with `source`, every line marker
+// is followed by the source line it starts
+inline void disassemble(FILE *out, const std::vector<uint8_t> &bytecode, const bytecode_check_t *check = nullptr,
+                        std::string_view source = {})
+{
+    std::vector<std::string_view> lines;
+    for (size_t pos = 0; pos < source.size();)
+    {
+        size_t end = std::min(source.find('\n', pos), source.size());
+        lines.push_back(source.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    bool depths = check && check->depth.size() == bytecode.size();
+    for (size_t i = 0; i < bytecode.size(); i += bytecode_size(&bytecode[i]))
+    {
+        const uint8_t *op = &bytecode[i];
+        fprintf(out, "%6zu  ", i);
+        if (depths)
+        {
+            if (check->depth[i] < 0) fprintf(out, "%6s  ", "-");
+            else fprintf(out, "%6d  ", check->depth[i]);
+        }
+        if (*op >= BC_OPCODE_COUNT)
+        {
+            fprintf(out, ".byte %d\n", *op);
+            continue;
+        }
+        int col = fprintf(out, "%s", opcode_info[*op].name);
+        if (bytecode.size() - i < bytecode_size(op) || (*op != BC_SYSCALL && bytecode.size() - i < 1 + 8u * opcode_info[*op].operands))
+        {
+            fputs(" <truncated>\n", out);
+            return;
+        }
+        if (*op == BC_SYSCALL)
+        {
+            fprintf(out, " %s\n", op[1] == BC_SYS_EXIT ? "exit" : op[1] == BC_SYS_WRITE_INT ? "write_int" : "?");
+            continue;
+        }
+        size_t n = (bytecode_size(op) - 1) / 8;
+        for (size_t k = 0; k < n; k++)
+        {
+            col += fprintf(out, "%s%lld", k ? ", " : " ", (long long)bytecode_operand(op, k));
+        }
+        int64_t line = *op == BC_LINE ? bytecode_operand(op, 0) : 0;
+        if (line >= 1 && (size_t)line <= lines.size())
+        {
+            fprintf(out, "%*s; %.*s", std::max(24 - col, 1), "", (int)lines[line - 1].size(), lines[line - 1].data());
+        }
+        fputc('\n', out);
+    }
+}
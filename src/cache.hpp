@@ -0,0 +1,254 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include "utils.hpp"
+
+// xxh64 over a byte range; used to content-address compiled programs
+inline uint64_t hash_bytes(const void *data, size_t len, uint64_t seed = 0)
+{
+    const uint64_t p1 = 0x9E3779B185EBCA87ULL, p2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t p3 = 0x165667B19E3779F9ULL, p4 = 0x85EBCA77C2B2AE63ULL;
+    const uint64_t p5 = 0x27D4EB2F165667C5ULL;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto read64 = [](const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; };
+    auto read32 = [](const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return (uint64_t)v; };
+    auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * p2, 31) * p1; };
+    auto merge = [&](uint64_t acc, uint64_t val) { return (acc ^ round(0, val)) * p1 + p4; };
+
+    const uint8_t *p = (const uint8_t *)data;
+    const uint8_t *end = p + len;
+    uint64_t h;
+    if (len >= 32)
+    {
+        uint64_t v1 = seed + p1 + p2, v2 = seed + p2, v3 = seed, v4 = seed - p1;
+        do
+        {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(h, v1);
+        h = merge(h, v2);
+        h = merge(h, v3);
+        h = merge(h, v4);
+    }
+    else
+    {
+        h = seed + p5;
+    }
+    h += len;
+    for (; p + 8 <= end; p += 8) h = rotl(h ^ round(0, read64(p)), 27) * p1 + p4;
+    if (p + 4 <= end)
+    {
+        h = rotl(h ^ (read32(p) * p1), 23) * p2 + p3;
+        p += 4;
+    }
+    for (; p < end; p++) h = rotl(h ^ (*p * p5), 11) * p1;
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+}
+
+// on-disk store of compiled executables keyed by a hash of the source, the
+// compiler build and the output-affecting options. entries are written to a
+// temporary name and renamed into place; once the directory grows past
+// `max_bytes` the least recently used entries (by mtime, refreshed on every
+// hit) are deleted.
+//
+// measuring the directory takes a stat per entry, so a store scans it only
+// when the size known from the last scan plus this process's stores since
+// passes the limit, or for about one key in evict_every. sampling by key
+// gives one-shot compiles their turn and picks up other processes' stores
+struct compile_cache_t
+{
+    static constexpr unsigned evict_every = 16;
+
+    std::string dir;
+    bool usable = false; // dir passed the ownership check in init
+    uint64_t max_bytes = 256ull << 20;
+    std::atomic<int64_t> known_bytes{-1}; // at the last scan plus stores since; -1 before one
+
+    // TOYLANG_CACHE_DIR, else $XDG_CACHE_HOME/toylang, else ~/.cache/toylang,
+    // else one per user under /tmp
+    static std::string default_dir()
+    {
+        if (const char *d = getenv("TOYLANG_CACHE_DIR")) return d;
+        if (const char *x = getenv("XDG_CACHE_HOME")) return std::string(x) + "/toylang";
+        if (const char *home = getenv("HOME")) return std::string(home) + "/.cache/toylang";
+        return "/tmp/toylang-cache-" + std::to_string(geteuid());
+    }
+
+    // entries are executed, so a directory that someone else owns or can
+    // write to is not used at all; lookups miss and stores do nothing
+    bool init(const std::string &path)
+    {
+        dir = path;
+        if (const char *m = getenv("TOYLANG_CACHE_MAX_MB")) max_bytes = strtoull(m, nullptr, 10) << 20;
+        make_dirs(dir, 0700);
+        struct stat st;
+        usable = lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == geteuid() && !(st.st_mode & 022);
+        if (!usable)
+            fprintf(stderr, "warning: not caching in %s, which is not a directory of this user closed to others\n", dir.c_str());
+        return usable;
+    }
+
+    static std::string make_key(std::string_view source, std::string_view options)
+    {
+        std::string material;
+        material.reserve(source.size() + options.size() + 64);
+        material += TOYLANG_VERSION "\n" __DATE__ " " __TIME__ "\n";
+        material += options;
+        material += '\n';
+        material += source;
+        char key[33];
+        snprintf(key, sizeof(key), "%016llx%016llx",
+                 (unsigned long long)hash_bytes(material.data(), material.size(), 0),
+                 (unsigned long long)hash_bytes(material.data(), material.size(), 0x746f796c616e67ULL));
+        return key;
+    }
+
+    std::string entry_path(const std::string &key) const { return dir + "/" + key; }
+
+    // returns the cached executable, or "" on a miss
+    std::string lookup(const std::string &key) const
+    {
+        if (!usable) return "";
+        std::string path = entry_path(key);
+        if (access(path.c_str(), X_OK) != 0) return "";
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+        return path;
+    }
+
+    // copies `built` into the cache under `key`; failures only cost the cache entry
+    bool store(const std::string &key, const std::string &built)
+    {
+        if (!usable) return false;
+        static std::atomic<unsigned> tmp_seq{0};
+        std::string tmp = entry_path(key) + ".tmp." + std::to_string(getpid()) + "." + std::to_string(tmp_seq++);
+        if (!copy_file(built, tmp, 0755))
+        {
+            unlink(tmp.c_str());
+            return false;
+        }
+        struct stat st;
+        int64_t size = stat(tmp.c_str(), &st) == 0 ? st.st_size : 0;
+        if (rename(tmp.c_str(), entry_path(key).c_str()) != 0)
+        {
+            unlink(tmp.c_str());
+            return false;
+        }
+        int64_t known = known_bytes.load();
+        if (known >= 0) known = known_bytes += size;
+        bool sampled = strtoull(key.substr(0, 8).c_str(), nullptr, 16) % evict_every == 0;
+        if (sampled || (known >= 0 && (uint64_t)known > max_bytes)) evict();
+        return true;
+    }
+
+    void evict()
+    {
+        struct entry_t
+        {
+            std::string path;
+            uint64_t size;
+            struct timespec mtime;
+        };
+        DIR *d = opendir(dir.c_str());
+        if (!d) return;
+        std::vector<entry_t> entries;
+        uint64_t total = 0;
+        while (struct dirent *e = readdir(d))
+        {
+            if (e->d_name[0] == '.') continue;
+            std::string path = dir + "/" + e->d_name;
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            entries.push_back({path, (uint64_t)st.st_size, st.st_mtim});
+            total += st.st_size;
+        }
+        closedir(d);
+        if (total <= max_bytes)
+        {
+            known_bytes = total;
+            return;
+        }
+        std::sort(entries.begin(), entries.end(), [](const entry_t &a, const entry_t &b) {
+            if (a.mtime.tv_sec != b.mtime.tv_sec) return a.mtime.tv_sec < b.mtime.tv_sec;
+            return a.mtime.tv_nsec < b.mtime.tv_nsec;
+        });
+        for (auto &e : entries)
+        {
+            if (total <= max_bytes) break;
+            if (unlink(e.path.c_str()) == 0) total -= e.size;
+        }
+        known_bytes = total;
+    }
+
+    static bool copy_file(const std::string &from, const std::string &to, mode_t mode)
+    {
+        int in = open(from.c_str(), O_RDONLY);
+        if (in < 0) return false;
+        int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+        if (out < 0)
+        {
+            close(in);
+            return false;
+        }
+        char buf[1 << 16];
+        bool ok = true;
+        for (;;)
+        {
+            ssize_t n = read(in, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0)
+            {
+                ok = n == 0;
+                break;
+            }
+            for (ssize_t off = 0; off < n;)
+            {
+                ssize_t w = write(out, buf + off, n - off);
+                if (w < 0 && errno == EINTR) continue;
+                if (w < 0)
+                {
+                    ok = false;
+                    break;
+                }
+                off += w;
+            }
+            if (!ok) break;
+        }
+        close(in);
+        if (close(out) != 0) ok = false;
+        return ok;
+    }
+
+    // mode applies to the last component only; parents get 0755
+    static void make_dirs(const std::string &path, mode_t mode = 0755)
+    {
+        for (size_t i = 1; i <= path.size(); i++)
+        {
+            if (i == path.size() || path[i] == '/')
+            {
+                mkdir(path.substr(0, i).c_str(), i == path.size() ? mode : 0755);
+            }
+        }
+    }
+};
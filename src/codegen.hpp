@@ -1,10 +1,18 @@
 #pragma once
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <queue>
+#include <algorithm>
 #include <string_view>
 #include <stdint.h>
-#include <sstream>
+#include <stdio.h>
 #include "parsing.hpp"
+#include "bytecode.hpp"
+#include "emitter.hpp"
+#include "isel.hpp"
+#include "runtime.hpp"
+#include "profile.hpp"
 
 enum VariableType
 {
@@ -14,16 +22,20 @@ enum VariableType
     VAR_STRING,
     VAR_BOOL,
     VAR_VOID,
+    VAR_ARRAY,
+    VAR_MAP,
     VARIABLE_TYPE
 };
 
-static const char *VariableTypeNames[] = {
+static const char *const VariableTypeNames[] = {
     "unknown",
     "int",
     "float",
     "string",
     "bool",
     "void",
+    "array",
+    "map",
     "variable"};
 
 enum FunctionType
@@ -33,41 +45,14 @@ enum FunctionType
     FUNCTION_TYPE
 };
 
-enum BytecodeOp
-{
-    BC_HALT = 0,
-    BC_SHRINK_STACK,
-    BC_PUSH_INT,
-    BC_SET_INT,
-    BC_COPY_INT,
-    BC_ADD_INT_INT,
-    BC_SUB_INT_INT,
-    BC_MUL_INT_INT,
-    BC_DIV_INT_INT,
-    BC_MOD_INT_INT,
-    BC_AND,
-    BC_OR,
-    BC_XOR,
-    BC_SHL,
-    BC_SHR,
-    BC_EQ_INT_INT,
-    BC_NE_INT_INT,
-    BC_GT_INT_INT,
-    BC_LT_INT_INT,
-    BC_GE_INT_INT,
-    BC_LE_INT_INT,
-    BC_IF,
-    BC_ELSE,
-    BC_TEST_FALSE_LABEL,
-    BC_TEST_END_END_LABEL,
-    BC_SYSCALL,
-};
+static constexpr size_t no_slot = SIZE_MAX;
 
 struct variable_t
 {
     size_t type = 0;
-    size_t offset = 0;
+    size_t offset = 0; // stack depth the value was pushed at, for variables without a slot
     size_t size = 4;
+    size_t slot = no_slot; // index into var_context_t::slot_vars
 };
 
 inline int64_t change_endian(int64_t value)
@@ -75,57 +60,188 @@ inline int64_t change_endian(int64_t value)
     return ((value & 0x000000FF) << 24) | ((value & 0x0000FF00) << 8) | ((value & 0x00FF0000) >> 8) | ((value & 0xFF000000) >> 24);
 }
 
-enum SystemCallType
-{
-    BC_SYS_EXIT = 0,
-    BC_SYS_WRITE_INT,
-};
-
-const char * int_to_str_asm_code = R"(
-
-int_to_str:
-    push rbx
-    push rdi
-    push rsi
-
-
-    mov rax, rdi                    # Get input integer from RDI
-    lea rdi, [numbuf + 20]          # Point to the end of numbuf
-    mov BYTE PTR [rdi], 0           # Null-terminate string
-    dec rdi                         # Move pointer back for storing digits
-
-    test rax, rax
-    jnz .convert_loop_int_to_str    
-    mov BYTE PTR [rdi], '0'         # Special case for zero
-    jmp .done_int_to_str
-
-.convert_loop_int_to_str:
-    xor rdx, rdx                    # Clear RDX for division
-    mov rbx, 10                     # Divisor
-    div rbx                         # RAX /= 10, remainder in RDX
-
-    add dl, '0'                     # Convert remainder to ASCII
-    mov BYTE PTR [rdi], dl          # Store ASCII digit
-    dec rdi                         # Move backward
-
-    test rax, rax
-    jnz .convert_loop_int_to_str
-
-.done_int_to_str:
-    inc rdi                         # Adjust pointer to start of the number
-    mov rax, rdi                    # Return pointer to the converted string
-
-    pop rsi
-    pop rdi
-    pop rbx
-    ret
-
-)";
+// asm templates for the opcodes the instruction selector (isel.hpp) leaves
+// alone, split around their operands so the emitter only ever appends
+// precomputed text and formatted integers.
+static constexpr char asm_entry_prologue[] =
+    ".intel_syntax noprefix\n"
+    ".section .note.GNU-stack, \"\", @progbits\n"
+    ".section .bss\n"
+    "numbuf:\n .skip 64\n"
+    "tempbuf:\n .skip 2024\n"
+    ".section .data\n"
+    "  msg: .asciz  \"Hello, World!\"\n"
+    "\n"
+    ".section .text\n"
+    "  .globl main\n"
+    "main:\n";
+static constexpr char asm_entry_epilogue[] =
+    "\n"
+    "  pop rdi\n"
+    "  jmp rt_exit\n";
+// with no libc to call main, _start does: the kernel leaves argc, argv[] and
+// envp[] on the stack, and main is entered through a call so that it sees
+// the same stack alignment as under libc
+static constexpr char asm_freestanding_start[] =
+    "\n"
+    ".text\n"
+    "  .globl _start\n"
+    "_start:\n"
+    "  xor ebp, ebp\n"
+    "  mov rdi, QWORD PTR [rsp]\n"
+    "  lea rsi, [rsp + 8]\n"
+    "  lea rdx, [rsi + rdi * 8 + 8]\n"
+    "  call main\n";
+static constexpr char asm_par_save_env[] = "  mov QWORD PTR [rt_envp], rdx\n\n";
+static constexpr char asm_par_entry_epilogue[] =
+    "\n"
+    "  pop rdi\n"
+    "  jmp rt_par_exit\n";
+static constexpr char asm_blank_line_end[] = "\n\n";
+static constexpr char asm_label_end[] = ":\n";
+static constexpr char asm_frame_begin[] = "  sub rsp, ";
+static constexpr char asm_frame_end[] = "\n  mov QWORD PTR [rsp], 0\n\n";
+static constexpr char asm_true_label_begin[] = ".if_true";
+static constexpr char asm_else_begin[] = "  jmp .if_end";
+static constexpr char asm_else_middle[] = "\n.if_false";
+static constexpr char asm_false_label_begin[] = ".if_false";
+static constexpr char asm_end_label_begin[] = ".if_end";
+// cold blocks go to subsection 1, which the assembler places after all of
+// .text; outlined task bodies go to subsection 2 + nesting depth
+static constexpr char asm_subsection_begin[] = ".text ";
+static constexpr int cold_subsection = 1;
+static constexpr int task_subsection = 2;
+// a switch dispatches on rax to .match<id>_<case>, the case after the last
+// being the else branch: through a bounds-checked table of .quad labels in
+// .rodata, or a balanced tree of compares whose inner nodes are _n<k>
+static constexpr char asm_match_label_begin[] = ".match";
+static constexpr char asm_match_jump_begin[] = "  jmp .match";
+static constexpr char asm_match_table_begin[] = "  jmp QWORD PTR [.match";
+static constexpr char asm_match_table_end[] = "_table + rax * 8]\n";
+static constexpr char asm_match_rodata_begin[] = ".section .rodata\n  .balign 8\n.match";
+static constexpr char asm_match_quad_begin[] = "  .quad .match";
+// loops keep their counter below the bound: [rsp + 8] = i, [rsp] = end
+static constexpr char asm_loop_label_begin[] = ".loop";
+static constexpr char asm_for_test_begin[] = "  mov rax, [rsp + 8]\n  cmp rax, [rsp]\n  jge .loop_end";
+static constexpr char asm_for_next_begin[] = "  inc QWORD PTR [rsp + 8]\n  jmp .loop";
+static constexpr char asm_loop_end_begin[] = "  jmp .loop";
+static constexpr char asm_loop_end_label_begin[] = "\n.loop_end";
+static constexpr char asm_loop_end_label[] = ".loop_end";
+static constexpr char asm_break_begin[] = "  jmp .loop_end";
+static constexpr char asm_parallel_for_begin[] = "  pop rdx\n  pop rsi\n  mov rdi, rsp\n  lea rcx, [.task";
+static constexpr char asm_parallel_for_end[] = "]\n  call rt_parallel_for\n\n";
+static constexpr char asm_spawn_begin[] = "  mov rdi, rsp\n  mov rsi, ";
+static constexpr char asm_spawn_middle[] = "\n  lea rdx, [.task";
+static constexpr char asm_spawn_end[] = "]\n  call rt_spawn\n\n";
+static constexpr char asm_join[] = "  call rt_join\n\n";
+// a task starts by copying the spawner's frame (rdi) below its own rsp, so
+// the body addresses variables exactly as it would inline
+static constexpr char asm_task_label_begin[] = ".task";
+static constexpr char asm_task_copy_begin[] = "  mov rax, rsi\n  sub rsp, ";
+static constexpr char asm_task_copy_middle[] = "\n  mov rsi, rdi\n  mov rdi, rsp\n  mov ecx, ";
+static constexpr char asm_task_copy_end[] = "\n  rep movsq\n";
+static constexpr char asm_task_range[] = "  push rax\n  push rdx\n";
+static constexpr char asm_task_end_begin[] = "  add rsp, ";
+static constexpr char asm_task_end_end[] = "\n  ret\n\n";
+// a generator is a resume function .gen<id>(frame) returning rax = 1 with the
+// value in rdx, or 0 once it has finished. frame[0] is the state index; from
+// frame + 16 on is the generator's operand stack as it was at the last yield,
+// which a resume copies back below its rsp before jumping to the state label
+static constexpr char asm_gen_label_begin[] = ".gen";
+static constexpr char asm_gen_dispatch_begin[] = "  mov rax, [rdi]\n  jmp QWORD PTR [.gen";
+static constexpr char asm_gen_dispatch_end[] = "_states + rax * 8]\n";
+static constexpr char asm_gen_state_middle[] = "_s";
+static constexpr char asm_gen_done_end[] = "_done:\n  xor eax, eax\n  ret\n";
+static constexpr char asm_gen_states_begin[] = ".section .rodata\n  .balign 8\n.gen";
+static constexpr char asm_gen_states_end[] = "_states:\n";
+static constexpr char asm_gen_quad_begin[] = "  .quad .gen";
+static constexpr char asm_yield_begin[] = "  pop rdx\n  mov rdi, [rsp + ";
+static constexpr char asm_gen_return_begin[] = "  mov rdi, [rsp + ";
+static constexpr char asm_yield_state[] = "]\n  mov QWORD PTR [rdi], ";
+static constexpr char asm_yield_end[] = "  mov eax, 1\n  ret\n";
+static constexpr char asm_frame_save_begin[] = "  mov rax, [rsp + ";
+static constexpr char asm_frame_save_middle[] = "]\n  mov [rdi + ";
+static constexpr char asm_frame_restore_begin[] = "  mov rax, [rdi + ";
+static constexpr char asm_frame_restore_middle[] = "]\n  mov [rsp + ";
+static constexpr char asm_frame_copy_end[] = "], rax\n";
+static constexpr char asm_frame_save_bulk[] = "  mov rsi, rsp\n  add rdi, 16\n  mov ecx, ";
+static constexpr char asm_frame_restore_bulk[] = "  lea rsi, [rdi + 16]\n  mov rdi, rsp\n  mov ecx, ";
+static constexpr char asm_sub_rsp_begin[] = "  sub rsp, ";
+static constexpr char asm_gen_new_begin[] = "  mov edi, ";
+static constexpr char asm_gen_new_middle[] = "\n  call rt_alloc\n  mov QWORD PTR [rax], 0\n  mov [rax + ";
+static constexpr char asm_gen_new_end[] = "], rax\n  push rax\n\n";
+static constexpr char asm_gen_arg_begin[] = "  pop rax\n  mov rdx, [rsp]\n  mov [rdx + ";
+static constexpr char asm_gen_next_begin[] = "  mov rdi, [rsp + 8]\n  call .gen";
+static constexpr char asm_gen_next_middle[] = "\n  test eax, eax\n  jz .loop_end";
+static constexpr char asm_gen_next_end[] = "\n  mov [rsp], rdx\n\n";
+static constexpr char asm_gen_free_begin[] = "  mov rdi, [rsp + 8]\n  mov esi, ";
+static constexpr char asm_gen_free_end[] = "\n  call rt_free\n\n";
+static constexpr char asm_sys_write_int_locked[] = "  mov rdi, [rsp]\n  call rt_write_int_locked\n\n";
+static constexpr char asm_par_exit[] = "  pop rdi\n  jmp rt_par_exit\n";
+static constexpr char asm_halt[] = "  xor edi, edi\n  jmp rt_exit\n\n";
+static constexpr char asm_sys_exit[] = "  pop rdi\n  jmp rt_exit\n";
+static constexpr char asm_alloc_array[] = "  pop rdi\n  call rt_alloc_array\n  push rax\n\n";
+static constexpr char asm_alloc_record_begin[] = "  mov edi, ";
+static constexpr char asm_alloc_record_end[] = "\n  call rt_alloc\n  push rax\n\n";
+static constexpr char asm_alloc_records_begin[] = "  pop rdi\n  mov esi, ";
+static constexpr char asm_alloc_records_end[] = "\n  call rt_alloc_records\n  push rax\n\n";
+// map operations call into rt_map_asm_code with the map in rdi and the key
+// in rsi; BC_MAP_SLOT leaves the address of the key's {key, value} slot
+static constexpr int64_t map_count_offset = 24; // RT_MAP_COUNT
+static constexpr char asm_alloc_map[] = "  call rt_map_new\n  push rax\n\n";
+static constexpr char asm_map_get[] = "  pop rsi\n  pop rdi\n  call rt_map_get\n  push rax\n\n";
+static constexpr char asm_map_slot[] = "  pop rsi\n  pop rdi\n  call rt_map_slot\n  push rax\n\n";
+static constexpr char asm_map_has[] = "  pop rsi\n  pop rdi\n  call rt_map_has\n  push rax\n\n";
+static constexpr char asm_map_del[] = "  pop rsi\n  pop rdi\n  call rt_map_del\n  push rax\n\n";
+// `for k[, v] in m` keeps the map, then a cursor above the loop variables
+static constexpr char asm_map_next_begin[] = "  mov rdi, [rsp + ";
+static constexpr char asm_map_next_middle[] = "]\n  mov rsi, [rsp + ";
+static constexpr char asm_map_next_call[] = "]\n  call rt_map_next\n  test rax, rax\n  jz .loop_end";
+static constexpr char asm_map_next_cursor[] = "\n  mov [rsp + ";
+static constexpr char asm_map_next_key[] = "], rdx\n  mov rcx, [rax]\n  mov [rsp + ";
+static constexpr char asm_map_next_value[] = "], rcx\n  mov rcx, [rax + 8]\n  mov [rsp], rcx\n\n";
+static constexpr char asm_store_index[] = "  pop rcx\n  pop rax\n  mov rdx, [rsp]\n  mov [rax + rcx * 8 + 8], rdx\n\n";
+static constexpr char asm_free_array_begin[] = "  mov rdi, [rsp + ";
+static constexpr char asm_free_array_end[] = "]\n  mov rsi, [rdi]\n  lea rsi, [rsi * 8 + 8]\n  call rt_free\n\n";
+static constexpr char asm_arena_mark[] = "  push QWORD PTR [rt_heap_top]\n\n";
+static constexpr char asm_arena_release_begin[] = "  mov rdi, [rsp + ";
+static constexpr char asm_arena_release_end[] = "]\n  call rt_arena_release\n\n";
+static constexpr char asm_sys_write_int[] = "  mov rdi, [rsp]\n  call rt_write_int\n\n";
+// -g: main gets an rbp frame so one CFA rule holds however deep the operand
+// stack grows, and every statement a .loc back to its source line
+static constexpr char asm_debug_frame[] =
+    "  .type main, @function\n"
+    "  .cfi_startproc\n"
+    "  push rbp\n"
+    "  .cfi_def_cfa_offset 16\n"
+    "  .cfi_offset rbp, -16\n"
+    "  mov rbp, rsp\n"
+    "  .cfi_def_cfa_register rbp\n\n";
+static constexpr char asm_debug_frame_end[] = "  .cfi_endproc\n  .size main, .-main\n";
+static constexpr char asm_loc_begin[] = "  .loc 1 ";
+static constexpr char asm_prof_start[] = "  call rt_prof_start\n\n";
+static constexpr char asm_prof_line_begin[] =
+    "  rdtsc\n  shl rdx, 32\n  or rax, rdx\n  mov rcx, rax\n"
+    "  sub rax, QWORD PTR [rt_prof_last_tsc]\n  mov QWORD PTR [rt_prof_last_tsc], rcx\n"
+    "  mov rdx, QWORD PTR [rt_prof_cur]\n  add QWORD PTR [rdx + 8], rax\n"
+    "  lea rdx, [rt_prof_table + ";
+static constexpr char asm_prof_line_end[] = "]\n  inc QWORD PTR [rdx]\n  mov QWORD PTR [rt_prof_cur], rdx\n\n";
+static constexpr char asm_prof_branch_begin[] =
+    "  mov rax, QWORD PTR [rsp]\n  xor ecx, ecx\n  test rax, rax\n  sete cl\n  inc QWORD PTR [rt_prof_branches + rcx * 8 + ";
+static constexpr char asm_prof_branch_end[] = "]\n\n";
 
 struct program_data_t
 {
     std::unordered_map<std::string_view, variable_t> vars;
     std::vector<uint8_t> bytecode;
+    bool trace = false; // print each emitted opcode to trace_out
+    std::ostream *trace_out = &std::cout;
+    bool profile = false; // instrument BC_LINE markers, see rt_profile_asm_code
+    std::string profile_path = "toy.prof";
+    uint64_t profile_source_hash = 0; // lets a later --profile-use build reject a stale profile
+    std::string debug_source; // when set, emit DWARF line info against this file
+    bool threaded = false; // uses parallel for / spawn: link the task runtime, serialize output
+    bool freestanding = false; // enter at _start and link without libc, see link_command
 
     void init_basic_syscalls()
     {
@@ -141,299 +257,793 @@ struct program_data_t
 
     std::string asm_str(bool entry_point = false)
     {
-        std::stringstream ss;
-        size_t syscalls = 0;
-        
-        bool include_int_to_str_code = false;
+        asm_emitter_t out;
+        emit_asm(out, entry_point);
+        return out.str();
+    }
+
+    void write_asm_file(const std::string &path, bool entry_point = false)
+    {
+        asm_emitter_t out;
+        out.open(path);
+        emit_asm(out, entry_point);
+        out.close();
+    }
+
+    // the profiler runtime plus the per-line and per-branch tables it fills
+    void emit_profile_data(asm_emitter_t &out, size_t lines, size_t branches)
+    {
+        out.put("\n.set rt_prof_hash, ");
+        out.put_uint(profile_source_hash);
+        out.put("\n.set rt_prof_lines, ");
+        out.put_uint(lines);
+        out.put("\n.set rt_prof_branch_count, ");
+        out.put_uint(branches);
+        out.put(rt_profile_asm_code);
+        out.put("\n.section .bss\n    .balign 64\nrt_prof_header:\n    .skip 32\nrt_prof_table:\n    .skip ");
+        out.put_uint(lines * 16);
+        out.put("\nrt_prof_branches:\n    .skip ");
+        out.put_uint(branches * 16);
+        out.put("\n.section .rodata\nrt_prof_path:\n    .asciz ");
+        put_quoted(out, profile_path);
+        out.put('\n');
+    }
+
+    static void put_quoted(asm_emitter_t &out, std::string_view s)
+    {
+        out.put('"');
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\') out.put('\\');
+            out.put(c);
+        }
+        out.put('"');
+    }
+
+    static void put_match_label(asm_emitter_t &out, size_t id, std::string_view kind, size_t n)
+    {
+        out.put(asm_match_label_begin);
+        out.put_uint(id);
+        out.put(kind);
+        out.put_uint(n);
+    }
+
+    static void put_cmp_rax(asm_emitter_t &out, int64_t value)
+    {
+        if (isel_t::fits32(value))
+        {
+            out.put("  cmp rax, ");
+            out.put_int(value);
+            out.put('\n');
+            return;
+        }
+        out.put("  movabs rcx, ");
+        out.put_int(value);
+        out.put("\n  cmp rax, rcx\n");
+    }
+
+    // binary search over sorted (value, case) pairs; runs of three or fewer
+    // are tested in line
+    static void put_switch_tree(asm_emitter_t &out, size_t id, const int64_t *pairs, size_t count, size_t otherwise, size_t &nodes)
+    {
+        if (count <= 3)
+        {
+            for (size_t k = 0; k < count; k++)
+            {
+                put_cmp_rax(out, pairs[2 * k]);
+                out.put("  je ");
+                put_match_label(out, id, "_", pairs[2 * k + 1]);
+                out.put('\n');
+            }
+            out.put(asm_match_jump_begin);
+            out.put_uint(id);
+            out.put('_');
+            out.put_uint(otherwise);
+            out.put('\n');
+            return;
+        }
+        size_t mid = count / 2;
+        size_t right = nodes++;
+        put_cmp_rax(out, pairs[2 * mid]);
+        out.put("  je ");
+        put_match_label(out, id, "_", pairs[2 * mid + 1]);
+        out.put("\n  jg ");
+        put_match_label(out, id, "_n", right);
+        out.put('\n');
+        put_switch_tree(out, id, pairs, mid, otherwise, nodes);
+        put_match_label(out, id, "_n", right);
+        out.put(asm_label_end);
+        put_switch_tree(out, id, pairs + 2 * (mid + 1), count - mid - 1, otherwise, nodes);
+    }
+
+    // BC_SWITCH_TABLE id, else, lo, n, then the case of lo .. lo + n - 1;
+    // BC_SWITCH_TREE id, else, n, then n sorted (value, case) pairs.
+    // returns the position of the next opcode
+    size_t put_switch(asm_emitter_t &out, size_t i, int subsection)
+    {
+        const int64_t *operands = (const int64_t *)&bytecode[i + 1];
+        size_t id = operands[0];
+        size_t otherwise = operands[1];
+        if (bytecode[i] == BC_SWITCH_TREE)
+        {
+            size_t count = operands[2];
+            size_t nodes = 0;
+            put_switch_tree(out, id, operands + 3, count, otherwise, nodes);
+            out.put('\n');
+            return i + 25 + 16 * count;
+        }
+        int64_t lo = operands[2];
+        size_t count = operands[3];
+        const int64_t *cases = operands + 4;
+        if (lo != 0)
+        {
+            if (isel_t::fits32(lo))
+            {
+                out.put("  sub rax, ");
+                out.put_int(lo);
+                out.put('\n');
+            }
+            else
+            {
+                out.put("  movabs rcx, ");
+                out.put_int(lo);
+                out.put("\n  sub rax, rcx\n");
+            }
+        }
+        out.put("  cmp rax, ");
+        out.put_uint(count - 1);
+        out.put("\n  ja ");
+        put_match_label(out, id, "_", otherwise);
+        out.put('\n');
+        out.put(asm_match_table_begin);
+        out.put_uint(id);
+        out.put(asm_match_table_end);
+        out.put(asm_match_rodata_begin);
+        out.put_uint(id);
+        out.put("_table:\n");
+        for (size_t k = 0; k < count; k++)
+        {
+            out.put(asm_match_quad_begin);
+            out.put_uint(id);
+            out.put('_');
+            out.put_uint(cases[k]);
+            out.put('\n');
+        }
+        out.put(asm_subsection_begin);
+        out.put_uint(subsection);
+        out.put(asm_blank_line_end);
+        return i + 33 + 8 * count;
+    }
+
+    // copies the top `bytes` of the operand stack into the frame in rdi
+    // (save) or back from it (restore); short frames are unrolled
+    static void put_frame_copy(asm_emitter_t &out, size_t bytes, bool save)
+    {
+        if (bytes > 16 * 8)
+        {
+            out.put(save ? std::string_view(asm_frame_save_bulk) : std::string_view(asm_frame_restore_bulk));
+            out.put_uint(bytes / 8);
+            out.put(asm_task_copy_end);
+            return;
+        }
+        for (size_t off = 0; off < bytes; off += 8)
+        {
+            out.put(save ? std::string_view(asm_frame_save_begin) : std::string_view(asm_frame_restore_begin));
+            out.put_uint(save ? off : off + 16);
+            out.put(save ? std::string_view(asm_frame_save_middle) : std::string_view(asm_frame_restore_middle));
+            out.put_uint(save ? off + 16 : off);
+            out.put(asm_frame_copy_end);
+        }
+    }
+
+    // the label a generator's dispatch jumps to for `state`, rebuilding the
+    // `bytes` of operand stack that were live there
+    static void put_gen_resume(asm_emitter_t &out, size_t id, size_t state, size_t bytes)
+    {
+        out.put(asm_gen_label_begin);
+        out.put_uint(id);
+        out.put(asm_gen_state_middle);
+        out.put_uint(state);
+        out.put(asm_label_end);
+        out.put(asm_sub_rsp_begin);
+        out.put_uint(bytes);
+        out.put('\n');
+        put_frame_copy(out, bytes, false);
+        out.put('\n');
+    }
+
+    // the opcodes the instruction selector handles without a template; it
+    // may consume the following opcode too (a branch on a comparison, the
+    // store of an in-place update), so it advances `i` itself
+    bool select(isel_t &sel, size_t &i)
+    {
+        auto opcode = bytecode[i];
+        uint8_t next = i + 1 < bytecode.size() ? bytecode[i + 1] : BC_HALT;
+        int64_t operand = i + 9 <= bytecode.size() ? *(int64_t *)&bytecode[i + 1] : 0;
+        if (opcode == BC_PUSH_INT)
+        {
+            if (trace) *trace_out << "push_int\n";
+            sel.push_imm(operand);
+            i += 9;
+        }
+        else if (opcode == BC_COPY_INT)
+        {
+            if (trace) *trace_out << "copy_int\n";
+            sel.copy(operand);
+            i += 9;
+        }
+        else if (opcode >= BC_ADD_INT_INT && opcode <= BC_SHR)
+        {
+            if (trace) *trace_out << "arith " << int(opcode) << "\n";
+            alu_op_t op = alu_op_t(opcode - BC_ADD_INT_INT);
+            if ((next == BC_STORE_INT || next == BC_SET_INT) &&
+                sel.modify_in_place(op, *(int64_t *)&bytecode[i + 2], next == BC_SET_INT))
+            {
+                i += 10;
+                return true;
+            }
+            sel.arith(op);
+            i += 1;
+        }
+        else if (opcode >= BC_EQ_INT_INT && opcode <= BC_LE_INT_INT)
+        {
+            int cc = opcode - BC_EQ_INT_INT;
+            int64_t id = i + 10 <= bytecode.size() ? *(int64_t *)&bytecode[i + 2] : 0;
+            if (next == BC_IF || next == BC_IF_NOT)
+            {
+                sel.compare_branch(cc, next == BC_IF_NOT, next == BC_IF ? asm_false_label_begin : asm_true_label_begin, id);
+                i += 10;
+            }
+            else if (next == BC_WHILE_TEST)
+            {
+                sel.compare_branch(cc, false, asm_loop_end_label, id);
+                i += 10;
+            }
+            else if (next == BC_SELECT)
+            {
+                sel.select_value(cc);
+                i += 2;
+            }
+            else
+            {
+                sel.compare(cc);
+                i += 1;
+            }
+        }
+        else if (opcode == BC_IF || opcode == BC_IF_NOT)
+        {
+            sel.branch(opcode == BC_IF_NOT, opcode == BC_IF ? asm_false_label_begin : asm_true_label_begin, operand);
+            i += 9;
+        }
+        else if (opcode == BC_WHILE_TEST)
+        {
+            sel.branch(false, asm_loop_end_label, operand);
+            i += 9;
+        }
+        else if (opcode == BC_SELECT)
+        {
+            sel.select_value(-1);
+            i += 1;
+        }
+        else if (opcode == BC_SET_INT)
+        {
+            if (trace) *trace_out << "set_int\n";
+            sel.set(operand);
+            i += 9;
+        }
+        else if (opcode == BC_STORE_INT)
+        {
+            sel.store(operand);
+            i += 9;
+        }
+        else if (opcode == BC_SHRINK_STACK)
+        {
+            if (trace) *trace_out << "shrink_stack\n";
+            sel.shrink(operand);
+            i += 9;
+        }
+        else if (opcode == BC_LOAD_INDEX)
+        {
+            sel.load_index();
+            i += 1;
+        }
+        else if (opcode == BC_LOAD_FIELD || opcode == BC_STORE_FIELD)
+        {
+            int64_t width = *(int64_t *)&bytecode[i + 9];
+            if (opcode == BC_LOAD_FIELD)
+                sel.load_field(operand, width);
+            else
+                sel.store_field(operand, width);
+            i += 17;
+        }
+        else if (opcode == BC_RECORD_ELEM)
+        {
+            // a field load right after folds into the element's address
+            int64_t column = *(int64_t *)&bytecode[i + 9];
+            if (i + 17 < bytecode.size() && bytecode[i + 17] == BC_LOAD_FIELD)
+            {
+                sel.record_element(operand, column, *(int64_t *)&bytecode[i + 18], *(int64_t *)&bytecode[i + 26], true);
+                i += 34;
+            }
+            else
+            {
+                sel.record_element(operand, column, 0, 8, false);
+                i += 17;
+            }
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
 
+    void emit_asm(asm_emitter_t &out, bool entry_point = false)
+    {
+        bool include_write_int_code = false;
+        bool include_heap_code = false;
+        bool include_map_code = false;
+        size_t max_line = 0;
+        size_t branch_count = 0;
+        std::vector<int> subsections = {0};
+        size_t task_depth = 0; // outlined tasks and generators
+        size_t gen_states = 0; // resume points of the generator being emitted
+        auto enter_subsection = [&](int n) {
+            if (n != subsections.back())
+            {
+                out.put(asm_subsection_begin);
+                out.put_uint(n);
+                out.put('\n');
+            }
+            subsections.push_back(n);
+        };
+        auto leave_subsection = [&]() {
+            int n = subsections.back();
+            subsections.pop_back();
+            if (n != subsections.back())
+            {
+                out.put(asm_subsection_begin);
+                out.put_uint(subsections.back());
+                out.put('\n');
+            }
+        };
 
+        if (entry_point)
+        {
+            out.put(asm_entry_prologue);
+            if (!debug_source.empty())
+            {
+                out.put("  .file 1 ");
+                put_quoted(out, debug_source);
+                out.put('\n');
+                out.put(asm_debug_frame);
+            }
+            if (profile)
+            {
+                out.put(asm_prof_start);
+            }
+            if (threaded)
+            {
+                out.put(asm_par_save_env);
+            }
+        }
 
-        int i = 0;
+        isel_t sel(out);
+        size_t i = 0;
         while (i < bytecode.size())
         {
             auto opcode = bytecode[i];
-            if (opcode == BC_PUSH_INT)
-            {
-
-                std::cout << "push_int" << std::endl;
-                ss << " # push_int" << std::endl;
-                ss << "  movabs rax, " << *(int64_t *)&bytecode[i + 1] << std::endl;
-                ss << "  push rax" << std::endl
-                   << std::endl;
-                i += 9;
-            }
-            else if (opcode == BC_SHRINK_STACK)
-            {
-                std::cout << "shrink_stack" << std::endl;
-                size_t size = *(int64_t *)&bytecode[i + 1];
-                ss << " # shrink_stack" << std::endl;
-                ss << "  add rsp, " << size << std::endl
-                   << std::endl;
-                i += 9;
-            }
-            else if (opcode == BC_ADD_INT_INT)
-            {
-                std::cout << "add_int_int" << std::endl;
-                ss << " # add_int_int" << std::endl;
-                ss << "  pop rax" << std::endl;
-                ss << "  pop rbx" << std::endl;
-                ss << "  add rax, rbx" << std::endl;
-                ss << "  push rax" << std::endl
-                   << std::endl;
-                ;
-                i += 1;
+            if (select(sel, i))
+            {
+                continue;
             }
-            else if (opcode == BC_SUB_INT_INT)
+            if (opcode == BC_SWITCH_TABLE || opcode == BC_SWITCH_TREE)
             {
-                ss << "  pop rbx" << std::endl;
-                ss << "  pop rax" << std::endl;
-                ss << "  sub rax, rbx" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                // the subject goes straight to rax
+                sel.flush_below(1);
+                sel.top_to_rax();
+                i = put_switch(out, i, subsections.back());
+                continue;
             }
-            else if (opcode == BC_MUL_INT_INT)
+            if (opcode >= BC_OPCODE_COUNT)
             {
-                ss << "  pop rax" << std::endl;
-                ss << "  pop rbx" << std::endl;
-                ss << "  imul rax, rbx" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                throw utils::error_t(0, "Unknown opcode: " + std::to_string(opcode));
             }
-            else if (opcode == BC_DIV_INT_INT)
+            // operand widths come from the opcode table, not from each branch
+            size_t size = bytecode_size(&bytecode[i]);
+            if (opcode != BC_LINE || profile)
             {
-                ss << "  pop rbx" << std::endl;
-                ss << "  pop rax" << std::endl;
-                ss << "  cqo" << std::endl;
-                ss << "  idiv rbx" << std::endl;
-                ss << "  push rax" << std::endl<< std::endl;
-                i += 1;
+                sel.flush();
             }
-            else if (opcode == BC_SET_INT)
+            if (opcode == BC_FRAME)
             {
-                std::cout << "set_int" << std::endl;
-                ss << "  # set_int" << std::endl;
-                ss << "  mov rax, [rsp]" << std::endl;
-                ss << "  mov [rsp + " << *(int64_t *)&bytecode[i + 1] << "], rax" << std::endl << std::endl;
-                i += 9;
+                out.put(asm_frame_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_frame_end);
             }
-            else if (opcode == BC_COPY_INT)
+            else if (opcode == BC_PROF_BRANCH)
             {
-                std::cout << "copy_int" << std::endl;
-                ss << "  # copy_int" << std::endl;
-                ss << "  mov rax, [rsp + " << *(int64_t *)&bytecode[i + 1] << "]" << std::endl;
-                ss << "  push rax" << std::endl  << std::endl;
-                i += 9;
+                size_t counter = *(int64_t *)&bytecode[i + 1];
+                if (counter >= branch_count) branch_count = counter + 1;
+                out.put(asm_prof_branch_begin);
+                out.put_uint(counter * 16);
+                out.put(asm_prof_branch_end);
             }
-            else if (opcode == BC_AND)
+            else if (opcode == BC_JUMP_END)
             {
-                ss << "  pop rax" << std::endl;
-                ss << "  pop rbx" << std::endl;
-                ss << "  and rax, rbx" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                // the hot side of an if jumps over its cold block, which ends
+                // right before .if_end. once the block moves out of line the
+                // jump is to the next instruction; inside an already cold
+                // region it stays where it is and the jump is needed
+                bool skips_moved_block = i + size < bytecode.size() && bytecode[i + size] == BC_COLD_BEGIN &&
+                                         subsections.back() != cold_subsection;
+                if (!skips_moved_block)
+                {
+                    out.put(asm_else_begin);
+                    out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                    out.put('\n');
+                }
             }
-            else if (opcode == BC_OR)
+            else if (opcode == BC_TRUE_LABEL)
             {
-                ss << "  pop rax" << std::endl;
-                ss << "  pop rbx" << std::endl;
-                ss << "  or rax, rbx" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                out.put(asm_true_label_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_label_end);
             }
-            else if (opcode == BC_XOR)
+            else if (opcode == BC_COLD_BEGIN)
             {
-                ss << "  pop rax" << std::endl;
-                ss << "  pop rbx" << std::endl;
-                ss << "  xor rax, rbx" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                enter_subsection(cold_subsection);
             }
-            else if (opcode == BC_SHL)
+            else if (opcode == BC_COLD_END)
             {
-                ss << "  pop rcx" << std::endl;
-                ss << "  pop rax" << std::endl;
-                ss << "  shl rax, cl" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                leave_subsection();
             }
-            else if (opcode == BC_SHR)
+            else if (opcode == BC_LOOP_LABEL)
             {
-                ss << "  pop rcx" << std::endl;
-                ss << "  pop rax" << std::endl;
-                ss << "  shr rax, cl" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                out.put(asm_loop_label_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_label_end);
             }
-            else if (opcode == BC_EQ_INT_INT)
+            else if (opcode == BC_FOR_TEST)
             {
-                ss << "  pop rax" << std::endl;
-                ss << "  pop rbx" << std::endl;
-                ss << "  cmp rax, rbx" << std::endl;
-                ss << "  sete al" << std::endl;
-                ss << "  movzx rax, al" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                out.put(asm_for_test_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put('\n');
             }
-            else if (opcode == BC_NE_INT_INT)
+            else if (opcode == BC_FOR_NEXT || opcode == BC_LOOP_END)
             {
-                ss << "  pop rax" << std::endl;
-                ss << "  pop rbx" << std::endl;
-                ss << "  cmp rax, rbx" << std::endl;
-                ss << "  setne al" << std::endl;
-                ss << "  movzx rax, al" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                size_t id = *(int64_t *)&bytecode[i + 1];
+                out.put(opcode == BC_FOR_NEXT ? std::string_view(asm_for_next_begin) : std::string_view(asm_loop_end_begin));
+                out.put_uint(id);
+                out.put(asm_loop_end_label_begin);
+                out.put_uint(id);
+                out.put(asm_label_end);
             }
-            else if (opcode == BC_GT_INT_INT)
+            else if (opcode == BC_BREAK || opcode == BC_CONTINUE || opcode == BC_FOR_CONTINUE)
             {
-                ss << "  pop rax" << std::endl;
-                ss << "  pop rbx" << std::endl;
-                ss << "  cmp rax, rbx" << std::endl;
-                ss << "  setg al" << std::endl;
-                ss << "  movzx rax, al" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                out.put(opcode == BC_BREAK      ? std::string_view(asm_break_begin)
+                        : opcode == BC_CONTINUE ? std::string_view(asm_loop_end_begin)
+                                                : std::string_view(asm_for_next_begin));
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put('\n');
             }
-            else if (opcode == BC_LT_INT_INT)
+            else if (opcode == BC_PARALLEL_FOR)
             {
-                ss << "  pop rax" << std::endl;
-                ss << "  pop rbx" << std::endl;
-                ss << "  cmp rax, rbx" << std::endl;
-                ss << "  setl al" << std::endl;
-                ss << "  movzx rax, al" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                out.put(asm_parallel_for_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_parallel_for_end);
             }
-            else if (opcode == BC_GE_INT_INT)
+            else if (opcode == BC_SPAWN)
             {
-                ss << "  pop rax" << std::endl;
-                ss << "  pop rbx" << std::endl;
-                ss << "  cmp rax, rbx" << std::endl;
-                ss << "  setge al" << std::endl;
-                ss << "  movzx rax, al" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                out.put(asm_spawn_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 9]);
+                out.put(asm_spawn_middle);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_spawn_end);
             }
-            else if (opcode == BC_LE_INT_INT)
+            else if (opcode == BC_JOIN)
             {
-                ss << "  pop rax" << std::endl;
-                ss << "  pop rbx" << std::endl;
-                ss << "  cmp rax, rbx" << std::endl;
-                ss << "  setle al" << std::endl;
-                ss << "  movzx rax, al" << std::endl;
-                ss << "  push rax" << std::endl << std::endl;
-                i += 1;
+                out.put(asm_join);
+            }
+            else if (opcode == BC_TASK_BEGIN || opcode == BC_PAR_TASK_BEGIN)
+            {
+                size_t frame = *(int64_t *)&bytecode[i + 9];
+                enter_subsection(task_subsection + task_depth++);
+                out.put(asm_task_label_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_label_end);
+                out.put(asm_task_copy_begin);
+                out.put_uint(frame);
+                out.put(asm_task_copy_middle);
+                out.put_uint(frame / 8);
+                out.put(asm_task_copy_end);
+                if (opcode == BC_PAR_TASK_BEGIN)
+                {
+                    out.put(asm_task_range);
+                }
+            }
+            else if (opcode == BC_TASK_END)
+            {
+                out.put(asm_task_end_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_task_end_end);
+                task_depth--;
+                leave_subsection();
+            }
+            else if (opcode == BC_GEN_BEGIN)
+            {
+                size_t id = *(int64_t *)&bytecode[i + 1];
+                size_t frame = *(int64_t *)&bytecode[i + 9];
+                enter_subsection(task_subsection + task_depth++);
+                out.put(asm_gen_label_begin);
+                out.put_uint(id);
+                out.put(asm_label_end);
+                out.put(asm_gen_dispatch_begin);
+                out.put_uint(id);
+                out.put(asm_gen_dispatch_end);
+                gen_states = 0;
+                put_gen_resume(out, id, gen_states++, frame);
             }
-            else if (opcode == BC_IF)
+            else if (opcode == BC_YIELD)
             {
                 size_t id = *(int64_t *)&bytecode[i + 1];
-                ss << "  pop rax" << std::endl;
-                ss << "  test rax, rax" << std::endl;
-                ss << "  jz .if_end" << id << std::endl;
-                i += 9;
+                size_t depth = *(int64_t *)&bytecode[i + 9];
+                out.put(asm_yield_begin);
+                out.put_uint(depth - 8);
+                out.put(asm_yield_state);
+                out.put_uint(gen_states);
+                out.put('\n');
+                put_frame_copy(out, depth, true);
+                out.put(asm_task_end_begin);
+                out.put_uint(depth);
+                out.put('\n');
+                out.put(asm_yield_end);
+                put_gen_resume(out, id, gen_states++, depth);
+            }
+            else if (opcode == BC_GEN_END)
+            {
+                size_t id = *(int64_t *)&bytecode[i + 1];
+                size_t frame = *(int64_t *)&bytecode[i + 9];
+                out.put(asm_gen_return_begin);
+                out.put_uint(frame - 8);
+                out.put(asm_yield_state);
+                out.put_uint(gen_states);
+                out.put('\n');
+                out.put(asm_task_end_begin);
+                out.put_uint(frame);
+                out.put('\n');
+                out.put(asm_gen_label_begin);
+                out.put_uint(id);
+                out.put(asm_gen_done_end);
+                out.put(asm_gen_states_begin);
+                out.put_uint(id);
+                out.put(asm_gen_states_end);
+                for (size_t s = 0; s < gen_states; s++)
+                {
+                    out.put(asm_gen_quad_begin);
+                    out.put_uint(id);
+                    out.put(asm_gen_state_middle);
+                    out.put_uint(s);
+                    out.put('\n');
+                }
+                out.put(asm_gen_quad_begin);
+                out.put_uint(id);
+                out.put("_done\n");
+                out.put(asm_subsection_begin);
+                out.put_uint(subsections.back());
+                out.put(asm_blank_line_end);
+                task_depth--;
+                leave_subsection();
+            }
+            else if (opcode == BC_GEN_NEW)
+            {
+                include_heap_code = true;
+                out.put(asm_gen_new_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_gen_new_middle);
+                out.put_uint(*(int64_t *)&bytecode[i + 9]);
+                out.put(asm_gen_new_end);
+            }
+            else if (opcode == BC_GEN_ARG)
+            {
+                out.put(asm_gen_arg_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_frame_copy_end);
+                out.put('\n');
+            }
+            else if (opcode == BC_GEN_NEXT)
+            {
+                out.put(asm_gen_next_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_gen_next_middle);
+                out.put_uint(*(int64_t *)&bytecode[i + 9]);
+                out.put(asm_gen_next_end);
+            }
+            else if (opcode == BC_GEN_FREE)
+            {
+                out.put(asm_gen_free_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_gen_free_end);
             }
             else if (opcode == BC_ELSE)
             {
                 size_t id = *(int64_t *)&bytecode[i + 1];
-                ss << "  pop rax" << std::endl;
-                ss << "  test rax, rax" << std::endl;
-                ss << "  jmp .if_end" << id << std::endl;
-                ss << ".if_false" << id << ":" << std::endl;
-                i += 9;
+                out.put(asm_else_begin);
+                out.put_uint(id);
+                out.put(asm_else_middle);
+                out.put_uint(id);
+                out.put(asm_label_end);
             }
             else if (opcode == BC_TEST_FALSE_LABEL)
             {
-                size_t id = *(int64_t *)&bytecode[i + 1];
-                ss << ".if_false" << id << ":" << std::endl;
-                i += 9;
+                out.put(asm_false_label_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_label_end);
+            }
+            else if (opcode == BC_CASE_LABEL)
+            {
+                put_match_label(out, *(int64_t *)&bytecode[i + 1], "_", *(int64_t *)&bytecode[i + 9]);
+                out.put(asm_label_end);
             }
             else if (opcode == BC_TEST_END_END_LABEL)
             {
-                size_t id = *(int64_t *)&bytecode[i + 1];
-                ss << ".if_end" << id << ":" << std::endl;
-                i += 9;
+                out.put(asm_end_label_begin);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_label_end);
             }
             else if (opcode == BC_HALT)
             {
-                ss << "  movabs rax, 60" << std::endl;
-                ss << "  xor rdi, rdi" << std::endl;
-                ss << "  syscall" << std::endl << std::endl;
-                i += 1;
+                out.put(asm_halt);
             }
             else if (opcode == BC_SYSCALL)
             {
                 auto syscall = bytecode[i + 1];
                 if (syscall == BC_SYS_EXIT)
                 {
-                    ss << "  movabs rax, 60" << std::endl;
-                    ss << "  pop rdi" << std::endl;
-                    ss << "  syscall" << std::endl;
+                    out.put(threaded ? std::string_view(asm_par_exit) : std::string_view(asm_sys_exit));
                 }
                 else if (syscall == BC_SYS_WRITE_INT)
                 {
-                    include_int_to_str_code = true;
-                    std::cout << "sys_call_write_int" << std::endl;
-                    //push top of stack to stack
-                    ss << "  mov rax, [rsp]" << std::endl;
-                    ss << "  push rax" << std::endl;
-                    ss << "  pop rdi" << std::endl;
-                    ss << "  call int_to_str" << std::endl;
-                    // ss << "  sub rsp, 8" << std::endl;
-                    ss << "  mov rax, 1" << std::endl;
-                    ss << "  mov rdi, 1" << std::endl;
-                    ss << "  lea rsi, [numbuf]" << std::endl;
-                    ss << "  mov rdx, 20" << std::endl;
-                    ss << "  syscall" << std::endl;
-                    // ss << "  pop rax" << std::endl;
-                    //clear numbuf 20 bytes to 0
-                    ss << "  lea rdi, [numbuf]" << std::endl;
-                    ss << "  mov rcx, 20" << std::endl;
-                    ss << "  mov al, 0" << std::endl;
-                    ss << "  rep stosb" << std::endl << std::endl;
-
-
-
+                    include_write_int_code = true;
+                    if (trace) *trace_out << "sys_call_write_int\n";
+                    out.put(threaded ? std::string_view(asm_sys_write_int_locked) : std::string_view(asm_sys_write_int));
+                }
+            }
+            else if (opcode == BC_ALLOC_RECORD || opcode == BC_ALLOC_RECORDS)
+            {
+                include_heap_code = true;
+                out.put(opcode == BC_ALLOC_RECORD ? std::string_view(asm_alloc_record_begin) : std::string_view(asm_alloc_records_begin));
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(opcode == BC_ALLOC_RECORD ? std::string_view(asm_alloc_record_end) : std::string_view(asm_alloc_records_end));
+            }
+            else if (opcode == BC_ALLOC_ARRAY)
+            {
+                include_heap_code = true;
+                out.put(asm_alloc_array);
+            }
+            else if (opcode == BC_ALLOC_MAP)
+            {
+                include_heap_code = include_map_code = true;
+                out.put(asm_alloc_map);
+            }
+            else if (opcode >= BC_MAP_GET && opcode <= BC_MAP_DEL)
+            {
+                static constexpr std::string_view map_ops[] = {asm_map_get, asm_map_slot, asm_map_has, asm_map_del};
+                out.put(map_ops[opcode - BC_MAP_GET]);
+            }
+            else if (opcode == BC_MAP_NEXT)
+            {
+                size_t vars = *(int64_t *)&bytecode[i + 9];
+                out.put(asm_map_next_begin);
+                out.put_uint(8 * vars + 8);
+                out.put(asm_map_next_middle);
+                out.put_uint(8 * vars);
+                out.put(asm_map_next_call);
+                out.put_uint(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_map_next_cursor);
+                out.put_uint(8 * vars);
+                out.put(asm_map_next_key);
+                out.put_uint(8 * vars - 8);
+                out.put(vars == 2 ? std::string_view(asm_map_next_value) : std::string_view("], rcx\n\n"));
+            }
+            else if (opcode == BC_STORE_INDEX)
+            {
+                out.put(asm_store_index);
+            }
+            else if (opcode == BC_FREE_ARRAY)
+            {
+                out.put(asm_free_array_begin);
+                out.put_int(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_free_array_end);
+            }
+            else if (opcode == BC_ARENA_MARK)
+            {
+                include_heap_code = true;
+                out.put(asm_arena_mark);
+            }
+            else if (opcode == BC_ARENA_RELEASE)
+            {
+                out.put(asm_arena_release_begin);
+                out.put_int(*(int64_t *)&bytecode[i + 1]);
+                out.put(asm_arena_release_end);
+            }
+            else if (opcode == BC_LINE)
+            {
+                size_t line = *(int64_t *)&bytecode[i + 1];
+                if (!debug_source.empty())
+                {
+                    out.put(asm_loc_begin);
+                    out.put_uint(line);
+                    out.put('\n');
+                }
+                if (profile)
+                {
+                    if (trace) *trace_out << "line " << line << "\n";
+                    if (line > max_line) max_line = line;
+                    out.put(asm_prof_line_begin);
+                    out.put_uint(line * 16);
+                    out.put(asm_prof_line_end);
                 }
-                i += 2;
             }
             else
             {
                 throw utils::error_t(0, "Unknown opcode: " + std::to_string(opcode));
-                break;
             }
+            i += size;
+            out.maybe_flush();
         }
-        std::string asm_code = ss.str();
+        sel.flush();
         if (entry_point)
         {
-            ss.str("");
-            ss.clear();
-            ss << ".intel_syntax noprefix" << std::endl;
-            ss << ".section .bss" << std::endl;
-            ss << "numbuf:\n .skip 64" << std::endl;
-            ss << "tempbuf:\n .skip 2024"<< std::endl;
-            ss << ".section .data" << std::endl;
-            ss << "  msg: .asciz  \"Hello, World!\"" << std::endl;
-            ss << std::endl;
-            ss << ".section .text" << std::endl;
-            ss << "  .globl main" << std::endl;
-            ss << "main:" << std::endl;
-            ss << asm_code << std::endl;
-            ss << "  movabs rax, 60" << std::endl;
-            ss << "  pop rdi" << std::endl;
-            ss << "  syscall" << std::endl;
-            if (include_int_to_str_code)
+            out.put(threaded ? std::string_view(asm_par_entry_epilogue) : std::string_view(asm_entry_epilogue));
+            if (!debug_source.empty())
+            {
+                out.put(asm_debug_frame_end);
+            }
+            if (freestanding)
+            {
+                out.put(asm_freestanding_start);
+            }
+            out.put(rt_output_asm_code);
+            if (include_write_int_code || threaded)
+            {
+                out.put(rt_write_int_asm_code);
+            }
+            if (threaded)
+            {
+                out.put(rt_parallel_asm_code);
+            }
+            if (include_heap_code)
+            {
+                out.put(rt_heap_asm_code);
+            }
+            if (include_map_code)
+            {
+                out.put(rt_map_asm_code);
+            }
+            if (profile)
+            {
+                emit_profile_data(out, max_line + 1, branch_count);
+            }
+            else
             {
-                ss << int_to_str_asm_code << std::endl;
+                out.put(rt_exit_hook_asm_code);
             }
-            return ss.str();
         }
-        return asm_code;
     }
 
-    
-
 };
 
+// the gcc invocation that assembles and links an entry-point program. the
+// runtime only makes raw system calls, so a freestanding program needs
+// neither libc nor the dynamic loader
+inline std::vector<std::string> link_command(const std::string &asm_path, const std::string &exe_path,
+                                             bool freestanding = false)
+{
+    if (freestanding) return {"gcc", "-nostdlib", "-static", "-no-pie", "-o", exe_path, asm_path};
+    return {"gcc", "-no-pie", "-o", exe_path, asm_path};
+}
+
 inline void check_ast_type(const ast_t &ast, size_t type)
 {
     if (ast.type != type)
@@ -450,10 +1060,30 @@ struct var_context_t
 {
     size_t stack_size = 0;
     std::vector<variable_t> vars;
+    std::vector<std::string_view> var_names;
     std::vector<size_t> scopes;
+    std::vector<size_t> scope_vars;
     std::unordered_map<std::string_view, size_t> var_map;
+    std::unordered_set<std::string_view> aliased_vars; // names copied into another variable
     size_t codition_count = 0;
 
+    // with `slots` set, variables declared by assignment live in a frame
+    // reserved once below everything else; stack_size then counts only what
+    // is pushed above it. slot operands are emitted relative to the frame
+    // base and patched once the slots are colored, see assign_slots
+    struct slot_var_t
+    {
+        size_t start = no_slot; // bytecode positions of the first and last operand naming it
+        size_t end = 0;
+        size_t color = 0;
+    };
+    bool slots = false;
+    std::vector<slot_var_t> slot_vars;
+    std::vector<std::pair<size_t, size_t>> slot_refs; // operand position, slot var
+    std::vector<size_t> frame_refs; // operands that must also count the frame size
+    std::vector<std::pair<size_t, size_t>> loops; // bytecode span of every loop
+    size_t colors = 0; // frame slots after coloring; 0 for one per variable
+
     void add_var(std::string_view name, size_t type, size_t size)
     {
         variable_t var;
@@ -461,6 +1091,19 @@ struct var_context_t
         var.offset = stack_size;
         var.size = size;
         vars.push_back(var);
+        var_names.push_back(name);
+        var_map[name] = vars.size() - 1;
+    }
+
+    void add_slot_var(std::string_view name, size_t type, size_t size)
+    {
+        variable_t var;
+        var.type = type;
+        var.size = size;
+        var.slot = slot_vars.size();
+        slot_vars.emplace_back();
+        vars.push_back(var);
+        var_names.push_back(name);
         var_map[name] = vars.size() - 1;
     }
 
@@ -482,48 +1125,181 @@ struct var_context_t
     void push_scope()
     {
         scopes.push_back(stack_size);
+        scope_vars.push_back(vars.size());
     }
     size_t pop_scope()
     {
         size_t offset = stack_size - scopes.back();
         stack_size = scopes.back();
         scopes.pop_back();
+        while (vars.size() > scope_vars.back())
+        {
+            var_map.erase(var_names.back());
+            var_names.pop_back();
+            vars.pop_back();
+        }
+        scope_vars.pop_back();
         return offset;       
     }
 };
 
 struct code_generator_t
 {
+    bool trace = false; // dump expression trees and variable slots to trace_out
+    std::ostream *trace_out = &std::cout;
+    bool profile = false; // mark the source line of every statement with BC_LINE, count if outcomes
+    bool debug_lines = false; // same markers, for DWARF .loc directives
+    const program_profile_t *profile_use = nullptr; // branch outcomes of a previous run, by if number
+    size_t if_count = 0; // numbers every if in source order, for its profile counters
+
+    // lowering choices the pass manager (passes.hpp) can turn off, and how
+    // many times each was taken
+    bool lower_branchless = true; // pure && / || / ?: without jumps
+    bool lower_if_to_switch = true; // if-chains on one variable as a switch
+    size_t branchless_count = 0;
+    size_t if_to_switch_count = 0;
+    var_context_t main_ctx; // main's frame, kept from lower_program for color_slots and layout_frame
+
+    struct generator_t
+    {
+        size_t id = 0;
+        size_t params = 0;
+        size_t frame = 0; // bytes: state, padding, and the deepest stack live at a yield
+    };
+    std::unordered_map<std::string_view, generator_t> generators;
+
+    // record types are numbered from VARIABLE_TYPE up, two per record: the
+    // record itself, then an array of it. fields are placed widest first,
+    // so every field is aligned without padding. an array of an soa record
+    // stores each field as a column of its own instead; since the columns
+    // follow the same order, a field's offset times the count is where its
+    // column starts
+    struct field_t
+    {
+        std::string_view name;
+        int64_t width = 8;
+        int64_t offset = 0;
+    };
+    struct record_t
+    {
+        std::string_view name;
+        std::vector<field_t> fields; // in declaration order
+        int64_t size = 0;
+        bool soa = false;
+        size_t type = 0;
+    };
+    std::vector<record_t> records;
+    std::unordered_map<std::string_view, size_t> record_map;
+    generator_t *current_generator = nullptr; // the one whose body is being generated
+
+    // the loops around the statement being generated, innermost last, for
+    // break and continue. generator and spawn bodies start a list of their own
+    struct loop_target_t
+    {
+        size_t id = 0;
+        size_t depth = 0; // ctx.stack_size at the loop label, where both jumps land
+        size_t marks = 0; // arena_marks outside the loop
+        uint8_t next = BC_CONTINUE; // BC_FOR_CONTINUE when the counter has to be stepped
+        bool parallel = false; // a chunk of a parallel for, which break cannot leave
+    };
+    std::vector<loop_target_t> loop_targets;
+    std::vector<size_t> arena_marks; // ctx.stack_size just above every open block's arena mark
+    size_t last_set_int = no_slot; // position of the latest BC_SET_INT, for drop_stmt_value
+
+    // lowering and frame layout only; the driver goes through
+    // pass_manager_t, which adds the AST and bytecode passes around them
     program_data_t gen_program(const ast_t &ast)
+    {
+        program_data_t data = lower_program(ast);
+        color_slots(main_ctx);
+        layout_frame(data, main_ctx);
+        return data;
+    }
+
+    // the bytecode with main's slot operands still relative to the frame
+    // base, to be patched by layout_frame
+    program_data_t lower_program(const ast_t &ast)
     {
         check_ast_type(ast, AST_PROGRAM);
+        if (const ast_t *lit = find_node(ast, AST_FLOAT))
+        {
+            // the lexer and parser take them, nothing below does yet
+            throw utils::error_t(lit->line, "float literals are not supported by code generation yet");
+        }
         program_data_t data;
-        var_context_t ctx;
+        data.profile = profile;
+        data.threaded = contains_node(ast, AST_PARALLEL_FOR) || contains_node(ast, AST_SPAWN);
+        if (profile && data.threaded)
+        {
+            throw utils::error_t(0, "--profile does not support parallel for or spawn");
+        }
+        var_context_t &ctx = main_ctx;
+        ctx = var_context_t();
+        collect_aliased_vars(ast, ctx);
+        ctx.slots = true;
+        data.bytecode.push_back(BC_FRAME);
+        emit_frame_operand(data, ctx, 0);
+        ctx.slot_vars.push_back({0, no_slot}); // result_slot, live throughout
         for (auto &child : ast.children)
         {
             generate_code_stmt(child, data, ctx);
         }
-        for (auto &v : ctx.vars)
+        if (contains_node(ast, AST_SPAWN))
         {
-            std::cout << "var: " << v.type << " offset: " << v.offset << std::endl;
+            data.bytecode.push_back(BC_JOIN); // spawned tasks finish before the program exits
+        }
+        data.bytecode.push_back(BC_COPY_INT);
+        emit_var_offset(data, ctx, result_var());
+        ctx.stack_size += sizeof(int64_t);
+        for (auto &v : ctx.vars)
+        {
+            if (trace) *trace_out << "var: " << v.type << " offset: " << v.offset << std::endl;
         }
         return data;
     }
 
     void generate_code_stmt(const ast_t &ast, program_data_t &data, var_context_t &ctx)
     {
+        if ((profile || debug_lines) && ast.type != AST_BLOCK)
+        {
+            data.bytecode.push_back(BC_LINE);
+            data.push_int(ast.line, false);
+        }
         if (ast.type == AST_EXPR_STMT)
         {
             auto &expr = ast.children[0];
+            size_t depth = ctx.stack_size;
             generate_code_expr(expr, data, ctx);
+            if (ctx.slots && ctx.stack_size > depth)
+            {
+                drop_stmt_value(data, ctx, ctx.stack_size - depth);
+            }
         }
         else if (ast.type == AST_BLOCK)
         {
             ctx.push_scope();
+            // everything the block allocates dies with it unless a pointer is
+            // stored into an enclosing variable, so the arena is rewound in bulk
+            // not inside generators, whose blocks span yields back to the caller
+            bool release = block_allocates(ast) && !current_generator && !block_leaks_alloc(ast, ctx);
+            size_t mark_pos = 0;
+            if (release)
+            {
+                data.bytecode.push_back(BC_ARENA_MARK);
+                ctx.stack_size += sizeof(int64_t);
+                mark_pos = ctx.stack_size;
+                arena_marks.push_back(mark_pos);
+            }
             for (auto &child : ast.children)
             {
                 generate_code_stmt(child, data, ctx);
             }
+            if (release)
+            {
+                arena_marks.pop_back();
+                data.bytecode.push_back(BC_ARENA_RELEASE);
+                data.push_int(ctx.stack_size - mark_pos, false);
+            }
             size_t offset = ctx.pop_scope();
             if (offset > 0)
             {
@@ -531,7 +1307,51 @@ struct code_generator_t
                 data.push_int(offset, false);
             }
         } else if (ast.type == AST_IF) {
-            generate_code_if(ast, data, ctx);
+            if (!generate_code_if_ladder(ast, data, ctx)) generate_code_if(ast, data, ctx);
+        }
+        else if (ast.type == AST_MATCH)
+        {
+            generate_code_match(ast, data, ctx);
+        }
+        else if (ast.type == AST_WHILE)
+        {
+            generate_code_while(ast, data, ctx);
+        }
+        else if (ast.type == AST_FOR)
+        {
+            generate_code_for(ast, data, ctx);
+        }
+        else if (ast.type == AST_PARALLEL_FOR)
+        {
+            generate_code_parallel_for(ast, data, ctx);
+        }
+        else if (ast.type == AST_SPAWN)
+        {
+            generate_code_spawn(ast, data, ctx);
+        }
+        else if (ast.type == AST_JOIN)
+        {
+            data.bytecode.push_back(BC_JOIN);
+        }
+        else if (ast.type == AST_GENERATOR)
+        {
+            generate_code_generator(ast, data, ctx);
+        }
+        else if (ast.type == AST_RECORD)
+        {
+            declare_record(ast);
+        }
+        else if (ast.type == AST_YIELD)
+        {
+            generate_code_yield(ast, data, ctx);
+        }
+        else if (ast.type == AST_FOR_IN)
+        {
+            generate_code_for_in(ast, data, ctx);
+        }
+        else if (ast.type == AST_BREAK || ast.type == AST_CONTINUE)
+        {
+            generate_code_break(ast, data, ctx);
         }
         else
         {
@@ -539,6 +1359,143 @@ struct code_generator_t
         }
     }
 
+    // the program exits with the value of its last top-level expression
+    // statement, kept in slot 0 of main's frame
+    static constexpr size_t result_slot = 0;
+
+    static variable_t result_var()
+    {
+        variable_t var;
+        var.type = VAR_INT;
+        var.slot = result_slot;
+        return var;
+    }
+
+    // operand addressing `var` at [rsp + operand] from the current depth
+    void emit_var_offset(program_data_t &data, var_context_t &ctx, const variable_t &var)
+    {
+        if (var.slot == no_slot)
+        {
+            data.push_int(ctx.stack_size - var.offset, false);
+            return;
+        }
+        size_t pos = data.bytecode.size();
+        data.push_int(ctx.stack_size, false);
+        ctx.slot_refs.push_back({pos, var.slot});
+        auto &slot = ctx.slot_vars[var.slot];
+        if (slot.start == no_slot) slot.start = pos;
+        slot.end = std::max(slot.end, pos);
+    }
+
+    // a byte count of operand stack that, in a slotted context, also has to
+    // cover the frame (task frame copies)
+    void emit_frame_operand(program_data_t &data, var_context_t &ctx, size_t bytes)
+    {
+        if (ctx.slots) ctx.frame_refs.push_back(data.bytecode.size());
+        data.push_int(bytes, false);
+    }
+
+    void note_loop(var_context_t &ctx, size_t start, size_t end)
+    {
+        if (ctx.slots) ctx.loops.push_back({start, end});
+    }
+
+    // with variables in slots nothing needs the value of an expression
+    // statement except the program result, so rsp stays where it was
+    void drop_stmt_value(program_data_t &data, var_context_t &ctx, size_t bytes)
+    {
+        if (ctx.scopes.empty() && bytes == sizeof(int64_t))
+        {
+            ctx.stack_size -= bytes;
+            data.bytecode.push_back(BC_STORE_INT);
+            emit_var_offset(data, ctx, result_var());
+            return;
+        }
+        if (bytes == sizeof(int64_t) && last_set_int + 9 == data.bytecode.size())
+        {
+            // `x = e` as a statement: store and pop in one go
+            data.bytecode[last_set_int] = BC_STORE_INT;
+            *(int64_t *)&data.bytecode[last_set_int + 1] -= sizeof(int64_t);
+            ctx.stack_size -= bytes;
+            return;
+        }
+        data.bytecode.push_back(BC_SHRINK_STACK);
+        data.push_int(bytes, false);
+        ctx.stack_size -= bytes;
+    }
+
+    // linear-scan coloring of the slot variables' live ranges. a range runs
+    // from the declaration to the last use in bytecode order, stretched over
+    // all of any loop it touches: the next iteration may read it again, and a
+    // variable declared in the body may be read before it is written there
+    // (`if c { t = 5 }  write(t)`). ranges that do not overlap share a slot.
+    // loops are listed inner first, so an outer loop sees the stretched range.
+    // returns the number of slots saved
+    static size_t color_slots(var_context_t &ctx)
+    {
+        auto &vars = ctx.slot_vars;
+        for (auto &v : vars)
+        {
+            for (auto &loop : ctx.loops)
+            {
+                if (v.start < loop.second && loop.first <= v.end)
+                {
+                    v.start = std::min(v.start, loop.first);
+                    v.end = std::max(v.end, loop.second);
+                }
+            }
+        }
+        std::vector<size_t> order(vars.size());
+        for (size_t n = 0; n < order.size(); n++) order[n] = n;
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return vars[a].start < vars[b].start; });
+        using active_t = std::pair<size_t, size_t>; // end, color
+        std::priority_queue<active_t, std::vector<active_t>, std::greater<active_t>> active;
+        std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> free_colors;
+        size_t colors = 0;
+        for (size_t n : order)
+        {
+            auto &v = vars[n];
+            while (!active.empty() && active.top().first < v.start)
+            {
+                free_colors.push(active.top().second);
+                active.pop();
+            }
+            if (free_colors.empty())
+            {
+                v.color = colors++;
+            }
+            else
+            {
+                v.color = free_colors.top();
+                free_colors.pop();
+            }
+            active.push({v.end, v.color});
+        }
+        ctx.colors = colors;
+        return vars.size() - colors;
+    }
+
+    // the frame is one slot per color, or per variable when uncolored; every
+    // recorded operand gets its final offset
+    void layout_frame(program_data_t &data, var_context_t &ctx)
+    {
+        auto &vars = ctx.slot_vars;
+        if (ctx.colors == 0)
+        {
+            for (size_t n = 0; n < vars.size(); n++) vars[n].color = n;
+            ctx.colors = vars.size();
+        }
+        for (auto &ref : ctx.slot_refs)
+        {
+            *(int64_t *)&data.bytecode[ref.first] += vars[ref.second].color * sizeof(int64_t);
+        }
+        for (size_t pos : ctx.frame_refs)
+        {
+            *(int64_t *)&data.bytecode[pos] += ctx.colors * sizeof(int64_t);
+        }
+        if (trace) *trace_out << "frame: " << vars.size() << " variables in " << ctx.colors << " slots" << std::endl;
+    }
+
     ASTType generate_code_expr(const ast_t &ast, program_data_t &data, var_context_t &ctx)
     {
         auto type_to_return = ast.type;
@@ -556,27 +1513,82 @@ struct code_generator_t
             {
                 throw utils::error_t(ast.line, "Undefined variable: " + std::string(ast.value));
             }
-            if (var->type == VAR_INT)
+            if (storable(var->type))
             {
                 data.bytecode.push_back(BC_COPY_INT);
-                data.push_int(ctx.stack_size - var->offset, false);
+                emit_var_offset(data, ctx, *var);
                 ctx.stack_size += sizeof(int64_t);
-                type_to_return = AST_INT;
+                if (var->type == VAR_INT) type_to_return = AST_INT;
+            }
+            break;
+        }
+        case AST_BRACKET_ACCESS:
+        {
+            if (is_record_array(ast.children[0], ctx))
+            {
+                throw utils::error_t(ast.line, "An element of a record array is accessed through its fields");
             }
+            bool map = get_expression_type(ast.children[0], ctx) == VAR_MAP;
+            generate_code_expr(ast.children[0], data, ctx);
+            generate_code_expr(ast.children[1], data, ctx);
+            data.bytecode.push_back(map ? BC_MAP_GET : BC_LOAD_INDEX);
+            ctx.stack_size -= sizeof(int64_t);
+            type_to_return = AST_INT;
             break;
         }
         case AST_BINARY_OP:
         {
-            parser_t p;
-            p.print(ast);
+            if (trace)
+            {
+                // print writes to a FILE, so buffer it for trace_out
+                char *buf = nullptr;
+                size_t len = 0;
+                if (FILE *f = open_memstream(&buf, &len))
+                {
+                    parser_t().print(ast, 0, f);
+                    fclose(f);
+                    trace_out->write(buf, len);
+                }
+                free(buf);
+            }
             type_to_return = generate_code_binary_op(ast, data, ctx);
             break;
         }
+        case AST_UNARY_OP:
+        {
+            type_to_return = generate_code_unary_op(ast, data, ctx);
+            break;
+        }
         case AST_ASSIGN:
         {
             generate_code_assign(ast, data, ctx);
             break;
         }
+        case AST_MODIFY_BY:
+        {
+            generate_code_modify(ast, data, ctx);
+            type_to_return = AST_INT;
+            break;
+        }
+        case AST_DOT_ACCESS:
+        {
+            int64_t offset;
+            auto &field = generate_code_field_address(ast, data, ctx, offset);
+            data.bytecode.push_back(BC_LOAD_FIELD);
+            data.push_int(offset, false);
+            data.push_int(field.width, false);
+            type_to_return = AST_INT;
+            break;
+        }
+        case AST_OP:
+        {
+            if (ast.value != "?")
+            {
+                throw utils::error_t(ast.line, "Unknown operator: " + std::string(ast.value));
+            }
+            type_to_return = generate_code_ternary(ast, data, ctx);
+            break;
+        }
         case AST_FUNC_CALL:
         {
             auto name = ast.children[0].value;
@@ -587,6 +1599,36 @@ struct code_generator_t
                 data.bytecode.push_back(BC_SYS_WRITE_INT);
                 return AST_INT;
             }
+            auto &args = ast.children[1].children;
+            if (name == "array" && args.size() == 2)
+            {
+                auto &rec = records[record_array_arg(ast)];
+                generate_code_expr(args[0], data, ctx);
+                data.bytecode.push_back(BC_ALLOC_RECORDS);
+                data.push_int(rec.size, false);
+            }
+            else if (name == "array")
+            {
+                generate_code_expr(args[0], data, ctx);
+                data.bytecode.push_back(BC_ALLOC_ARRAY);
+            }
+            else if (name == "map")
+            {
+                if (!args.empty())
+                {
+                    throw utils::error_t(ast.line, "map() takes no arguments");
+                }
+                data.bytecode.push_back(BC_ALLOC_MAP);
+                ctx.stack_size += sizeof(int64_t);
+            }
+            else if (name == "has" || name == "del" || name == "len")
+            {
+                return generate_code_container_call(ast, data, ctx);
+            }
+            else if (record_map.count(name))
+            {
+                generate_code_record_new(ast, records[record_map[name]], data, ctx);
+            }
         }
         break;
         default:
@@ -599,7 +1641,7 @@ struct code_generator_t
     void generate_code_int(const ast_t &ast, program_data_t &data, size_t &stack_size)
     {
         data.bytecode.push_back(BC_PUSH_INT);
-        int64_t value = std::stoll(std::string(ast.value));
+        int64_t value = ast.int_value;
         stack_size += sizeof(int64_t);
         data.bytecode.insert(data.bytecode.end(), reinterpret_cast<uint8_t *>(&value),
                              reinterpret_cast<uint8_t *>(&value) + sizeof(value));
@@ -608,13 +1650,17 @@ struct code_generator_t
     ASTType generate_code_binary_op(const ast_t &ast, program_data_t &data, var_context_t &ctx)
     {
         check_ast_type(ast, AST_BINARY_OP);
+        if (ast.value == "&&" || ast.value == "||")
+        {
+            return generate_code_logical(ast, data, ctx);
+        }
         auto t1 = generate_code_expr(ast.children[0], data, ctx);
         auto t2 = generate_code_expr(ast.children[1], data, ctx);
 
-        static const char *arithmatic_ops[] = {"+", "-", "*", "/"};
-        static BytecodeOp arithmatic_ops_int[] = {BC_ADD_INT_INT, BC_SUB_INT_INT, BC_MUL_INT_INT, BC_DIV_INT_INT};
+        static const char *const arithmatic_ops[] = {"+", "-", "*", "/", "%"};
+        static const BytecodeOp arithmatic_ops_int[] = {BC_ADD_INT_INT, BC_SUB_INT_INT, BC_MUL_INT_INT, BC_DIV_INT_INT, BC_MOD_INT_INT};
 
-        for (size_t i = 0; i < 4; i++)
+        for (size_t i = 0; i < 5; i++)
         {
 
             if (ast.value == arithmatic_ops[i] && t1 == AST_INT && t2 == AST_INT)
@@ -625,10 +1671,10 @@ struct code_generator_t
             }
         }
 
-        static const char *logical_ops[] = {"&&", "||", "^^", "&", "|", "^", "<<", ">>"};
-        static BytecodeOp logical_ops_code[] = {BC_AND, BC_OR, BC_XOR, BC_AND, BC_OR, BC_XOR, BC_SHL, BC_SHR};
+        static const char *const logical_ops[] = {"^^", "&", "|", "^", "<<", ">>"};
+        static const BytecodeOp logical_ops_code[] = {BC_XOR, BC_AND, BC_OR, BC_XOR, BC_SHL, BC_SHR};
 
-        for (size_t i = 0; i < 8; i++)
+        for (size_t i = 0; i < 6; i++)
         {
             if (ast.value == logical_ops[i])
             {
@@ -638,8 +1684,8 @@ struct code_generator_t
             }
         }
 
-        static const char *comparison_ops[] = {"==", "!=", ">", "<", ">=", "<="};
-        static BytecodeOp comparison_ops_code[] = {BC_EQ_INT_INT, BC_NE_INT_INT, BC_GT_INT_INT, BC_LT_INT_INT, BC_GE_INT_INT, BC_LE_INT_INT};
+        static const char *const comparison_ops[] = {"==", "!=", ">", "<", ">=", "<="};
+        static const BytecodeOp comparison_ops_code[] = {BC_EQ_INT_INT, BC_NE_INT_INT, BC_GT_INT_INT, BC_LT_INT_INT, BC_GE_INT_INT, BC_LE_INT_INT};
 
         for (size_t i = 0; i < 6; i++)
         {
@@ -654,10 +1700,78 @@ struct code_generator_t
         throw utils::error_t(ast.line, std::string("Unknown binary operator: ") + std::string(ast.value));
     }
 
+    // -x as 0 - x, ~x as x ^ -1 and !x as x == 0; a negated literal is
+    // pushed as the negative constant it is
+    ASTType generate_code_unary_op(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        check_ast_type(ast, AST_UNARY_OP);
+        int64_t value;
+        if (case_value(ast, value))
+        {
+            data.bytecode.push_back(BC_PUSH_INT);
+            data.push_int(value, false);
+            ctx.stack_size += sizeof(int64_t);
+            return AST_INT;
+        }
+        bool negate = ast.value == "-";
+        if (negate)
+        {
+            data.bytecode.push_back(BC_PUSH_INT);
+            data.push_int(0, false);
+            ctx.stack_size += sizeof(int64_t);
+        }
+        if (generate_code_expr(ast.children[0], data, ctx) != AST_INT)
+        {
+            throw utils::error_t(ast.line, "Operand of unary " + std::string(ast.value) + " is not an integer");
+        }
+        if (!negate)
+        {
+            data.bytecode.push_back(BC_PUSH_INT);
+            data.push_int(ast.value == "~" ? -1 : 0, false);
+            ctx.stack_size += sizeof(int64_t);
+        }
+        data.bytecode.push_back(negate ? BC_SUB_INT_INT : ast.value == "~" ? BC_XOR : BC_EQ_INT_INT);
+        ctx.stack_size -= sizeof(int64_t);
+        return AST_INT;
+    }
+
     void generate_code_assign(const ast_t &ast, program_data_t &data, var_context_t &ctx)
     {
         check_ast_type(ast, AST_ASSIGN);
         auto &lhs = ast.children[0];
+        if (lhs.type == AST_DOT_ACCESS)
+        {
+            if (get_expression_type(ast.children[1], ctx) != VAR_INT)
+            {
+                throw utils::error_t(ast.line, "Type mismatch in assignment");
+            }
+            generate_code_expr(ast.children[1], data, ctx);
+            generate_code_field_store(lhs, data, ctx);
+            return;
+        }
+        if (lhs.type == AST_BRACKET_ACCESS && get_expression_type(lhs.children[0], ctx) == VAR_MAP)
+        {
+            generate_code_expr(ast.children[1], data, ctx);
+            generate_code_map_slot(lhs, data, ctx);
+            data.bytecode.push_back(BC_STORE_FIELD);
+            data.push_int(sizeof(int64_t), false);
+            data.push_int(sizeof(int64_t), false);
+            ctx.stack_size -= sizeof(int64_t);
+            return;
+        }
+        if (lhs.type == AST_BRACKET_ACCESS)
+        {
+            if (is_record_array(lhs.children[0], ctx))
+            {
+                throw utils::error_t(ast.line, "An element of a record array is accessed through its fields");
+            }
+            generate_code_expr(ast.children[1], data, ctx);
+            generate_code_expr(lhs.children[0], data, ctx);
+            generate_code_expr(lhs.children[1], data, ctx);
+            data.bytecode.push_back(BC_STORE_INDEX);
+            ctx.stack_size -= 2 * sizeof(int64_t);
+            return;
+        }
         if (lhs.type != AST_ID)
         {
             throw utils::error_t(ast.line, "Invalid assignment target");
@@ -667,7 +1781,14 @@ struct code_generator_t
         auto var = ctx.get_var(lhs.value);
         if (!var)
         {
-            if (rhs == AST_INT)
+            if (storable(rhs) && ctx.slots)
+            {
+                ctx.add_slot_var(lhs.value, rhs, sizeof(int64_t));
+                last_set_int = data.bytecode.size();
+                data.bytecode.push_back(BC_SET_INT);
+                emit_var_offset(data, ctx, *ctx.get_var(lhs.value));
+            }
+            else if (storable(rhs))
             {
                 ctx.add_var(lhs.value, rhs, sizeof(int64_t));
             }
@@ -678,81 +1799,1272 @@ struct code_generator_t
             {
                 throw utils::error_t(ast.line, "Type mismatch in assignment");
             }
+            if (var->type == VAR_ARRAY && ast.children[1].type != AST_ID && !ctx.aliased_vars.count(lhs.value))
+            {
+                // sole owner of the old block: hand it back to its size class
+                data.bytecode.push_back(BC_FREE_ARRAY);
+                emit_var_offset(data, ctx, *var);
+            }
+            last_set_int = data.bytecode.size();
             data.bytecode.push_back(BC_SET_INT);
-            data.push_int(ctx.stack_size - var->offset, false);
+            emit_var_offset(data, ctx, *var);
         }
     }
 
-    size_t get_expression_type(const ast_t &exp, var_context_t &ctx)
+    // `x op= e` is `x = x op e`; the instruction selector turns the pair of
+    // the operation and the store back into a single read-modify-write
+    void generate_code_modify(const ast_t &ast, program_data_t &data, var_context_t &ctx)
     {
-        if (exp.type == AST_INT)
+        static const char *const modify_ops[] = {"+=", "-=", "*=", "/=", "%="};
+        static const BytecodeOp modify_ops_int[] = {BC_ADD_INT_INT, BC_SUB_INT_INT, BC_MUL_INT_INT, BC_DIV_INT_INT, BC_MOD_INT_INT};
+        BytecodeOp op = BC_HALT;
+        for (size_t i = 0; i < 5; i++)
         {
-            return VAR_INT;
+            if (ast.value == modify_ops[i]) op = modify_ops_int[i];
         }
-        if (exp.type == AST_ID)
+        auto &lhs = ast.children[0];
+        if (lhs.type == AST_ID)
+        {
+            auto var = ctx.get_var(lhs.value);
+            if (!var)
+            {
+                throw utils::error_t(ast.line, "Undefined variable: " + std::string(lhs.value));
+            }
+            if (var->type != VAR_INT)
+            {
+                throw utils::error_t(ast.line, "Type mismatch in assignment");
+            }
+        }
+        else if (lhs.type != AST_BRACKET_ACCESS && lhs.type != AST_DOT_ACCESS)
         {
-            return ctx.get_var(exp.value)->type;
+            throw utils::error_t(ast.line, "Invalid assignment target");
         }
-        if (exp.type == AST_BINARY_OP)
+        if (lhs.type == AST_BRACKET_ACCESS && get_expression_type(lhs.children[0], ctx) == VAR_MAP)
         {
-            return get_expression_type(exp.children[0], ctx);
+            // one probe: the slot's address stays under the update and is
+            // dropped once the new value has been stored through it
+            generate_code_map_slot(lhs, data, ctx);
+            data.bytecode.push_back(BC_COPY_INT);
+            data.push_int(0, false);
+            data.bytecode.push_back(BC_LOAD_FIELD);
+            data.push_int(sizeof(int64_t), false);
+            data.push_int(sizeof(int64_t), false);
+            ctx.stack_size += sizeof(int64_t);
+            generate_code_expr(ast.children[1], data, ctx);
+            data.bytecode.push_back(op);
+            data.bytecode.push_back(BC_COPY_INT);
+            data.push_int(sizeof(int64_t), false);
+            data.bytecode.push_back(BC_STORE_FIELD);
+            data.push_int(sizeof(int64_t), false);
+            data.push_int(sizeof(int64_t), false);
+            data.bytecode.push_back(BC_STORE_INT);
+            data.push_int(0, false);
+            ctx.stack_size -= 2 * sizeof(int64_t);
+            return;
         }
-        throw utils::error_t(exp.line, "cannot determine expression type");
+        generate_code_expr(lhs, data, ctx);
+        generate_code_expr(ast.children[1], data, ctx);
+        data.bytecode.push_back(op);
+        ctx.stack_size -= sizeof(int64_t);
+        if (lhs.type == AST_ID)
+        {
+            last_set_int = data.bytecode.size();
+            data.bytecode.push_back(BC_SET_INT);
+            emit_var_offset(data, ctx, *ctx.get_var(lhs.value));
+            return;
+        }
+        if (lhs.type == AST_DOT_ACCESS)
+        {
+            generate_code_field_store(lhs, data, ctx);
+            return;
+        }
+        generate_code_expr(lhs.children[0], data, ctx);
+        generate_code_expr(lhs.children[1], data, ctx);
+        data.bytecode.push_back(BC_STORE_INDEX);
+        ctx.stack_size -= 2 * sizeof(int64_t);
     }
 
-    size_t generate_code_if(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    static bool storable(size_t type) { return type == VAR_INT || type == VAR_ARRAY || type == VAR_MAP || type >= VARIABLE_TYPE; }
+
+    static bool is_builtin(std::string_view name)
     {
-        size_t id = ctx.create_condition_id();
-        check_ast_type(ast, AST_IF);
-        auto &cond = ast.children[0];
-        auto &stmt = ast.children[1];
-        generate_code_expr(cond, data, ctx);
+        return name == "array" || name == "write" || name == "map" || name == "has" || name == "del" || name == "len";
+    }
 
-        if(ast.children.size() == 3) {
-            data.bytecode.push_back(BC_IF);
-            data.push_int(id, false);
-            ctx.stack_size -= sizeof(int64_t);
-            generate_code_stmt(stmt, data, ctx);
-            data.bytecode.push_back(BC_TEST_FALSE_LABEL);
-            auto &else_stmt = ast.children[2];
-            generate_code_stmt(else_stmt, data, ctx);
-            data.bytecode.push_back(BC_TEST_END_END_LABEL);
-            data.push_int(id, false);
+    bool is_allocation(const ast_t &ast) const
+    {
+        if (ast.type != AST_FUNC_CALL) return false;
+        auto name = ast.children[0].value;
+        return name == "array" || name == "map" || record_map.count(name);
+    }
+
+    // m[k] -> the address of k's {key, value} slot, inserting k when absent
+    void generate_code_map_slot(const ast_t &lhs, program_data_t &data, var_context_t &ctx)
+    {
+        generate_code_expr(lhs.children[0], data, ctx);
+        generate_code_expr(lhs.children[1], data, ctx);
+        data.bytecode.push_back(BC_MAP_SLOT);
+        ctx.stack_size -= sizeof(int64_t);
+    }
+
+    // has(m, k), del(m, k), and len(x) of a map or of an array, whose count
+    // sits in its first word
+    ASTType generate_code_container_call(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        auto name = ast.children[0].value;
+        auto &args = ast.children[1].children;
+        if (name == "len")
+        {
+            size_t type = args.size() == 1 ? get_expression_type(args[0], ctx) : VAR_UNKNOWN;
+            bool array;
+            if (type != VAR_MAP && type != VAR_ARRAY && !(record_of(type, array) && array))
+            {
+                throw utils::error_t(ast.line, "len() expects a map or an array");
+            }
+            generate_code_expr(args[0], data, ctx);
+            data.bytecode.push_back(BC_LOAD_FIELD);
+            data.push_int(type == VAR_MAP ? map_count_offset : 0, false);
+            data.push_int(sizeof(int64_t), false);
+            return AST_INT;
         }
-        else {
-            data.bytecode.push_back(BC_IF);
-            data.push_int(id, false);
-            ctx.stack_size -= sizeof(int64_t);
-            generate_code_stmt(stmt, data, ctx);
-            data.bytecode.push_back(BC_TEST_END_END_LABEL);
-            data.push_int(id, false);
+        if (args.size() != 2 || get_expression_type(args[0], ctx) != VAR_MAP)
+        {
+            throw utils::error_t(ast.line, std::string(name) + "() expects a map and a key");
+        }
+        generate_code_expr(args[0], data, ctx);
+        generate_code_expr(args[1], data, ctx);
+        data.bytecode.push_back(name == "has" ? BC_MAP_HAS : BC_MAP_DEL);
+        ctx.stack_size -= sizeof(int64_t);
+        return AST_INT;
+    }
+
+    void declare_record(const ast_t &ast)
+    {
+        auto name = ast.children[0].value;
+        if (record_map.count(name) || generators.count(name) || is_builtin(name))
+        {
+            throw utils::error_t(ast.line, "Redefinition of " + std::string(name));
+        }
+        record_t rec;
+        rec.name = name;
+        rec.soa = ast.value == "soa";
+        rec.type = VARIABLE_TYPE + 2 * records.size();
+        for (size_t k = 1; k < ast.children.size(); k++)
+        {
+            auto &f = ast.children[k];
+            field_t field{f.value};
+            if (!f.children.empty())
+            {
+                auto t = f.children[0].value;
+                field.width = t == "int" || t == "i64" ? 8 : t == "i32" ? 4 : t == "i16" ? 2 : t == "i8" ? 1 : 0;
+                if (!field.width)
+                {
+                    throw utils::error_t(ast.line, "Unknown field type: " + std::string(t));
+                }
+            }
+            for (auto &other : rec.fields)
+            {
+                if (other.name == field.name)
+                {
+                    throw utils::error_t(ast.line, "Duplicate field: " + std::string(field.name));
+                }
+            }
+            rec.fields.push_back(field);
+        }
+        if (rec.fields.empty())
+        {
+            throw utils::error_t(ast.line, "Record " + std::string(name) + " has no fields");
+        }
+        std::vector<size_t> order(rec.fields.size());
+        for (size_t k = 0; k < order.size(); k++) order[k] = k;
+        std::stable_sort(order.begin(), order.end(),
+                         [&](size_t a, size_t b) { return rec.fields[a].width > rec.fields[b].width; });
+        for (size_t k : order)
+        {
+            rec.fields[k].offset = rec.size;
+            rec.size += rec.fields[k].width;
+        }
+        int64_t align = rec.fields[order[0]].width;
+        rec.size = (rec.size + align - 1) / align * align;
+        if (trace)
+        {
+            *trace_out << "record " << name << ": " << rec.size << " bytes" << (rec.soa ? ", soa" : "") << std::endl;
+            for (auto &f : rec.fields) *trace_out << "  " << f.name << " +" << f.offset << " (" << f.width << ")" << std::endl;
+        }
+        record_map[name] = records.size();
+        records.push_back(rec);
+    }
+
+    // the record of `array(n, name)`
+    size_t record_array_arg(const ast_t &call)
+    {
+        auto &kind = call.children[1].children[1];
+        auto it = kind.type == AST_ID ? record_map.find(kind.value) : record_map.end();
+        if (it == record_map.end())
+        {
+            throw utils::error_t(call.line, "array(n, record) needs a record type");
         }
+        return it->second;
+    }
 
+    // the record a record or record array type stands for, or null
+    const record_t *record_of(size_t type, bool &array) const
+    {
+        if (type < VARIABLE_TYPE) return nullptr;
+        array = (type - VARIABLE_TYPE) % 2;
+        return &records[(type - VARIABLE_TYPE) / 2];
+    }
 
+    bool is_record_array(const ast_t &ast, var_context_t &ctx)
+    {
+        bool array = false;
+        return record_of(get_expression_type(ast, ctx), array) && array;
+    }
 
+    // pushes the address BC_LOAD_FIELD / BC_STORE_FIELD take for
+    // `record.field` or `records[i].field` and sets the displacement from it
+    const field_t &generate_code_field_address(const ast_t &ast, program_data_t &data, var_context_t &ctx, int64_t &offset)
+    {
+        auto &base = ast.children[0];
+        auto &member = ast.children[1];
+        bool array = false;
+        const record_t *rec = nullptr;
+        bool element = base.type == AST_BRACKET_ACCESS && is_record_array(base.children[0], ctx);
+        if (element)
+        {
+            rec = record_of(get_expression_type(base.children[0], ctx), array);
+        }
+        else
+        {
+            rec = record_of(get_expression_type(base, ctx), array);
+            if (!rec || array)
+            {
+                throw utils::error_t(ast.line, "Field access on a value that is not a record");
+            }
+        }
+        const field_t *field = nullptr;
+        for (auto &f : rec->fields)
+        {
+            if (member.type == AST_ID && f.name == member.value) field = &f;
+        }
+        if (!field)
+        {
+            throw utils::error_t(ast.line, "Record " + std::string(rec->name) + " has no field " + std::string(member.value));
+        }
+        if (!element)
+        {
+            generate_code_expr(base, data, ctx);
+            offset = field->offset;
+            return *field;
+        }
+        generate_code_expr(base.children[0], data, ctx);
+        generate_code_expr(base.children[1], data, ctx);
+        data.bytecode.push_back(BC_RECORD_ELEM);
+        data.push_int(rec->soa ? field->width : rec->size, false);
+        data.push_int(rec->soa ? field->offset : 0, false);
+        ctx.stack_size -= sizeof(int64_t);
+        offset = rec->soa ? 0 : field->offset;
+        return *field;
+    }
 
-        // data.bytecode.push_back(BC_IF);
-        // data.push_int(id, false);
-        // ctx.stack_size -= sizeof(int64_t);
-        // if(stmt.type == AST_BLOCK) {
-        //     generate_code_stmt(stmt, data, ctx);
-        //     data.bytecode.push_back(BC_TEST_FALSE_LABEL);
-        //     data.push_int(id, false);
-        // }
-        // if(ast.children.size() == 3) {
-        //     bool is_else_if = ast.children[2].type == AST_IF;
-        //     if(is_else_if) {
-        //         data.bytecode.push_back(BC_ELSE);
-        //         data.push_int(id, false);
-        //         generate_code_if(ast.children[2], data, ctx);
-        //     } else {
-        //         auto &else_stmt = ast.children[2];
-        //         generate_code_stmt(else_stmt, data, ctx);
-        //         data.bytecode.push_back(BC_TEST_END_END_LABEL);
-        //         data.push_int(id, false);
-        //     }
-        // }
+    // the value on top goes into the field and stays there as the result
+    void generate_code_field_store(const ast_t &lhs, program_data_t &data, var_context_t &ctx)
+    {
+        int64_t offset;
+        auto &field = generate_code_field_address(lhs, data, ctx, offset);
+        data.bytecode.push_back(BC_STORE_FIELD);
+        data.push_int(offset, false);
+        data.push_int(field.width, false);
+        ctx.stack_size -= sizeof(int64_t);
+    }
 
-        return 0;
+    // name(a, b, ...) fills the fields in declaration order, zeroing the
+    // ones left out
+    void generate_code_record_new(const ast_t &ast, const record_t &rec, program_data_t &data, var_context_t &ctx)
+    {
+        auto &args = ast.children[1].children;
+        if (args.size() > rec.fields.size())
+        {
+            throw utils::error_t(ast.line, "Record " + std::string(rec.name) + " has " + std::to_string(rec.fields.size()) +
+                                               " fields, got " + std::to_string(args.size()));
+        }
+        data.bytecode.push_back(BC_ALLOC_RECORD);
+        data.push_int(rec.size, false);
+        ctx.stack_size += sizeof(int64_t);
+        for (size_t k = 0; k < rec.fields.size(); k++)
+        {
+            if (k < args.size())
+            {
+                if (get_expression_type(args[k], ctx) != VAR_INT)
+                {
+                    throw utils::error_t(ast.line, "Record fields hold integers");
+                }
+                generate_code_expr(args[k], data, ctx);
+            }
+            else
+            {
+                emit_push_int(data, ctx, 0);
+            }
+            data.bytecode.push_back(BC_COPY_INT);
+            data.push_int(sizeof(int64_t), false);
+            data.bytecode.push_back(BC_STORE_FIELD);
+            data.push_int(rec.fields[k].offset, false);
+            data.push_int(rec.fields[k].width, false);
+            data.bytecode.push_back(BC_SHRINK_STACK);
+            data.push_int(sizeof(int64_t), false);
+            ctx.stack_size -= sizeof(int64_t);
+        }
+    }
+
+    size_t get_expression_type(const ast_t &exp, var_context_t &ctx)
+    {
+        if (exp.type == AST_INT)
+        {
+            return VAR_INT;
+        }
+        if (exp.type == AST_ID)
+        {
+            auto var = ctx.get_var(exp.value);
+            if (!var)
+            {
+                throw utils::error_t(exp.line, "Undefined variable: " + std::string(exp.value));
+            }
+            return var->type;
+        }
+        if (exp.type == AST_MODIFY_BY || exp.type == AST_UNARY_OP)
+        {
+            return VAR_INT;
+        }
+        if (exp.type == AST_OP && exp.value == "?")
+        {
+            return get_expression_type(exp.children[1], ctx);
+        }
+        if (exp.type == AST_BINARY_OP || exp.type == AST_BRACKET_ACCESS)
+        {
+            return exp.type == AST_BINARY_OP ? get_expression_type(exp.children[0], ctx) : VAR_INT;
+        }
+        if (exp.type == AST_DOT_ACCESS)
+        {
+            return VAR_INT;
+        }
+        if (exp.type == AST_FUNC_CALL)
+        {
+            auto name = exp.children[0].value;
+            if (name == "array")
+            {
+                return exp.children[1].children.size() == 2 ? records[record_array_arg(exp)].type + 1 : VAR_ARRAY;
+            }
+            if (name == "map")
+            {
+                return VAR_MAP;
+            }
+            auto it = record_map.find(name);
+            return it != record_map.end() ? records[it->second].type : VAR_INT;
+        }
+        throw utils::error_t(exp.line, "cannot determine expression type");
+    }
+
+    // a variable whose value an assignment can hand on, through ?: arms and
+    // nested assignments, shares its heap block with the target, and so does
+    // the target; neither is freed early
+    void collect_aliased_vars(const ast_t &ast, var_context_t &ctx)
+    {
+        if (ast.type == AST_ASSIGN)
+        {
+            if (collect_value_sources(ast.children[1], ctx) && ast.children[0].type == AST_ID)
+            {
+                ctx.aliased_vars.insert(ast.children[0].value);
+            }
+        }
+        for (auto &child : ast.children)
+        {
+            collect_aliased_vars(child, ctx);
+        }
+    }
+
+    // adds the names whose value `exp` may evaluate to; false if there are none
+    bool collect_value_sources(const ast_t &exp, var_context_t &ctx)
+    {
+        if (exp.type == AST_ID)
+        {
+            ctx.aliased_vars.insert(exp.value);
+            return true;
+        }
+        if (exp.type == AST_OP && exp.value == "?")
+        {
+            bool a = collect_value_sources(exp.children[1], ctx);
+            bool b = collect_value_sources(exp.children[2], ctx);
+            return a || b;
+        }
+        if (exp.type == AST_ASSIGN)
+        {
+            bool a = collect_value_sources(exp.children[0], ctx);
+            bool b = collect_value_sources(exp.children[1], ctx);
+            return a || b;
+        }
+        return false;
+    }
+
+    bool contains_node(const ast_t &ast, ASTType type)
+    {
+        return find_node(ast, type) != nullptr;
+    }
+
+    // the first node of the given type, in source order
+    const ast_t *find_node(const ast_t &ast, ASTType type)
+    {
+        if (ast.type == type)
+        {
+            return &ast;
+        }
+        for (auto &child : ast.children)
+        {
+            if (const ast_t *found = find_node(child, type)) return found;
+        }
+        return nullptr;
+    }
+
+    // runs a loop body in its own scope and drops whatever it left on the
+    // stack, so every iteration starts at the same depth
+    void generate_code_loop_body(const ast_t &body, program_data_t &data, var_context_t &ctx)
+    {
+        ctx.push_scope();
+        generate_code_stmt(body, data, ctx);
+        size_t offset = ctx.pop_scope();
+        if (offset > 0)
+        {
+            data.bytecode.push_back(BC_SHRINK_STACK);
+            data.push_int(offset, false);
+        }
+    }
+
+    // the body of loop `id`: break leaves it for .loop_end and continue
+    // goes back to the loop label through `next`, both from the depth here
+    void generate_code_loop(const ast_t &body, size_t id, uint8_t next, program_data_t &data, var_context_t &ctx,
+                            bool parallel = false)
+    {
+        loop_targets.push_back({id, ctx.stack_size, arena_marks.size(), next, parallel});
+        generate_code_loop_body(body, data, ctx);
+        loop_targets.pop_back();
+    }
+
+    // drops what the loop body has on the stack, rewinding the arena to the
+    // first mark inside the loop if a block there has one, then jumps
+    void generate_code_break(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        bool is_break = ast.type == AST_BREAK;
+        if (loop_targets.empty())
+        {
+            throw utils::error_t(ast.line, std::string(is_break ? "break" : "continue") + " outside of a loop");
+        }
+        const loop_target_t &loop = loop_targets.back();
+        if (is_break && loop.parallel)
+        {
+            throw utils::error_t(ast.line, "break is not allowed inside parallel for");
+        }
+        if (arena_marks.size() > loop.marks)
+        {
+            data.bytecode.push_back(BC_ARENA_RELEASE);
+            data.push_int(ctx.stack_size - arena_marks[loop.marks], false);
+        }
+        if (ctx.stack_size > loop.depth)
+        {
+            data.bytecode.push_back(BC_SHRINK_STACK);
+            data.push_int(ctx.stack_size - loop.depth, false);
+        }
+        data.bytecode.push_back(is_break ? BC_BREAK : loop.next);
+        data.push_int(loop.id, false);
+    }
+
+    void generate_code_while(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        size_t id = ctx.create_condition_id();
+        size_t start = data.bytecode.size();
+        data.bytecode.push_back(BC_LOOP_LABEL);
+        data.push_int(id, false);
+        generate_code_cond(ast.children[0], data, ctx, {false, BC_WHILE_TEST, id});
+        generate_code_loop(ast.children[1], id, BC_CONTINUE, data, ctx);
+        data.bytecode.push_back(BC_LOOP_END);
+        data.push_int(id, false);
+        note_loop(ctx, start, data.bytecode.size());
+    }
+
+    // the counter and the bound live in two slots of their own scope
+    void generate_code_for(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        size_t id = ctx.create_condition_id();
+        auto &var = ast.children[0];
+        if (ctx.get_var(var.value))
+        {
+            throw utils::error_t(ast.line, "Loop variable shadows an existing variable: " + std::string(var.value));
+        }
+        ctx.push_scope();
+        generate_code_expr(ast.children[1], data, ctx);
+        ctx.add_var(var.value, VAR_INT, sizeof(int64_t));
+        generate_code_expr(ast.children[2], data, ctx);
+        size_t start = data.bytecode.size();
+        data.bytecode.push_back(BC_LOOP_LABEL);
+        data.push_int(id, false);
+        data.bytecode.push_back(BC_FOR_TEST);
+        data.push_int(id, false);
+        generate_code_loop(ast.children[3], id, BC_FOR_CONTINUE, data, ctx);
+        data.bytecode.push_back(BC_FOR_NEXT);
+        data.push_int(id, false);
+        note_loop(ctx, start, data.bytecode.size());
+        data.bytecode.push_back(BC_SHRINK_STACK);
+        data.push_int(ctx.pop_scope(), false);
+    }
+
+    // the body of a generator becomes the resume function .gen<id>. it runs
+    // on its own variable context whose bottom slot holds the frame pointer,
+    // with the parameters above it; every yield is a state that saves the
+    // live operand stack to the frame and returns, see asm_gen_label_begin
+    void generate_code_generator(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        auto name = ast.children[0].value;
+        if (current_generator)
+        {
+            throw utils::error_t(ast.line, "Generators cannot be declared inside a generator: " + std::string(name));
+        }
+        if (generators.count(name))
+        {
+            throw utils::error_t(ast.line, "Generator redefined: " + std::string(name));
+        }
+        generator_t gen;
+        gen.id = ctx.create_condition_id();
+        gen.params = ast.children[1].children.size();
+
+        var_context_t gctx;
+        gctx.codition_count = ctx.codition_count; // labels are shared with the caller's code
+        collect_aliased_vars(ast.children[2], gctx);
+        gctx.stack_size = sizeof(int64_t);
+        for (auto &param : ast.children[1].children)
+        {
+            if (gctx.get_var(param.value))
+            {
+                throw utils::error_t(ast.line, "Duplicate generator parameter: " + std::string(param.value));
+            }
+            gctx.stack_size += sizeof(int64_t);
+            gctx.add_var(param.value, VAR_INT, sizeof(int64_t));
+        }
+        size_t entry = gctx.stack_size;
+        gen.frame = 2 * sizeof(int64_t) + entry;
+
+        data.bytecode.push_back(BC_GEN_BEGIN);
+        data.push_int(gen.id, false);
+        data.push_int(entry, false);
+        current_generator = &gen;
+        std::vector<loop_target_t> outer;
+        outer.swap(loop_targets);
+        generate_code_stmt(ast.children[2], data, gctx);
+        loop_targets.swap(outer);
+        current_generator = nullptr;
+        data.bytecode.push_back(BC_GEN_END);
+        data.push_int(gen.id, false);
+        data.push_int(entry, false);
+        ctx.codition_count = gctx.codition_count;
+        generators[name] = gen;
+    }
+
+    void generate_code_yield(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        if (!current_generator)
+        {
+            throw utils::error_t(ast.line, "yield outside of a generator");
+        }
+        generate_code_expr(ast.children[0], data, ctx);
+        ctx.stack_size -= sizeof(int64_t);
+        data.bytecode.push_back(BC_YIELD);
+        data.push_int(current_generator->id, false);
+        data.push_int(ctx.stack_size, false);
+        current_generator->frame = std::max(current_generator->frame, 2 * sizeof(int64_t) + ctx.stack_size);
+    }
+
+    // `for v in g(args)`: a heap frame for g in a hidden slot under v, filled
+    // with the arguments where g's entry state expects its parameters, then
+    // one call of .gen<id> per iteration
+    void generate_code_for_in(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        auto &var = ast.children[0];
+        auto &call = ast.children[1];
+        if (call.type != AST_FUNC_CALL || !generators.count(call.children[0].value))
+        {
+            if (get_expression_type(call, ctx) == VAR_MAP)
+            {
+                generate_code_for_in_map(ast, data, ctx);
+                return;
+            }
+            if (call.type != AST_FUNC_CALL)
+            {
+                throw utils::error_t(ast.line, "for ... in expects a generator call or a map");
+            }
+            throw utils::error_t(ast.line, "Unknown generator: " + std::string(call.children[0].value));
+        }
+        if (ast.children.size() > 3)
+        {
+            throw utils::error_t(ast.line, "Only a map loop takes a key and a value variable");
+        }
+        const generator_t &gen = generators.find(call.children[0].value)->second;
+        auto &args = call.children[1].children;
+        if (args.size() != gen.params)
+        {
+            throw utils::error_t(ast.line, "Generator " + std::string(call.children[0].value) + " takes " +
+                                               std::to_string(gen.params) + " arguments, got " + std::to_string(args.size()));
+        }
+        if (ctx.get_var(var.value))
+        {
+            throw utils::error_t(ast.line, "Loop variable shadows an existing variable: " + std::string(var.value));
+        }
+        size_t id = ctx.create_condition_id();
+        size_t entry = (gen.params + 1) * sizeof(int64_t);
+        ctx.push_scope();
+        data.bytecode.push_back(BC_GEN_NEW);
+        data.push_int(gen.frame, false);
+        data.push_int(entry + sizeof(int64_t), false);
+        ctx.stack_size += sizeof(int64_t);
+        for (size_t j = 0; j < args.size(); j++)
+        {
+            generate_code_expr(args[j], data, ctx);
+            data.bytecode.push_back(BC_GEN_ARG);
+            data.push_int(entry - j * sizeof(int64_t), false);
+            ctx.stack_size -= sizeof(int64_t);
+        }
+        data.bytecode.push_back(BC_PUSH_INT);
+        data.push_int(0, false);
+        ctx.stack_size += sizeof(int64_t);
+        ctx.add_var(var.value, VAR_INT, sizeof(int64_t));
+        size_t start = data.bytecode.size();
+        data.bytecode.push_back(BC_LOOP_LABEL);
+        data.push_int(id, false);
+        data.bytecode.push_back(BC_GEN_NEXT);
+        data.push_int(gen.id, false);
+        data.push_int(id, false);
+        generate_code_loop(ast.children[2], id, BC_CONTINUE, data, ctx);
+        data.bytecode.push_back(BC_LOOP_END);
+        data.push_int(id, false);
+        note_loop(ctx, start, data.bytecode.size());
+        data.bytecode.push_back(BC_GEN_FREE);
+        data.push_int(gen.frame, false);
+        data.bytecode.push_back(BC_SHRINK_STACK);
+        data.push_int(ctx.pop_scope(), false);
+    }
+
+    // `for k in m` / `for k, v in m`: the map and a cursor in hidden slots
+    // under the loop variables; rt_map_next finds the next full slot from the
+    // cursor on. inserting into m inside the loop may rehash it, after which
+    // keys can be skipped or seen twice
+    void generate_code_for_in_map(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        std::vector<const ast_t *> vars = {&ast.children[0]};
+        if (ast.children.size() > 3) vars.push_back(&ast.children[3]);
+        for (auto var : vars)
+        {
+            if (ctx.get_var(var->value))
+            {
+                throw utils::error_t(ast.line, "Loop variable shadows an existing variable: " + std::string(var->value));
+            }
+        }
+        size_t id = ctx.create_condition_id();
+        ctx.push_scope();
+        generate_code_expr(ast.children[1], data, ctx);
+        data.bytecode.push_back(BC_PUSH_INT);
+        data.push_int(0, false);
+        ctx.stack_size += sizeof(int64_t);
+        for (auto var : vars)
+        {
+            data.bytecode.push_back(BC_PUSH_INT);
+            data.push_int(0, false);
+            ctx.stack_size += sizeof(int64_t);
+            ctx.add_var(var->value, VAR_INT, sizeof(int64_t));
+        }
+        size_t start = data.bytecode.size();
+        data.bytecode.push_back(BC_LOOP_LABEL);
+        data.push_int(id, false);
+        data.bytecode.push_back(BC_MAP_NEXT);
+        data.push_int(id, false);
+        data.push_int(vars.size(), false);
+        generate_code_loop(ast.children[2], id, BC_CONTINUE, data, ctx);
+        data.bytecode.push_back(BC_LOOP_END);
+        data.push_int(id, false);
+        note_loop(ctx, start, data.bytecode.size());
+        data.bytecode.push_back(BC_SHRINK_STACK);
+        data.push_int(ctx.pop_scope(), false);
+    }
+
+    // task bodies run on other threads against a copy of the current frame,
+    // so a store to an enclosing variable is lost when the task ends; the
+    // heap allocator is single-threaded, so they may not allocate, and they
+    // cannot return to a generator's caller
+    void check_task_body(const ast_t &ast, var_context_t &ctx)
+    {
+        size_t line = ast.line;
+        if (const ast_t *store = find_captured_store(ast.children.back(), ctx, line))
+        {
+            throw utils::error_t(line, "assignment to " + std::string(store->children[0].value) +
+                                                  " inside parallel for or spawn only changes the task's copy; store results in an array");
+        }
+        if (block_allocates(ast.children.back()))
+        {
+            throw utils::error_t(ast.line, "array(), records and generator loops are not allowed inside parallel for or spawn");
+        }
+        if (block_grows_map(ast.children.back(), ctx))
+        {
+            throw utils::error_t(ast.line, "map insertions are not allowed inside parallel for or spawn");
+        }
+        if (contains_node(ast.children.back(), AST_YIELD))
+        {
+            throw utils::error_t(ast.line, "yield is not allowed inside parallel for or spawn");
+        }
+    }
+
+    // the range is split into chunks that workers run through an outlined
+    // .task<id>: a for loop over its chunk inside a copy of this frame
+    void generate_code_parallel_for(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        check_task_body(ast, ctx);
+        size_t id = ctx.create_condition_id();
+        auto &var = ast.children[0];
+        if (ctx.get_var(var.value))
+        {
+            throw utils::error_t(ast.line, "Loop variable shadows an existing variable: " + std::string(var.value));
+        }
+        generate_code_expr(ast.children[1], data, ctx);
+        generate_code_expr(ast.children[2], data, ctx);
+        data.bytecode.push_back(BC_PARALLEL_FOR);
+        data.push_int(id, false);
+        ctx.stack_size -= 2 * sizeof(int64_t);
+
+        size_t frame = ctx.stack_size;
+        data.bytecode.push_back(BC_PAR_TASK_BEGIN);
+        data.push_int(id, false);
+        emit_frame_operand(data, ctx, frame);
+        ctx.push_scope();
+        ctx.stack_size += sizeof(int64_t);
+        ctx.add_var(var.value, VAR_INT, sizeof(int64_t));
+        ctx.stack_size += sizeof(int64_t);
+        size_t start = data.bytecode.size();
+        data.bytecode.push_back(BC_LOOP_LABEL);
+        data.push_int(id, false);
+        data.bytecode.push_back(BC_FOR_TEST);
+        data.push_int(id, false);
+        std::vector<loop_target_t> outer;
+        outer.swap(loop_targets);
+        generate_code_loop(ast.children[3], id, BC_FOR_CONTINUE, data, ctx, true);
+        loop_targets.swap(outer);
+        data.bytecode.push_back(BC_FOR_NEXT);
+        data.push_int(id, false);
+        note_loop(ctx, start, data.bytecode.size());
+        data.bytecode.push_back(BC_TASK_END);
+        emit_frame_operand(data, ctx, frame + ctx.pop_scope());
+    }
+
+    void generate_code_spawn(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        check_task_body(ast, ctx);
+        size_t id = ctx.create_condition_id();
+        size_t frame = ctx.stack_size;
+        data.bytecode.push_back(BC_SPAWN);
+        data.push_int(id, false);
+        emit_frame_operand(data, ctx, frame);
+        data.bytecode.push_back(BC_TASK_BEGIN);
+        data.push_int(id, false);
+        emit_frame_operand(data, ctx, frame);
+        std::vector<loop_target_t> outer;
+        outer.swap(loop_targets);
+        generate_code_loop_body(ast.children[0], data, ctx);
+        loop_targets.swap(outer);
+        data.bytecode.push_back(BC_TASK_END);
+        emit_frame_operand(data, ctx, frame);
+    }
+
+    bool block_allocates(const ast_t &ast)
+    {
+        if (is_allocation(ast) || (ast.type == AST_FOR_IN && ast.children[1].type == AST_FUNC_CALL))
+        {
+            return true;
+        }
+        for (auto &child : ast.children)
+        {
+            if (block_allocates(child)) return true;
+        }
+        return false;
+    }
+
+    // true if the block may store a heap pointer into a variable that outlives
+    // it: any assignment to an enclosing pointer variable except a copy of
+    // another enclosing variable, since a ?: or a nested assignment can hand
+    // over a block-local one as well as a bare name can
+    bool block_leaks_alloc(const ast_t &ast, var_context_t &ctx)
+    {
+        auto outer = ast.type == AST_ASSIGN && ast.children[0].type == AST_ID ? ctx.get_var(ast.children[0].value) : nullptr;
+        if (outer)
+        {
+            auto &rhs = ast.children[1];
+            bool copies_outer = rhs.type == AST_ID && ctx.get_var(rhs.value);
+            if (outer->type != VAR_INT && !copies_outer) return true;
+            if (is_allocation(rhs)) return true;
+        }
+        if (stores_into_map(ast, ctx)) return true;
+        for (auto &child : ast.children)
+        {
+            if (block_leaks_alloc(child, ctx)) return true;
+        }
+        return false;
+    }
+
+    // `m[k] = e` or `m[k] op= e` on a map held by an enclosing variable: the
+    // store may move the map's table to a block allocated in the current one
+    static bool stores_into_map(const ast_t &ast, var_context_t &ctx)
+    {
+        if ((ast.type != AST_ASSIGN && ast.type != AST_MODIFY_BY) || ast.children[0].type != AST_BRACKET_ACCESS) return false;
+        auto &base = ast.children[0].children[0];
+        auto var = base.type == AST_ID ? ctx.get_var(base.value) : nullptr;
+        return var && var->type == VAR_MAP;
+    }
+
+    // the first `x = e`, `x := e` or `x op= e` on a variable declared outside
+    // `ast`, with `line` set to the line of the statement holding it
+    const ast_t *find_captured_store(const ast_t &ast, var_context_t &ctx, size_t &line)
+    {
+        if (ast.type == AST_EXPR_STMT) line = ast.line;
+        bool store = ast.type == AST_ASSIGN || ast.type == AST_ASSIGN_COPY || ast.type == AST_MODIFY_BY;
+        if (store && ast.children[0].type == AST_ID && ctx.get_var(ast.children[0].value)) return &ast;
+        for (auto &child : ast.children)
+        {
+            if (const ast_t *found = find_captured_store(child, ctx, line)) return found;
+        }
+        return nullptr;
+    }
+
+    bool block_grows_map(const ast_t &ast, var_context_t &ctx)
+    {
+        if (stores_into_map(ast, ctx)) return true;
+        for (auto &child : ast.children)
+        {
+            if (block_grows_map(child, ctx)) return true;
+        }
+        return false;
+    }
+
+    // where a condition jumps: with `if_true` set, op to its label when the
+    // condition holds, else when it does not. op is BC_IF (to .if_false),
+    // BC_IF_NOT (to .if_true) or BC_WHILE_TEST (to .loop_end)
+    struct jump_t
+    {
+        bool if_true;
+        BytecodeOp op;
+        size_t id;
+    };
+
+    static bool is_logical(const ast_t &ast)
+    {
+        return ast.type == AST_BINARY_OP && (ast.value == "&&" || ast.value == "||");
+    }
+
+    // evaluates `ast` for its truth value only, as a chain of conditional
+    // jumps: && and || never materialize a 0/1, and their right operand is
+    // skipped as soon as the left one decides. the jump to `to` is only ever
+    // taken with its own polarity; the other one goes to a fresh label right
+    // after the operator
+    void generate_code_cond(const ast_t &ast, program_data_t &data, var_context_t &ctx, jump_t to)
+    {
+        if (!is_logical(ast))
+        {
+            generate_code_expr(ast, data, ctx);
+            data.bytecode.push_back(to.op);
+            data.push_int(to.id, false);
+            ctx.stack_size -= sizeof(int64_t);
+            return;
+        }
+        bool is_and = ast.value == "&&";
+        if (is_and != to.if_true)
+        {
+            // a false operand of && or a true one of || takes the jump alone
+            generate_code_cond(ast.children[0], data, ctx, to);
+            generate_code_cond(ast.children[1], data, ctx, to);
+            return;
+        }
+        size_t past = ctx.create_condition_id();
+        generate_code_cond(ast.children[0], data, ctx, is_and ? jump_t{false, BC_IF, past} : jump_t{true, BC_IF_NOT, past});
+        generate_code_cond(ast.children[1], data, ctx, to);
+        data.bytecode.push_back(is_and ? BC_TEST_FALSE_LABEL : BC_TRUE_LABEL);
+        data.push_int(past, false);
+    }
+
+    // side-effect free and unable to fault, so it may be evaluated even when
+    // the source would not: constants, variables and the non-dividing
+    // operators over them
+    bool is_pure(const ast_t &ast, var_context_t &ctx)
+    {
+        if (ast.type == AST_INT)
+        {
+            return true;
+        }
+        if (ast.type == AST_ID)
+        {
+            auto var = ctx.get_var(ast.value);
+            return var && var->type == VAR_INT;
+        }
+        if (ast.type == AST_BINARY_OP)
+        {
+            return ast.value != "/" && ast.value != "%" && is_pure(ast.children[0], ctx) && is_pure(ast.children[1], ctx);
+        }
+        if (ast.type == AST_UNARY_OP)
+        {
+            return is_pure(ast.children[0], ctx);
+        }
+        if (ast.type == AST_OP && ast.value == "?")
+        {
+            return is_pure(ast.children[0], ctx) && is_pure(ast.children[1], ctx) && is_pure(ast.children[2], ctx);
+        }
+        return false;
+    }
+
+    static bool is_boolean(const ast_t &ast)
+    {
+        static const char *const ops[] = {"==", "!=", ">", "<", ">=", "<=", "&&", "||"};
+        if (ast.type == AST_INT) return ast.int_value == 0 || ast.int_value == 1;
+        if (ast.type != AST_BINARY_OP) return false;
+        for (auto op : ops)
+        {
+            if (ast.value == op) return true;
+        }
+        return false;
+    }
+
+    // && and || as values are 0 or 1. with a pure right operand both sides
+    // are computed and combined without a branch; otherwise the jump chain
+    // of generate_code_cond picks which constant to push
+    ASTType generate_code_logical(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        if (lower_branchless && is_pure(ast.children[1], ctx))
+        {
+            branchless_count++;
+            for (auto &operand : ast.children)
+            {
+                generate_code_expr(operand, data, ctx);
+                if (!is_boolean(operand))
+                {
+                    data.bytecode.push_back(BC_PUSH_INT);
+                    data.push_int(0, false);
+                    data.bytecode.push_back(BC_NE_INT_INT);
+                }
+            }
+            data.bytecode.push_back(ast.value == "&&" ? BC_AND : BC_OR);
+            ctx.stack_size -= sizeof(int64_t);
+            return AST_INT;
+        }
+        size_t id = ctx.create_condition_id();
+        generate_code_cond(ast, data, ctx, {false, BC_IF, id});
+        generate_code_select_arms(data, ctx, id, [&] { emit_push_int(data, ctx, 1); }, [&] { emit_push_int(data, ctx, 0); });
+        return AST_INT;
+    }
+
+    void emit_push_int(program_data_t &data, var_context_t &ctx, int64_t value)
+    {
+        data.bytecode.push_back(BC_PUSH_INT);
+        data.push_int(value, false);
+        ctx.stack_size += sizeof(int64_t);
+    }
+
+    // the two arms of a branching select after its condition jumped to
+    // .if_false<id>: each leaves one value at the same depth
+    template <typename T, typename F>
+    void generate_code_select_arms(program_data_t &data, var_context_t &ctx, size_t id, T then_arm, F else_arm)
+    {
+        then_arm();
+        ctx.stack_size -= sizeof(int64_t);
+        data.bytecode.push_back(BC_ELSE);
+        data.push_int(id, false);
+        else_arm();
+        data.bytecode.push_back(BC_TEST_END_END_LABEL);
+        data.push_int(id, false);
+    }
+
+    // c ? x : y. when all three are pure the arms are computed up front and
+    // BC_SELECT picks one with a cmov, fused with a comparison in c;
+    // otherwise only the chosen arm runs
+    ASTType generate_code_ternary(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        auto &cond = ast.children[0];
+        if (get_expression_type(ast.children[1], ctx) != get_expression_type(ast.children[2], ctx))
+        {
+            throw utils::error_t(ast.line, "Type mismatch in ?:");
+        }
+        ASTType type = AST_INT;
+        if (lower_branchless && is_pure(ast, ctx))
+        {
+            branchless_count++;
+            generate_code_expr(ast.children[1], data, ctx);
+            generate_code_expr(ast.children[2], data, ctx);
+            generate_code_expr(cond, data, ctx);
+            data.bytecode.push_back(BC_SELECT);
+            ctx.stack_size -= 2 * sizeof(int64_t);
+            return type;
+        }
+        size_t id = ctx.create_condition_id();
+        generate_code_cond(cond, data, ctx, {false, BC_IF, id});
+        generate_code_select_arms(
+            data, ctx, id, [&] { type = generate_code_expr(ast.children[1], data, ctx); },
+            [&] { generate_code_expr(ast.children[2], data, ctx); });
+        return type;
+    }
+
+    size_t generate_code_if(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        size_t id = ctx.create_condition_id();
+        // counters are numbered apart from labels: the label ids taken by
+        // the condition differ between a profiling and an optimized build
+        size_t counter = if_count++;
+        check_ast_type(ast, AST_IF);
+        auto &cond = ast.children[0];
+        auto &stmt = ast.children[1];
+
+        bool has_else = ast.children.size() == 3;
+        auto emit = [&](BytecodeOp op) {
+            data.bytecode.push_back(op);
+            data.push_int(id, false);
+        };
+        // BC_IF jumps to the false label, BC_IF_NOT to the true one. a
+        // profiling build computes the whole condition once and counts its
+        // value, so the counters are outcomes of the if and not of its operands
+        auto test = [&](BytecodeOp op) {
+            if (!profile) return generate_code_cond(cond, data, ctx, {op == BC_IF_NOT, op, id});
+            generate_code_expr(cond, data, ctx);
+            data.bytecode.push_back(BC_PROF_BRANCH);
+            data.push_int(counter, false);
+            emit(op);
+            ctx.stack_size -= sizeof(int64_t);
+        };
+
+        // with a profile the likely side falls through and a side taken in at
+        // most 1% of executions is moved out of line
+        bool then_cold = false, else_cold = false, invert = false;
+        if (auto *counts = profile_use ? profile_use->branch(counter) : nullptr)
+        {
+            uint64_t total = counts->taken + counts->not_taken;
+            then_cold = total && counts->taken * 100 <= total;
+            else_cold = has_else && total && counts->not_taken * 100 <= total;
+            invert = has_else && counts->not_taken > counts->taken;
+        }
+
+        // the fall-through side always jumps over the cold block; emit_asm
+        // drops the jump when the block really moves out of line
+        if (then_cold) {
+            test(BC_IF_NOT);
+            if(has_else) generate_code_stmt(ast.children[2], data, ctx);
+            emit(BC_JUMP_END);
+            data.bytecode.push_back(BC_COLD_BEGIN);
+            emit(BC_TRUE_LABEL);
+            generate_code_stmt(stmt, data, ctx);
+            emit(BC_JUMP_END);
+            data.bytecode.push_back(BC_COLD_END);
+            emit(BC_TEST_END_END_LABEL);
+        }
+        else if (else_cold) {
+            test(BC_IF);
+            generate_code_stmt(stmt, data, ctx);
+            emit(BC_JUMP_END);
+            data.bytecode.push_back(BC_COLD_BEGIN);
+            emit(BC_TEST_FALSE_LABEL);
+            generate_code_stmt(ast.children[2], data, ctx);
+            emit(BC_JUMP_END);
+            data.bytecode.push_back(BC_COLD_END);
+            emit(BC_TEST_END_END_LABEL);
+        }
+        else if (invert) {
+            test(BC_IF_NOT);
+            generate_code_stmt(ast.children[2], data, ctx);
+            emit(BC_JUMP_END);
+            emit(BC_TRUE_LABEL);
+            generate_code_stmt(stmt, data, ctx);
+            emit(BC_TEST_END_END_LABEL);
+        }
+        else if(has_else) {
+            test(BC_IF);
+            generate_code_stmt(stmt, data, ctx);
+            emit(BC_ELSE);
+            generate_code_stmt(ast.children[2], data, ctx);
+            emit(BC_TEST_END_END_LABEL);
+        }
+        else {
+            test(BC_IF);
+            generate_code_stmt(stmt, data, ctx);
+            emit(BC_TEST_FALSE_LABEL);
+        }
+        return 0;
+    }
+
+    // one arm of a multi-way branch on an integer
+    struct switch_case_t
+    {
+        std::vector<int64_t> values;
+        const ast_t *body;
+    };
+
+    static bool case_value(const ast_t &ast, int64_t &value)
+    {
+        bool negative = ast.type == AST_UNARY_OP && ast.value == "-";
+        const ast_t &lit = negative ? ast.children[0] : ast;
+        if (lit.type != AST_INT) return false;
+        value = lit.int_value;
+        if (negative) value = (int64_t)(0 - (uint64_t)value);
+        return true;
+    }
+
+    // dense values get a jump table, sparse ones a binary search; either way
+    // the subject is evaluated once. bodies are laid out in case order, the
+    // else branch last
+    void generate_code_switch(const ast_t &subject, const std::vector<switch_case_t> &cases, const ast_t *otherwise,
+                              program_data_t &data, var_context_t &ctx)
+    {
+        size_t id = ctx.create_condition_id();
+        std::vector<std::pair<int64_t, size_t>> entries;
+        for (size_t k = 0; k < cases.size(); k++)
+        {
+            for (int64_t v : cases[k].values) entries.push_back({v, k});
+        }
+        std::sort(entries.begin(), entries.end());
+        size_t else_case = cases.size();
+        generate_code_expr(subject, data, ctx);
+        ctx.stack_size -= sizeof(int64_t);
+        uint64_t span = entries.empty() ? 0 : (uint64_t)entries.back().first - (uint64_t)entries.front().first;
+        if (entries.size() >= 4 && span < 4 * entries.size() && span < 1024)
+        {
+            data.bytecode.push_back(BC_SWITCH_TABLE);
+            data.push_int(id, false);
+            data.push_int(else_case, false);
+            data.push_int(entries.front().first, false);
+            data.push_int(span + 1, false);
+            size_t next = 0;
+            for (uint64_t off = 0; off <= span; off++)
+            {
+                bool hit = (uint64_t)entries[next].first - (uint64_t)entries.front().first == off;
+                data.push_int(hit ? entries[next++].second : else_case, false);
+            }
+        }
+        else
+        {
+            data.bytecode.push_back(BC_SWITCH_TREE);
+            data.push_int(id, false);
+            data.push_int(else_case, false);
+            data.push_int(entries.size(), false);
+            for (auto &e : entries)
+            {
+                data.push_int(e.first, false);
+                data.push_int(e.second, false);
+            }
+        }
+        auto label = [&](size_t k) {
+            data.bytecode.push_back(BC_CASE_LABEL);
+            data.push_int(id, false);
+            data.push_int(k, false);
+        };
+        for (size_t k = 0; k < cases.size(); k++)
+        {
+            label(k);
+            generate_code_stmt(*cases[k].body, data, ctx);
+            data.bytecode.push_back(BC_JUMP_END);
+            data.push_int(id, false);
+        }
+        label(else_case);
+        if (otherwise) generate_code_stmt(*otherwise, data, ctx);
+        data.bytecode.push_back(BC_TEST_END_END_LABEL);
+        data.push_int(id, false);
+    }
+
+    void generate_code_match(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        check_ast_type(ast, AST_MATCH);
+        if (get_expression_type(ast.children[0], ctx) != VAR_INT)
+        {
+            throw utils::error_t(ast.line, "match needs an integer");
+        }
+        std::vector<switch_case_t> cases;
+        const ast_t *otherwise = nullptr;
+        std::unordered_set<int64_t> seen;
+        for (size_t k = 1; k < ast.children.size(); k++)
+        {
+            auto &c = ast.children[k];
+            if (c.value == "else")
+            {
+                otherwise = &c.children.back();
+                continue;
+            }
+            switch_case_t arm{{}, &c.children.back()};
+            for (size_t j = 0; j + 1 < c.children.size(); j++)
+            {
+                int64_t v;
+                case_value(c.children[j], v);
+                if (!seen.insert(v).second)
+                {
+                    throw utils::error_t(c.line, "Duplicate case value: " + std::to_string(v));
+                }
+                arm.values.push_back(v);
+            }
+            cases.push_back(arm);
+        }
+        generate_code_switch(ast.children[0], cases, otherwise, data, ctx);
+    }
+
+    // the values `var == c || c == var || ...` tests for, all on one name
+    static bool ladder_values(const ast_t &cond, std::string_view &var, std::vector<int64_t> &values)
+    {
+        if (cond.type != AST_BINARY_OP) return false;
+        if (cond.value == "||")
+        {
+            return ladder_values(cond.children[0], var, values) && ladder_values(cond.children[1], var, values);
+        }
+        if (cond.value != "==") return false;
+        const ast_t *id = &cond.children[0], *lit = &cond.children[1];
+        if (id->type != AST_ID) std::swap(id, lit);
+        int64_t v;
+        if (id->type != AST_ID || !case_value(*lit, v) || (!var.empty() && id->value != var)) return false;
+        var = id->value;
+        values.push_back(v);
+        return true;
+    }
+
+    // `if x == 1 {} else if x == 2 || x == 3 {} else if ...` on one integer
+    // variable is a match in disguise: with four or more values it is
+    // lowered by generate_code_switch instead of testing one by one. a value
+    // repeated further down can never be reached there and is dropped.
+    // profiling builds keep every if, since their counters are per if
+    bool generate_code_if_ladder(const ast_t &ast, program_data_t &data, var_context_t &ctx)
+    {
+        if (profile || profile_use || !lower_if_to_switch) return false;
+        std::string_view var;
+        std::vector<switch_case_t> cases;
+        std::unordered_set<int64_t> seen;
+        size_t count = 0;
+        const ast_t *node = &ast;
+        const ast_t *otherwise = nullptr;
+        while (node && node->type == AST_IF)
+        {
+            std::vector<int64_t> values;
+            if (!ladder_values(node->children[0], var, values))
+            {
+                break;
+            }
+            switch_case_t arm{{}, &node->children[1]};
+            for (int64_t v : values)
+            {
+                if (seen.insert(v).second) arm.values.push_back(v);
+            }
+            count += arm.values.size();
+            cases.push_back(arm);
+            node = node->children.size() == 3 ? &node->children[2] : nullptr;
+        }
+        otherwise = node;
+        auto v = var.empty() ? nullptr : ctx.get_var(var);
+        if (count < 4 || !v || v->type != VAR_INT)
+        {
+            return false;
+        }
+        ast_t subject = {AST_ID, var};
+        subject.line = ast.line;
+        generate_code_switch(subject, cases, otherwise, data, ctx);
+        if_to_switch_count++;
+        return true;
     }
 };
\ No newline at end of file
@@ -0,0 +1,130 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <new>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include "utils.hpp"
+
+// growable append buffer for generated assembly text.
+// when bound to a file descriptor the buffer is written out every
+// `flush_threshold` bytes, so emission never holds the whole program in memory.
+struct asm_emitter_t
+{
+    char *buf = nullptr;
+    size_t len = 0;
+    size_t cap = 0;
+    int fd = -1;
+    size_t flush_threshold = 1 << 16;
+
+    asm_emitter_t() = default;
+    asm_emitter_t(const asm_emitter_t &) = delete;
+    asm_emitter_t &operator=(const asm_emitter_t &) = delete;
+    ~asm_emitter_t()
+    {
+        if (fd >= 0)
+        {
+            if (len > 0) write_all(buf, len);
+            ::close(fd);
+        }
+        free(buf);
+    }
+
+    void open(const std::string &path)
+    {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw utils::error_t(0, "Failed to open file: " + path);
+        reserve(flush_threshold * 2);
+    }
+
+    void close()
+    {
+        if (fd < 0) return;
+        flush();
+        int rc = ::close(fd);
+        fd = -1;
+        if (rc != 0)
+            throw utils::error_t(0, "Failed to close output file");
+    }
+
+    void reserve(size_t n)
+    {
+        if (n <= cap) return;
+        size_t new_cap = cap ? cap : 4096;
+        while (new_cap < n) new_cap *= 2;
+        char *p = (char *)realloc(buf, new_cap);
+        if (!p) throw std::bad_alloc();
+        buf = p;
+        cap = new_cap;
+    }
+
+    void put(const char *s, size_t n)
+    {
+        if (len + n > cap) reserve(len + n);
+        memcpy(buf + len, s, n);
+        len += n;
+    }
+
+    // string literals / fragment tables: length is known at compile time
+    template <size_t N>
+    void put(const char (&s)[N]) { put(s, N - 1); }
+
+    void put(std::string_view s) { put(s.data(), s.size()); }
+
+    void put(char c)
+    {
+        if (len + 1 > cap) reserve(len + 1);
+        buf[len++] = c;
+    }
+
+    void put_int(int64_t value)
+    {
+        if (len + 24 > cap) reserve(len + 24);
+        len = std::to_chars(buf + len, buf + cap, value).ptr - buf;
+    }
+
+    void put_uint(uint64_t value)
+    {
+        if (len + 24 > cap) reserve(len + 24);
+        len = std::to_chars(buf + len, buf + cap, value).ptr - buf;
+    }
+
+    // called between instructions; a no-op for in-memory emitters
+    void maybe_flush()
+    {
+        if (fd >= 0 && len >= flush_threshold) flush();
+    }
+
+    void flush()
+    {
+        if (fd < 0 || len == 0) return;
+        if (!write_all(buf, len))
+            throw utils::error_t(0, std::string("Failed to write output: ") + strerror(errno));
+        len = 0;
+    }
+
+    std::string str() const { return std::string(buf ? buf : "", len); }
+
+private:
+    bool write_all(const char *p, size_t n)
+    {
+        while (n > 0)
+        {
+            ssize_t w = ::write(fd, p, n);
+            if (w < 0)
+            {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            p += w;
+            n -= w;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,874 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "emitter.hpp"
+
+// signed division by a constant d >= 2 as a multiply-high and shift
+// (Hacker's Delight, figure 10-1)
+inline void signed_div_magic(int64_t d, int64_t &magic, int &shift)
+{
+    const uint64_t two63 = 1ull << 63;
+    uint64_t ad = d;
+    uint64_t anc = two63 - 1 - two63 % ad;
+    int p = 63;
+    uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;
+    uint64_t delta;
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    magic = (int64_t)(q2 + 1);
+    shift = p - 64;
+}
+
+enum alu_op_t
+{
+    ALU_ADD,
+    ALU_SUB,
+    ALU_MUL,
+    ALU_DIV,
+    ALU_MOD,
+    ALU_AND,
+    ALU_OR,
+    ALU_XOR,
+    ALU_SHL,
+    ALU_SHR,
+};
+
+// condition codes in the order of the comparison opcodes: == != > < >= <=
+static constexpr const char *isel_cc[] = {"e", "ne", "g", "l", "ge", "le"};
+static constexpr int isel_cc_negated[] = {1, 0, 5, 4, 3, 2};
+
+// instruction selection for the stack bytecode. values the bytecode pushes
+// are held back as pending operands (a constant, a stack slot, rax, or a
+// slot shifted left) for as long as only pure opcodes follow, so that the
+// consumer can match them as immediates and memory operands, fuse a compare
+// into its branch, update a variable in place, and so on. everything pending
+// is pushed (flush) before any other opcode, so labels, calls and templates
+// always see the plain stack machine.
+//
+// pending operands sit above the real stack. `depth` counts the bytes this
+// selector pushed minus what it popped; a slot is remembered as the depth
+// coordinate depth - offset, which stays valid as the real stack moves.
+struct isel_t
+{
+    enum kind_t
+    {
+        OPND_IMM,
+        OPND_MEM,
+        OPND_RAX,
+        OPND_SCALED, // the slot at `value`, shifted left by `shift`
+        OPND_RCX,    // only as an instruction source
+    };
+    struct operand_t
+    {
+        kind_t kind;
+        int64_t value;
+        int shift = 0;
+    };
+
+    asm_emitter_t &out;
+    std::vector<operand_t> pending;
+    int64_t depth = 0;
+
+    explicit isel_t(asm_emitter_t &o) : out(o) {}
+
+    static bool fits32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+    size_t count() const { return pending.size(); }
+
+    void put_mem(int64_t location)
+    {
+        out.put("QWORD PTR [rsp + ");
+        out.put_int(depth - location);
+        out.put(']');
+    }
+
+    void put_src(const operand_t &src)
+    {
+        if (src.kind == OPND_IMM)
+            out.put_int(src.value);
+        else if (src.kind == OPND_MEM)
+            put_mem(src.value);
+        else if (src.kind == OPND_RCX)
+            out.put("rcx");
+        else
+            out.put("rax");
+    }
+
+    void load(const operand_t &e, bool to_rcx)
+    {
+        std::string_view reg = to_rcx ? "rcx" : "rax";
+        if (e.kind == OPND_RAX)
+        {
+            if (to_rcx) out.put("  mov rcx, rax\n");
+            return;
+        }
+        if (e.kind == OPND_IMM)
+        {
+            out.put(fits32(e.value) ? "  mov " : "  movabs ");
+            out.put(reg);
+            out.put(", ");
+            out.put_int(e.value);
+            out.put('\n');
+            return;
+        }
+        out.put("  mov ");
+        out.put(reg);
+        out.put(", ");
+        put_mem(e.value);
+        out.put('\n');
+        if (e.kind == OPND_SCALED)
+        {
+            out.put("  shl ");
+            out.put(reg);
+            out.put(", ");
+            out.put_int(e.shift);
+            out.put('\n');
+        }
+    }
+
+    void materialize(const operand_t &e)
+    {
+        if (e.kind == OPND_IMM && fits32(e.value))
+        {
+            out.put("  push ");
+            out.put_int(e.value);
+            out.put('\n');
+        }
+        else if (e.kind == OPND_MEM)
+        {
+            out.put("  push ");
+            put_mem(e.value);
+            out.put('\n');
+        }
+        else if (e.kind == OPND_RAX)
+        {
+            out.put("  push rax\n");
+        }
+        else
+        {
+            load(e, true);
+            out.put("  push rcx\n");
+        }
+        depth += 8;
+    }
+
+    // pushes every pending operand except the top `keep`
+    void flush_below(size_t keep)
+    {
+        if (pending.size() <= keep) return;
+        size_t n = pending.size() - keep;
+        for (size_t k = 0; k < n; k++) materialize(pending[k]);
+        pending.erase(pending.begin(), pending.begin() + n);
+    }
+
+    void flush()
+    {
+        if (pending.empty()) return;
+        flush_below(0);
+        out.put('\n');
+    }
+
+    // true if an operand below the top `keep` lives in rax
+    bool rax_busy(size_t keep) const
+    {
+        for (size_t k = 0; k + keep < pending.size(); k++)
+            if (pending[k].kind == OPND_RAX) return true;
+        return false;
+    }
+
+    // true if an operand below the top `keep` reads the slot at `location`
+    bool reads(int64_t location, size_t keep) const
+    {
+        for (size_t k = 0; k + keep < pending.size(); k++)
+            if ((pending[k].kind == OPND_MEM || pending[k].kind == OPND_SCALED) && pending[k].value == location)
+                return true;
+        return false;
+    }
+
+    // `e` as an instruction source: an imm32 or a slot where allowed, else rcx
+    operand_t source(const operand_t &e, bool imm, bool mem)
+    {
+        if (e.kind == OPND_IMM && imm && fits32(e.value)) return e;
+        if (e.kind == OPND_MEM && mem) return e;
+        load(e, true);
+        return {OPND_RCX, 0};
+    }
+
+    void push_imm(int64_t value) { pending.push_back({OPND_IMM, value}); }
+
+    // a stack variable `offset` bytes above the conceptual rsp
+    void copy(int64_t offset)
+    {
+        int64_t held = 8 * (int64_t)pending.size();
+        if (offset < held)
+        {
+            flush();
+            held = 0;
+        }
+        pending.push_back({OPND_MEM, depth - (offset - held)});
+    }
+
+    // the top operand into rax, popped
+    void top_to_rax()
+    {
+        if (pending.empty())
+        {
+            out.put("  pop rax\n");
+            depth -= 8;
+            return;
+        }
+        if (pending.back().kind != OPND_RAX)
+        {
+            if (rax_busy(1)) flush_below(1);
+            load(pending.back(), false);
+        }
+        pending.pop_back();
+    }
+
+    // the two top operands, popped: the left one in rax and the right one
+    // returned as a source for `op rax, src`
+    operand_t binary(bool commutative, bool imm, bool mem)
+    {
+        if (pending.empty())
+        {
+            out.put("  pop rcx\n  pop rax\n");
+            depth -= 16;
+            return {OPND_RCX, 0};
+        }
+        if (pending.size() == 1)
+        {
+            operand_t src = source(pending.back(), imm, false);
+            pending.pop_back();
+            out.put("  pop rax\n");
+            depth -= 8;
+            return src;
+        }
+        if (rax_busy(2)) flush_below(2);
+        operand_t a = pending[pending.size() - 2];
+        operand_t b = pending.back();
+        pending.resize(pending.size() - 2);
+        if (b.kind == OPND_RAX)
+        {
+            if (commutative) return source(a, imm, mem);
+            out.put("  mov rcx, rax\n");
+            load(a, false);
+            return {OPND_RCX, 0};
+        }
+        load(a, false);
+        return source(b, imm, mem);
+    }
+
+    void put_alu(alu_op_t op, const operand_t &src)
+    {
+        static constexpr const char *names[] = {"  add rax, ", "  sub rax, ", "  imul rax, ", "", "",
+                                                "  and rax, ", "  or rax, ",  "  xor rax, "};
+        out.put(std::string_view(names[op]));
+        put_src(src);
+        out.put('\n');
+    }
+
+    static bool fold(alu_op_t op, int64_t a, int64_t b, int64_t &r)
+    {
+        uint64_t ua = a, ub = b;
+        switch (op)
+        {
+        case ALU_ADD: r = (int64_t)(ua + ub); return true;
+        case ALU_SUB: r = (int64_t)(ua - ub); return true;
+        case ALU_MUL: r = (int64_t)(ua * ub); return true;
+        case ALU_AND: r = a & b; return true;
+        case ALU_OR: r = a | b; return true;
+        case ALU_XOR: r = a ^ b; return true;
+        case ALU_SHL: r = (int64_t)(ua << (b & 63)); return true;
+        case ALU_SHR: r = (int64_t)(ua >> (b & 63)); return true;
+        case ALU_DIV:
+        case ALU_MOD:
+            if (b == 0 || (a == INT64_MIN && b == -1)) return false;
+            r = op == ALU_DIV ? a / b : a % b;
+            return true;
+        }
+        return false;
+    }
+
+    static int log2_exact(int64_t v)
+    {
+        if (v <= 0 || (v & (v - 1))) return -1;
+        return __builtin_ctzll(v);
+    }
+
+    // rax = rax / d or rax % d; clobbers rcx and rdx
+    void put_div_const(int64_t d, bool mod)
+    {
+        int64_t ad = d < 0 ? -d : d;
+        int k = log2_exact(ad);
+        out.put("  mov rcx, rax\n");
+        if (ad == 1)
+        {
+            if (mod) out.put("  xor eax, eax\n");
+            else if (d < 0) out.put("  neg rax\n");
+            return;
+        }
+        if (k > 0)
+        {
+            out.put("  mov rdx, rax\n  sar rdx, 63\n  shr rdx, ");
+            out.put_int(64 - k);
+            out.put("\n  add rax, rdx\n  sar rax, ");
+            out.put_int(k);
+            out.put('\n');
+        }
+        else
+        {
+            int64_t magic;
+            int shift;
+            signed_div_magic(ad, magic, shift);
+            out.put("  movabs rax, ");
+            out.put_int(magic);
+            out.put("\n  imul rcx\n");
+            if (magic < 0) out.put("  add rdx, rcx\n");
+            if (shift)
+            {
+                out.put("  sar rdx, ");
+                out.put_int(shift);
+                out.put('\n');
+            }
+            out.put("  mov rax, rdx\n  shr rax, 63\n  add rax, rdx\n");
+        }
+        if (mod && k > 0)
+        {
+            // q * d == |q| * |d| whatever the sign of d
+            out.put("  shl rax, ");
+            out.put_int(k);
+            out.put("\n  sub rcx, rax\n  mov rax, rcx\n");
+            return;
+        }
+        if (d < 0) out.put("  neg rax\n");
+        if (mod)
+        {
+            out.put("  imul rax, rax, ");
+            out.put_int(d);
+            out.put("\n  sub rcx, rax\n  mov rax, rcx\n");
+        }
+    }
+
+    void arith(alu_op_t op)
+    {
+        size_t n = pending.size();
+        bool commutative = op == ALU_ADD || op == ALU_MUL || op == ALU_AND || op == ALU_OR || op == ALU_XOR;
+        if (n >= 2 && commutative && pending[n - 2].kind == OPND_IMM && pending[n - 1].kind != OPND_IMM)
+        {
+            std::swap(pending[n - 2], pending[n - 1]);
+        }
+        if (n >= 2 && pending[n - 2].kind == OPND_IMM && pending[n - 1].kind == OPND_IMM)
+        {
+            int64_t r;
+            if (fold(op, pending[n - 2].value, pending[n - 1].value, r))
+            {
+                pending.pop_back();
+                pending.back().value = r;
+                return;
+            }
+        }
+        if (n >= 1 && pending.back().kind == OPND_IMM && arith_imm(op, pending.back().value))
+        {
+            return;
+        }
+        if (op == ALU_ADD && n >= 2 && (pending[n - 1].kind == OPND_SCALED || pending[n - 2].kind == OPND_SCALED))
+        {
+            // x + y * 2^k in one lea
+            if (pending[n - 1].kind != OPND_SCALED) std::swap(pending[n - 2], pending[n - 1]);
+            operand_t scaled = pending.back();
+            pending.pop_back();
+            top_to_rax();
+            out.put("  mov rcx, ");
+            put_mem(scaled.value);
+            out.put("\n  lea rax, [rax + rcx * ");
+            out.put_int(1 << scaled.shift);
+            out.put("]\n");
+            pending.push_back({OPND_RAX, 0});
+            return;
+        }
+        if (op == ALU_DIV || op == ALU_MOD)
+        {
+            operand_t src = binary(false, false, true);
+            out.put("  cqo\n  idiv ");
+            put_src(src);
+            out.put(op == ALU_MOD ? "\n  mov rax, rdx\n" : "\n");
+        }
+        else if (op == ALU_SHL || op == ALU_SHR)
+        {
+            binary(false, false, false);
+            out.put(op == ALU_SHL ? "  shl rax, cl\n" : "  shr rax, cl\n");
+        }
+        else
+        {
+            put_alu(op, binary(commutative, true, true));
+        }
+        pending.push_back({OPND_RAX, 0});
+    }
+
+    // `x op k`; false leaves the generic path to it
+    bool arith_imm(alu_op_t op, int64_t k)
+    {
+        if (k == 0 && (op == ALU_ADD || op == ALU_SUB || op == ALU_OR || op == ALU_XOR || op == ALU_SHL || op == ALU_SHR))
+        {
+            pending.pop_back();
+            return true;
+        }
+        if (k == 1 && (op == ALU_MUL || op == ALU_DIV))
+        {
+            pending.pop_back();
+            return true;
+        }
+        int shift = op == ALU_MUL ? log2_exact(k) : (op == ALU_SHL || op == ALU_SHR) ? (int)(k & 63) : -1;
+        if (op == ALU_SHR && shift >= 0)
+        {
+            pending.pop_back();
+            top_to_rax();
+            out.put("  shr rax, ");
+            out.put_int(shift);
+            out.put('\n');
+            pending.push_back({OPND_RAX, 0});
+            return true;
+        }
+        if (shift > 0)
+        {
+            pending.pop_back();
+            if (shift <= 3 && !pending.empty() && pending.back().kind == OPND_MEM)
+            {
+                pending.back() = {OPND_SCALED, pending.back().value, shift};
+                return true;
+            }
+            top_to_rax();
+            out.put("  shl rax, ");
+            out.put_int(shift);
+            out.put('\n');
+            pending.push_back({OPND_RAX, 0});
+            return true;
+        }
+        if (op == ALU_MUL && (k == 3 || k == 5 || k == 9))
+        {
+            pending.pop_back();
+            top_to_rax();
+            out.put("  lea rax, [rax + rax * ");
+            out.put_int(k - 1);
+            out.put("]\n");
+            pending.push_back({OPND_RAX, 0});
+            return true;
+        }
+        if (op == ALU_MUL && fits32(k))
+        {
+            pending.pop_back();
+            if (!pending.empty() && pending.back().kind == OPND_MEM)
+            {
+                if (rax_busy(1)) flush_below(1);
+                out.put("  imul rax, ");
+                put_mem(pending.back().value);
+                pending.pop_back();
+            }
+            else
+            {
+                top_to_rax();
+                out.put("  imul rax, rax");
+            }
+            out.put(", ");
+            out.put_int(k);
+            out.put('\n');
+            pending.push_back({OPND_RAX, 0});
+            return true;
+        }
+        if ((op == ALU_DIV || op == ALU_MOD) && k != 0 && k != INT64_MIN && fits32(k))
+        {
+            pending.pop_back();
+            top_to_rax();
+            put_div_const(k, op == ALU_MOD);
+            pending.push_back({OPND_RAX, 0});
+            return true;
+        }
+        return false;
+    }
+
+    // `x = x op y` where the result goes straight back to x's slot: one
+    // read-modify-write instead of load, op, store. `offset` is the store's
+    // operand, taken with the result popped (store) or on top (set)
+    bool modify_in_place(alu_op_t op, int64_t offset, bool keep_value)
+    {
+        size_t n = pending.size();
+        if (n < 2 || pending[n - 2].kind != OPND_MEM) return false;
+        if (op != ALU_ADD && op != ALU_SUB && op != ALU_AND && op != ALU_OR && op != ALU_XOR) return false;
+        int64_t held = 8 * (int64_t)(keep_value ? n - 1 : n - 2);
+        if (offset < held) return false;
+        int64_t target = depth - (offset - held);
+        if (pending[n - 2].value != target || reads(target, 2)) return false;
+        operand_t b = pending.back();
+        if (b.kind == OPND_RAX && rax_busy(2)) return false;
+        pending.pop_back();
+        pending.pop_back();
+        operand_t src = b.kind == OPND_RAX ? b : source(b, true, false);
+        static constexpr const char *names[] = {"  add ", "  sub ", "", "", "", "  and ", "  or ", "  xor "};
+        out.put(std::string_view(names[op]));
+        put_mem(target);
+        out.put(", ");
+        put_src(src);
+        out.put('\n');
+        if (keep_value) pending.push_back({OPND_MEM, target});
+        return true;
+    }
+
+    void compare(int cc)
+    {
+        put_compare();
+        out.put("  set");
+        out.put(std::string_view(isel_cc[cc]));
+        out.put(" al\n  movzx eax, al\n");
+        pending.push_back({OPND_RAX, 0});
+    }
+
+    // a comparison consumed by a conditional jump: no 0/1 value in between
+    void compare_branch(int cc, bool jump_if_true, std::string_view label, uint64_t id)
+    {
+        flush_below(2); // the target sees the plain stack
+        put_compare();
+        out.put("  j");
+        out.put(std::string_view(isel_cc[jump_if_true ? cc : isel_cc_negated[cc]]));
+        out.put(' ');
+        out.put(label);
+        out.put_uint(id);
+        out.put("\n\n");
+    }
+
+    void put_compare()
+    {
+        size_t n = pending.size();
+        if (n >= 2 && pending[n - 2].kind == OPND_MEM && pending[n - 1].kind == OPND_IMM && fits32(pending[n - 1].value))
+        {
+            flush_below(2);
+            out.put("  cmp ");
+            put_mem(pending[0].value);
+            out.put(", ");
+            out.put_int(pending[1].value);
+            out.put('\n');
+            pending.clear();
+            return;
+        }
+        operand_t src = binary(false, true, true);
+        out.put("  cmp rax, ");
+        put_src(src);
+        out.put('\n');
+    }
+
+    // c ? x : y without a branch, x and y below the condition: either the
+    // top operand (cc < 0) or the two compared by cc. x and y must already
+    // be plain values since both are loaded after the flags are set
+    void select_value(int cc)
+    {
+        size_t k = cc < 0 ? 1 : 2;
+        size_t n = pending.size();
+        auto plain = [](const operand_t &e) { return e.kind == OPND_IMM || e.kind == OPND_MEM; };
+        if (n < k + 2 || !plain(pending[n - k - 2]) || !plain(pending[n - k - 1]))
+        {
+            flush();
+            out.put(cc < 0 ? "  pop rcx\n  test rcx, rcx\n" : "  pop rcx\n  pop rax\n  cmp rax, rcx\n");
+            out.put("  pop rdx\n  pop rax\n  cmov");
+            out.put(std::string_view(cc < 0 ? "z" : isel_cc[isel_cc_negated[cc]]));
+            out.put(" rax, rdx\n");
+            depth -= 8 * (int64_t)(k + 2);
+            pending.push_back({OPND_RAX, 0});
+            return;
+        }
+        if (rax_busy(k + 2))
+        {
+            flush_below(k + 2);
+            n = pending.size();
+        }
+        operand_t x = pending[n - k - 2], y = pending[n - k - 1];
+        pending.erase(pending.begin() + (n - k - 2), pending.begin() + (n - k));
+        if (cc < 0 && pending.back().kind == OPND_IMM)
+        {
+            pending.back() = pending.back().value ? x : y;
+            return;
+        }
+        if (cc >= 0)
+        {
+            put_compare();
+        }
+        else if (pending.back().kind == OPND_MEM)
+        {
+            out.put("  cmp ");
+            put_mem(pending.back().value);
+            out.put(", 0\n");
+            pending.pop_back();
+        }
+        else
+        {
+            top_to_rax();
+            out.put("  test rax, rax\n");
+        }
+        load(x, false);
+        if (y.kind == OPND_IMM) load(y, true);
+        out.put("  cmov");
+        out.put(std::string_view(cc < 0 ? "z" : isel_cc[isel_cc_negated[cc]]));
+        out.put(" rax, ");
+        put_src(y.kind == OPND_IMM ? operand_t{OPND_RCX, 0} : y);
+        out.put('\n');
+        pending.push_back({OPND_RAX, 0});
+    }
+
+    // pops the top operand and jumps to label<id> if it is nonzero
+    // (jump_if_true) or zero
+    void branch(bool jump_if_true, std::string_view label, uint64_t id)
+    {
+        flush_below(1);
+        if (!pending.empty() && pending.back().kind == OPND_IMM)
+        {
+            bool taken = (pending.back().value != 0) == jump_if_true;
+            pending.pop_back();
+            if (taken)
+            {
+                out.put("  jmp ");
+                out.put(label);
+                out.put_uint(id);
+                out.put("\n\n");
+            }
+            return;
+        }
+        if (!pending.empty() && pending.back().kind == OPND_MEM)
+        {
+            out.put("  cmp ");
+            put_mem(pending.back().value);
+            out.put(", 0\n");
+            pending.pop_back();
+        }
+        else
+        {
+            top_to_rax();
+            out.put("  test rax, rax\n");
+        }
+        out.put(jump_if_true ? "  jnz " : "  jz ");
+        out.put(label);
+        out.put_uint(id);
+        out.put("\n\n");
+    }
+
+    // writes the top into the slot `offset` above rsp and keeps it
+    void set(int64_t offset)
+    {
+        int64_t held = 8 * (int64_t)pending.size();
+        if (pending.empty() || offset < held)
+        {
+            flush();
+            out.put("  mov rax, [rsp]\n  mov [rsp + ");
+            out.put_int(offset);
+            out.put("], rax\n\n");
+            return;
+        }
+        int64_t target = depth - (offset - held);
+        if (reads(target, 1) || rax_busy(1)) flush_below(1);
+        operand_t top = pending.back();
+        if (top.kind == OPND_IMM && fits32(top.value))
+        {
+            out.put("  mov ");
+            put_mem(target);
+            out.put(", ");
+            out.put_int(top.value);
+            out.put("\n\n");
+            return;
+        }
+        if (top.kind != OPND_RAX)
+        {
+            load(top, false);
+            pending.back() = {OPND_RAX, 0};
+        }
+        out.put("  mov ");
+        put_mem(target);
+        out.put(", rax\n\n");
+    }
+
+    // pops the top into the slot `offset` above the popped rsp
+    void store(int64_t offset)
+    {
+        int64_t held = 8 * ((int64_t)pending.size() - 1);
+        if (pending.empty() || offset < held)
+        {
+            flush();
+            out.put("  pop rax\n  mov [rsp + ");
+            out.put_int(offset);
+            out.put("], rax\n\n");
+            depth -= 8;
+            return;
+        }
+        int64_t target = depth - (offset - held);
+        if (reads(target, 1)) flush_below(1);
+        operand_t top = pending.back();
+        pending.pop_back();
+        operand_t src = top.kind == OPND_RAX ? top : source(top, true, false);
+        out.put("  mov ");
+        put_mem(target);
+        out.put(", ");
+        put_src(src);
+        out.put("\n\n");
+    }
+
+    void shrink(int64_t bytes)
+    {
+        while (bytes > 0 && !pending.empty())
+        {
+            pending.pop_back();
+            bytes -= 8;
+        }
+        if (bytes > 0)
+        {
+            out.put("  add rsp, ");
+            out.put_int(bytes);
+            out.put("\n\n");
+            depth -= bytes;
+        }
+    }
+
+    // array[index]: the element after the length word
+    void load_index()
+    {
+        size_t n = pending.size();
+        if (n >= 1 && pending.back().kind == OPND_IMM && pending.back().value >= 0 && pending.back().value < (1 << 27))
+        {
+            int64_t disp = pending.back().value * 8 + 8;
+            pending.pop_back();
+            top_to_rax();
+            out.put("  mov rax, [rax + ");
+            out.put_int(disp);
+            out.put("]\n");
+        }
+        else
+        {
+            binary(false, false, false);
+            out.put("  mov rax, [rax + rcx * 8 + 8]\n");
+        }
+        pending.push_back({OPND_RAX, 0});
+    }
+
+    // record fields are 1, 2, 4 or 8 bytes wide, sign-extended on load
+    static int width_index(int64_t width) { return width == 8 ? 3 : width == 4 ? 2 : width == 2 ? 1 : 0; }
+
+    void put_field_load(int64_t width)
+    {
+        static constexpr const char *loads[] = {"  movsx rax, BYTE PTR [rax", "  movsx rax, WORD PTR [rax",
+                                                "  movsxd rax, DWORD PTR [rax", "  mov rax, QWORD PTR [rax"};
+        out.put(std::string_view(loads[width_index(width)]));
+    }
+
+    // record.field: the address is popped into rax, the field is one
+    // fixed-displacement load
+    void load_field(int64_t offset, int64_t width)
+    {
+        top_to_rax();
+        put_field_load(width);
+        out.put(" + ");
+        out.put_int(offset);
+        out.put("]\n");
+        pending.push_back({OPND_RAX, 0});
+    }
+
+    // the value below the address is stored into the field and stays
+    void store_field(int64_t offset, int64_t width)
+    {
+        static constexpr const char *ptrs[] = {"  mov BYTE PTR [rcx + ", "  mov WORD PTR [rcx + ",
+                                               "  mov DWORD PTR [rcx + ", "  mov QWORD PTR [rcx + "};
+        static constexpr const char *regs[] = {"], al\n", "], ax\n", "], eax\n", "], rax\n"};
+        if (rax_busy(2)) flush_below(2);
+        if (pending.empty())
+        {
+            out.put("  pop rcx\n");
+            depth -= 8;
+        }
+        else
+        {
+            load(pending.back(), true);
+            pending.pop_back();
+        }
+        // below the address there is either a pending operand or the real top
+        operand_t v = pending.empty() ? operand_t{OPND_MEM, depth} : pending.back();
+        bool imm = v.kind == OPND_IMM && fits32(v.value);
+        if (!imm) load(v, false);
+        int w = width_index(width);
+        out.put(std::string_view(ptrs[w]));
+        out.put_int(offset);
+        if (imm)
+        {
+            int bits = 8 * (int)width;
+            out.put("], ");
+            out.put_int(width == 8 ? v.value : (int64_t)((uint64_t)v.value << (64 - bits)) >> (64 - bits));
+            out.put('\n');
+            return;
+        }
+        out.put(std::string_view(regs[w]));
+    }
+
+    // reg *= k for a positive constant
+    void put_scale(std::string_view reg, int64_t k)
+    {
+        int shift = log2_exact(k);
+        out.put(shift >= 0 ? "  shl " : "  imul ");
+        out.put(reg);
+        out.put(", ");
+        if (shift < 0)
+        {
+            out.put(reg);
+            out.put(", ");
+        }
+        out.put_int(shift >= 0 ? shift : k);
+        out.put('\n');
+    }
+
+    // the address of a record array element: the index is popped into rcx
+    // and the base into rax. stride is the record size for an array of
+    // records, or the field width with `column` bytes per element of the
+    // fields before it for a structure of arrays, whose columns start
+    // count * column past the header. with `load`, the field at `offset`
+    // is read through the same address instead of materializing it
+    void record_element(int64_t stride, int64_t column, int64_t offset, int64_t width, bool load_value)
+    {
+        binary(false, false, false);
+        if (column)
+        {
+            out.put("  mov rdx, [rax]\n");
+            put_scale("rdx", column);
+            out.put("  add rax, rdx\n");
+        }
+        int64_t scale = stride;
+        if (stride != 1 && stride != 2 && stride != 4 && stride != 8)
+        {
+            put_scale("rcx", stride);
+            scale = 1;
+        }
+        if (load_value)
+        {
+            put_field_load(width);
+        }
+        else
+        {
+            out.put("  lea rax, [rax");
+        }
+        out.put(" + rcx * ");
+        out.put_int(scale);
+        out.put(" + ");
+        out.put_int(8 + offset);
+        out.put("]\n");
+        pending.push_back({OPND_RAX, 0});
+    }
+};
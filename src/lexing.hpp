@@ -1,8 +1,11 @@
 #pragma once
 #include <stdint.h>
+#include <charconv>
+#include <string>
 #include <string_view>
 #include <string.h>
 #include <ctype.h>
+#include "utils.hpp"
 
 
 enum LexTokenType {
@@ -10,7 +13,6 @@ LEX_TOKEN_EOF = 0,
 LEX_TOKEN_ID,
 LEX_TOKEN_INT ,
 LEX_TOKEN_FLOAT,
-LEX_TOKEN_HEX ,
 LEX_TOKEN_STR ,
 LEX_TOKEN_OP,
 LEX_TOKEN_NEWLINE
@@ -20,11 +22,21 @@ LEX_TOKEN_NEWLINE
 struct lex_token_t {
     LexTokenType type; 
     std::string_view value;
+    union {
+        int64_t int_value = 0;  // LEX_TOKEN_INT, decoded by the lexer
+        double float_value;     // LEX_TOKEN_FLOAT
+    };
     lex_token_t(LexTokenType type, std::string_view value) : type(type), value(value) {}
 };
 
-const char * lex_operators = "+-*/%&|:?^~<>=,;(){}[].!";
-const char * lex_operators_single = "~,;(){}[]";
+// 10^0 .. 10^22, the powers of ten a double holds exactly
+inline constexpr double exact_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+inline constexpr const char * lex_operators = "+-*/%&|:?^~<>=,;(){}[].!";
+inline constexpr const char * lex_operators_single = "~,;(){}[]";
 
 
 struct lexer_t {
@@ -79,21 +91,107 @@ struct lexer_t {
         return lex_token_t(LEX_TOKEN_OP, std::string_view(start, cur - start));
     }
 
+    // numbers are decoded here, once, so nothing downstream parses text:
+    // decimal integers up to INT64_MAX, 0x / 0b literals of up to 64 bits
+    // taken as a bit pattern, and floats with an optional signed exponent
     lex_token_t read_number()
     {
         char * start = cur;
-        if (*cur == '0' && (cur[1] == 'x' || cur[1] == 'X')) {
-            cur += 2;
-            while (isxdigit(*cur)) cur++;
-            return lex_token_t(LEX_TOKEN_HEX, std::string_view(start, cur - start));
+        if (*cur == '0' && (cur[1] | 0x20) == 'x') return read_radix(start, 4);
+        if (*cur == '0' && (cur[1] | 0x20) == 'b') return read_radix(start, 1);
+        uint64_t value = 0;
+        bool overflow = false;
+        for (; isdigit(*cur); cur++) {
+            unsigned d = *cur - '0';
+            overflow |= value > (UINT64_MAX - d) / 10;
+            value = value * 10 + d;
+        }
+        if (*cur == '.' || *cur == 'e' || *cur == 'E') return read_float(start);
+        end_number(start);
+        if (overflow || value > (uint64_t)INT64_MAX) {
+            throw utils::error_t(line, "Integer literal out of range: " + std::string(start, cur - start));
+        }
+        lex_token_t token(LEX_TOKEN_INT, std::string_view(start, cur - start));
+        token.int_value = (int64_t)value;
+        return token;
+    }
+
+    // digits of 2^bits_per_digit after the 0x / 0b prefix
+    lex_token_t read_radix(char * start, int bits_per_digit)
+    {
+        cur += 2;
+        uint64_t value = 0;
+        char * digits = cur;
+        for (;; cur++) {
+            int d = isdigit(*cur) ? *cur - '0' : isxdigit(*cur) ? (*cur | 0x20) - 'a' + 10 : -1;
+            if (d < 0 || d >> bits_per_digit) break;
+            if (value >> (64 - bits_per_digit)) {
+                while (isxdigit(*cur)) cur++;
+                throw utils::error_t(line, "Integer literal out of range: " + std::string(start, cur - start));
+            }
+            value = value << bits_per_digit | d;
+        }
+        if (cur == digits) end_number(start, true);
+        end_number(start);
+        lex_token_t token(LEX_TOKEN_INT, std::string_view(start, cur - start));
+        token.int_value = (int64_t)value;
+        return token;
+    }
+
+    // digits[.digits][(e|E)[+|-]digits]. up to 19 significant digits and a
+    // power of ten a double holds exactly make one exact multiply or divide
+    // (Clinger's fast path); anything else goes to std::from_chars, which is
+    // correctly rounded and does not allocate
+    lex_token_t read_float(char * start)
+    {
+        cur = start;
+        uint64_t mantissa = 0;
+        int digits = 0, exponent = 0;
+        for (; isdigit(*cur); cur++) {
+            if (digits < 19) mantissa = mantissa * 10 + (*cur - '0');
+            else exponent++;
+            if (mantissa) digits++;
         }
-        while (isdigit(*cur)) cur++;
-        if (*cur == '.' || *cur == 'e' || *cur == 'E') {
+        if (*cur == '.') {
+            for (cur++; isdigit(*cur); cur++) {
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + (*cur - '0');
+                    exponent--;
+                }
+                if (mantissa) digits++;
+            }
+        }
+        if ((*cur | 0x20) == 'e') {
             cur++;
-            while (isdigit(*cur)) cur++;
-            return lex_token_t(LEX_TOKEN_FLOAT, std::string_view(start, cur - start));
+            bool negative = *cur == '-';
+            if (*cur == '-' || *cur == '+') cur++;
+            if (!isdigit(*cur)) end_number(start, true);
+            int e = 0;
+            for (; isdigit(*cur); cur++) {
+                if (e < 100000) e = e * 10 + (*cur - '0');
+            }
+            exponent += negative ? -e : e;
+        }
+        end_number(start);
+        lex_token_t token(LEX_TOKEN_FLOAT, std::string_view(start, cur - start));
+        if (digits <= 19 && mantissa <= (uint64_t)1 << 53 && exponent >= -22 && exponent <= 22) {
+            double m = (double)mantissa;
+            token.float_value = exponent < 0 ? m / exact_powers_of_ten[-exponent] : m * exact_powers_of_ten[exponent];
+            return token;
+        }
+        auto res = std::from_chars(start, cur, token.float_value);
+        if (res.ec == std::errc::result_out_of_range) {
+            throw utils::error_t(line, "Float literal out of range: " + std::string(token.value));
         }
-        return lex_token_t(LEX_TOKEN_INT, std::string_view(start, cur - start));
+        return token;
+    }
+
+    // a number runs into a letter, or is cut short, as in `12ab`, `0x` or `1e`
+    void end_number(char * start, bool cut_short = false)
+    {
+        if (!cut_short && !isalnum(*cur) && *cur != '_') return;
+        while (isalnum(*cur) || *cur == '_') cur++;
+        throw utils::error_t(line, "Malformed number literal: " + std::string(start, cur - start));
     }
 
     lex_token_t read_string()
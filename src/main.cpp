@@ -1,65 +1,647 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <chrono>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "lexing.hpp"
 #include "parsing.hpp"
 #include "codegen.hpp"
+#include "passes.hpp"
+#include "regcode.hpp"
+#include "cache.hpp"
+#include "thread_pool.hpp"
+#include "server.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
 #include "utils.hpp"
 
 
+// counts every heap allocation of the compiler for --stats
+void * operator new(size_t size) {
+    stats::note_alloc(size);
+    if(void * p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void * p) noexcept { free(p); }
+void operator delete(void * p, size_t) noexcept { free(p); }
 
+enum StatsMode { STATS_NONE = 0, STATS_TEXT, STATS_JSON };
 
+struct driver_options_t {
+    const char * input = nullptr;
+    std::string output = "out";
+    bool trace = false;
+    bool dump = false;         // echo the source, tokens, AST and progress to stdout
+    bool run = false;          // exec the program once it is built
+    bool use_cache = true;
+    StatsMode stats = STATS_NONE;  // per-phase report on stderr
+    std::vector<char *> run_args;
 
-int main(int argc, char **argv) {
-    if(argc == 1) {
-        std::cerr << "No input file provided" << std::endl;
-        return 1;
+    bool batch = false;        // every positional argument is an input file or directory
+    std::vector<std::string> inputs;
+    std::string out_dir = "toy_out";
+    size_t jobs = 0;
+
+    bool profile = false;      // instrument every statement, dump counters to profile_out at exit
+    std::string profile_out = "toy.prof";
+    const char * report_profile = nullptr;  // annotate input with this profile instead of compiling
+    const char * profile_use = nullptr;     // lay out branches from this profile
+    std::string profile_use_hash;           // of the profile's contents, for the cache key
+    bool debug = false;        // DWARF line table and CFI for perf / gdb
+    bool freestanding = false; // _start entry, linked -nostdlib -static
+
+    int opt_level = 2;         // -O0 / -O1 / -O2, see pass_manager_t
+    std::vector<std::string> disabled_passes;
+    std::vector<std::string> print_after;  // dump the AST or bytecode to stderr after these passes
+    bool list_passes = false;
+    bool disasm = false;       // print the verified bytecode with stack depths instead of compiling
+    bool regcode = false;      // emit through the register bytecode, see regcode.hpp
+
+    bool daemon = false;       // serve compiles on socket_path until killed, see server.hpp
+    bool connect = false;      // hand the compile to the daemon on socket_path
+    std::string socket_path;   // "" for toyd::default_socket()
+
+    // absolute path recorded in the line table
+    static std::string debug_path(const std::string & src_path) {
+        char * abs = realpath(src_path.c_str(), nullptr);
+        std::string path = abs ? abs : src_path;
+        free(abs);
+        return path;
+    }
+
+    // everything that changes the produced executable, folded into the cache key
+    std::string codegen_key(const std::string & src_path) const {
+        std::string key = freestanding ? "gcc -nostdlib -static -no-pie" : "gcc -no-pie";
+        if(debug) key += " -g " + debug_path(src_path);
+        if(profile) key += " profile=" + profile_out;
+        if(profile_use) key += " profile-use=" + profile_use_hash;
+        key += " -O" + std::to_string(opt_level);
+        for(auto & name : disabled_passes) key += " --disable-pass " + name;
+        if(regcode) key += " --regcode";
+        return key;
     }
+};
 
-    std::string src = utils::read_file_as_string(argv[1]);
+static void usage() {
+    std::cerr << "usage: toy [--run] [--no-cache] [--trace] [--dump] [--stats[=json]] [-g] [-O0|-O1|-O2] [--freestanding] [-o out] file.tl [args...]" << std::endl;
+    std::cerr << "       toy [--disable-pass name[,name...]] [--print-after name|all] ... file.tl" << std::endl;
+    std::cerr << "       toy --list-passes" << std::endl;
+    std::cerr << "       toy --disasm [--regcode] [--profile-use toy.prof] [-O0|-O1|-O2] [--disable-pass name[,name...]] file.tl" << std::endl;
+    std::cerr << "       toy --regcode [--run] [-O0|-O1|-O2] [--freestanding] [-o out] file.tl [args...]" << std::endl;
+    std::cerr << "       toy --profile [--profile-out toy.prof] [--run] file.tl [args...]" << std::endl;
+    std::cerr << "       toy --profile-use toy.prof [-o out] file.tl" << std::endl;
+    std::cerr << "       toy --profile-report toy.prof file.tl" << std::endl;
+    std::cerr << "       toy --batch [-j N] [-g] [--out-dir dir] [--no-cache] (file.tl | dir)..." << std::endl;
+    std::cerr << "       toy --daemon [--socket path] [-j N] [--no-cache]" << std::endl;
+    std::cerr << "       toy --connect [--socket path] [--run] [-O0|-O1|-O2] [--freestanding] [-o out] file.tl [args...]" << std::endl;
+}
 
-    lexer_t lexer;
-    std::cout << "> Lexing..." << std::endl;
-    try {
-        lexer.init(src.c_str(), src.size());
-        while (lexer.has_token())
-        {
-            auto token = lexer.next_token();
-            std::cout << "token: " << token.value
-                        << " line: " << lexer.line << std::endl;
-        }
-        std::cout << "> Lexed" << std::endl;
-    } catch (utils::error_t & e) {
-        std::cerr << e.what() << std::endl;
+static bool parse_args(int argc, char **argv, driver_options_t & opts) {
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(opts.input) opts.run_args.push_back(argv[i]);
+        else if(arg == "--trace") opts.trace = true;
+        else if(arg == "--dump") opts.dump = true;
+        else if(arg == "--run") opts.run = true;
+        else if(arg == "--no-cache") opts.use_cache = false;
+        else if(arg == "--stats") opts.stats = STATS_TEXT;
+        else if(arg == "--stats=json") opts.stats = STATS_JSON;
+        else if(arg == "-o" && i + 1 < argc) opts.output = argv[++i];
+        else if(arg == "--batch") opts.batch = true;
+        else if(arg == "--out-dir" && i + 1 < argc) opts.out_dir = argv[++i];
+        else if(arg == "-j" && i + 1 < argc) opts.jobs = strtoul(argv[++i], nullptr, 10);
+        else if(arg == "--profile") opts.profile = true;
+        else if(arg == "-g") opts.debug = true;
+        else if(arg == "--freestanding") opts.freestanding = true;
+        else if(arg == "--profile-out" && i + 1 < argc) opts.profile_out = argv[++i];
+        else if(arg == "--profile-report" && i + 1 < argc) opts.report_profile = argv[++i];
+        else if(arg == "--profile-use" && i + 1 < argc) opts.profile_use = argv[++i];
+        else if(arg == "-O0" || arg == "-O1" || arg == "-O2") opts.opt_level = arg[2] - '0';
+        else if(arg == "--disable-pass" && i + 1 < argc) {
+            std::string list = argv[++i];
+            for(size_t pos = 0; pos <= list.size();) {
+                size_t comma = std::min(list.find(',', pos), list.size());
+                if(comma > pos) opts.disabled_passes.push_back(list.substr(pos, comma - pos));
+                pos = comma + 1;
+            }
+        }
+        else if(arg == "--print-after" && i + 1 < argc) opts.print_after.push_back(argv[++i]);
+        else if(arg == "--list-passes") opts.list_passes = true;
+        else if(arg == "--disasm") opts.disasm = true;
+        else if(arg == "--regcode") opts.regcode = true;
+        else if(arg == "--daemon") opts.daemon = true;
+        else if(arg == "--connect") opts.connect = true;
+        else if(arg == "--socket" && i + 1 < argc) opts.socket_path = argv[++i];
+        else if(arg[0] == '-') return false;
+        else if(opts.batch) opts.inputs.push_back(arg);
+        else opts.input = argv[i];
     }
-  
+    if(opts.daemon) return !opts.input && !opts.batch && !opts.connect;
+    if(opts.batch) return !opts.inputs.empty() && !opts.run;
+    return opts.input != nullptr || opts.list_passes;
+}
+
+static int exec_program(const std::string & path, driver_options_t & opts) {
+    std::vector<char *> args;
+    args.push_back((char *)path.c_str());
+    args.insert(args.end(), opts.run_args.begin(), opts.run_args.end());
+    args.push_back(nullptr);
+    std::string exe = path.find('/') == std::string::npos ? "./" + path : path;
+    execv(exe.c_str(), args.data());
+    std::cerr << "Failed to execute " << path << std::endl;
+    return 127;
+}
+
+// lexes, parses and generates `asm_path`, then assembles it into `exe_path`.
+// holds no shared state, so several compiles can run on different threads
+static bool compile(const std::string & src, const std::string & src_path,
+                    const std::string & asm_path, const std::string & exe_path,
+                    const driver_options_t & opts, bool verbose, std::string & error,
+                    compile_stats_t * stats = nullptr, const program_profile_t * profile_use = nullptr) {
+    if(verbose) {
+        std::cout << src << std::endl;
+        lexer_t lexer;
+        std::cout << "> Lexing..." << std::endl;
+        try {
+            lexer.init(src.c_str(), src.size());
+            while (lexer.has_token())
+            {
+                auto token = lexer.next_token();
+                std::cout << "token: " << token.value
+                            << " line: " << lexer.line << std::endl;
+            }
+            std::cout << "> Lexed" << std::endl;
+        } catch (utils::error_t & e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
     parser_t parser;
-    std::cout << "> Parsing..." << std::endl;
+    if(verbose) std::cout << "> Parsing..." << std::endl;
     try {
-        ast_t ast = parser.parse(src.c_str(), src.size());
-        std::cout << "> Parsed AST" << std::endl;
-        std::cout << "ast node size: " << sizeof(ast) << std::endl;
-        parser.print(ast);
+        std::vector<lex_token_t> tokens;
+        std::vector<size_t> line_nos;
+        if(stats) stats->begin("lex");
+        parser.tokenize(src.c_str(), src.size(), tokens, line_nos);
+        if(stats) {
+            stats->end();
+            stats->tokens = tokens.size() - 1;
+            stats->begin("parse");
+        }
+        ast_t ast = parser.parse_program(tokens, line_nos);
+        if(stats) {
+            stats->end();
+            stats->ast_nodes = ast_node_count(ast);
+        }
+        if(verbose) {
+            std::cout << "> Parsed AST" << std::endl;
+            std::cout << "ast node size: " << sizeof(ast) << std::endl;
+            parser.print(ast);
+            std::cout << "> Generating code..." << std::endl;
+        }
 
-        std::cout << "> Generating code..." << std::endl;
         code_generator_t codegen;
-        var_context_t ctx;
-        auto program = codegen.gen_program(ast);
-        std::cout << "> Generated code" << std::endl;
-        std::cout << "program bytecode size: " << program.bytecode.size() << std::endl;
-        std::cout << "bytecode: " << std::endl;
-        std::string asm_code = program.asm_str(true);
-        utils::write_string_to_file("asm_code.s", asm_code);
+        codegen.trace = opts.trace;
+        codegen.profile = opts.profile;
+        codegen.profile_use = profile_use;
+        codegen.debug_lines = opts.debug;
+        pass_manager_t pm;
+        pm.level = opts.opt_level;
+        pm.disabled.insert(opts.disabled_passes.begin(), opts.disabled_passes.end());
+        pm.print_after.insert(opts.print_after.begin(), opts.print_after.end());
+        auto program = pm.run(ast, codegen, stats);
+        if(stats) stats->bytecode_bytes = program.bytecode.size();
+        if(verbose) {
+            std::cout << "> Generated code" << std::endl;
+            std::cout << "program bytecode size: " << program.bytecode.size() << std::endl;
+            std::cout << "bytecode: " << std::endl;
+        }
+        program.trace = opts.trace;
+        program.freestanding = opts.freestanding;
+        program.profile_path = opts.profile_out;
+        program.profile_source_hash = hash_bytes(src.data(), src.size());
+        if(opts.debug) program.debug_source = driver_options_t::debug_path(src_path);
+        if(stats) stats->begin("emit");
+        if(opts.regcode) write_regcode_asm_file(translate_to_regcode(program.bytecode), asm_path, opts.freestanding);
+        else program.write_asm_file(asm_path, true);
+        if(stats) stats->end();
         // compile using gcc
-        std::string cmd = "gcc -no-pie -o out asm_code.s";
-        system(cmd.c_str());
-        std::cout << "> Compiled code" << std::endl;
-    
+        if(stats) stats->begin("assemble");
+        int rc = utils::run_command(link_command(asm_path, exe_path, opts.freestanding));
+        if(stats) stats->end();
+        if(rc != 0) {
+            error = "Assembling " + asm_path + " failed";
+            return false;
+        }
+        if(verbose) std::cout << "> Compiled code" << std::endl;
+
+    } catch (utils::error_t & e) {
+        error = e.what();
+        return false;
+    }
+    return true;
+}
+
+// the final bytecode with the stack depth before every instruction and the
+// source line of every statement, then the deepest stack of each body.
+// problems the verifier finds go to stderr. with a profile the cold blocks
+// are laid out as --profile-use would
+static int disassemble_program(const std::string & src, const driver_options_t & opts,
+                               const program_profile_t * profile_use) {
+    try {
+        parser_t parser;
+        std::vector<lex_token_t> tokens;
+        std::vector<size_t> line_nos;
+        parser.tokenize(src.c_str(), src.size(), tokens, line_nos);
+        ast_t ast = parser.parse_program(tokens, line_nos);
+        code_generator_t codegen;
+        codegen.debug_lines = true;
+        codegen.profile_use = profile_use;
+        pass_manager_t pm;
+        pm.level = opts.opt_level;
+        pm.disabled.insert(opts.disabled_passes.begin(), opts.disabled_passes.end());
+        auto program = pm.run(ast, codegen);
+        if(opts.regcode) {
+            reg_program_t regs = translate_to_regcode(program.bytecode);
+            disassemble_regcode(stdout, regs);
+            size_t stack_insns = 0;
+            for(size_t i = 0; i < program.bytecode.size(); i += bytecode_size(&program.bytecode[i])) {
+                if(program.bytecode[i] != BC_LINE) stack_insns++;
+            }
+            printf("; %zu instructions over %d registers, from %zu stack instructions\n", regs.code.size(),
+                   regs.registers, stack_insns);
+            return 0;
+        }
+        bytecode_check_t check = verify_bytecode(program.bytecode, true);
+        disassemble(stdout, program.bytecode, &check, src);
+        for(auto & body : check.bodies) {
+            if(body.kind == std::string_view("main")) printf("; main: %lld bytes of stack\n", (long long)body.max_depth);
+            else printf("; %s%lld: %lld bytes of stack\n", body.kind, (long long)body.id, (long long)body.max_depth);
+        }
+        for(auto & e : check.errors) std::cerr << "bytecode " << e << std::endl;
+        return check.ok() ? 0 : 1;
     } catch (utils::error_t & e) {
         std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
+
+static void collect_inputs(const std::string & path, std::vector<std::string> & files) {
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        files.push_back(path);
+        return;
+    }
+    DIR * d = opendir(path.c_str());
+    if(!d) return;
+    std::vector<std::string> names;
+    while(struct dirent * e = readdir(d)) {
+        if(e->d_name[0] != '.') names.push_back(e->d_name);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    for(auto & name : names) {
+        std::string child = path + "/" + name;
+        if(stat(child.c_str(), &st) != 0) continue;
+        if(S_ISDIR(st.st_mode)) collect_inputs(child, files);
+        else if(name.size() > 3 && name.compare(name.size() - 3, 3, ".tl") == 0) files.push_back(child);
+    }
+}
+
+// out_dir/<input path without .tl>, so inputs sharing a basename never collide
+static std::string batch_output_path(const std::string & out_dir, const std::string & input) {
+    std::string rel = input;
+    while(rel.compare(0, 2, "./") == 0) rel.erase(0, 2);
+    while(!rel.empty() && rel[0] == '/') rel.erase(0, 1);
+    for(size_t pos; (pos = rel.find("../")) != std::string::npos;) rel.replace(pos, 3, "__/");
+    if(rel.size() > 3 && rel.compare(rel.size() - 3, 3, ".tl") == 0) rel.resize(rel.size() - 3);
+    return out_dir + "/" + rel;
+}
+
+static int run_batch(const driver_options_t & opts) {
+    std::vector<std::string> files;
+    for(auto & in : opts.inputs) collect_inputs(in, files);
+
+    compile_cache_t cache;
+    if(opts.use_cache) cache.init(compile_cache_t::default_dir());
+
+    std::mutex report_mutex;
+    std::atomic<size_t> failed{0};
+    std::atomic<size_t> source_bytes{0};
+    auto start = std::chrono::steady_clock::now();
+    {
+        thread_pool_t pool(opts.jobs ? opts.jobs : thread_pool_t::default_size());
+        for(auto & file : files) {
+            pool.submit([&, file] {
+                auto t0 = std::chrono::steady_clock::now();
+                std::string exe = batch_output_path(opts.out_dir, file);
+                std::string error, src, status = "ok";
+                bool ok = utils::read_file(file, src);
+                if(!ok) error = "Failed to open file";
+                else {
+                    source_bytes += src.size();
+                    compile_cache_t::make_dirs(exe.substr(0, exe.rfind('/')));
+                    std::string key, hit;
+                    if(opts.use_cache) {
+                        key = compile_cache_t::make_key(src, opts.codegen_key(file));
+                        hit = cache.lookup(key);
+                    }
+                    if(!hit.empty()) {
+                        status = "cached";
+                        ok = compile_cache_t::copy_file(hit, exe, 0755);
+                        if(!ok) error = "Failed to write " + exe;
+                    } else {
+                        ok = compile(src, file, exe + ".s", exe, opts, false, error);
+                        if(ok && opts.use_cache) cache.store(key, exe);
+                    }
+                }
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+                if(!ok) failed++;
+                std::lock_guard<std::mutex> lock(report_mutex);
+                if(ok) printf("[%s] %s -> %s (%.1f ms)\n", status.c_str(), file.c_str(), exe.c_str(), ms);
+                else printf("[FAIL] %s: %s\n", file.c_str(), error.c_str());
+                fflush(stdout);
+            });
+        }
+        pool.wait();
     }
-    
-    
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("> %zu files, %zu failed, %.3f s, %.1f files/s, %.2f MB/s of source\n", files.size(), failed.load(),
+           secs, files.size() / secs, source_bytes.load() / secs / (1 << 20));
+    return failed ? 1 : 0;
+}
+
+// builds for clients of toy --connect. executables stay in the on-disk cache
+// or, with --no-cache, in <socket>.d next to the socket, which is emptied on
+// every start; either way a repeated request is answered without compiling
+static int run_daemon(const driver_options_t & opts) {
+    compile_cache_t cache;
+    if(opts.use_cache) cache.init(compile_cache_t::default_dir());
+    std::mutex built_mutex;
+    std::unordered_map<std::string, std::string> built;  // key -> executable in scratch, without a cache
+    std::atomic<size_t> seq{0};
 
+    toyd_server_t server;
+    server.socket_path = opts.socket_path;
+    if(opts.jobs) server.jobs = opts.jobs;
+    std::string error;
+    if(!server.listen(error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    // emptied only once the socket is ours; a running daemon may still use it.
+    // one left from an earlier run is reused only if it is still a directory
+    // private to this user, since clients run what the daemon writes there
+    std::string scratch = opts.socket_path + ".d";
+    if(mkdir(scratch.c_str(), 0700) != 0 && errno != EEXIST) {
+        std::cerr << "Failed to create " << scratch << std::endl;
+        return 1;
+    }
+    struct stat st;
+    if(lstat(scratch.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+       (st.st_mode & 07777) != 0700) {
+        std::cerr << scratch << " is not a directory owned by this user with mode 0700" << std::endl;
+        return 1;
+    }
+    if(DIR * d = opendir(scratch.c_str())) {
+        while(struct dirent * e = readdir(d)) {
+            if(e->d_name[0] != '.') unlink((scratch + "/" + e->d_name).c_str());
+        }
+        closedir(d);
+    }
+
+    server.handler = [&](const toyd_request_t & req) {
+        toyd_reply_t reply;
+        if(req.opt_level > 2) {
+            reply.message = "Unknown optimization level: " + std::to_string(req.opt_level);
+            return reply;
+        }
+        driver_options_t ropts = opts;
+        ropts.opt_level = req.opt_level;
+        ropts.freestanding = req.freestanding;
+        std::string key = compile_cache_t::make_key(req.source, ropts.codegen_key(req.source_path));
+        std::string exe;
+        if(opts.use_cache) exe = cache.lookup(key);
+        else {
+            std::lock_guard<std::mutex> lock(built_mutex);
+            auto it = built.find(key);
+            if(it != built.end()) exe = it->second;
+        }
+        reply.cached = !exe.empty();
+        if(exe.empty()) {
+            std::string path = scratch + "/" + std::to_string(seq++);
+            bool ok = compile(req.source, req.source_path, path + ".s", path, ropts, false, reply.message);
+            unlink((path + ".s").c_str());
+            if(!ok) {
+                unlink(path.c_str());
+                return reply;
+            }
+            exe = path;
+            if(opts.use_cache) {
+                if(cache.store(key, path)) {
+                    unlink(path.c_str());
+                    exe = cache.entry_path(key);
+                }
+            } else {
+                std::lock_guard<std::mutex> lock(built_mutex);
+                built.emplace(key, path);
+            }
+        }
+        if(req.kind == TOYD_RUN) {
+            std::vector<std::string> argv = {exe};
+            argv.insert(argv.end(), req.args.begin(), req.args.end());
+            reply.exit_code = utils::run_capture(exe, argv, reply.output);
+            if(reply.exit_code < 0) reply.message = "Failed to execute " + exe;
+        } else if(!req.output.empty()) {
+            if(!compile_cache_t::copy_file(exe, req.output, 0755)) reply.message = "Failed to write " + req.output;
+        }
+        reply.exe = req.output.empty() ? exe : req.output;
+        reply.ok = reply.message.empty();
+        return reply;
+    };
+    std::cout << "> toyd listening on " << opts.socket_path << std::endl;
+    server.run(error);
+    std::cerr << error << std::endl;
+    return 1;
+}
+
+// the thin client: sends the source to the daemon, which writes the
+// executable to -o; with --run the daemon's copy is executed in place
+static int run_client(const driver_options_t & opts) {
+    toyd_request_t req;
+    if(!utils::read_file(opts.input, req.source)) {
+        std::cerr << "Failed to open file: " << opts.input << std::endl;
+        return 1;
+    }
+    req.source_path = opts.input;
+    req.opt_level = opts.opt_level;
+    req.freestanding = opts.freestanding;
+    if(!opts.run) {
+        // the daemon may run in another directory
+        req.output = opts.output;
+        if(req.output[0] != '/') {
+            char * cwd = getcwd(nullptr, 0);
+            req.output = std::string(cwd ? cwd : ".") + "/" + req.output;
+            free(cwd);
+        }
+    }
+    int fd = toyd::connect_to(opts.socket_path);
+    if(fd < 0) {
+        std::cerr << "No toyd listening on " << opts.socket_path << ", start one with toy --daemon" << std::endl;
+        return 1;
+    }
+    toyd_reply_t reply;
+    bool answered = toyd::call(fd, req, reply);
+    close(fd);
+    if(!answered) {
+        std::cerr << "Lost the connection to toyd on " << opts.socket_path << std::endl;
+        return 1;
+    }
+    if(!reply.ok) {
+        std::cerr << reply.message << std::endl;
+        return 1;
+    }
+    if(opts.run) {
+        driver_options_t run_opts = opts;
+        return exec_program(reply.exe, run_opts);
+    }
+    return 0;
+}
+
+static int report_profile(const driver_options_t & opts) {
+    program_profile_t profile;
+    if(!profile.load(opts.report_profile)) {
+        std::cerr << "Failed to read profile: " << opts.report_profile << std::endl;
+        return 1;
+    }
+    std::string src;
+    if(!utils::read_file(opts.input, src)) {
+        std::cerr << "Failed to open file: " << opts.input << std::endl;
+        return 1;
+    }
+    profile.print_annotated(stdout, src);
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    driver_options_t opts;
+    if(!parse_args(argc, argv, opts)) {
+        if(argc == 1) std::cerr << "No input file provided" << std::endl;
+        usage();
+        return 1;
+    }
+    if(opts.list_passes) {
+        pass_manager_t::list(stdout);
+        return 0;
+    }
+    for(auto & name : opts.disabled_passes) {
+        if(!pass_manager_t::find(name)) {
+            std::cerr << "Unknown pass: " << name << std::endl;
+            return 1;
+        }
+    }
+    for(auto & name : opts.print_after) {
+        if(name != "all" && !pass_manager_t::find(name)) {
+            std::cerr << "Unknown pass: " << name << std::endl;
+            return 1;
+        }
+    }
+    if(opts.daemon || opts.connect) {
+        // everything else changes the output in ways the protocol cannot carry
+        if(opts.trace || opts.stats || opts.debug || opts.profile || opts.profile_use || opts.report_profile
+           || opts.batch || opts.regcode || !opts.disabled_passes.empty() || !opts.print_after.empty()) {
+            std::cerr << "--daemon and --connect take only the options shown in the usage" << std::endl;
+            usage();
+            return 1;
+        }
+        if(opts.socket_path.empty()) opts.socket_path = toyd::default_socket();
+        return opts.daemon ? run_daemon(opts) : run_client(opts);
+    }
+    // the register code carries neither line markers nor profile counters
+    if(opts.regcode && (opts.debug || opts.profile || opts.profile_use)) {
+        std::cerr << "--regcode cannot be combined with -g, --profile or --profile-use" << std::endl;
+        return 1;
+    }
+    // a cached executable would skip the passes whose output was asked for
+    if(!opts.print_after.empty()) opts.use_cache = false;
+    if(opts.batch) return run_batch(opts);
+    if(opts.report_profile) return report_profile(opts);
+
+    compile_stats_t stats_data;
+    compile_stats_t * stats = opts.stats ? &stats_data : nullptr;
+    auto report = [&] {
+        if(opts.stats == STATS_TEXT) stats->print_text(stderr);
+        else if(opts.stats == STATS_JSON) stats->print_json(stderr);
+    };
+
+    std::string src;
+    if(stats) stats->begin("read");
+    if(!utils::read_file(opts.input, src)) {
+        std::cerr << "Failed to open file: " << opts.input << std::endl;
+        return 1;
+    }
+    if(stats) {
+        stats->end();
+        stats->source_bytes = src.size();
+    }
+
+    program_profile_t profile_data;
+    const program_profile_t * profile_use = nullptr;
+    if(opts.profile_use) {
+        std::string raw;
+        if(!utils::read_file(opts.profile_use, raw) || !profile_data.load(opts.profile_use)) {
+            std::cerr << "Failed to read profile: " << opts.profile_use << std::endl;
+            return 1;
+        }
+        if(profile_data.source_hash != hash_bytes(src.data(), src.size())) {
+            std::cerr << "warning: " << opts.profile_use << " was recorded for a different version of "
+                      << opts.input << ", ignoring it" << std::endl;
+            opts.profile_use = nullptr;
+        } else {
+            profile_use = &profile_data;
+            opts.profile_use_hash = compile_cache_t::make_key(raw, "");
+        }
+    }
+
+    if(opts.disasm) return disassemble_program(src, opts, profile_use);
+
+    compile_cache_t cache;
+    std::string key;
+    if(opts.use_cache) {
+        if(stats) stats->begin("cache");
+        cache.init(compile_cache_t::default_dir());
+        key = compile_cache_t::make_key(src, opts.codegen_key(opts.input));
+        std::string hit = cache.lookup(key);
+        if(stats) {
+            stats->end();
+            stats->cache_hit = !hit.empty();
+        }
+        if(!hit.empty()) {
+            report();
+            if(opts.run) return exec_program(hit, opts);
+            if(!compile_cache_t::copy_file(hit, opts.output, 0755)) {
+                std::cerr << "Failed to write " << opts.output << std::endl;
+                return 1;
+            }
+            if(opts.dump) std::cout << "> Cached " << key << std::endl;
+            return 0;
+        }
+    }
+
+    std::string error;
+    if(!compile(src, opts.input, "asm_code.s", opts.output, opts, opts.dump, error, stats, profile_use)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    if(opts.use_cache) cache.store(key, opts.output);
+    report();
+    if(opts.run) return exec_program(opts.output, opts);
     return 0;
-}
\ No newline at end of file
+}
@@ -35,6 +35,16 @@ enum ASTType {
     AST_PROGRAM,
     AST_DOT_ACCESS,
     AST_BRACKET_ACCESS,
+    AST_FOR,
+    AST_PARALLEL_FOR,
+    AST_SPAWN,
+    AST_JOIN,
+    AST_GENERATOR,
+    AST_YIELD,
+    AST_FOR_IN,
+    AST_MATCH,
+    AST_CASE,
+    AST_RECORD,
 };
 
 constexpr const char * ASTTypeNames[] = {
@@ -66,6 +76,16 @@ constexpr const char * ASTTypeNames[] = {
     "PROGRAM",
     "DOT_ACCESS",
     "BRACKET_ACCESS",
+    "FOR",
+    "PARALLEL_FOR",
+    "SPAWN",
+    "JOIN",
+    "GENERATOR",
+    "YIELD",
+    "FOR_IN",
+    "MATCH",
+    "CASE",
+    "RECORD",
 };
 
 
@@ -74,8 +94,18 @@ struct ast_t {
     std::string_view value;
     std::vector<ast_t> children;
     size_t line = 0;
+    union {
+        int64_t int_value = 0;  // AST_INT, as decoded by the lexer
+        double float_value;     // AST_FLOAT
+    };
 };
 
+inline size_t ast_node_count(const ast_t & ast) {
+    size_t n = 1;
+    for(const ast_t & child : ast.children) n += ast_node_count(child);
+    return n;
+}
+
 
 
 
@@ -85,10 +115,16 @@ struct parser_t {
     lexer_t lexer;
 
     ast_t parse(const char * code, size_t length) {
-        lexer.init(code, length);
-        size_t avg_token_count = length >> 2;
         std::vector<lex_token_t> tokens;
         std::vector<size_t> line_nos;
+        tokenize(code, length, tokens, line_nos);
+        return parse_program(tokens, line_nos);
+    }
+
+    // fills `tokens` (terminated by an EOF token) and the line of each token
+    void tokenize(const char * code, size_t length, std::vector<lex_token_t> & tokens, std::vector<size_t> & line_nos) {
+        lexer.init(code, length);
+        size_t avg_token_count = length >> 2;
         tokens.reserve(avg_token_count);
         line_nos.reserve(avg_token_count);
         while(lexer.has_token()) {
@@ -96,15 +132,16 @@ struct parser_t {
             tokens.push_back(token);
             line_nos.push_back(lexer.line);
         }
-
-
-        return parse_program(tokens, line_nos);
+        tokens.push_back(lex_token_t(LEX_TOKEN_EOF, ""));
+        line_nos.push_back(lexer.line);
     }
 
     ast_t parse_program(std::vector<lex_token_t> & tokens, std::vector<size_t> & line_nos) {
         ast_t program = {AST_PROGRAM, ""};
         size_t i = 0;
         while(i < tokens.size()) {
+            while(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+            if(tokens[i].type == LEX_TOKEN_EOF) break;
             size_t line = line_nos[i];
             ast_t stmt = parse_stmt(tokens, line_nos, i);
             stmt.line = line;
@@ -117,11 +154,15 @@ struct parser_t {
         lex_token_t& token = tokens[i];
         if(token.type == LEX_TOKEN_INT) {
             i++;
-            return {AST_INT, token.value};
+            ast_t lit = {AST_INT, token.value};
+            lit.int_value = token.int_value;
+            return lit;
         }
         if(token.type == LEX_TOKEN_FLOAT) {
-            i++;
-            return {AST_FLOAT, token.value};
+            ast_t lit = {AST_FLOAT, token.value};
+            lit.float_value = token.float_value;
+            lit.line = line_nos[i++]; // codegen rejects these, so point at the literal
+            return lit;
         }
         if(token.type == LEX_TOKEN_STR) {
             i++;
@@ -187,7 +228,6 @@ struct parser_t {
                 }
                 ast_t member = parse_func_call(tokens, line_nos, i);
                 term = {AST_DOT_ACCESS, "", {term, member}};
-                i++;
             } else if(i < tokens.size() && tokens[i].type == LEX_TOKEN_OP && tokens[i].value == "[") {
                 i++;
                 ast_t index = parse_expr(tokens, line_nos, i);
@@ -323,7 +363,9 @@ struct parser_t {
         }
         i++;
         ast_t block = {AST_BLOCK, ""};
-        while(i < tokens.size() && !(tokens[i].type == LEX_TOKEN_OP && tokens[i].value == "}")) {
+        while(i < tokens.size()) {
+            while(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+            if(tokens[i].type == LEX_TOKEN_EOF || (tokens[i].type == LEX_TOKEN_OP && tokens[i].value == "}")) break;
             ast_t stmt = parse_stmt(tokens, line_nos, i);
             block.children.push_back(stmt);
         }
@@ -335,8 +377,168 @@ struct parser_t {
     }
 
 
+    // `for i = lo, hi { ... }` runs the block for i in [lo, hi);
+    // `for v in gen(args) { ... }` runs it for every value the generator yields,
+    // `for k in m` / `for k, v in m` for every entry of a map (the value
+    // variable, if any, is the fourth child)
+    ast_t parse_for(std::vector<lex_token_t> & tokens, std::vector<size_t> & line_nos, size_t & i, ASTType type) {
+        if(tokens[i].type != LEX_TOKEN_ID) {
+            utils::unexpected_token(line_nos[i], tokens[i].value, "identifier");
+        }
+        ast_t var = {AST_ID, tokens[i].value};
+        i++;
+        bool pair = type == AST_FOR && tokens[i].type == LEX_TOKEN_OP && tokens[i].value == "," &&
+                    tokens[i + 1].type == LEX_TOKEN_ID && tokens[i + 2].type == LEX_TOKEN_ID && tokens[i + 2].value == "in";
+        ast_t value = {AST_ID, pair ? tokens[i + 1].value : ""};
+        if(pair) i += 2;
+        if(type == AST_FOR && tokens[i].type == LEX_TOKEN_ID && tokens[i].value == "in") {
+            i++;
+            ast_t source = parse_expr(tokens, line_nos, i);
+            if(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+            ast_t loop = {AST_FOR_IN, "", {var, source, parse_block(tokens, line_nos, i)}};
+            if(pair) loop.children.push_back(value);
+            return loop;
+        }
+        if(tokens[i].type != LEX_TOKEN_OP || tokens[i].value != "=") {
+            utils::unexpected_token(line_nos[i], tokens[i].value, "=");
+        }
+        i++;
+        ast_t lo = parse_trinary(tokens, line_nos, i);
+        if(tokens[i].type != LEX_TOKEN_OP || tokens[i].value != ",") {
+            utils::unexpected_token(line_nos[i], tokens[i].value, ",");
+        }
+        i++;
+        ast_t hi = parse_trinary(tokens, line_nos, i);
+        if(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+        return {type, "", {var, lo, hi, parse_block(tokens, line_nos, i)}};
+    }
+
+
+    // `generator name(a, b) { ... yield x ... }`
+    ast_t parse_generator(std::vector<lex_token_t> & tokens, std::vector<size_t> & line_nos, size_t & i) {
+        if(tokens[i].type != LEX_TOKEN_ID) {
+            utils::unexpected_token(line_nos[i], tokens[i].value, "identifier");
+        }
+        ast_t name = {AST_ID, tokens[i].value};
+        i++;
+        if(tokens[i].type != LEX_TOKEN_OP || tokens[i].value != "(") {
+            utils::unexpected_token(line_nos[i], tokens[i].value, "(");
+        }
+        i++;
+        ast_t params = {AST_FUNC_PARAMS, ""};
+        while(tokens[i].type == LEX_TOKEN_ID) {
+            params.children.push_back({AST_ID, tokens[i].value});
+            i++;
+            if(tokens[i].type == LEX_TOKEN_OP && tokens[i].value == ",") i++;
+            else break;
+        }
+        if(tokens[i].type != LEX_TOKEN_OP || tokens[i].value != ")") {
+            utils::unexpected_token(line_nos[i], tokens[i].value, ")");
+        }
+        i++;
+        if(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+        return {AST_GENERATOR, "", {name, params, parse_block(tokens, line_nos, i)}};
+    }
+
+
+    // `match e { 1, 2 { ... } 7 { ... } else { ... } }`: each case lists
+    // integer constants, the else case comes last. a case is its constants
+    // followed by the block; else is a CASE with the block only
+    ast_t parse_match(std::vector<lex_token_t> & tokens, std::vector<size_t> & line_nos, size_t & i) {
+        ast_t subject = parse_expr(tokens, line_nos, i);
+        ast_t match = {AST_MATCH, "", {subject}};
+        if(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+        if(tokens[i].type != LEX_TOKEN_OP || tokens[i].value != "{") {
+            utils::unexpected_token(line_nos[i], tokens[i].value, "{");
+        }
+        i++;
+        bool has_else = false;
+        while(i < tokens.size()) {
+            while(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+            if(tokens[i].type == LEX_TOKEN_EOF || (tokens[i].type == LEX_TOKEN_OP && tokens[i].value == "}")) break;
+            if(has_else) {
+                utils::unexpected_token(line_nos[i], tokens[i].value, "}");
+            }
+            ast_t c = {AST_CASE, ""};
+            c.line = line_nos[i];
+            if(tokens[i].type == LEX_TOKEN_ID && tokens[i].value == "else") {
+                i++;
+                c.value = "else";
+                has_else = true;
+            } else {
+                while(true) {
+                    bool negative = tokens[i].type == LEX_TOKEN_OP && tokens[i].value == "-";
+                    if(negative) i++;
+                    if(tokens[i].type != LEX_TOKEN_INT) {
+                        utils::unexpected_token(line_nos[i], tokens[i].value, "integer");
+                    }
+                    ast_t value = {AST_INT, tokens[i].value};
+                    value.int_value = tokens[i].int_value;
+                    c.children.push_back(negative ? ast_t{AST_UNARY_OP, "-", {value}} : value);
+                    i++;
+                    if(tokens[i].type == LEX_TOKEN_OP && tokens[i].value == ",") i++;
+                    else break;
+                }
+            }
+            if(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+            c.children.push_back(parse_block(tokens, line_nos, i));
+            match.children.push_back(c);
+        }
+        if(i >= tokens.size() || tokens[i].type != LEX_TOKEN_OP || tokens[i].value != "}") {
+            utils::unexpected_token(line_nos[i], tokens[i].value, "}");
+        }
+        i++;
+        return match;
+    }
+
+
+    // `record name { a, b: i32, c: i8 }`, optionally prefixed by `soa`:
+    // value "soa" or "", then the name, then one ID per field whose child,
+    // if any, names its type
+    ast_t parse_record(std::vector<lex_token_t> & tokens, std::vector<size_t> & line_nos, size_t & i, bool soa) {
+        if(tokens[i].type != LEX_TOKEN_ID) {
+            utils::unexpected_token(line_nos[i], tokens[i].value, "identifier");
+        }
+        ast_t record = {AST_RECORD, soa ? "soa" : "", {{AST_ID, tokens[i].value}}};
+        i++;
+        if(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+        if(tokens[i].type != LEX_TOKEN_OP || tokens[i].value != "{") {
+            utils::unexpected_token(line_nos[i], tokens[i].value, "{");
+        }
+        i++;
+        while(true) {
+            while(tokens[i].type == LEX_TOKEN_NEWLINE || (tokens[i].type == LEX_TOKEN_OP && tokens[i].value == ",")) i++;
+            if(tokens[i].type != LEX_TOKEN_ID) break;
+            ast_t field = {AST_ID, tokens[i].value};
+            i++;
+            if(tokens[i].type == LEX_TOKEN_OP && tokens[i].value == ":") {
+                i++;
+                if(tokens[i].type != LEX_TOKEN_ID) {
+                    utils::unexpected_token(line_nos[i], tokens[i].value, "type");
+                }
+                field.children.push_back({AST_ID, tokens[i].value});
+                i++;
+            }
+            record.children.push_back(field);
+        }
+        if(tokens[i].type != LEX_TOKEN_OP || tokens[i].value != "}") {
+            utils::unexpected_token(line_nos[i], tokens[i].value, "}");
+        }
+        i++;
+        return record;
+    }
+
+
+    // every statement carries the line of its first token
     ast_t parse_stmt(std::vector<lex_token_t> & tokens, std::vector<size_t> & line_nos, size_t & i) {
         while(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+        size_t line = line_nos[i];
+        ast_t stmt = parse_stmt_body(tokens, line_nos, i);
+        stmt.line = line;
+        return stmt;
+    }
+
+    ast_t parse_stmt_body(std::vector<lex_token_t> & tokens, std::vector<size_t> & line_nos, size_t & i) {
         if(tokens[i].type == LEX_TOKEN_INT || tokens[i].type == LEX_TOKEN_FLOAT || tokens[i].type == LEX_TOKEN_STR) {
             ast_t exp =  parse_expr(tokens, line_nos, i);
             return {AST_EXPR_STMT, "", {exp}};
@@ -395,6 +597,48 @@ struct parser_t {
                 }
                 return while_statement;
             }
+            if(tokens[i].value == "for") {
+                i++;
+                return parse_for(tokens, line_nos, i, AST_FOR);
+            }
+            if(tokens[i].value == "parallel") {
+                i++;
+                if(tokens[i].type != LEX_TOKEN_ID || tokens[i].value != "for") {
+                    utils::unexpected_token(line_nos[i], tokens[i].value, "for");
+                }
+                i++;
+                return parse_for(tokens, line_nos, i, AST_PARALLEL_FOR);
+            }
+            if(tokens[i].value == "spawn") {
+                i++;
+                return {AST_SPAWN, "", {parse_block(tokens, line_nos, i)}};
+            }
+            if(tokens[i].value == "generator") {
+                i++;
+                return parse_generator(tokens, line_nos, i);
+            }
+            if(tokens[i].value == "record" || (tokens[i].value == "soa" && tokens[i + 1].type == LEX_TOKEN_ID && tokens[i + 1].value == "record")) {
+                bool soa = tokens[i].value == "soa";
+                i += soa ? 2 : 1;
+                return parse_record(tokens, line_nos, i, soa);
+            }
+            if(tokens[i].value == "match") {
+                i++;
+                return parse_match(tokens, line_nos, i);
+            }
+            if(tokens[i].value == "yield") {
+                i++;
+                ast_t expr = parse_expr(tokens, line_nos, i);
+                if(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+                else if(tokens[i].type == LEX_TOKEN_OP && tokens[i].value == ";") i++;
+                return {AST_YIELD, "", {expr}};
+            }
+            if(tokens[i].value == "join") {
+                i++;
+                if(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
+                else if(tokens[i].type == LEX_TOKEN_OP && tokens[i].value == ";") i++;
+                return {AST_JOIN, ""};
+            }
             ast_t expr = parse_expr(tokens, line_nos, i);
             if(tokens[i].type == LEX_TOKEN_NEWLINE) i++;
             else if(tokens[i].type == LEX_TOKEN_OP && tokens[i].value == ";") i++;
@@ -412,21 +656,19 @@ struct parser_t {
     
 
 
-    void print(const ast_t & ast) {
-        static int indent = 0;
-        for(int i = 0; i < indent; i++) printf(" .");
-        printf("%s: ", ASTTypeNames[ast.type]);
-        printf("%.*s", (int)ast.value.size(), ast.value.data());
-        if(ast.line) printf(" (%zu)", ast.line);
+    void print(const ast_t & ast, int indent = 0, FILE * out = stdout) {
+        for(int i = 0; i < indent; i++) fprintf(out, " .");
+        fprintf(out, "%s: ", ASTTypeNames[ast.type]);
+        if(ast.type == AST_INT) fprintf(out, "%lld", (long long)ast.int_value);
+        else fprintf(out, "%.*s", (int)ast.value.size(), ast.value.data());
+        if(ast.line) fprintf(out, " (%zu)", ast.line);
         if(ast.children.size() > 0) {
-            printf(" {\n");
-            indent++;
-            for(const ast_t & child : ast.children) print(child);
-            indent--;
-            for(int i = 0; i < indent; i++) printf("  ");
-            printf("}\n");
+            fprintf(out, " {\n");
+            for(const ast_t & child : ast.children) print(child, indent + 1, out);
+            for(int i = 0; i < indent; i++) fprintf(out, "  ");
+            fprintf(out, "}\n");
         } else {
-            printf("\n");
+            fprintf(out, "\n");
         }
     }
 
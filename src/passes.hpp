@@ -0,0 +1,357 @@
+#pragma once
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include "parsing.hpp"
+#include "codegen.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+// where in the pipeline a pass runs: rewriting the AST, as a choice made
+// while lowering to bytecode, on main's frame before its offsets are fixed,
+// or on the finished bytecode
+enum PassStage
+{
+    PASS_AST,
+    PASS_LOWER,
+    PASS_FRAME,
+    PASS_BYTECODE,
+};
+
+static const char *const PassStageNames[] = {"ast", "lower", "frame", "bytecode"};
+
+// what a pass gets to work on. `data` is empty before lowering
+struct pass_unit_t
+{
+    ast_t &ast;
+    code_generator_t &codegen;
+    program_data_t &data;
+};
+
+// a lowering pass has no run function; it is the codegen flag that enables
+// it and the counter of the times it fired
+struct pass_t
+{
+    const char *name;
+    PassStage stage;
+    int level; // lowest -O level that runs it
+    const char *summary;
+    size_t (*run)(pass_unit_t &unit);
+    bool code_generator_t::*flag;
+    size_t code_generator_t::*count;
+};
+
+namespace passes
+{
+    static bool literal_value(const ast_t &ast, int64_t &value)
+    {
+        if (ast.type != AST_INT) return false;
+        value = ast.int_value;
+        return true;
+    }
+
+    // the result of `a op b` as the generated code computes it; false for
+    // operators the folder leaves alone and for division by zero
+    static bool fold_binary(std::string_view op, int64_t a, int64_t b, int64_t &r)
+    {
+        static constexpr std::string_view alu_names[] = {"+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>"};
+        static constexpr alu_op_t alu_ops[] = {ALU_ADD, ALU_SUB, ALU_MUL, ALU_DIV, ALU_MOD,
+                                               ALU_AND, ALU_OR,  ALU_XOR, ALU_SHL, ALU_SHR};
+        if (op == "^^") op = "^";
+        for (size_t k = 0; k < sizeof(alu_ops) / sizeof(alu_ops[0]); k++)
+        {
+            if (op == alu_names[k]) return isel_t::fold(alu_ops[k], a, b, r);
+        }
+        if (op == "==") r = a == b;
+        else if (op == "!=") r = a != b;
+        else if (op == ">") r = a > b;
+        else if (op == "<") r = a < b;
+        else if (op == ">=") r = a >= b;
+        else if (op == "<=") r = a <= b;
+        else return false;
+        return true;
+    }
+
+    // a folded literal has no source text, only its value
+    static void make_literal(ast_t &ast, int64_t value)
+    {
+        ast_t lit = {AST_INT, ""};
+        lit.int_value = value;
+        lit.line = ast.line;
+        ast = std::move(lit);
+    }
+
+    // replaces `ast` by one of its children, or by an empty block when
+    // `child` is out of range
+    static void hoist_child(ast_t &ast, size_t child)
+    {
+        ast_t keep = child < ast.children.size() ? std::move(ast.children[child]) : ast_t{AST_BLOCK, ""};
+        if (!keep.line) keep.line = ast.line;
+        ast = std::move(keep);
+    }
+
+    // bottom-up constant folding of unary and binary integer operators,
+    // short-circuits and ?: with a constant left side or condition, and of
+    // if / while whose condition is constant. branch folding is skipped in profiling builds,
+    // whose counters are indexed by condition id
+    static size_t fold_node(ast_t &ast, bool branches)
+    {
+        size_t changes = 0;
+        for (auto &child : ast.children) changes += fold_node(child, branches);
+        int64_t a, b, r;
+        if (ast.type == AST_BINARY_OP && ast.children.size() == 2)
+        {
+            bool logical = ast.value == "&&" || ast.value == "||";
+            if (logical && branches && literal_value(ast.children[0], a))
+            {
+                // the right side never runs when the left decides
+                bool decided = ast.value == "&&" ? a == 0 : a != 0;
+                if (decided) make_literal(ast, ast.value == "||");
+                else if (literal_value(ast.children[1], b)) make_literal(ast, b != 0);
+                else return changes;
+                return changes + 1;
+            }
+            if (!logical && literal_value(ast.children[0], a) && literal_value(ast.children[1], b) &&
+                fold_binary(ast.value, a, b, r))
+            {
+                make_literal(ast, r);
+                return changes + 1;
+            }
+        }
+        else if (ast.type == AST_UNARY_OP && literal_value(ast.children[0], a))
+        {
+            make_literal(ast, ast.value == "-" ? (int64_t)(0 - (uint64_t)a) : ast.value == "~" ? ~a : a == 0);
+            return changes + 1;
+        }
+        else if (ast.type == AST_OP && ast.value == "?" && branches && literal_value(ast.children[0], a))
+        {
+            hoist_child(ast, a ? 1 : 2);
+            return changes + 1;
+        }
+        else if (ast.type == AST_IF && branches && literal_value(ast.children[0], a))
+        {
+            hoist_child(ast, a ? 1 : 2);
+            return changes + 1;
+        }
+        else if (ast.type == AST_WHILE && branches && literal_value(ast.children[0], a) && a == 0)
+        {
+            hoist_child(ast, SIZE_MAX);
+            return changes + 1;
+        }
+        return changes;
+    }
+
+    static size_t fold(pass_unit_t &unit)
+    {
+        bool branches = !unit.codegen.profile && !unit.codegen.profile_use;
+        return fold_node(unit.ast, branches);
+    }
+
+    static size_t color_slots(pass_unit_t &unit)
+    {
+        return code_generator_t::color_slots(unit.codegen.main_ctx);
+    }
+
+    static int64_t operand(const std::vector<uint8_t> &bc, size_t pos, size_t k = 0)
+    {
+        return *(const int64_t *)&bc[pos + 1 + 8 * k];
+    }
+
+    // local cleanups on the laid-out bytecode: a push straight into a
+    // shrink_stack is never read, two shrinks merge, and a jump to the end
+    // label that follows it (past the empty else case of a switch at most)
+    // falls through instead. positions are not recorded anywhere past
+    // layout_frame, so instructions can simply be dropped
+    static size_t peephole(pass_unit_t &unit)
+    {
+        auto &bc = unit.data.bytecode;
+        std::vector<uint8_t> out;
+        out.reserve(bc.size());
+        std::vector<size_t> starts; // of the instructions in `out`
+        size_t changes = 0;
+        auto last = [&](size_t back) -> uint8_t * {
+            return starts.size() > back ? &out[starts[starts.size() - 1 - back]] : nullptr;
+        };
+        for (size_t i = 0; i < bc.size();)
+        {
+            size_t size = bytecode_size(&bc[i]);
+            uint8_t op = bc[i];
+            if (op == BC_SHRINK_STACK)
+            {
+                int64_t bytes = operand(bc, i);
+                while (bytes > 0)
+                {
+                    uint8_t *prev = last(0);
+                    if (prev && *prev == BC_SHRINK_STACK)
+                    {
+                        bytes += *(int64_t *)(prev + 1);
+                    }
+                    else if (prev && (*prev == BC_PUSH_INT || *prev == BC_COPY_INT) && bytes >= (int64_t)sizeof(int64_t))
+                    {
+                        bytes -= sizeof(int64_t);
+                    }
+                    else
+                    {
+                        break;
+                    }
+                    out.resize(starts.back());
+                    starts.pop_back();
+                    changes++;
+                }
+                if (bytes > 0)
+                {
+                    starts.push_back(out.size());
+                    out.push_back(BC_SHRINK_STACK);
+                    out.insert(out.end(), (uint8_t *)&bytes, (uint8_t *)&bytes + sizeof(bytes));
+                }
+                else if (bytes == 0)
+                {
+                    changes++;
+                }
+                i += size;
+                continue;
+            }
+            if (op == BC_TEST_END_END_LABEL)
+            {
+                int64_t id = operand(bc, i);
+                uint8_t *prev = last(0);
+                size_t back = prev && *prev == BC_CASE_LABEL && *(int64_t *)(prev + 1) == id ? 1 : 0;
+                uint8_t *jump = last(back);
+                if (jump && *jump == BC_JUMP_END && *(int64_t *)(jump + 1) == id)
+                {
+                    std::vector<uint8_t> tail(out.begin() + starts[starts.size() - 1 - back] + 9, out.end());
+                    out.resize(starts[starts.size() - 1 - back]);
+                    starts.pop_back();
+                    if (back)
+                    {
+                        starts.back() = out.size();
+                        out.insert(out.end(), tail.begin(), tail.end());
+                    }
+                    changes++;
+                }
+            }
+            starts.push_back(out.size());
+            out.insert(out.end(), bc.begin() + i, bc.begin() + i + size);
+            i += size;
+        }
+        bc.swap(out);
+        return changes;
+    }
+}
+
+// the optimization pipeline between parsing and emission. passes run in
+// table order when the -O level reaches theirs and they are not disabled;
+// the frame layout in between is not optional, it fixes main's offsets
+struct pass_manager_t
+{
+    static constexpr pass_t pipeline[] = {
+        {"fold", PASS_AST, 1, "fold constant operators, short-circuits and branches", passes::fold, nullptr, nullptr},
+        {"branchless", PASS_LOWER, 1, "pure && / || / ?: as setcc and cmov",
+         nullptr, &code_generator_t::lower_branchless, &code_generator_t::branchless_count},
+        {"if-to-switch", PASS_LOWER, 2, "if-chains on one variable as a jump table or search tree",
+         nullptr, &code_generator_t::lower_if_to_switch, &code_generator_t::if_to_switch_count},
+        {"color-slots", PASS_FRAME, 1, "share frame slots between variables that are not live together",
+         passes::color_slots, nullptr, nullptr},
+        {"peephole", PASS_BYTECODE, 1, "drop dead pushes and jumps, merge stack shrinks", passes::peephole, nullptr,
+         nullptr},
+    };
+
+    int level = 2;
+    std::set<std::string> disabled; // names from find(), checked by the caller
+    std::set<std::string> print_after; // pass names, or "all"
+    FILE *print_out = stderr;
+    std::vector<pass_stats_t> records;
+
+    static const pass_t *find(std::string_view name)
+    {
+        for (auto &p : pipeline)
+        {
+            if (name == p.name) return &p;
+        }
+        return nullptr;
+    }
+
+    bool enabled(const pass_t &p) const { return p.level <= level && !disabled.count(p.name); }
+
+    static void list(FILE *out)
+    {
+        for (auto &p : pipeline)
+        {
+            fprintf(out, "%-14s -O%d  %-8s %s\n", p.name, p.level, PassStageNames[p.stage], p.summary);
+        }
+    }
+
+    program_data_t run(ast_t &ast, code_generator_t &codegen, compile_stats_t *stats = nullptr)
+    {
+        program_data_t data;
+        pass_unit_t unit{ast, codegen, data};
+        records.clear();
+
+        if (stats) stats->begin("ast-opt");
+        run_stage(PASS_AST, unit);
+        if (stats)
+        {
+            stats->end();
+            stats->begin("codegen");
+        }
+        for (auto &p : pipeline)
+        {
+            if (p.stage == PASS_LOWER) codegen.*p.flag = enabled(p);
+        }
+        data = codegen.lower_program(ast);
+        for (auto &p : pipeline)
+        {
+            if (p.stage != PASS_LOWER) continue;
+            records.push_back({p.name, -1, codegen.*p.count, enabled(p)});
+            dump(p, unit);
+        }
+        if (stats)
+        {
+            stats->end();
+            stats->begin("bc-opt");
+        }
+        run_stage(PASS_FRAME, unit);
+        codegen.layout_frame(data, codegen.main_ctx);
+        for (auto &p : pipeline)
+        {
+            if (p.stage == PASS_FRAME) dump(p, unit);
+        }
+        run_stage(PASS_BYTECODE, unit);
+        if (stats)
+        {
+            stats->end();
+            stats->passes = records;
+        }
+        return data;
+    }
+
+    void run_stage(PassStage stage, pass_unit_t &unit)
+    {
+        for (auto &p : pipeline)
+        {
+            if (p.stage != stage) continue;
+            pass_stats_t rec{p.name};
+            if (enabled(p))
+            {
+                double start = stats::wall_seconds();
+                rec.changes = p.run(unit);
+                rec.wall = stats::wall_seconds() - start;
+                rec.ran = true;
+            }
+            records.push_back(rec);
+            // a frame pass only shows in the bytecode once the frame is laid out
+            if (stage != PASS_FRAME) dump(p, unit);
+        }
+    }
+
+    void dump(const pass_t &p, pass_unit_t &unit)
+    {
+        if (!print_after.count("all") && !print_after.count(p.name)) return;
+        fprintf(print_out, "; after %s\n", p.name);
+        if (p.stage == PASS_AST) parser_t().print(unit.ast, 0, print_out);
+        else disassemble(print_out, unit.data.bytecode);
+    }
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "utils.hpp"
+
+// counters written by a --profile build at exit: a 32-byte header
+// ("TLPROF03", source hash, line count, branch count), then {count, cycles}
+// for every source line, index 0 being the startup code before the first
+// statement, then {true, false} outcomes for every if, numbered in source
+// order (code_generator_t::if_count).
+struct program_profile_t
+{
+    struct entry_t
+    {
+        uint64_t count = 0;
+        uint64_t cycles = 0;
+    };
+    struct branch_t
+    {
+        uint64_t taken = 0;
+        uint64_t not_taken = 0;
+    };
+    uint64_t source_hash = 0;
+    std::vector<entry_t> lines;
+    std::vector<branch_t> branches;
+
+    bool load(const std::string &path)
+    {
+        std::string data;
+        if (!utils::read_file(path, data) || data.size() < 32 || memcmp(data.data(), "TLPROF03", 8) != 0) return false;
+        uint64_t n, b;
+        memcpy(&source_hash, data.data() + 8, 8);
+        memcpy(&n, data.data() + 16, 8);
+        memcpy(&b, data.data() + 24, 8);
+        size_t room = (data.size() - 32) / 16;
+        if (n > room || b > room - n) return false;
+        lines.resize(n);
+        memcpy(lines.data(), data.data() + 32, n * sizeof(entry_t));
+        branches.resize(b);
+        memcpy(branches.data(), data.data() + 32 + n * sizeof(entry_t), b * sizeof(branch_t));
+        return true;
+    }
+
+    const branch_t *branch(size_t id) const { return id < branches.size() ? &branches[id] : nullptr; }
+
+    // the source with execution count, cycles and share of total cycles in
+    // front of every line; lines that never ran are left blank
+    void print_annotated(FILE *out, const std::string &src) const
+    {
+        uint64_t total = 0;
+        for (auto &e : lines) total += e.cycles;
+        fprintf(out, "%12s %14s %7s  line\n", "count", "cycles", "%");
+        size_t line = 1;
+        size_t pos = 0;
+        while (pos < src.size())
+        {
+            size_t end = src.find('\n', pos);
+            if (end == std::string::npos) end = src.size();
+            const entry_t *e = line < lines.size() && lines[line].count ? &lines[line] : nullptr;
+            if (e)
+                fprintf(out, "%12llu %14llu %6.2f%%", (unsigned long long)e->count, (unsigned long long)e->cycles,
+                        total ? 100.0 * e->cycles / total : 0.0);
+            else
+                fprintf(out, "%12s %14s %7s", "", "", "");
+            fprintf(out, " %5zu| %.*s\n", line, (int)(end - pos), src.data() + pos);
+            pos = end + 1;
+            line++;
+        }
+        if (!lines.empty() && lines[0].cycles)
+            fprintf(out, "%12s %14llu %6.2f%%  (startup)\n", "", (unsigned long long)lines[0].cycles,
+                    total ? 100.0 * lines[0].cycles / total : 0.0);
+        fprintf(out, "total %llu cycles\n", (unsigned long long)total);
+        for (size_t id = 0; id < branches.size(); id++)
+            fprintf(out, "if #%zu: %llu true, %llu false\n", id, (unsigned long long)branches[id].taken,
+                    (unsigned long long)branches[id].not_taken);
+    }
+};
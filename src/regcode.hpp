@@ -0,0 +1,1280 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "bytecode.hpp"
+#include "codegen.hpp"
+#include "utils.hpp"
+
+// the register bytecode: three-address instructions over virtual registers,
+// `add r1, r2, 7` where the stack bytecode would copy, push, add and store.
+// it is translated from the verified stack bytecode, whose depth at every
+// instruction is known: the value at byte depth 8 * (k + 1) is register k,
+// so main's frame slots keep their registers and temporaries get the ones
+// above. operands a and b are registers or, per `form`, immediates; d and c
+// are always registers, or jump targets as instruction indices.
+enum RegOp : uint8_t
+{
+    R_MOV, // d = a
+    R_ADD, // d = a op b, in the order of alu_op_t
+    R_SUB,
+    R_MUL,
+    R_DIV,
+    R_MOD,
+    R_AND,
+    R_OR,
+    R_XOR,
+    R_SHL,
+    R_SHR,
+    R_EQ, // d = a cc b, in the order of isel_cc
+    R_NE,
+    R_GT,
+    R_LT,
+    R_GE,
+    R_LE,
+    R_SELECT, // d = c ? a : b
+    R_JMP,    // to c
+    R_JZ,     // to c if a == 0
+    R_JNZ,    // to c if a != 0
+    R_JEQ,    // to c if a cc b, in the order of isel_cc
+    R_JNE,
+    R_JGT,
+    R_JLT,
+    R_JGE,
+    R_JLE,
+    R_SWITCH,      // to the target of a in cases[c .. c + b), sorted by value, else to d
+    R_WRITE,       // write(a)
+    R_EXIT,        // exit with status a
+    R_ALLOC_ARRAY, // d = zeroed array of a elements
+    R_LOAD,        // d = a[b]
+    R_STORE,       // a[b] = d
+    R_FREE_ARRAY,  // a
+    R_ARENA_MARK,  // d = mark
+    R_ARENA_RELEASE, // to mark a
+    R_OPCODE_COUNT
+};
+
+static const char *const reg_opcode_names[] = {
+    "mov", "add", "sub", "mul", "div", "mod", "and", "or", "xor", "shl", "shr", "eq", "ne", "gt", "lt", "ge", "le",
+    "select", "jmp", "jz", "jnz", "jeq", "jne", "jgt", "jlt", "jge", "jle", "switch", "write", "exit",
+    "alloc_array", "load", "store", "free_array", "arena_mark", "arena_release"};
+static_assert(sizeof(reg_opcode_names) / sizeof(reg_opcode_names[0]) == R_OPCODE_COUNT, "reg_opcode_names is out of date");
+
+enum RegForm : uint8_t
+{
+    REG_IMM_A = 1,
+    REG_IMM_B = 2,
+};
+
+struct reg_insn_t
+{
+    uint8_t op;
+    uint8_t form = 0;
+    int32_t d = 0;
+    int32_t c = 0;
+    int64_t a = 0;
+    int64_t b = 0;
+};
+
+struct reg_case_t
+{
+    int64_t value;
+    int32_t target;
+};
+
+struct reg_program_t
+{
+    std::vector<reg_insn_t> code;
+    std::vector<reg_case_t> cases; // of the switches
+    int32_t registers = 0;
+};
+
+inline bool reg_is_branch(uint8_t op) { return op == R_JMP || op == R_JZ || op == R_JNZ || (op >= R_JEQ && op <= R_JLE); }
+
+// a op b for the arithmetic and comparison opcodes, as the native code
+// computes it; false where that traps (division by zero or overflow)
+inline bool reg_binary(uint8_t op, int64_t a, int64_t b, int64_t &r)
+{
+    switch (op)
+    {
+    case R_EQ: r = a == b; return true;
+    case R_NE: r = a != b; return true;
+    case R_GT: r = a > b; return true;
+    case R_LT: r = a < b; return true;
+    case R_GE: r = a >= b; return true;
+    case R_LE: r = a <= b; return true;
+    default: return isel_t::fold((alu_op_t)(op - R_ADD), a, b, r);
+    }
+}
+
+// stack bytecode to register bytecode. every stack position holds an
+// operand that has not necessarily been written to its register yet: a
+// constant, another register whose value it copies, or (on top only) an
+// arithmetic or comparison result, so that its consumer can take it as an
+// immediate, read the register it copies, or compute the result straight
+// into a variable. before anything writes a register, the positions that
+// still read it are materialized; at labels, branches and jumps all of them
+// are, so that control flow always meets the plain register file.
+struct regcode_builder_t
+{
+    enum kind_t
+    {
+        OPND_REG,
+        OPND_IMM,
+        OPND_EXPR, // expr, which is the top of the stack
+    };
+    struct operand_t
+    {
+        kind_t kind;
+        int64_t value;
+
+        bool operator==(const operand_t &o) const { return kind == o.kind && value == o.value; }
+    };
+    struct expr_t
+    {
+        uint8_t op;
+        operand_t a, b;
+    };
+    enum LabelKind
+    {
+        LBL_IF_FALSE,
+        LBL_IF_TRUE,
+        LBL_IF_END,
+        LBL_LOOP,
+        LBL_LOOP_END,
+        LBL_MATCH,
+    };
+    struct fixup_t
+    {
+        int section;
+        size_t index;
+    };
+
+    reg_program_t program;
+    std::vector<operand_t> stack; // by position, 8 bytes each
+    expr_t expr{};
+    // cold blocks collect in section 1, which is placed after main as the
+    // assembler places subsection 1 after .text
+    std::vector<reg_insn_t> sections[2];
+    int section = 0;
+    std::map<std::tuple<int, int64_t, int64_t>, int32_t> label_ids;
+    std::vector<std::pair<int, size_t>> label_at; // by label id, (section, index); index SIZE_MAX while undefined
+    std::vector<fixup_t> fixups;                  // instructions whose c (or switch cases) are label ids
+
+    static operand_t reg(int64_t r) { return {OPND_REG, r}; }
+    static operand_t imm(int64_t v) { return {OPND_IMM, v}; }
+
+    bool reads(const operand_t &e, int64_t r) const
+    {
+        if (e.kind == OPND_REG) return e.value == r;
+        if (e.kind == OPND_EXPR) return (expr.a.kind == OPND_REG && expr.a.value == r) || (expr.b.kind == OPND_REG && expr.b.value == r);
+        return false;
+    }
+
+    int32_t label(int kind, int64_t id, int64_t n = 0)
+    {
+        auto [it, added] = label_ids.emplace(std::make_tuple(kind, id, n), (int32_t)label_at.size());
+        if (added) label_at.push_back({0, SIZE_MAX});
+        return it->second;
+    }
+
+    void emit(uint8_t op, int64_t d, operand_t a = imm(0), operand_t b = imm(0), int32_t c = 0)
+    {
+        // a constant goes on the right, where the lowering can use it as an
+        // immediate: commutative operators swap, comparisons mirror
+        static constexpr uint8_t mirrored[] = {0, 1, 3, 2, 5, 4};
+        bool commutes = op == R_ADD || op == R_MUL || op == R_AND || op == R_OR || op == R_XOR;
+        bool compares = (op >= R_EQ && op <= R_LE) || (op >= R_JEQ && op <= R_JLE);
+        if (a.kind == OPND_IMM && b.kind == OPND_REG && (commutes || compares))
+        {
+            if (op >= R_EQ && op <= R_LE) op = R_EQ + mirrored[op - R_EQ];
+            else if (compares) op = R_JEQ + mirrored[op - R_JEQ];
+            std::swap(a, b);
+        }
+        reg_insn_t in;
+        in.op = op;
+        in.form = (a.kind == OPND_IMM ? REG_IMM_A : 0) | (b.kind == OPND_IMM ? REG_IMM_B : 0);
+        in.d = (int32_t)d;
+        in.c = c;
+        in.a = a.value;
+        in.b = b.value;
+        sections[section].push_back(in);
+    }
+
+    void emit_jump(uint8_t op, int32_t target, operand_t a = imm(0), operand_t b = imm(0))
+    {
+        fixups.push_back({section, sections[section].size()});
+        emit(op, 0, a, b, target);
+    }
+
+    // about to overwrite register r: whatever still reads it, except the
+    // position `keep` that is about to be consumed, gets its own value first
+    void clobber(int64_t r, size_t keep = SIZE_MAX)
+    {
+        for (size_t k = 0; k < stack.size(); k++)
+        {
+            if ((int64_t)k != r && k != keep && reads(stack[k], r)) materialize(k);
+        }
+    }
+
+    void materialize(size_t k)
+    {
+        operand_t e = stack[k];
+        if (e == reg(k)) return;
+        clobber(k);
+        if (e.kind == OPND_EXPR) emit(expr.op, k, expr.a, expr.b);
+        else emit(R_MOV, k, e);
+        stack[k] = reg(k);
+    }
+
+    void flush()
+    {
+        for (size_t k = 0; k < stack.size(); k++) materialize(k);
+    }
+
+    // the top as a plain operand
+    operand_t pop()
+    {
+        if (stack.back().kind == OPND_EXPR) materialize(stack.size() - 1);
+        operand_t e = stack.back();
+        stack.pop_back();
+        return e;
+    }
+
+    // the top as a register: immediates go to their own
+    operand_t pop_reg()
+    {
+        if (stack.back().kind == OPND_IMM) materialize(stack.size() - 1);
+        return pop();
+    }
+
+    void push(operand_t e)
+    {
+        if (!stack.empty() && stack.back().kind == OPND_EXPR) materialize(stack.size() - 1);
+        stack.push_back(e);
+    }
+
+    // position k takes the value v, computed now
+    void assign(size_t k, operand_t v)
+    {
+        if (v == reg(k) && stack[k] == reg(k)) return;
+        clobber(k);
+        if (v.kind == OPND_EXPR) emit(expr.op, k, expr.a, expr.b);
+        else emit(R_MOV, k, v);
+        stack[k] = reg(k);
+    }
+
+    // the position of the slot `offset` bytes below the top
+    size_t slot(int64_t offset) const { return stack.size() - 1 - offset / 8; }
+
+    void define(int32_t id)
+    {
+        label_at[id] = {section, sections[section].size()};
+    }
+
+    // jumps to `target` when the condition popped off the top is zero
+    // (when_true false) or nonzero; a comparison fuses into the branch
+    void branch(int32_t target, bool when_true)
+    {
+        operand_t cond = stack.back();
+        if (cond.kind == OPND_EXPR && expr.op >= R_EQ && expr.op <= R_LE)
+        {
+            stack.pop_back();
+            flush();
+            int cc = expr.op - R_EQ;
+            emit_jump(R_JEQ + (when_true ? cc : isel_cc_negated[cc]), target, expr.a, expr.b);
+            return;
+        }
+        cond = pop();
+        flush();
+        if (cond.kind == OPND_IMM)
+        {
+            if ((cond.value != 0) == when_true) emit_jump(R_JMP, target);
+            return;
+        }
+        emit_jump(when_true ? R_JNZ : R_JZ, target, cond);
+    }
+
+    void jump(int32_t target)
+    {
+        flush();
+        emit_jump(R_JMP, target);
+    }
+
+    void reset(int64_t depth)
+    {
+        stack.clear();
+        for (int64_t k = 0; k < depth / 8; k++) stack.push_back(reg(k));
+    }
+
+    reg_program_t build(const std::vector<uint8_t> &bytecode)
+    {
+        bytecode_check_t check = verify_bytecode(bytecode, true);
+        if (!check.ok()) throw utils::error_t(0, "Invalid bytecode: " + check.errors[0]);
+        program.registers = (int32_t)(check.bodies[0].max_depth / 8);
+        struct saved_t
+        {
+            std::vector<operand_t> stack;
+            bool live;
+            int section;
+        };
+        std::vector<saved_t> saved;
+        bool live = true;
+        for (size_t i = 0; i < bytecode.size(); i += bytecode_size(&bytecode[i]))
+        {
+            const uint8_t *op = &bytecode[i];
+            if (*op == BC_COLD_BEGIN)
+            {
+                // the code after the block goes on from the state before it
+                saved.push_back({stack, live, section});
+                section = 1;
+                live = false;
+                continue;
+            }
+            if (*op == BC_COLD_END)
+            {
+                stack = saved.back().stack;
+                live = saved.back().live;
+                section = saved.back().section;
+                saved.pop_back();
+                continue;
+            }
+            if (check.depth[i] < 0) continue; // unreachable
+            if (!live)
+            {
+                reset(check.depth[i]); // a label reached only by jumps
+                live = true;
+            }
+            int64_t a = opcode_info[*op].operands > 0 ? bytecode_operand(op, 0) : 0;
+            int64_t b = opcode_info[*op].operands > 1 ? bytecode_operand(op, 1) : 0;
+            switch (*op)
+            {
+            case BC_LINE: break;
+            case BC_FRAME:
+                for (int64_t k = 0; k < a / 8; k++) stack.push_back(reg(stack.size()));
+                if (a > 0) stack.back() = imm(0); // the exit status, zeroed like the native frame's top
+                break;
+            case BC_PUSH_INT: push(imm(a)); break;
+            case BC_COPY_INT:
+            {
+                size_t k = slot(a);
+                if (stack[k].kind == OPND_EXPR) materialize(k);
+                push(stack[k]);
+                break;
+            }
+            case BC_SET_INT:
+            {
+                size_t k = slot(a), top = stack.size() - 1;
+                if (k == top) break;
+                operand_t v = stack[top];
+                if (v.kind == OPND_EXPR)
+                {
+                    // computed into the variable, which the top then copies
+                    clobber(k, top);
+                    emit(expr.op, k, expr.a, expr.b);
+                    stack[k] = reg(k);
+                    stack[top] = reg(k);
+                }
+                else
+                {
+                    assign(k, v);
+                }
+                break;
+            }
+            case BC_STORE_INT:
+            {
+                operand_t v = stack.back();
+                stack.pop_back();
+                assign(slot(a), v);
+                break;
+            }
+            case BC_SHRINK_STACK:
+                for (int64_t n = a / 8; n > 0; n--)
+                {
+                    // a dropped division still traps where the stack code would
+                    bool traps = stack.back().kind == OPND_EXPR && (expr.op == R_DIV || expr.op == R_MOD);
+                    if (traps) materialize(stack.size() - 1);
+                    stack.pop_back();
+                }
+                break;
+            case BC_ADD_INT_INT:
+            case BC_SUB_INT_INT:
+            case BC_MUL_INT_INT:
+            case BC_DIV_INT_INT:
+            case BC_MOD_INT_INT:
+            case BC_AND:
+            case BC_OR:
+            case BC_XOR:
+            case BC_SHL:
+            case BC_SHR:
+            case BC_EQ_INT_INT:
+            case BC_NE_INT_INT:
+            case BC_GT_INT_INT:
+            case BC_LT_INT_INT:
+            case BC_GE_INT_INT:
+            case BC_LE_INT_INT:
+            {
+                uint8_t rop = *op >= BC_EQ_INT_INT ? R_EQ + (*op - BC_EQ_INT_INT) : R_ADD + (*op - BC_ADD_INT_INT);
+                operand_t y = pop(), x = pop();
+                int64_t r;
+                if (x.kind == OPND_IMM && y.kind == OPND_IMM && reg_binary(rop, x.value, y.value, r))
+                {
+                    stack.push_back(imm(r));
+                    break;
+                }
+                expr = {rop, x, y};
+                stack.push_back({OPND_EXPR, 0});
+                break;
+            }
+            case BC_SELECT:
+            {
+                operand_t cond = pop_reg(), y = pop(), x = pop();
+                size_t k = stack.size();
+                stack.push_back(reg(k));
+                clobber(k);
+                emit(R_SELECT, k, x, y, (int32_t)cond.value);
+                break;
+            }
+            case BC_IF: branch(label(LBL_IF_FALSE, a), false); break;
+            case BC_IF_NOT: branch(label(LBL_IF_TRUE, a), true); break;
+            case BC_WHILE_TEST: branch(label(LBL_LOOP_END, a), false); break;
+            case BC_FOR_TEST:
+            {
+                // the counter below the bound, both kept on the stack
+                flush();
+                size_t n = stack.size();
+                emit_jump(R_JGE, label(LBL_LOOP_END, a), reg(n - 2), reg(n - 1));
+                break;
+            }
+            case BC_FOR_NEXT:
+            {
+                flush();
+                size_t n = stack.size();
+                emit(R_ADD, n - 2, reg(n - 2), imm(1));
+                emit_jump(R_JMP, label(LBL_LOOP, a));
+                define(label(LBL_LOOP_END, a));
+                live = false;
+                break;
+            }
+            case BC_LOOP_END:
+                jump(label(LBL_LOOP, a));
+                define(label(LBL_LOOP_END, a));
+                live = false;
+                break;
+            case BC_FOR_CONTINUE:
+            {
+                flush();
+                size_t n = stack.size();
+                emit(R_ADD, n - 2, reg(n - 2), imm(1));
+                emit_jump(R_JMP, label(LBL_LOOP, a));
+                live = false;
+                break;
+            }
+            case BC_CONTINUE:
+            case BC_BREAK:
+                jump(label(*op == BC_BREAK ? LBL_LOOP_END : LBL_LOOP, a));
+                live = false;
+                break;
+            case BC_ELSE:
+                jump(label(LBL_IF_END, a));
+                define(label(LBL_IF_FALSE, a));
+                live = false;
+                break;
+            case BC_JUMP_END:
+                jump(label(LBL_IF_END, a));
+                live = false;
+                break;
+            case BC_LOOP_LABEL:
+            case BC_TEST_FALSE_LABEL:
+            case BC_TRUE_LABEL:
+            case BC_TEST_END_END_LABEL:
+            case BC_CASE_LABEL:
+            {
+                flush();
+                int kind = *op == BC_LOOP_LABEL ? LBL_LOOP : *op == BC_TEST_FALSE_LABEL ? LBL_IF_FALSE
+                         : *op == BC_TRUE_LABEL ? LBL_IF_TRUE : *op == BC_CASE_LABEL ? LBL_MATCH : LBL_IF_END;
+                define(label(kind, a, *op == BC_CASE_LABEL ? b : 0));
+                break;
+            }
+            case BC_SWITCH_TABLE:
+            case BC_SWITCH_TREE:
+            {
+                operand_t subject = pop();
+                flush();
+                int32_t otherwise = label(LBL_MATCH, a, b);
+                std::vector<reg_case_t> cases;
+                int64_t n = bytecode_operand(op, *op == BC_SWITCH_TABLE ? 3 : 2);
+                for (int64_t k = 0; k < n; k++)
+                {
+                    int64_t value = *op == BC_SWITCH_TABLE ? bytecode_operand(op, 2) + k : bytecode_operand(op, 3 + 2 * k);
+                    int64_t target = bytecode_operand(op, *op == BC_SWITCH_TABLE ? 4 + k : 4 + 2 * k);
+                    if (target != b) cases.push_back({value, label(LBL_MATCH, a, target)});
+                }
+                live = false;
+                if (subject.kind == OPND_IMM)
+                {
+                    int32_t to = otherwise;
+                    for (auto &c : cases)
+                    {
+                        if (c.value == subject.value) to = c.target;
+                    }
+                    emit_jump(R_JMP, to);
+                    break;
+                }
+                std::sort(cases.begin(), cases.end(), [](const reg_case_t &x, const reg_case_t &y) { return x.value < y.value; });
+                fixups.push_back({section, sections[section].size()});
+                emit(R_SWITCH, otherwise, subject, imm((int64_t)cases.size()), (int32_t)program.cases.size());
+                program.cases.insert(program.cases.end(), cases.begin(), cases.end());
+                break;
+            }
+            case BC_SYSCALL:
+                if (op[1] == BC_SYS_WRITE_INT)
+                {
+                    if (stack.back().kind == OPND_EXPR) materialize(stack.size() - 1);
+                    emit(R_WRITE, 0, stack.back());
+                    break;
+                }
+                emit(R_EXIT, 0, pop());
+                live = false;
+                break;
+            case BC_HALT:
+                emit(R_EXIT, 0, imm(0));
+                live = false;
+                break;
+            case BC_ALLOC_ARRAY:
+            {
+                operand_t count = pop();
+                size_t k = stack.size();
+                stack.push_back(reg(k));
+                clobber(k);
+                emit(R_ALLOC_ARRAY, k, count);
+                break;
+            }
+            case BC_LOAD_INDEX:
+            {
+                // loads happen in place: a store may come before any consumer
+                operand_t index = pop(), array = pop_reg();
+                size_t k = stack.size();
+                stack.push_back(reg(k));
+                clobber(k);
+                emit(R_LOAD, k, array, index);
+                break;
+            }
+            case BC_STORE_INDEX:
+            {
+                operand_t index = pop(), array = pop_reg();
+                if (stack.back().kind != OPND_REG) materialize(stack.size() - 1);
+                emit(R_STORE, stack.back().value, array, index);
+                break;
+            }
+            case BC_FREE_ARRAY:
+            case BC_ARENA_RELEASE:
+            {
+                size_t k = slot(a);
+                if (stack[k].kind != OPND_REG) materialize(k);
+                emit(*op == BC_FREE_ARRAY ? R_FREE_ARRAY : R_ARENA_RELEASE, 0, stack[k]);
+                break;
+            }
+            case BC_ARENA_MARK:
+            {
+                push(reg(stack.size()));
+                clobber(stack.size() - 1);
+                emit(R_ARENA_MARK, stack.size() - 1);
+                break;
+            }
+            default:
+                throw utils::error_t(0, std::string("The register bytecode has no ") + opcode_info[*op].name);
+            }
+            if (opcode_info[*op].flags & OPF_JUMP) live = false;
+        }
+        if (live) emit(R_EXIT, 0, pop()); // the exit status is left on top
+
+        size_t main_size = sections[0].size();
+        program.code = std::move(sections[0]);
+        program.code.insert(program.code.end(), sections[1].begin(), sections[1].end());
+        auto resolve = [&](int32_t id) {
+            auto [sec, index] = label_at[id];
+            if (index == SIZE_MAX) throw utils::error_t(0, "Label without a definition in the register bytecode");
+            return (int32_t)(sec ? main_size + index : index);
+        };
+        for (auto &f : fixups)
+        {
+            reg_insn_t &in = program.code[f.section ? main_size + f.index : f.index];
+            if (in.op == R_SWITCH)
+            {
+                in.d = resolve(in.d);
+                for (int64_t k = 0; k < in.b; k++) program.cases[in.c + k].target = resolve(program.cases[in.c + k].target);
+            }
+            else
+            {
+                in.c = resolve(in.c);
+            }
+        }
+        return std::move(program);
+    }
+};
+
+inline reg_program_t translate_to_regcode(const std::vector<uint8_t> &bytecode)
+{
+    return regcode_builder_t().build(bytecode);
+}
+
+// the reference executor: one switch dispatch per instruction, output to
+// `output` as rt_write_int formats it. returns the exit status; division by
+// zero throws where the native code would trap. with `steps`, counts the
+// instructions executed
+inline int run_regcode(const reg_program_t &program, std::string &output, uint64_t *steps = nullptr)
+{
+    std::vector<int64_t> r(std::max(program.registers, 1), 0);
+    std::vector<int64_t *> arrays; // every allocation, so that arenas can release them
+    auto release = [&](size_t mark) {
+        for (size_t k = mark; k < arrays.size(); k++) free(arrays[k]);
+        arrays.resize(std::min(mark, arrays.size()));
+    };
+    const reg_insn_t *code = program.code.data();
+    uint64_t executed = 0;
+    size_t pc = 0;
+    int64_t status = 0;
+    for (;;)
+    {
+        const reg_insn_t &in = code[pc++];
+        executed++;
+        int64_t a = in.form & REG_IMM_A ? in.a : r[in.a];
+        int64_t b = in.form & REG_IMM_B ? in.b : r[in.b];
+        switch (in.op)
+        {
+        case R_MOV: r[in.d] = a; break;
+        case R_ADD: r[in.d] = (int64_t)((uint64_t)a + (uint64_t)b); break;
+        case R_SUB: r[in.d] = (int64_t)((uint64_t)a - (uint64_t)b); break;
+        case R_MUL: r[in.d] = (int64_t)((uint64_t)a * (uint64_t)b); break;
+        case R_DIV:
+        case R_MOD:
+            if (b == 0 || (a == INT64_MIN && b == -1))
+            {
+                release(0);
+                throw utils::error_t(0, "Division by zero");
+            }
+            r[in.d] = in.op == R_DIV ? a / b : a % b;
+            break;
+        case R_AND: r[in.d] = a & b; break;
+        case R_OR: r[in.d] = a | b; break;
+        case R_XOR: r[in.d] = a ^ b; break;
+        case R_SHL: r[in.d] = (int64_t)((uint64_t)a << (b & 63)); break;
+        case R_SHR: r[in.d] = (int64_t)((uint64_t)a >> (b & 63)); break;
+        case R_EQ: r[in.d] = a == b; break;
+        case R_NE: r[in.d] = a != b; break;
+        case R_GT: r[in.d] = a > b; break;
+        case R_LT: r[in.d] = a < b; break;
+        case R_GE: r[in.d] = a >= b; break;
+        case R_LE: r[in.d] = a <= b; break;
+        case R_SELECT: r[in.d] = r[in.c] ? a : b; break;
+        case R_JMP: pc = in.c; break;
+        case R_JZ: if (a == 0) pc = in.c; break;
+        case R_JNZ: if (a != 0) pc = in.c; break;
+        case R_JEQ: if (a == b) pc = in.c; break;
+        case R_JNE: if (a != b) pc = in.c; break;
+        case R_JGT: if (a > b) pc = in.c; break;
+        case R_JLT: if (a < b) pc = in.c; break;
+        case R_JGE: if (a >= b) pc = in.c; break;
+        case R_JLE: if (a <= b) pc = in.c; break;
+        case R_SWITCH:
+        {
+            const reg_case_t *first = program.cases.data() + in.c, *last = first + in.b;
+            const reg_case_t *hit = std::lower_bound(first, last, a, [](const reg_case_t &x, int64_t v) { return x.value < v; });
+            pc = hit != last && hit->value == a ? hit->target : in.d;
+            break;
+        }
+        case R_WRITE:
+            output += std::to_string(a);
+            output += '\n';
+            break;
+        case R_EXIT: status = a; break;
+        case R_ALLOC_ARRAY:
+        {
+            // rt_alloc_array's limit: the byte size must not overflow
+            int64_t *p = (uint64_t)a >> 59 ? nullptr : (int64_t *)calloc(a + 1, sizeof(int64_t));
+            if (!p) throw std::bad_alloc();
+            p[0] = a;
+            arrays.push_back(p);
+            r[in.d] = (int64_t)p;
+            break;
+        }
+        case R_LOAD: r[in.d] = ((int64_t *)a)[b + 1]; break;
+        case R_STORE: ((int64_t *)a)[b + 1] = r[in.d]; break;
+        case R_FREE_ARRAY: break; // its arena, or the end of the run, frees it
+        case R_ARENA_MARK: r[in.d] = (int64_t)arrays.size(); break;
+        case R_ARENA_RELEASE: release((size_t)a); break;
+        }
+        if (in.op == R_EXIT) break;
+    }
+    release(0);
+    if (steps) *steps = executed;
+    return (int)(status & 0xff);
+}
+
+// one instruction per line: index, name and operands, registers as r<k>
+// and jump targets as @<index>
+inline void disassemble_regcode(FILE *out, const reg_program_t &program)
+{
+    auto opnd = [](const reg_insn_t &in, bool second) {
+        bool is_imm = in.form & (second ? REG_IMM_B : REG_IMM_A);
+        int64_t v = second ? in.b : in.a;
+        return (is_imm ? "" : "r") + std::to_string(v);
+    };
+    for (size_t pc = 0; pc < program.code.size(); pc++)
+    {
+        const reg_insn_t &in = program.code[pc];
+        fprintf(out, "%6zu  %s", pc, reg_opcode_names[in.op]);
+        std::string text;
+        if (in.op == R_MOV || in.op == R_ALLOC_ARRAY) text = "r" + std::to_string(in.d) + ", " + opnd(in, false);
+        else if (in.op >= R_ADD && in.op <= R_LE) text = "r" + std::to_string(in.d) + ", " + opnd(in, false) + ", " + opnd(in, true);
+        else if (in.op == R_SELECT)
+            text = "r" + std::to_string(in.d) + ", r" + std::to_string(in.c) + ", " + opnd(in, false) + ", " + opnd(in, true);
+        else if (in.op == R_JMP) text = "@" + std::to_string(in.c);
+        else if (in.op == R_JZ || in.op == R_JNZ) text = opnd(in, false) + ", @" + std::to_string(in.c);
+        else if (in.op >= R_JEQ && in.op <= R_JLE) text = opnd(in, false) + ", " + opnd(in, true) + ", @" + std::to_string(in.c);
+        else if (in.op == R_SWITCH)
+        {
+            text = opnd(in, false) + ", [";
+            for (int64_t k = 0; k < in.b; k++)
+            {
+                const reg_case_t &c = program.cases[in.c + k];
+                text += (k ? ", " : "") + std::to_string(c.value) + " -> @" + std::to_string(c.target);
+            }
+            text += "], else @" + std::to_string(in.d);
+        }
+        else if (in.op == R_LOAD) text = "r" + std::to_string(in.d) + ", " + opnd(in, false) + "[" + opnd(in, true) + "]";
+        else if (in.op == R_STORE) text = opnd(in, false) + "[" + opnd(in, true) + "], r" + std::to_string(in.d);
+        else if (in.op == R_ARENA_MARK) text = "r" + std::to_string(in.d);
+        else text = opnd(in, false);
+        fprintf(out, " %s\n", text.c_str());
+    }
+}
+
+// x86-64 for a register program, linked with the same runtime as the stack
+// code. the most used registers, weighted by loop nesting, live in the
+// callee-saved machine registers, which the runtime routines preserve; the
+// rest in a frame below rsp. rax, rcx and rdx are scratch
+struct regcode_asm_t
+{
+    static constexpr const char *machine[] = {"rbx", "r12", "r13", "r14", "r15", "rbp"};
+
+    const reg_program_t &program;
+    asm_emitter_t &out;
+    std::vector<int> home; // by register: index into machine, or -1 - frame slot
+
+    regcode_asm_t(const reg_program_t &p, asm_emitter_t &o) : program(p), out(o) {}
+
+    static bool fits32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+    void assign_homes()
+    {
+        const auto &code = program.code;
+        // loop nesting from the backward jumps, as a running count of the
+        // ranges they span
+        std::vector<int> starts(code.size() + 1, 0);
+        for (size_t pc = 0; pc < code.size(); pc++)
+        {
+            if (reg_is_branch(code[pc].op) && (size_t)code[pc].c <= pc)
+            {
+                starts[code[pc].c]++;
+                starts[pc + 1]--;
+            }
+        }
+        std::vector<double> weight(program.registers, 0);
+        int nesting = 0;
+        for (size_t pc = 0; pc < code.size(); pc++)
+        {
+            nesting += starts[pc];
+            double w = 1;
+            for (int k = 0; k < std::min(nesting, 6); k++) w *= 8;
+            const reg_insn_t &in = code[pc];
+            if (!(in.form & REG_IMM_A) && in.op != R_JMP && in.op != R_ARENA_MARK) weight[in.a] += w;
+            if (!(in.form & REG_IMM_B) && in.op != R_JMP && in.op != R_ARENA_MARK) weight[in.b] += w;
+            bool writes_d = in.op <= R_SELECT || in.op == R_ALLOC_ARRAY || in.op == R_LOAD || in.op == R_STORE || in.op == R_ARENA_MARK;
+            if (writes_d) weight[in.d] += w;
+            if (in.op == R_SELECT) weight[in.c] += w;
+        }
+        std::vector<int32_t> order(program.registers);
+        for (int32_t k = 0; k < program.registers; k++) order[k] = k;
+        std::stable_sort(order.begin(), order.end(), [&](int32_t x, int32_t y) { return weight[x] > weight[y]; });
+        home.assign(program.registers, 0);
+        int spilled = 0;
+        for (size_t k = 0; k < order.size(); k++)
+        {
+            home[order[k]] = k < 6 && weight[order[k]] > 0 ? (int)k : -1 - spilled++;
+        }
+    }
+
+    size_t frame_bytes() const
+    {
+        int slots = 0;
+        for (int h : home) slots = std::max(slots, -h);
+        return 8 * (size_t)slots;
+    }
+
+    bool in_machine(int64_t r) const { return home[r] >= 0; }
+
+    void put_reg(int64_t r)
+    {
+        if (home[r] >= 0)
+        {
+            out.put(std::string_view(machine[home[r]]));
+            return;
+        }
+        out.put("QWORD PTR [rsp + ");
+        out.put_int(8 * (-1 - home[r]));
+        out.put(']');
+    }
+
+    // `dst` = operand a (second = false) or b of `in`
+    void load(const char *dst, const reg_insn_t &in, bool second)
+    {
+        bool is_imm = in.form & (second ? REG_IMM_B : REG_IMM_A);
+        int64_t v = second ? in.b : in.a;
+        if (is_imm)
+        {
+            out.put(fits32(v) ? "  mov " : "  movabs ");
+            out.put(std::string_view(dst));
+            out.put(", ");
+            out.put_int(v);
+        }
+        else
+        {
+            out.put("  mov ");
+            out.put(std::string_view(dst));
+            out.put(", ");
+            put_reg(v);
+        }
+        out.put('\n');
+    }
+
+    // operand b as an instruction source: an imm32, a register or memory.
+    // a wider constant is loaded into rcx by prepare_b first
+    void prepare_b(const reg_insn_t &in)
+    {
+        if ((in.form & REG_IMM_B) && !fits32(in.b)) load("rcx", in, true);
+    }
+
+    void put_b(const reg_insn_t &in)
+    {
+        if (!(in.form & REG_IMM_B)) put_reg(in.b);
+        else if (fits32(in.b)) out.put_int(in.b);
+        else out.put("rcx");
+    }
+
+    // whether `op d, b` can take b as it is: never memory to memory
+    bool direct(int64_t d, const reg_insn_t &in) const
+    {
+        return in_machine(d) || (in.form & REG_IMM_B) || in_machine(in.b);
+    }
+
+    void store_rax(int64_t d)
+    {
+        out.put("  mov ");
+        put_reg(d);
+        out.put(", rax\n");
+    }
+
+    void put_target(int32_t pc)
+    {
+        out.put(".R");
+        out.put_uint(pc);
+    }
+
+    // sets the flags for a cmp b
+    void compare(const reg_insn_t &in)
+    {
+        prepare_b(in);
+        if (!(in.form & REG_IMM_A) && direct(in.a, in))
+        {
+            out.put("  cmp ");
+            put_reg(in.a);
+        }
+        else
+        {
+            load("rax", in, false);
+            out.put("  cmp rax");
+        }
+        out.put(", ");
+        put_b(in);
+        out.put('\n');
+    }
+
+    // a balanced tree of compares over cases[lo, hi) on rax
+    void put_switch(size_t pc, const reg_insn_t &in, size_t lo, size_t hi, size_t &nodes)
+    {
+        const reg_case_t *cases = program.cases.data() + in.c;
+        if (hi - lo <= 3)
+        {
+            for (size_t k = lo; k < hi; k++)
+            {
+                put_case_compare(cases[k].value);
+                out.put("  je ");
+                put_target(cases[k].target);
+                out.put('\n');
+            }
+            out.put("  jmp ");
+            put_target(in.d);
+            out.put('\n');
+            return;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        size_t right = nodes++;
+        put_case_compare(cases[mid].value);
+        out.put("  je ");
+        put_target(cases[mid].target);
+        out.put("\n  jg ");
+        put_target(pc);
+        out.put("_n");
+        out.put_uint(right);
+        out.put('\n');
+        put_switch(pc, in, lo, mid, nodes);
+        put_target(pc);
+        out.put("_n");
+        out.put_uint(right);
+        out.put(":\n");
+        put_switch(pc, in, mid + 1, hi, nodes);
+    }
+
+    void put_case_compare(int64_t value)
+    {
+        if (fits32(value))
+        {
+            out.put("  cmp rax, ");
+            out.put_int(value);
+            out.put('\n');
+            return;
+        }
+        out.put("  movabs rcx, ");
+        out.put_int(value);
+        out.put("\n  cmp rax, rcx\n");
+    }
+
+    void emit(bool freestanding)
+    {
+        assign_homes();
+        const auto &code = program.code;
+        std::vector<bool> target(code.size() + 1, false);
+        bool writes = false, heap = false;
+        for (auto &in : code)
+        {
+            if (reg_is_branch(in.op)) target[in.c] = true;
+            if (in.op == R_SWITCH)
+            {
+                target[in.d] = true;
+                for (int64_t k = 0; k < in.b; k++) target[program.cases[in.c + k].target] = true;
+            }
+            writes = writes || in.op == R_WRITE;
+            heap = heap || in.op == R_ALLOC_ARRAY || in.op == R_FREE_ARRAY || in.op == R_ARENA_MARK || in.op == R_ARENA_RELEASE;
+        }
+
+        out.put(asm_entry_prologue);
+        if (size_t bytes = frame_bytes())
+        {
+            out.put(asm_sub_rsp_begin);
+            out.put_uint(bytes);
+            out.put('\n');
+        }
+        for (size_t pc = 0; pc < code.size(); pc++)
+        {
+            const reg_insn_t &in = code[pc];
+            if (target[pc])
+            {
+                put_target(pc);
+                out.put(asm_label_end);
+            }
+            switch (in.op)
+            {
+            case R_MOV:
+                if (in.form & REG_IMM_A)
+                {
+                    if (!in_machine(in.d) && !fits32(in.a))
+                    {
+                        load("rax", in, false);
+                        store_rax(in.d);
+                        break;
+                    }
+                    out.put(fits32(in.a) ? "  mov " : "  movabs ");
+                    put_reg(in.d);
+                    out.put(", ");
+                    out.put_int(in.a);
+                    out.put('\n');
+                    break;
+                }
+                if (home[in.a] == home[in.d]) break;
+                if (!in_machine(in.a) && !in_machine(in.d))
+                {
+                    load("rax", in, false);
+                    store_rax(in.d);
+                    break;
+                }
+                out.put("  mov ");
+                put_reg(in.d);
+                out.put(", ");
+                put_reg(in.a);
+                out.put('\n');
+                break;
+            case R_ADD:
+            case R_SUB:
+            case R_AND:
+            case R_OR:
+            case R_XOR:
+            case R_MUL:
+            {
+                static constexpr const char *names[] = {"add ", "sub ", "imul ", "", "", "and ", "or ", "xor "};
+                const char *name = names[in.op - R_ADD];
+                prepare_b(in);
+                // imul has no memory destination, and takes an immediate
+                // only in its three-operand form
+                bool imm_mul = in.op == R_MUL && (in.form & REG_IMM_B) && fits32(in.b);
+                bool in_place = !(in.form & REG_IMM_A) && in.a == in.d && direct(in.d, in) &&
+                                (in.op != R_MUL || in_machine(in.d));
+                if (in_place)
+                {
+                    out.put("  ");
+                    out.put(std::string_view(name));
+                    put_reg(in.d);
+                    out.put(", ");
+                    if (imm_mul)
+                    {
+                        put_reg(in.d);
+                        out.put(", ");
+                    }
+                    put_b(in);
+                    out.put('\n');
+                    break;
+                }
+                // a machine register that b does not live in is built in place
+                bool b_is_d = !(in.form & REG_IMM_B) && home[in.b] == home[in.d];
+                if (in_machine(in.d) && !b_is_d)
+                {
+                    if (imm_mul && !(in.form & REG_IMM_A))
+                    {
+                        out.put("  imul ");
+                        put_reg(in.d);
+                        out.put(", ");
+                        put_reg(in.a);
+                        out.put(", ");
+                        put_b(in);
+                        out.put('\n');
+                        break;
+                    }
+                    load(machine[home[in.d]], in, false);
+                    out.put("  ");
+                    out.put(std::string_view(name));
+                    put_reg(in.d);
+                    out.put(", ");
+                    if (imm_mul)
+                    {
+                        put_reg(in.d);
+                        out.put(", ");
+                    }
+                    put_b(in);
+                    out.put('\n');
+                    break;
+                }
+                load("rax", in, false);
+                out.put("  ");
+                out.put(std::string_view(name));
+                out.put(imm_mul ? "rax, rax, " : "rax, ");
+                put_b(in);
+                out.put('\n');
+                store_rax(in.d);
+                break;
+            }
+            case R_DIV:
+            case R_MOD:
+                load("rax", in, false);
+                if ((in.form & REG_IMM_B) && in.b != 0 && in.b != INT64_MIN && fits32(in.b))
+                {
+                    // a constant divisor goes through the shifts and magic
+                    // multiplies of the stack code
+                    isel_t sel(out);
+                    sel.put_div_const(in.b, in.op == R_MOD);
+                    store_rax(in.d);
+                    break;
+                }
+                if (in.form & REG_IMM_B) load("rcx", in, true);
+                out.put("  cqo\n  idiv ");
+                if (in.form & REG_IMM_B) out.put("rcx");
+                else put_reg(in.b);
+                out.put(in.op == R_DIV ? "\n" : "\n  mov rax, rdx\n");
+                store_rax(in.d);
+                break;
+            case R_SHL:
+            case R_SHR:
+                if ((in.form & REG_IMM_B) && in_machine(in.d))
+                {
+                    if ((in.form & REG_IMM_A) || in.a != in.d) load(machine[home[in.d]], in, false);
+                    out.put(in.op == R_SHL ? "  shl " : "  shr ");
+                    put_reg(in.d);
+                    out.put(", ");
+                    out.put_int(in.b & 63);
+                    out.put('\n');
+                    break;
+                }
+                load("rax", in, false);
+                if (in.form & REG_IMM_B)
+                {
+                    out.put(in.op == R_SHL ? "  shl rax, " : "  shr rax, ");
+                    out.put_int(in.b & 63);
+                    out.put('\n');
+                }
+                else
+                {
+                    load("rcx", in, true);
+                    out.put(in.op == R_SHL ? "  shl rax, cl\n" : "  shr rax, cl\n");
+                }
+                store_rax(in.d);
+                break;
+            case R_EQ:
+            case R_NE:
+            case R_GT:
+            case R_LT:
+            case R_GE:
+            case R_LE:
+                compare(in);
+                out.put("  set");
+                out.put(std::string_view(isel_cc[in.op - R_EQ]));
+                out.put(" al\n  movzx eax, al\n");
+                store_rax(in.d);
+                break;
+            case R_SELECT:
+                load("rax", in, false);
+                load("rdx", in, true);
+                out.put("  cmp ");
+                put_reg(in.c);
+                out.put(", 0\n  cmovz rax, rdx\n");
+                store_rax(in.d);
+                break;
+            case R_JMP:
+                if ((size_t)in.c == pc + 1) break;
+                out.put("  jmp ");
+                put_target(in.c);
+                out.put('\n');
+                break;
+            case R_JZ:
+            case R_JNZ:
+                if (in.form & REG_IMM_A)
+                {
+                    load("rax", in, false);
+                    out.put("  test rax, rax\n");
+                }
+                else
+                {
+                    out.put("  cmp ");
+                    put_reg(in.a);
+                    out.put(", 0\n");
+                }
+                out.put(in.op == R_JZ ? "  jz " : "  jnz ");
+                put_target(in.c);
+                out.put('\n');
+                break;
+            case R_JEQ:
+            case R_JNE:
+            case R_JGT:
+            case R_JLT:
+            case R_JGE:
+            case R_JLE:
+                compare(in);
+                out.put("  j");
+                out.put(std::string_view(isel_cc[in.op - R_JEQ]));
+                out.put(' ');
+                put_target(in.c);
+                out.put('\n');
+                break;
+            case R_SWITCH:
+            {
+                load("rax", in, false);
+                size_t nodes = 0;
+                put_switch(pc, in, 0, in.b, nodes);
+                break;
+            }
+            case R_WRITE:
+                load("rdi", in, false);
+                out.put("  call rt_write_int\n");
+                break;
+            case R_EXIT:
+                load("rdi", in, false);
+                out.put("  jmp rt_exit\n");
+                break;
+            case R_ALLOC_ARRAY:
+                load("rdi", in, false);
+                out.put("  call rt_alloc_array\n");
+                store_rax(in.d);
+                break;
+            case R_LOAD:
+            case R_STORE:
+            {
+                load("rax", in, false);
+                bool index_imm = (in.form & REG_IMM_B) && fits32(8 * in.b + 8);
+                if (!index_imm && !((in.form & REG_IMM_B) == 0 && in_machine(in.b))) load("rcx", in, true);
+                auto put_element = [&] {
+                    out.put("QWORD PTR [rax + ");
+                    if (index_imm) out.put_int(8 * in.b + 8);
+                    else
+                    {
+                        if ((in.form & REG_IMM_B) == 0 && in_machine(in.b)) put_reg(in.b);
+                        else out.put("rcx");
+                        out.put(" * 8 + 8");
+                    }
+                    out.put(']');
+                };
+                if (in.op == R_LOAD)
+                {
+                    out.put("  mov rax, ");
+                    put_element();
+                    out.put('\n');
+                    store_rax(in.d);
+                    break;
+                }
+                if (!in_machine(in.d))
+                {
+                    out.put("  mov rdx, ");
+                    put_reg(in.d);
+                    out.put('\n');
+                }
+                out.put("  mov ");
+                put_element();
+                out.put(", ");
+                if (in_machine(in.d)) put_reg(in.d);
+                else out.put("rdx");
+                out.put('\n');
+                break;
+            }
+            case R_FREE_ARRAY:
+                load("rdi", in, false);
+                out.put("  mov rsi, [rdi]\n  lea rsi, [rsi * 8 + 8]\n  call rt_free\n");
+                break;
+            case R_ARENA_MARK:
+                out.put("  mov rax, QWORD PTR [rt_heap_top]\n");
+                store_rax(in.d);
+                break;
+            case R_ARENA_RELEASE:
+                load("rdi", in, false);
+                out.put("  call rt_arena_release\n");
+                break;
+            }
+            out.maybe_flush();
+        }
+        if (freestanding) out.put(asm_freestanding_start);
+        out.put(rt_output_asm_code);
+        if (writes) out.put(rt_write_int_asm_code);
+        if (heap) out.put(rt_heap_asm_code);
+        out.put(rt_exit_hook_asm_code);
+    }
+};
+
+inline void write_regcode_asm_file(const reg_program_t &program, const std::string &path, bool freestanding = false)
+{
+    asm_emitter_t out;
+    out.open(path);
+    regcode_asm_t(program, out).emit(freestanding);
+    out.close();
+}
@@ -0,0 +1,1227 @@
+#pragma once
+
+// runtime support linked into generated programs, emitted as assembly text.
+// routines are free to clobber every caller-saved register; generated code
+// keeps all live values on the machine stack between opcodes.
+
+// size of the user-space stdout buffer; rt_write_int flushes when the next
+// number would not fit, rt_exit flushes whatever is left.
+#define RT_OUTBUF_SIZE "65536"
+
+// always emitted: output buffer, rt_flush and rt_exit (rdi = exit status)
+static constexpr char rt_output_asm_code[] = R"(
+.section .bss
+    .balign 64
+rt_outbuf:
+    .skip )" RT_OUTBUF_SIZE R"( + 32
+rt_outbuf_len:
+    .skip 8
+
+.section .text
+rt_flush:
+    mov rdx, QWORD PTR [rt_outbuf_len]
+    lea rsi, [rt_outbuf]
+.rt_flush_loop:
+    test rdx, rdx
+    jz .rt_flush_done
+    mov eax, 1                      # write(1, rsi, rdx)
+    mov edi, 1
+    syscall
+    test rax, rax
+    js .rt_flush_error
+    add rsi, rax
+    sub rdx, rax
+    jmp .rt_flush_loop
+.rt_flush_error:
+    cmp rax, -4                     # EINTR: retry, anything else drops the buffer
+    je .rt_flush_loop
+.rt_flush_done:
+    mov QWORD PTR [rt_outbuf_len], 0
+    ret
+
+rt_exit:
+    push rdi
+    call rt_exit_hook
+    call rt_flush
+    pop rdi
+    mov eax, 231                    # exit_group: takes worker threads down too
+    syscall
+)";
+
+// rt_exit_hook runs before the final flush; a bare ret unless a runtime
+// component (the line profiler) needs to finish something
+static constexpr char rt_exit_hook_asm_code[] = R"(
+rt_exit_hook:
+    ret
+)";
+
+// profiler for --profile builds. every statement marker adds the cycles since
+// the previous marker to the previous line's entry and counts the new line;
+// every if counts its outcome. the emitter lays out rt_prof_header (32 bytes)
+// directly followed by rt_prof_table, {count, cycles} per source line with
+// line 0 for startup, and rt_prof_branches, {true, false} per condition id,
+// and defines rt_prof_hash, rt_prof_lines, rt_prof_branch_count and
+// rt_prof_path. at exit the header ("TLPROF03", source hash, line count,
+// branch count) and both tables are written to rt_prof_path in one go.
+static constexpr char rt_profile_asm_code[] = R"(
+.section .bss
+    .balign 8
+rt_prof_last_tsc:
+    .skip 8
+rt_prof_cur:
+    .skip 8
+
+.section .text
+rt_prof_start:
+    movabs rax, 0x3330464f52504c54  # "TLPROF03"
+    mov QWORD PTR [rt_prof_header], rax
+    movabs rax, rt_prof_hash
+    mov QWORD PTR [rt_prof_header + 8], rax
+    mov QWORD PTR [rt_prof_header + 16], rt_prof_lines
+    mov QWORD PTR [rt_prof_header + 24], rt_prof_branch_count
+    lea rax, [rt_prof_table]
+    mov QWORD PTR [rt_prof_cur], rax
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov QWORD PTR [rt_prof_last_tsc], rax
+    ret
+
+rt_exit_hook:
+    rdtsc                           # charge the last statement up to exit
+    shl rdx, 32
+    or rax, rdx
+    sub rax, QWORD PTR [rt_prof_last_tsc]
+    mov rdx, QWORD PTR [rt_prof_cur]
+    add QWORD PTR [rdx + 8], rax
+    mov eax, 2                      # open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)
+    lea rdi, [rt_prof_path]
+    mov esi, 0x241
+    mov edx, 0644
+    syscall
+    test rax, rax
+    js .rt_prof_done
+    mov rdi, rax
+    lea rsi, [rt_prof_header]
+    mov rdx, rt_prof_lines * 16 + rt_prof_branch_count * 16 + 32
+.rt_prof_write:
+    test rdx, rdx
+    jz .rt_prof_close
+    mov eax, 1
+    syscall
+    test rax, rax
+    js .rt_prof_close
+    add rsi, rax
+    sub rdx, rax
+    jmp .rt_prof_write
+.rt_prof_close:
+    mov eax, 3
+    syscall
+.rt_prof_done:
+    ret
+)";
+
+// emitted when the program calls write(x): formats rdi as a signed decimal
+// followed by a newline into rt_outbuf. two digits per step via the pair
+// table, x / 100 computed as mulhi(x >> 2, 0x28F5C28F5C28F5C3) >> 2.
+static constexpr char rt_write_int_asm_code[] = R"(
+.section .rodata
+rt_digit_pairs:
+    .ascii "0001020304050607080910111213141516171819"
+    .ascii "2021222324252627282930313233343536373839"
+    .ascii "4041424344454647484950515253545556575859"
+    .ascii "6061626364656667686970717273747576777879"
+    .ascii "8081828384858687888990919293949596979899"
+
+.section .text
+rt_write_int:
+    mov rax, rdi
+    lea r8, [numbuf + 32]           # digits are written backwards from here
+    mov r9, r8
+    test rax, rax
+    jns .rt_wi_loop
+    neg rax                         # INT64_MIN stays correct as unsigned
+.rt_wi_loop:
+    cmp rax, 100
+    jb .rt_wi_tail
+    mov rsi, rax
+    shr rax, 2
+    movabs rcx, 0x28F5C28F5C28F5C3
+    mul rcx
+    shr rdx, 2                      # rdx = x / 100
+    imul rcx, rdx, 100
+    sub rsi, rcx                    # rsi = x % 100
+    movzx ecx, WORD PTR [rt_digit_pairs + rsi * 2]
+    sub r9, 2
+    mov WORD PTR [r9], cx
+    mov rax, rdx
+    jmp .rt_wi_loop
+.rt_wi_tail:
+    cmp rax, 10
+    jb .rt_wi_one_digit
+    movzx ecx, WORD PTR [rt_digit_pairs + rax * 2]
+    sub r9, 2
+    mov WORD PTR [r9], cx
+    jmp .rt_wi_sign
+.rt_wi_one_digit:
+    add al, '0'
+    dec r9
+    mov BYTE PTR [r9], al
+.rt_wi_sign:
+    test rdi, rdi
+    jns .rt_wi_append
+    dec r9
+    mov BYTE PTR [r9], '-'
+.rt_wi_append:
+    mov BYTE PTR [r8], 10
+    inc r8
+    sub r8, r9                      # r8 = length, at most 21 bytes
+    mov rax, QWORD PTR [rt_outbuf_len]
+    lea rcx, [rax + r8]
+    cmp rcx, )" RT_OUTBUF_SIZE R"(
+    jbe .rt_wi_copy
+    call rt_flush
+    xor eax, eax
+    mov rcx, r8
+.rt_wi_copy:
+    mov rdx, QWORD PTR [r9]         # copy 24 bytes, the buffer has slack for it
+    mov QWORD PTR [rt_outbuf + rax], rdx
+    mov rdx, QWORD PTR [r9 + 8]
+    mov QWORD PTR [rt_outbuf + rax + 8], rdx
+    mov rdx, QWORD PTR [r9 + 16]
+    mov QWORD PTR [rt_outbuf + rax + 16], rdx
+    mov QWORD PTR [rt_outbuf_len], rcx
+    ret
+)";
+
+// size of the virtual range reserved for the heap on first allocation. pages
+// are only committed when touched (MAP_NORESERVE), so this is address space,
+// not memory.
+#define RT_HEAP_RESERVE "0x400000000"
+
+// emitted when the program allocates. one mmap-backed arena with a bump
+// pointer; blocks of up to 256 bytes are recycled through 16-byte size-class
+// free lists. rt_arena_release rewinds the bump pointer to a mark taken on
+// scope entry, drops free-list entries above it and returns large spans of
+// pages to the kernel.
+static constexpr char rt_heap_asm_code[] = R"(
+.section .bss
+    .balign 8
+rt_heap_base:
+    .skip 8
+rt_heap_top:
+    .skip 8
+rt_heap_end:
+    .skip 8
+rt_free_lists:
+    .skip 17 * 8                    # index = size / 16, 1..16
+
+.section .text
+# rdi = size in bytes (> 0) -> rax = 16-byte aligned block
+rt_alloc:
+    add rdi, 15
+    and rdi, -16
+    cmp rdi, 256
+    ja .rt_alloc_bump
+    mov rcx, rdi
+    shr rcx, 4
+    mov rax, QWORD PTR [rt_free_lists + rcx * 8]
+    test rax, rax
+    jz .rt_alloc_bump
+    mov rdx, QWORD PTR [rax]
+    mov QWORD PTR [rt_free_lists + rcx * 8], rdx
+    ret
+.rt_alloc_bump:
+    mov rax, QWORD PTR [rt_heap_top]
+    lea rdx, [rax + rdi]
+    cmp rdx, QWORD PTR [rt_heap_end]
+    ja .rt_alloc_reserve
+    mov QWORD PTR [rt_heap_top], rdx
+    ret
+.rt_alloc_reserve:
+    cmp QWORD PTR [rt_heap_end], 0
+    jne rt_out_of_memory
+    push rdi
+    mov eax, 9                      # mmap(0, RESERVE, RW, PRIVATE|ANON|NORESERVE, -1, 0)
+    xor edi, edi
+    movabs rsi, )" RT_HEAP_RESERVE R"(
+    mov edx, 3
+    mov r10d, 0x4022
+    mov r8, -1
+    xor r9d, r9d
+    syscall
+    pop rdi
+    cmp rax, -4096
+    ja rt_out_of_memory
+    mov QWORD PTR [rt_heap_base], rax
+    mov QWORD PTR [rt_heap_top], rax
+    movabs rdx, )" RT_HEAP_RESERVE R"(
+    add rdx, rax
+    mov QWORD PTR [rt_heap_end], rdx
+    jmp .rt_alloc_bump
+
+# rdi = block, rsi = size it was allocated with
+rt_free:
+    add rsi, 15
+    and rsi, -16
+    cmp rsi, 256
+    ja .rt_free_done                # large blocks wait for a bulk release
+    shr rsi, 4
+    mov rax, QWORD PTR [rt_free_lists + rsi * 8]
+    mov QWORD PTR [rdi], rax
+    mov QWORD PTR [rt_free_lists + rsi * 8], rdi
+.rt_free_done:
+    ret
+
+# rdi = mark (a previous value of rt_heap_top)
+rt_arena_release:
+    test rdi, rdi                   # marked before the heap existed
+    jnz .rt_release_rewind
+    mov rdi, QWORD PTR [rt_heap_base]
+.rt_release_rewind:
+    mov r9, QWORD PTR [rt_heap_top]
+    mov QWORD PTR [rt_heap_top], rdi
+    mov ecx, 1
+.rt_release_class:
+    lea rdx, [rt_free_lists + rcx * 8]
+.rt_release_entry:
+    mov rsi, QWORD PTR [rdx]
+    test rsi, rsi
+    jz .rt_release_next
+    cmp rsi, rdi
+    jb .rt_release_keep
+    mov r8, QWORD PTR [rsi]         # block is above the mark: unlink it
+    mov QWORD PTR [rdx], r8
+    jmp .rt_release_entry
+.rt_release_keep:
+    mov rdx, rsi                    # the link lives in the first word
+    jmp .rt_release_entry
+.rt_release_next:
+    inc ecx
+    cmp ecx, 16
+    jbe .rt_release_class
+    lea rsi, [rdi + 4095]           # madvise(DONTNEED) whole pages past the mark
+    and rsi, -4096
+    and r9, -4096
+    sub r9, rsi
+    cmp r9, 1048576
+    jl .rt_release_done
+    mov eax, 28
+    mov rdi, rsi
+    mov rsi, r9
+    mov edx, 4
+    syscall
+.rt_release_done:
+    ret
+
+# rdi = element count -> rax = zeroed array, length stored in the first word.
+# a negative count, or one whose byte size overflows, is out of memory
+rt_alloc_array:
+    mov rax, rdi
+    shr rax, 59
+    jnz rt_out_of_memory
+    push rdi
+    lea rdi, [rdi * 8 + 8]
+    call rt_alloc
+    pop rcx
+    mov QWORD PTR [rax], rcx
+    lea rdi, [rax + 8]
+    mov rdx, rax
+    xor eax, eax
+    rep stosq
+    mov rax, rdx
+    ret
+
+# rdi = count, rsi = record size -> rax = zeroed records after a count word
+rt_alloc_records:
+    test rdi, rdi
+    js rt_out_of_memory
+    push rdi
+    imul rdi, rsi
+    jo rt_out_of_memory
+    add rdi, 15
+    shr rdi, 3
+    push rdi
+    shl rdi, 3
+    call rt_alloc
+    pop rcx
+    mov rdx, rax
+    mov rdi, rax
+    xor eax, eax
+    rep stosq
+    pop rcx
+    mov QWORD PTR [rdx], rcx
+    mov rax, rdx
+    ret
+
+rt_out_of_memory:
+    mov edi, 12                     # ENOMEM
+    jmp rt_exit
+)";
+
+// emitted when the program uses map(); needs the heap. a map is a header
+// {ctrl, mask, slots, count, growth left} over one rt_alloc block holding a
+// control byte per slot, then 16-byte {key, value} slots. a control byte is
+// EMPTY (0x80), DELETED (0xfe) or, for a full slot, the low 7 bits of the
+// key's hash. probes load 16 control bytes at once, compare them against
+// those 7 bits with SSE2 and only visit slots whose byte matches; a group
+// with an EMPTY byte ends the search. the first 16 control bytes are
+// mirrored past the last so an unaligned group never wraps. the table grows
+// (or drops its tombstones) once 7/8 of it has been used.
+static constexpr char rt_map_asm_code[] = R"(
+.set RT_MAP_CTRL, 0
+.set RT_MAP_MASK, 8
+.set RT_MAP_SLOTS, 16
+.set RT_MAP_COUNT, 24
+.set RT_MAP_GROWTH, 32
+
+.section .rodata
+    .balign 16
+rt_map_empty_group:
+    .fill 16, 1, 0x80
+
+.section .text
+# -> rax = an empty map of 16 slots
+rt_map_new:
+    mov edi, 40
+    call rt_alloc
+    push rax
+    mov rdi, rax
+    mov esi, 16
+    call .rt_map_alloc_table
+    pop rax
+    mov QWORD PTR [rax + RT_MAP_COUNT], 0
+    ret
+
+# rdi = map, rsi = capacity (a power of two >= 16): a fresh all-EMPTY table
+.rt_map_alloc_table:
+    push rdi
+    push rsi
+    imul rdi, rsi, 17
+    add rdi, 16
+    call rt_alloc
+    pop rsi
+    pop rdi
+    mov QWORD PTR [rdi + RT_MAP_CTRL], rax
+    lea rcx, [rsi - 1]
+    mov QWORD PTR [rdi + RT_MAP_MASK], rcx
+    lea rdx, [rax + rsi + 16]
+    mov QWORD PTR [rdi + RT_MAP_SLOTS], rdx
+    mov rdx, rsi
+    shr rdx, 3
+    neg rdx
+    add rdx, rsi
+    mov QWORD PTR [rdi + RT_MAP_GROWTH], rdx
+    push rdi
+    mov rdi, rax
+    lea rcx, [rsi + 16]
+    shr rcx, 3
+    movabs rax, 0x8080808080808080
+    rep stosq
+    pop rdi
+    ret
+
+# rdi = map, rsi = key -> rax = slot or 0. keeps rdi and rsi; leaves the
+# hash in r10, the control bytes in r8 and the mask in r9
+rt_map_find:
+    movabs rax, 0x9e3779b97f4a7c15  # hash = both halves of key * 2^64 / phi
+    mul rsi
+    xor rax, rdx
+    mov r10, rax
+    and eax, 0x7f
+    movd xmm1, eax                  # broadcast the 7 tag bits to 16 lanes
+    punpcklbw xmm1, xmm1
+    pshuflw xmm1, xmm1, 0
+    pshufd xmm1, xmm1, 0
+    mov r8, QWORD PTR [rdi + RT_MAP_CTRL]
+    mov r9, QWORD PTR [rdi + RT_MAP_MASK]
+    mov rax, r10
+    shr rax, 7
+    xor r11d, r11d
+.rt_mf_group:
+    and rax, r9
+    movdqu xmm0, XMMWORD PTR [r8 + rax]
+    movdqa xmm2, xmm0
+    pcmpeqb xmm2, xmm1
+    pmovmskb ecx, xmm2
+    test ecx, ecx
+    jz .rt_mf_empty
+.rt_mf_candidate:
+    bsf edx, ecx
+    add rdx, rax
+    and rdx, r9
+    shl rdx, 4
+    add rdx, QWORD PTR [rdi + RT_MAP_SLOTS]
+    cmp QWORD PTR [rdx], rsi
+    je .rt_mf_found
+    lea edx, [rcx - 1]
+    and ecx, edx
+    jnz .rt_mf_candidate
+.rt_mf_empty:
+    pcmpeqb xmm0, XMMWORD PTR [rt_map_empty_group]
+    pmovmskb ecx, xmm0
+    test ecx, ecx
+    jnz .rt_mf_missing
+    add r11, 16                     # triangular steps visit every group
+    add rax, r11
+    jmp .rt_mf_group
+.rt_mf_found:
+    mov rax, rdx
+    ret
+.rt_mf_missing:
+    xor eax, eax
+    ret
+
+# r8 = control bytes, r9 = mask, r10 = hash -> rax = index of the first
+# EMPTY or DELETED slot on the key's probe sequence
+.rt_map_free_index:
+    mov rax, r10
+    shr rax, 7
+    xor r11d, r11d
+.rt_mfi_group:
+    and rax, r9
+    movdqu xmm0, XMMWORD PTR [r8 + rax]
+    pmovmskb ecx, xmm0              # the high bit marks EMPTY and DELETED
+    test ecx, ecx
+    jnz .rt_mfi_found
+    add r11, 16
+    add rax, r11
+    jmp .rt_mfi_group
+.rt_mfi_found:
+    bsf ecx, ecx
+    add rax, rcx
+    and rax, r9
+    ret
+
+# rdi = map, rsi = key -> rax = value, 0 when absent
+rt_map_get:
+    call rt_map_find
+    test rax, rax
+    jz .rt_mg_done
+    mov rax, QWORD PTR [rax + 8]
+.rt_mg_done:
+    ret
+
+# rdi = map, rsi = key -> rax = 1 when present
+rt_map_has:
+    call rt_map_find
+    test rax, rax
+    setnz al
+    movzx eax, al
+    ret
+
+# rdi = map, rsi = key -> rax = the key's slot, inserted with value 0 when
+# absent; the value is at [rax + 8]
+rt_map_slot:
+    call rt_map_find
+    test rax, rax
+    jz .rt_ms_insert
+    ret
+.rt_ms_insert:
+    cmp QWORD PTR [rdi + RT_MAP_GROWTH], 0
+    jne .rt_ms_place
+    push rdi
+    push rsi
+    call .rt_map_resize
+    pop rsi
+    pop rdi
+    jmp rt_map_slot
+.rt_ms_place:
+    call .rt_map_free_index
+    cmp BYTE PTR [r8 + rax], -128   # reusing a tombstone costs no growth
+    jne .rt_ms_tag
+    dec QWORD PTR [rdi + RT_MAP_GROWTH]
+.rt_ms_tag:
+    mov ecx, r10d
+    and ecx, 0x7f
+    mov BYTE PTR [r8 + rax], cl
+    lea rdx, [rax - 15]             # the mirror for index < 16, else itself
+    and rdx, r9
+    mov BYTE PTR [r8 + rdx + 15], cl
+    inc QWORD PTR [rdi + RT_MAP_COUNT]
+    shl rax, 4
+    add rax, QWORD PTR [rdi + RT_MAP_SLOTS]
+    mov QWORD PTR [rax], rsi
+    mov QWORD PTR [rax + 8], 0
+    ret
+
+# rdi = map, rsi = key -> rax = 1 when it was present. the slot becomes
+# EMPTY again unless it sits in a run of 16 non-EMPTY bytes, which a probe
+# may have walked past; then it has to stay a DELETED tombstone
+rt_map_del:
+    call rt_map_find
+    test rax, rax
+    jz .rt_md_done
+    sub rax, QWORD PTR [rdi + RT_MAP_SLOTS]
+    shr rax, 4
+    movdqa xmm1, XMMWORD PTR [rt_map_empty_group]
+    movdqu xmm0, XMMWORD PTR [r8 + rax]
+    pcmpeqb xmm0, xmm1
+    pmovmskb ecx, xmm0
+    or ecx, 0x10000
+    bsf ecx, ecx                    # non-EMPTY bytes from the slot on
+    lea rdx, [rax - 16]
+    and rdx, r9
+    movdqu xmm0, XMMWORD PTR [r8 + rdx]
+    pcmpeqb xmm0, xmm1
+    pmovmskb edx, xmm0
+    lea edx, [rdx * 2 + 1]
+    bsr edx, edx
+    neg edx
+    add edx, 16                     # non-EMPTY bytes right before it
+    add ecx, edx
+    mov edx, -2
+    cmp ecx, 16
+    jae .rt_md_tag
+    mov edx, -128
+    inc QWORD PTR [rdi + RT_MAP_GROWTH]
+.rt_md_tag:
+    mov BYTE PTR [r8 + rax], dl
+    sub rax, 15
+    and rax, r9
+    mov BYTE PTR [r8 + rax + 15], dl
+    dec QWORD PTR [rdi + RT_MAP_COUNT]
+    mov eax, 1
+.rt_md_done:
+    ret
+
+# rdi = map, rsi = cursor -> rax = the first full slot at or after the
+# cursor, or 0 at the end; rdx = the cursor past it
+rt_map_next:
+    mov r8, QWORD PTR [rdi + RT_MAP_CTRL]
+    mov r9, QWORD PTR [rdi + RT_MAP_MASK]
+.rt_mn_group:
+    cmp rsi, r9
+    ja .rt_mn_end
+    movdqu xmm0, XMMWORD PTR [r8 + rsi]
+    pmovmskb ecx, xmm0
+    not ecx
+    and ecx, 0xffff
+    jz .rt_mn_skip
+    bsf ecx, ecx
+    add rsi, rcx
+    cmp rsi, r9                     # a mirrored byte: past the last slot
+    ja .rt_mn_end
+    lea rdx, [rsi + 1]
+    shl rsi, 4
+    mov rax, QWORD PTR [rdi + RT_MAP_SLOTS]
+    add rax, rsi
+    ret
+.rt_mn_skip:
+    add rsi, 16
+    jmp .rt_mn_group
+.rt_mn_end:
+    xor eax, eax
+    ret
+
+# rdi = map: rehash into a table twice the size, or the same size when
+# tombstones rather than entries used it up, and free the old one
+.rt_map_resize:
+    push rbx
+    push r12
+    push r13
+    push r14
+    mov rbx, rdi
+    mov r12, QWORD PTR [rdi + RT_MAP_CTRL]
+    mov r13, QWORD PTR [rdi + RT_MAP_SLOTS]
+    mov r14, QWORD PTR [rdi + RT_MAP_MASK]
+    inc r14                         # old capacity
+    mov rsi, r14
+    imul rax, QWORD PTR [rdi + RT_MAP_COUNT], 16
+    imul rcx, r14, 7
+    cmp rax, rcx
+    jbe .rt_mr_alloc
+    add rsi, rsi
+.rt_mr_alloc:
+    call .rt_map_alloc_table
+    mov rdi, rbx
+    mov rax, QWORD PTR [rdi + RT_MAP_COUNT]
+    sub QWORD PTR [rdi + RT_MAP_GROWTH], rax
+    mov r8, QWORD PTR [rdi + RT_MAP_CTRL]
+    mov r9, QWORD PTR [rdi + RT_MAP_MASK]
+    xor ebx, ebx
+.rt_mr_next:
+    cmp BYTE PTR [r12 + rbx], 0
+    jl .rt_mr_skip
+    mov rax, rbx
+    shl rax, 4
+    mov rsi, QWORD PTR [r13 + rax]
+    movabs rax, 0x9e3779b97f4a7c15
+    mul rsi
+    xor rax, rdx
+    mov r10, rax
+    call .rt_map_free_index
+    mov ecx, r10d
+    and ecx, 0x7f
+    mov BYTE PTR [r8 + rax], cl
+    lea rdx, [rax - 15]
+    and rdx, r9
+    mov BYTE PTR [r8 + rdx + 15], cl
+    shl rax, 4
+    add rax, QWORD PTR [rdi + RT_MAP_SLOTS]
+    mov QWORD PTR [rax], rsi
+    mov rdx, rbx
+    shl rdx, 4
+    mov rdx, QWORD PTR [r13 + rdx + 8]
+    mov QWORD PTR [rax + 8], rdx
+.rt_mr_skip:
+    inc rbx
+    cmp rbx, r14
+    jb .rt_mr_next
+    mov rdi, r12
+    imul rsi, r14, 17
+    add rsi, 16
+    call rt_free
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    ret
+)";
+
+// worker count cap, per-worker deque capacity (a power of two), stack size of
+// each worker thread and the address space reserved for task records
+#define RT_MAX_WORKERS "64"
+#define RT_DEQUE_CAP "4096"
+#define RT_WORKER_STACK "0x4000000"
+#define RT_TASK_RESERVE "0x100000000"
+
+// emitted when the program uses parallel for or spawn. one worker per cpu in
+// the affinity mask, or TOY_THREADS of them, the main thread being worker 0; workers are raw clone()
+// threads that keep their worker record in r15, which generated code never
+// touches. each worker owns a Chase-Lev deque: the owner pushes and pops at
+// the bottom, idle workers steal from the top, and workers that find nothing
+// for a while sleep on the rt_work_seq futex until the next push.
+//
+// a task record is {fn, frame, lo, hi, parent counter} followed, for spawn, by
+// a copy of the spawner's frame; fn(frame, lo, hi) is generated code. every
+// task waits for its own children before it decrements its parent's counter,
+// so once main's counter drops to zero no task is alive and the record arena
+// is rewound.
+static constexpr char rt_parallel_asm_code[] = R"(
+.set RT_W_TOP, 0
+.set RT_W_BOTTOM, 64
+.set RT_W_COUNTER, 72
+.set RT_W_ID, 80
+.set RT_W_BUF, 88
+.set RT_W_SIZE, 128
+
+.section .bss
+    .balign 64
+rt_workers:
+    .skip )" RT_MAX_WORKERS R"( * RT_W_SIZE
+rt_deques:
+    .skip )" RT_MAX_WORKERS R"( * )" RT_DEQUE_CAP R"( * 8
+rt_work_seq:
+    .skip 64
+rt_sleepers:
+    .skip 64
+rt_write_lock:
+    .skip 64
+rt_par_workers:
+    .skip 8
+rt_par_started:
+    .skip 8
+rt_main_pending:
+    .skip 8
+rt_task_base:
+    .skip 8
+rt_task_top:
+    .skip 8
+rt_task_end:
+    .skip 8
+rt_cpu_mask:
+    .skip 128
+rt_envp:
+    .skip 8                         # saved by main's prologue
+
+.section .text
+rt_par_init:
+    push r12
+    push r13
+    mov rsi, QWORD PTR [rt_envp]    # TOY_THREADS=n overrides the cpu count
+    test rsi, rsi
+    jz .rt_pi_affinity
+.rt_pi_env:
+    mov rdi, QWORD PTR [rsi]
+    test rdi, rdi
+    jz .rt_pi_affinity
+    add rsi, 8
+    movabs rax, 0x455248545f594f54  # "TOY_THRE"
+    cmp QWORD PTR [rdi], rax
+    jne .rt_pi_env
+    cmp DWORD PTR [rdi + 8], 0x3d534441 # "ADS="
+    jne .rt_pi_env
+    add rdi, 12
+    xor ecx, ecx
+.rt_pi_digit:
+    movzx eax, BYTE PTR [rdi]
+    sub eax, '0'
+    cmp eax, 9
+    ja .rt_pi_clamp
+    imul rcx, rcx, 10
+    add rcx, rax
+    inc rdi
+    jmp .rt_pi_digit
+.rt_pi_affinity:
+    mov eax, 204                    # sched_getaffinity(0, 128, mask)
+    xor edi, edi
+    mov esi, 128
+    lea rdx, [rt_cpu_mask]
+    syscall
+    xor ecx, ecx
+    test rax, rax
+    jle .rt_pi_clamp
+    xor r8d, r8d
+.rt_pi_count:
+    popcnt r9, QWORD PTR [rt_cpu_mask + r8 * 8]
+    add rcx, r9
+    inc r8
+    cmp r8, 16
+    jb .rt_pi_count
+.rt_pi_clamp:
+    cmp rcx, )" RT_MAX_WORKERS R"(
+    jbe .rt_pi_nonzero
+    mov ecx, )" RT_MAX_WORKERS R"(
+.rt_pi_nonzero:
+    test rcx, rcx
+    jnz .rt_pi_workers
+    mov ecx, 1
+.rt_pi_workers:
+    mov QWORD PTR [rt_par_workers], rcx
+    xor r8d, r8d                    # worker k: id k, deque k
+.rt_pi_worker:
+    imul rax, r8, RT_W_SIZE
+    lea rax, [rt_workers + rax]
+    mov QWORD PTR [rax + RT_W_ID], r8
+    imul rdx, r8, )" RT_DEQUE_CAP R"( * 8
+    lea rdx, [rt_deques + rdx]
+    mov QWORD PTR [rax + RT_W_BUF], rdx
+    inc r8
+    cmp r8, rcx
+    jb .rt_pi_worker
+    mov eax, 9                      # task arena: mmap(0, RESERVE, RW, PRIVATE|ANON|NORESERVE)
+    xor edi, edi
+    movabs rsi, )" RT_TASK_RESERVE R"(
+    mov edx, 3
+    mov r10d, 0x4022
+    mov r8, -1
+    xor r9d, r9d
+    syscall
+    cmp rax, -4096
+    ja rt_task_overflow
+    mov QWORD PTR [rt_task_base], rax
+    mov QWORD PTR [rt_task_top], rax
+    movabs rdx, )" RT_TASK_RESERVE R"(
+    add rdx, rax
+    mov QWORD PTR [rt_task_end], rdx
+    lea r15, [rt_workers]
+    lea rax, [rt_main_pending]
+    mov QWORD PTR [r15 + RT_W_COUNTER], rax
+    mov QWORD PTR [rt_par_started], 1
+    mov r12d, 1
+.rt_pi_spawn:
+    cmp r12, QWORD PTR [rt_par_workers]
+    jae .rt_pi_done
+    mov eax, 9                      # worker stack
+    xor edi, edi
+    mov esi, )" RT_WORKER_STACK R"(
+    mov edx, 3
+    mov r10d, 0x4022
+    mov r8, -1
+    xor r9d, r9d
+    syscall
+    cmp rax, -4096
+    ja .rt_pi_done                  # run with the workers we have
+    lea rsi, [rax + )" RT_WORKER_STACK R"( - 16]
+    imul r13, r12, RT_W_SIZE
+    lea r13, [rt_workers + r13]
+    mov QWORD PTR [rsi], r13        # the child pops its worker record
+    mov eax, 56                     # clone(VM|FS|FILES|SIGHAND|THREAD|SYSVSEM, stack)
+    mov edi, 0x50f00
+    xor edx, edx
+    xor r10d, r10d
+    xor r8d, r8d
+    syscall
+    test rax, rax
+    jz .rt_worker_entry
+    js .rt_pi_done
+    inc r12
+    jmp .rt_pi_spawn
+.rt_pi_done:
+    mov QWORD PTR [rt_par_workers], r12
+    pop r13
+    pop r12
+    ret
+.rt_worker_entry:
+    pop r15
+    jmp rt_worker_loop
+
+rt_task_overflow:
+    mov edi, 12                     # ENOMEM
+    jmp rt_exit
+
+# rdi = task -> eax = 1, or 0 when the deque is full
+rt_deque_push:
+    mov rdx, QWORD PTR [r15 + RT_W_BOTTOM]
+    mov rax, rdx
+    sub rax, QWORD PTR [r15 + RT_W_TOP]
+    cmp rax, )" RT_DEQUE_CAP R"(
+    jge .rt_push_full
+    mov rsi, QWORD PTR [r15 + RT_W_BUF]
+    mov rax, rdx
+    and rax, )" RT_DEQUE_CAP R"( - 1
+    mov QWORD PTR [rsi + rax * 8], rdi
+    inc rdx
+    mov QWORD PTR [r15 + RT_W_BOTTOM], rdx # stores are not reordered: the slot is visible first
+    mov eax, 1
+    ret
+.rt_push_full:
+    xor eax, eax
+    ret
+
+# -> rax = task from the bottom of our own deque, or 0
+rt_deque_pop:
+    mov rdx, QWORD PTR [r15 + RT_W_BOTTOM]
+    dec rdx
+    mov rsi, rdx
+    xchg QWORD PTR [r15 + RT_W_BOTTOM], rsi # full fence before reading top
+    mov rsi, QWORD PTR [r15 + RT_W_TOP]
+    cmp rsi, rdx
+    jg .rt_pop_empty
+    mov rax, QWORD PTR [r15 + RT_W_BUF]
+    mov r10, rdx
+    and r10, )" RT_DEQUE_CAP R"( - 1
+    mov rax, QWORD PTR [rax + r10 * 8]
+    cmp rsi, rdx
+    jne .rt_pop_done
+    mov r11, rax                    # last task: race the thieves for it
+    lea r10, [rdx + 1]
+    mov rax, rsi
+    lock cmpxchg QWORD PTR [r15 + RT_W_TOP], r10
+    mov rax, r11
+    je .rt_pop_last
+    xor eax, eax
+.rt_pop_last:
+    mov QWORD PTR [r15 + RT_W_BOTTOM], r10
+.rt_pop_done:
+    ret
+.rt_pop_empty:
+    inc rdx
+    mov QWORD PTR [r15 + RT_W_BOTTOM], rdx
+    xor eax, eax
+    ret
+
+# rdi = victim worker -> rax = task from the top of its deque, or 0
+rt_deque_steal:
+    mov rsi, QWORD PTR [rdi + RT_W_TOP]
+    mov rdx, QWORD PTR [rdi + RT_W_BOTTOM]
+    cmp rsi, rdx
+    jge .rt_steal_none
+    mov rax, QWORD PTR [rdi + RT_W_BUF]
+    mov r10, rsi
+    and r10, )" RT_DEQUE_CAP R"( - 1
+    mov r11, QWORD PTR [rax + r10 * 8]
+    lea r10, [rsi + 1]
+    mov rax, rsi
+    lock cmpxchg QWORD PTR [rdi + RT_W_TOP], r10
+    jne .rt_steal_none
+    mov rax, r11
+    ret
+.rt_steal_none:
+    xor eax, eax
+    ret
+
+# -> rax = a task from our deque or stolen from another worker, or 0
+rt_find_task:
+    call rt_deque_pop
+    test rax, rax
+    jnz .rt_find_done
+    mov rcx, QWORD PTR [rt_par_workers]
+    mov r8, QWORD PTR [r15 + RT_W_ID]
+    lea r9, [rcx - 1]
+.rt_find_next:
+    test r9, r9
+    jz .rt_find_done
+    inc r8
+    cmp r8, rcx
+    jb .rt_find_victim
+    xor r8d, r8d
+.rt_find_victim:
+    imul rdi, r8, RT_W_SIZE
+    lea rdi, [rt_workers + rdi]
+    call rt_deque_steal
+    test rax, rax
+    jnz .rt_find_done
+    dec r9
+    jmp .rt_find_next
+.rt_find_done:
+    ret
+
+# rdi = task record; runs it, waits for its children, then signs off with the
+# parent. keeps rbx and r12-r15 intact even though task code clobbers rbx.
+rt_run_task:
+    push r12
+    push rbx
+    push QWORD PTR [r15 + RT_W_COUNTER]
+    push 0                          # children of this task
+    mov r12, rdi
+    mov QWORD PTR [r15 + RT_W_COUNTER], rsp
+    mov rdi, QWORD PTR [r12 + 8]
+    mov rsi, QWORD PTR [r12 + 16]
+    mov rdx, QWORD PTR [r12 + 24]
+    call QWORD PTR [r12]
+    mov rdi, rsp
+    call rt_wait
+    mov rax, QWORD PTR [r12 + 32]
+    lock dec QWORD PTR [rax]
+    add rsp, 8
+    pop QWORD PTR [r15 + RT_W_COUNTER]
+    pop rbx
+    pop r12
+    ret
+
+# rdi = counter; runs other tasks until it reaches zero
+rt_wait:
+    push r12
+    mov r12, rdi
+.rt_wait_loop:
+    cmp QWORD PTR [r12], 0
+    je .rt_wait_done
+    call rt_find_task
+    test rax, rax
+    jz .rt_wait_spin
+    mov rdi, rax
+    call rt_run_task
+    jmp .rt_wait_loop
+.rt_wait_spin:
+    pause
+    jmp .rt_wait_loop
+.rt_wait_done:
+    pop r12
+    ret
+
+rt_worker_loop:
+    xor r13d, r13d                  # consecutive empty scans
+.rt_wl_next:
+    mov r12d, DWORD PTR [rt_work_seq] # sample before looking, so no push is missed
+    call rt_find_task
+    test rax, rax
+    jz .rt_wl_idle
+    mov rdi, rax
+    call rt_run_task
+    xor r13d, r13d
+    jmp .rt_wl_next
+.rt_wl_idle:
+    inc r13
+    cmp r13, 256
+    ja .rt_wl_sleep
+    pause
+    jmp .rt_wl_next
+.rt_wl_sleep:
+    lock inc QWORD PTR [rt_sleepers]
+    mov eax, 202                    # futex(&rt_work_seq, FUTEX_WAIT_PRIVATE, sample)
+    lea rdi, [rt_work_seq]
+    mov esi, 128
+    mov edx, r12d
+    xor r10d, r10d
+    syscall
+    lock dec QWORD PTR [rt_sleepers]
+    xor r13d, r13d
+    jmp .rt_wl_next
+
+# rdi = task record; queues it and wakes sleepers, or runs it right away when
+# our deque is full
+rt_submit:
+    call rt_deque_push
+    test eax, eax
+    jz rt_run_task
+    mov esi, 1
+    jmp rt_notify
+
+# esi = number of sleepers to wake once the new work is visible
+rt_notify:
+    lock inc DWORD PTR [rt_work_seq]
+    cmp QWORD PTR [rt_sleepers], 0
+    je .rt_notify_done
+    mov eax, 202                    # futex(&rt_work_seq, FUTEX_WAKE_PRIVATE, n)
+    lea rdi, [rt_work_seq]
+    mov edx, esi
+    mov esi, 129
+    syscall
+.rt_notify_done:
+    ret
+
+.rt_par_ensure_started:
+    cmp QWORD PTR [rt_par_started], 0
+    jne .rt_par_started_done
+    push rdi
+    push rsi
+    push rdx
+    push rcx
+    call rt_par_init
+    pop rcx
+    pop rdx
+    pop rsi
+    pop rdi
+.rt_par_started_done:
+    ret
+
+# nothing is alive once main's own wait is over: reuse the record arena
+.rt_par_rewind:
+    lea rax, [rt_main_pending]
+    cmp QWORD PTR [r15 + RT_W_COUNTER], rax
+    jne .rt_par_rewind_done
+    cmp QWORD PTR [rt_main_pending], 0
+    jne .rt_par_rewind_done
+    mov rax, QWORD PTR [rt_task_base]
+    mov QWORD PTR [rt_task_top], rax
+.rt_par_rewind_done:
+    ret
+
+# rdi = frame, rsi = lo, rdx = hi, rcx = fn; returns once fn(frame, lo', hi')
+# has run over every chunk of [lo, hi)
+rt_parallel_for:
+    call .rt_par_ensure_started
+    mov rax, rdx
+    sub rax, rsi
+    jle .rt_pf_ret
+    cmp QWORD PTR [rt_par_workers], 1
+    ja .rt_pf_split
+    mov rax, rcx
+    jmp rax                         # one worker: the whole range in place
+.rt_pf_split:
+    push r12
+    push r13
+    push r14
+    push rbx
+    push rbp
+    mov r12, rdi
+    mov r13, rsi
+    mov r14, rdx
+    mov rbp, rcx
+    mov rcx, QWORD PTR [rt_par_workers] # aim for min(n, 4 * workers) chunks
+    shl rcx, 2
+    cmp rax, rcx
+    jae .rt_pf_chunks
+    mov rcx, rax
+.rt_pf_chunks:
+    mov r8, rax
+    lea rax, [r8 + rcx - 1]         # chunk length = ceil(n / chunks)
+    xor edx, edx
+    div rcx
+    mov rbx, rax
+    lea rax, [r8 + rbx - 1]         # chunks actually needed at that length
+    xor edx, edx
+    div rbx
+    push rax                        # pending chunks
+    imul rax, rax, 48               # all records at once
+    mov rdx, rax
+    lock xadd QWORD PTR [rt_task_top], rax
+    add rdx, rax
+    cmp rdx, QWORD PTR [rt_task_end]
+    ja rt_task_overflow
+    mov rdi, rax
+.rt_pf_fill:
+    cmp r13, r14
+    jge .rt_pf_filled
+    mov QWORD PTR [rdi], rbp
+    mov QWORD PTR [rdi + 8], r12
+    mov QWORD PTR [rdi + 16], r13
+    add r13, rbx
+    mov rax, r13
+    cmp rax, r14
+    jle .rt_pf_hi
+    mov rax, r14
+.rt_pf_hi:
+    mov QWORD PTR [rdi + 24], rax
+    mov QWORD PTR [rdi + 32], rsp
+    push rdi
+    call rt_deque_push
+    pop rdi
+    test eax, eax
+    jnz .rt_pf_queued
+    push rdi
+    call rt_run_task
+    pop rdi
+.rt_pf_queued:
+    add rdi, 48
+    jmp .rt_pf_fill
+.rt_pf_filled:
+    mov esi, 0x7fffffff
+    call rt_notify
+    mov rdi, rsp
+    call rt_wait
+    call .rt_par_rewind
+    pop rcx
+    pop rbp
+    pop rbx
+    pop r14
+    pop r13
+    pop r12
+.rt_pf_ret:
+    ret
+
+# rdi = frame, rsi = frame bytes, rdx = fn; fn(copy of the frame) runs later
+# on some worker
+rt_spawn:
+    call .rt_par_ensure_started
+    lea rcx, [rsi + 40 + 15]
+    and rcx, -16
+    mov rax, rcx
+    lock xadd QWORD PTR [rt_task_top], rax
+    add rcx, rax
+    cmp rcx, QWORD PTR [rt_task_end]
+    ja rt_task_overflow
+    mov QWORD PTR [rax], rdx
+    lea rcx, [rax + 40]
+    mov QWORD PTR [rax + 8], rcx
+    mov rcx, QWORD PTR [r15 + RT_W_COUNTER]
+    mov QWORD PTR [rax + 32], rcx
+    lock inc QWORD PTR [rcx]
+    mov rcx, rsi
+    shr rcx, 3
+    mov rsi, rdi
+    lea rdi, [rax + 40]
+    mov rdx, rax
+    rep movsq
+    mov rdi, rdx
+    jmp rt_submit
+
+# waits for everything spawned by the current task (or by main)
+rt_join:
+    cmp QWORD PTR [rt_par_started], 0
+    je .rt_join_done
+    mov rdi, QWORD PTR [r15 + RT_W_COUNTER]
+    call rt_wait
+    call .rt_par_rewind
+.rt_join_done:
+    ret
+
+# write() from threaded programs: one writer at a time in rt_outbuf
+rt_write_int_locked:
+    call .rt_write_lock_acquire
+    call rt_write_int
+    mov DWORD PTR [rt_write_lock], 0
+    ret
+
+.rt_write_lock_acquire:
+    mov eax, 1
+    xchg eax, DWORD PTR [rt_write_lock]
+    test eax, eax
+    jz .rt_write_lock_done
+.rt_write_lock_spin:
+    pause
+    cmp DWORD PTR [rt_write_lock], 0
+    jne .rt_write_lock_spin
+    jmp .rt_write_lock_acquire
+.rt_write_lock_done:
+    ret
+
+# rdi = status; exits with the output lock held so no thread writes mid-flush
+rt_par_exit:
+    push rdi
+    call .rt_write_lock_acquire
+    pop rdi
+    jmp rt_exit
+)";
@@ -0,0 +1,361 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include "thread_pool.hpp"
+
+// toyd, the compile server: a long-lived process on a unix socket that
+// compiles for thin clients, so each request skips process startup and
+// finds the cache index, the thread pool and the scratch directory ready.
+// messages are a little-endian u32 byte count and a payload of fixed-width
+// integers and u32-length-prefixed strings; a connection can carry any
+// number of request / reply pairs
+enum ToydRequestKind : uint8_t
+{
+    TOYD_COMPILE = 1, // write the executable to `output`, or just build it
+    TOYD_RUN = 2,     // build, run with `args` and return stdout and exit code
+};
+
+struct toyd_request_t
+{
+    uint8_t kind = TOYD_COMPILE;
+    uint8_t opt_level = 2;
+    bool freestanding = false;
+    std::string source;
+    std::string source_path; // for messages only; the server never reads it
+    std::string output;      // absolute path; empty to leave the executable in the server's cache
+    std::vector<std::string> args;
+};
+
+struct toyd_reply_t
+{
+    bool ok = false;
+    bool cached = false;
+    int32_t exit_code = -1; // TOYD_RUN
+    std::string message;    // the compile error when !ok
+    std::string exe;        // where the executable is, for TOYD_COMPILE
+    std::string output;     // stdout of the program, for TOYD_RUN
+};
+
+namespace toyd
+{
+    // $TOYD_SOCKET, else $XDG_RUNTIME_DIR/toyd.sock, else /tmp/toyd-<uid>.sock
+    inline std::string default_socket()
+    {
+        if (const char *s = getenv("TOYD_SOCKET")) return s;
+        if (const char *r = getenv("XDG_RUNTIME_DIR")) return std::string(r) + "/toyd.sock";
+        return "/tmp/toyd-" + std::to_string(getuid()) + ".sock";
+    }
+
+    struct writer_t
+    {
+        std::string buf = std::string(4, '\0'); // the length, filled in by finish()
+
+        void u8(uint8_t v) { buf += (char)v; }
+        void u32(uint32_t v) { buf.append((const char *)&v, 4); }
+        void str(const std::string &s)
+        {
+            u32(s.size());
+            buf += s;
+        }
+        const std::string &finish()
+        {
+            uint32_t n = buf.size() - 4;
+            memcpy(&buf[0], &n, 4);
+            return buf;
+        }
+    };
+
+    // fails soft: reading past the end sets `bad` and yields zeros
+    struct reader_t
+    {
+        const std::string &buf;
+        size_t pos = 0;
+        bool bad = false;
+
+        bool take(size_t n)
+        {
+            bad = bad || buf.size() - pos < n;
+            return !bad;
+        }
+        uint8_t u8() { return take(1) ? (uint8_t)buf[pos++] : 0; }
+        uint32_t u32()
+        {
+            uint32_t v = 0;
+            if (take(4)) memcpy(&v, &buf[pos], 4), pos += 4;
+            return v;
+        }
+        std::string str()
+        {
+            uint32_t n = u32();
+            if (!take(n)) return "";
+            pos += n;
+            return buf.substr(pos - n, n);
+        }
+    };
+
+    inline std::string encode(const toyd_request_t &req)
+    {
+        writer_t w;
+        w.u8(req.kind);
+        w.u8(req.opt_level);
+        w.u8(req.freestanding);
+        w.str(req.source);
+        w.str(req.source_path);
+        w.str(req.output);
+        w.u32(req.args.size());
+        for (auto &a : req.args) w.str(a);
+        return w.finish();
+    }
+
+    inline bool decode(const std::string &payload, toyd_request_t &req)
+    {
+        reader_t r{payload};
+        req.kind = r.u8();
+        req.opt_level = r.u8();
+        req.freestanding = r.u8();
+        req.source = r.str();
+        req.source_path = r.str();
+        req.output = r.str();
+        uint32_t n = r.u32();
+        req.args.clear();
+        for (uint32_t k = 0; k < n && !r.bad; k++) req.args.push_back(r.str());
+        return !r.bad && (req.kind == TOYD_COMPILE || req.kind == TOYD_RUN);
+    }
+
+    inline std::string encode(const toyd_reply_t &reply)
+    {
+        writer_t w;
+        w.u8(reply.ok);
+        w.u8(reply.cached);
+        w.u32((uint32_t)reply.exit_code);
+        w.str(reply.message);
+        w.str(reply.exe);
+        w.str(reply.output);
+        return w.finish();
+    }
+
+    inline bool decode(const std::string &payload, toyd_reply_t &reply)
+    {
+        reader_t r{payload};
+        reply.ok = r.u8();
+        reply.cached = r.u8();
+        reply.exit_code = (int32_t)r.u32();
+        reply.message = r.str();
+        reply.exe = r.str();
+        reply.output = r.str();
+        return !r.bad;
+    }
+
+    inline bool write_all(int fd, const std::string &data)
+    {
+        for (size_t off = 0; off < data.size();)
+        {
+            ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            off += n;
+        }
+        return true;
+    }
+
+    inline bool read_all(int fd, char *data, size_t size)
+    {
+        for (size_t off = 0; off < size;)
+        {
+            ssize_t n = read(fd, data + off, size - off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            off += n;
+        }
+        return true;
+    }
+
+    // one framed message; false at end of stream or on a frame over 1 GiB
+    inline bool read_message(int fd, std::string &payload)
+    {
+        uint32_t n;
+        if (!read_all(fd, (char *)&n, 4) || n > (1u << 30)) return false;
+        payload.resize(n);
+        return read_all(fd, &payload[0], n);
+    }
+
+    inline bool make_address(const std::string &path, sockaddr_un &addr)
+    {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) return false;
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    // a connected socket, or -1 if no server is listening on `path`
+    inline int connect_to(const std::string &path)
+    {
+        sockaddr_un addr;
+        if (!make_address(path, addr)) return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // SIGINT / SIGTERM remove the socket so that clients fail fast instead of
+    // connecting to nothing; unlink is async-signal-safe, the string is set
+    // once before the handler is installed
+    inline char listening_path[sizeof(sockaddr_un::sun_path)];
+
+    inline void stop_on_signal(int)
+    {
+        unlink(listening_path);
+        _exit(0);
+    }
+
+    // one round trip on a connection from connect_to
+    inline bool call(int fd, const toyd_request_t &req, toyd_reply_t &reply)
+    {
+        std::string payload;
+        return write_all(fd, encode(req)) && read_message(fd, payload) && decode(payload, reply);
+    }
+}
+
+// accepts connections on `socket_path` and serves each on its own thread;
+// the requests themselves run on a pool of `jobs` threads, which bounds the
+// number of compiles (and gcc processes) in flight
+struct toyd_server_t
+{
+    std::string socket_path;
+    std::function<toyd_reply_t(const toyd_request_t &)> handler;
+    size_t jobs = thread_pool_t::default_size();
+
+    int listen_fd = -1;
+
+    // binds the socket, replacing one left behind by a server that was killed.
+    // the server runs whatever it is sent and writes wherever a client asks,
+    // so the socket is 0600 whatever the umask, and run() also drops peers
+    // that are not this user
+    bool listen(std::string &error)
+    {
+        sockaddr_un addr;
+        if (!toyd::make_address(socket_path, addr))
+        {
+            error = "Socket path too long: " + socket_path;
+            return false;
+        }
+        int probe = toyd::connect_to(socket_path);
+        if (probe >= 0)
+        {
+            close(probe);
+            error = "A server is already listening on " + socket_path;
+            return false;
+        }
+        unlink(socket_path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        mode_t old_mask = umask(077);
+        bool bound = listen_fd >= 0 && bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) == 0;
+        umask(old_mask);
+        if (!bound || chmod(socket_path.c_str(), 0600) != 0 || ::listen(listen_fd, 128) != 0)
+        {
+            error = "Failed to listen on " + socket_path + ": " + strerror(errno);
+            if (listen_fd >= 0) close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        memcpy(toyd::listening_path, addr.sun_path, sizeof(addr.sun_path));
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = toyd::stop_on_signal;
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+        return true;
+    }
+
+    // the accept loop; returns only on failure, with a message in `error`.
+    // out of descriptors, the pending connection stays queued and accept
+    // fails again at once, so the loop sleeps until connections close
+    void run(std::string &error)
+    {
+        thread_pool_t pool(jobs);
+        for (;;)
+        {
+            int conn = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (conn < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (errno == EMFILE || errno == ENFILE)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                    continue;
+                }
+                error = std::string("accept failed: ") + strerror(errno);
+                unlink(socket_path.c_str());
+                close(listen_fd);
+                return;
+            }
+            struct ucred peer;
+            socklen_t len = sizeof(peer);
+            if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &peer, &len) != 0 || peer.uid != geteuid())
+            {
+                close(conn);
+                continue;
+            }
+            std::thread([this, conn, &pool] { serve(conn, pool); }).detach();
+        }
+    }
+
+    void serve(int conn, thread_pool_t &pool)
+    {
+        std::string payload;
+        while (toyd::read_message(conn, payload))
+        {
+            toyd_request_t req;
+            toyd_reply_t reply;
+            if (!toyd::decode(payload, req))
+            {
+                reply.message = "Malformed request";
+            }
+            else
+            {
+                // a throw on a pool thread would terminate the daemon for every
+                // client, so whatever the handler throws becomes this reply's error
+                std::promise<toyd_reply_t> done;
+                pool.submit([&] {
+                    toyd_reply_t r;
+                    try
+                    {
+                        r = handler(req);
+                    }
+                    catch (std::exception &e)
+                    {
+                        r.message = std::string("Internal error: ") + e.what();
+                    }
+                    catch (...)
+                    {
+                        r.message = "Internal error";
+                    }
+                    done.set_value(std::move(r));
+                });
+                reply = done.get_future().get();
+            }
+            if (!toyd::write_all(conn, toyd::encode(reply))) break;
+        }
+        close(conn);
+    }
+};
@@ -0,0 +1,190 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// process-wide allocation counters, fed by the operator new replacement in
+// the driver. other embedders simply see zeros.
+namespace stats
+{
+    inline std::atomic<uint64_t> alloc_count{0};
+    inline std::atomic<uint64_t> alloc_bytes{0};
+
+    inline void note_alloc(size_t size)
+    {
+        alloc_count.fetch_add(1, std::memory_order_relaxed);
+        alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    inline double wall_seconds()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+    }
+
+    // our own cpu time plus that of reaped children (gcc)
+    inline double cpu_seconds()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        rusage ru;
+        getrusage(RUSAGE_CHILDREN, &ru);
+        return ts.tv_sec + ts.tv_nsec * 1e-9 + ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+               ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+    }
+
+    // resets the kernel's resident-set high-water mark; no-op where unsupported
+    inline void reset_peak_rss()
+    {
+        if (FILE *f = fopen("/proc/self/clear_refs", "w"))
+        {
+            fputs("5", f);
+            fclose(f);
+        }
+    }
+
+    // VmHWM in KiB, falling back to the lifetime maximum from getrusage
+    inline uint64_t peak_rss_kb()
+    {
+        if (FILE *f = fopen("/proc/self/status", "r"))
+        {
+            char line[256];
+            uint64_t kb = 0;
+            while (fgets(line, sizeof(line), f))
+            {
+                if (strncmp(line, "VmHWM:", 6) == 0)
+                {
+                    kb = strtoull(line + 6, nullptr, 10);
+                    break;
+                }
+            }
+            fclose(f);
+            if (kb) return kb;
+        }
+        rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        return ru.ru_maxrss;
+    }
+}
+
+struct phase_stats_t
+{
+    std::string name;
+    double wall = 0;
+    double cpu = 0;
+    uint64_t allocs = 0;
+    uint64_t alloc_bytes = 0;
+    uint64_t peak_rss_kb = 0;
+};
+
+// one optimization pass of a compile: its wall time and how many rewrites
+// it made. passes folded into code generation have no time of their own
+struct pass_stats_t
+{
+    std::string name;
+    double wall = -1;
+    uint64_t changes = 0;
+    bool ran = false;
+};
+
+// per-phase measurements of a single compile; phases are timed between
+// begin() and end() and must not nest
+struct compile_stats_t
+{
+    std::vector<phase_stats_t> phases;
+    std::vector<pass_stats_t> passes;
+    uint64_t source_bytes = 0;
+    uint64_t tokens = 0;
+    uint64_t ast_nodes = 0;
+    uint64_t bytecode_bytes = 0;
+    bool cache_hit = false;
+
+    double start_wall = 0, start_cpu = 0;
+    uint64_t start_allocs = 0, start_alloc_bytes = 0;
+
+    void begin(const char *name)
+    {
+        phases.push_back({name});
+        stats::reset_peak_rss();
+        start_allocs = stats::alloc_count.load(std::memory_order_relaxed);
+        start_alloc_bytes = stats::alloc_bytes.load(std::memory_order_relaxed);
+        start_cpu = stats::cpu_seconds();
+        start_wall = stats::wall_seconds();
+    }
+
+    void end()
+    {
+        auto &p = phases.back();
+        p.wall = stats::wall_seconds() - start_wall;
+        p.cpu = stats::cpu_seconds() - start_cpu;
+        p.allocs = stats::alloc_count.load(std::memory_order_relaxed) - start_allocs;
+        p.alloc_bytes = stats::alloc_bytes.load(std::memory_order_relaxed) - start_alloc_bytes;
+        p.peak_rss_kb = stats::peak_rss_kb();
+    }
+
+    void print_text(FILE *out) const
+    {
+        fprintf(out, "%-10s %10s %10s %10s %12s %10s\n", "phase", "wall ms", "cpu ms", "allocs", "alloc KiB", "peak KiB");
+        phase_stats_t total{"total"};
+        for (auto &p : phases)
+        {
+            fprintf(out, "%-10s %10.3f %10.3f %10llu %12.1f %10llu\n", p.name.c_str(), p.wall * 1e3, p.cpu * 1e3,
+                    (unsigned long long)p.allocs, p.alloc_bytes / 1024.0, (unsigned long long)p.peak_rss_kb);
+            total.wall += p.wall;
+            total.cpu += p.cpu;
+            total.allocs += p.allocs;
+            total.alloc_bytes += p.alloc_bytes;
+            if (p.peak_rss_kb > total.peak_rss_kb) total.peak_rss_kb = p.peak_rss_kb;
+        }
+        fprintf(out, "%-10s %10.3f %10.3f %10llu %12.1f %10llu\n", "total", total.wall * 1e3, total.cpu * 1e3,
+                (unsigned long long)total.allocs, total.alloc_bytes / 1024.0, (unsigned long long)total.peak_rss_kb);
+        fprintf(out, "source %llu bytes, %llu tokens, %llu ast nodes, %llu bytecode bytes%s\n",
+                (unsigned long long)source_bytes, (unsigned long long)tokens, (unsigned long long)ast_nodes,
+                (unsigned long long)bytecode_bytes, cache_hit ? " (cache hit)" : "");
+        if (passes.empty()) return;
+        fprintf(out, "%-14s %10s %10s\n", "pass", "wall ms", "changes");
+        for (auto &p : passes)
+        {
+            if (!p.ran)
+                fprintf(out, "%-14s %10s\n", p.name.c_str(), "off");
+            else if (p.wall < 0)
+                fprintf(out, "%-14s %10s %10llu\n", p.name.c_str(), "-", (unsigned long long)p.changes);
+            else
+                fprintf(out, "%-14s %10.3f %10llu\n", p.name.c_str(), p.wall * 1e3, (unsigned long long)p.changes);
+        }
+    }
+
+    void print_json(FILE *out) const
+    {
+        fprintf(out, "{\"source_bytes\": %llu, \"tokens\": %llu, \"ast_nodes\": %llu, \"bytecode_bytes\": %llu, "
+                     "\"cache_hit\": %s, \"phases\": [",
+                (unsigned long long)source_bytes, (unsigned long long)tokens, (unsigned long long)ast_nodes,
+                (unsigned long long)bytecode_bytes, cache_hit ? "true" : "false");
+        for (size_t i = 0; i < phases.size(); i++)
+        {
+            auto &p = phases[i];
+            fprintf(out, "%s{\"name\": \"%s\", \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"allocs\": %llu, "
+                         "\"alloc_bytes\": %llu, \"peak_rss_kb\": %llu}",
+                    i ? ", " : "", p.name.c_str(), p.wall * 1e3, p.cpu * 1e3, (unsigned long long)p.allocs,
+                    (unsigned long long)p.alloc_bytes, (unsigned long long)p.peak_rss_kb);
+        }
+        fprintf(out, "], \"passes\": [");
+        for (size_t i = 0; i < passes.size(); i++)
+        {
+            auto &p = passes[i];
+            fprintf(out, "%s{\"name\": \"%s\", \"ran\": %s, \"wall_ms\": ", i ? ", " : "", p.name.c_str(),
+                    p.ran ? "true" : "false");
+            if (p.ran && p.wall >= 0) fprintf(out, "%.3f", p.wall * 1e3);
+            else fprintf(out, "null");
+            fprintf(out, ", \"changes\": %llu}", (unsigned long long)p.changes);
+        }
+        fprintf(out, "]}\n");
+    }
+};
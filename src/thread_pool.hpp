@@ -0,0 +1,87 @@
+#pragma once
+#include <stddef.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+// fixed set of worker threads draining a shared FIFO of tasks
+struct thread_pool_t
+{
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::condition_variable all_done;
+    size_t running = 0;
+    bool stopping = false;
+
+    explicit thread_pool_t(size_t count)
+    {
+        if (count == 0) count = 1;
+        for (size_t i = 0; i < count; i++)
+        {
+            workers.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    thread_pool_t(const thread_pool_t &) = delete;
+    thread_pool_t &operator=(const thread_pool_t &) = delete;
+
+    ~thread_pool_t()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        task_ready.notify_all();
+        for (auto &w : workers) w.join();
+    }
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        task_ready.notify_one();
+    }
+
+    // blocks until the queue is empty and no task is executing
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        all_done.wait(lock, [this] { return tasks.empty() && running == 0; });
+    }
+
+    static size_t default_size()
+    {
+        size_t n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+private:
+    void worker_loop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                task_ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                running++;
+            }
+            task();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running--;
+                if (tasks.empty() && running == 0) all_done.notify_all();
+            }
+        }
+    }
+};
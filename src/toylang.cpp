@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <exception>
+#include "toylang.h"
+#include "parsing.hpp"
+#include "codegen.hpp"
+#include "passes.hpp"
+#include "utils.hpp"
+
+namespace toy {
+
+program_t compile(std::string_view source, const options_t & options) {
+    program_t program;
+    try {
+        for(auto & name : options.disabled_passes) {
+            if(!pass_manager_t::find(name)) throw utils::error_t(0, "Unknown pass: " + name);
+        }
+        // the lexer stops at a NUL, which a string_view need not have
+        std::string src(source);
+        parser_t parser;
+        std::vector<lex_token_t> tokens;
+        std::vector<size_t> line_nos;
+        parser.tokenize(src.c_str(), src.size(), tokens, line_nos);
+        ast_t ast = parser.parse_program(tokens, line_nos);
+        code_generator_t codegen;
+        pass_manager_t pm;
+        pm.level = options.opt_level;
+        pm.disabled.insert(options.disabled_passes.begin(), options.disabled_passes.end());
+        program_data_t data = pm.run(ast, codegen);
+        data.freestanding = program.freestanding = options.freestanding;
+        program.assembly = data.asm_str(true);
+    } catch(utils::error_t & e) {
+        program.diagnostics.push_back({e.line, e.message});
+    } catch(std::exception & e) {
+        program.diagnostics.push_back({0, e.what()});
+    }
+    return program;
+}
+
+// a fresh directory under $TMPDIR, or "" if none could be made
+static std::string make_temp_dir() {
+    const char * tmp = getenv("TMPDIR");
+    std::string path = std::string(tmp && *tmp ? tmp : "/tmp") + "/toylang-XXXXXX";
+    return mkdtemp(&path[0]) ? path : "";
+}
+
+bool link(const program_t & program, const std::string & exe_path, std::vector<diagnostic_t> & diagnostics) {
+    if(!program.ok()) {
+        diagnostics.insert(diagnostics.end(), program.diagnostics.begin(), program.diagnostics.end());
+        return false;
+    }
+    std::string dir = make_temp_dir();
+    if(dir.empty()) {
+        diagnostics.push_back({0, "Failed to create a temporary directory"});
+        return false;
+    }
+    std::string asm_path = dir + "/program.s";
+    bool ok = utils::write_string_to_file(asm_path, program.assembly);
+    if(!ok) diagnostics.push_back({0, "Failed to write " + asm_path});
+    else if(utils::run_command(link_command(asm_path, exe_path, program.freestanding)) != 0) {
+        diagnostics.push_back({0, "Assembling " + asm_path + " failed"});
+        ok = false;
+    }
+    unlink(asm_path.c_str());
+    rmdir(dir.c_str());
+    return ok;
+}
+
+run_result_t run(const program_t & program, const std::vector<std::string> & args) {
+    run_result_t result;
+    std::string dir = make_temp_dir();
+    if(dir.empty()) {
+        result.diagnostics.push_back({0, "Failed to create a temporary directory"});
+        return result;
+    }
+    std::string exe = dir + "/program";
+    if(link(program, exe, result.diagnostics)) {
+        std::vector<std::string> argv = {exe};
+        argv.insert(argv.end(), args.begin(), args.end());
+        result.exit_code = utils::run_capture(exe, argv, result.output);
+        if(result.exit_code < 0) result.diagnostics.push_back({0, "Failed to execute " + exe});
+        unlink(exe.c_str());
+    }
+    rmdir(dir.c_str());
+    return result;
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+
+// embedding interface of the compiler, built into bin/libtoy.a by `make lib`.
+// calls keep all their state on their own stack and heap, so any number of
+// threads can compile and run programs at the same time. nothing is written
+// to stdout or stderr; problems come back as diagnostics
+namespace toy
+{
+    struct diagnostic_t
+    {
+        size_t line = 0; // 0 when not tied to a source line
+        std::string message;
+    };
+
+    struct options_t
+    {
+        int opt_level = 2; // as -O0 / -O1 / -O2
+        bool freestanding = false; // no libc: enter at _start, link -nostdlib -static
+        std::vector<std::string> disabled_passes;
+    };
+
+    // a compiled program: x86-64 assembly for the GNU assembler, or the
+    // diagnostics that stopped the compile
+    struct program_t
+    {
+        std::string assembly;
+        std::vector<diagnostic_t> diagnostics;
+        bool freestanding = false;
+
+        bool ok() const { return diagnostics.empty(); }
+    };
+
+    struct run_result_t
+    {
+        int exit_code = -1; // 128 + signal if it was killed, -1 if it never ran
+        std::string output; // everything it wrote to stdout
+        std::vector<diagnostic_t> diagnostics;
+    };
+
+    program_t compile(std::string_view source, const options_t &options = {});
+
+    // assembles and links an executable with gcc; false with a diagnostic if
+    // the program did not compile or gcc failed
+    bool link(const program_t &program, const std::string &exe_path, std::vector<diagnostic_t> &diagnostics);
+
+    // links into a private temporary directory, runs the executable with
+    // `args` and removes it again. stdin is /dev/null
+    run_result_t run(const program_t &program, const std::vector<std::string> &args = {});
+}
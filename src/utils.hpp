@@ -3,48 +3,117 @@
 #include <fstream>
 #include <iostream>
 #include <string_view>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+#define TOYLANG_VERSION "0.0.1"
 
 namespace utils
 {
-    std::string read_file_as_string(const std::string &path) {
-        std::ifstream file(path);
-        if (!file.is_open()) {
-            std::cerr << "Failed to open file: " << path << std::endl;
-            return "";
-        }
-        std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-        std::cout << content << std::endl;
-        file.close();
+    // reads a whole file without echoing it; false if it cannot be opened
+    inline bool read_file(const std::string &path, std::string &content) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) return false;
+        std::streamoff size = file.tellg();
+        if (size < 0) return false;
+        content.resize(size);
+        file.seekg(0);
+        return (bool)file.read(&content[0], size);
+    }
+
+    // the file's contents, or "" if it cannot be read
+    inline std::string read_file_as_string(const std::string &path) {
+        std::string content;
+        if (!read_file(path, content)) content.clear();
         return content;
     }
 
-    void write_string_to_file(const std::string &path, const std::string &content) {
-        std::ofstream file(path);
-        if (!file.is_open()) {
-            std::cerr << "Failed to open file: " << path << std::endl;
-            return;
+    // runs argv[0] from PATH and waits for it; returns its exit status or -1.
+    // safe to call from several threads, unlike system()
+    inline int run_command(const std::vector<std::string> &args) {
+        std::vector<char *> argv;
+        for (auto &a : args) argv.push_back(const_cast<char *>(a.c_str()));
+        argv.push_back(nullptr);
+        pid_t pid;
+        if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0) return -1;
+        int status;
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) return -1;
         }
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+    // runs `path` with stdin on /dev/null and its stdout appended to `output`.
+    // returns the exit status, 128 + the signal that killed it, or -1 if it
+    // could not be started. the pipe is close-on-exec so that programs
+    // started concurrently from other threads do not hold it open
+    inline int run_capture(const std::string &path, const std::vector<std::string> &args, std::string &output) {
+        std::vector<char *> argv;
+        for (auto &a : args) argv.push_back(const_cast<char *>(a.c_str()));
+        argv.push_back(nullptr);
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+        pid_t pid;
+        int rc = posix_spawn(&pid, path.c_str(), &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(fds[1]);
+        if (rc != 0) {
+            close(fds[0]);
+            return -1;
+        }
+        char buf[4096];
+        for (;;) {
+            ssize_t n = read(fds[0], buf, sizeof(buf));
+            if (n > 0) output.append(buf, n);
+            else if (n == 0 || errno != EINTR) break;
+        }
+        close(fds[0]);
+        int status;
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) return -1;
+        }
+        if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+    inline bool write_string_to_file(const std::string &path, const std::string &content) {
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) return false;
         file << content;
-        file.close();
+        return (bool)file;
     }
 
     class error_t : public std::runtime_error
     {
     public:
-        error_t(size_t line, std::string msg) : std::runtime_error(format_message(line, msg)) {}
+        size_t line;         // 0 when not tied to a source line
+        std::string message; // without the line prefix of what()
+
+        error_t(size_t line, std::string msg)
+            : std::runtime_error(format_message(line, msg)), line(line), message(std::move(msg)) {}
 
-        std::string format_message(size_t line, std::string msg) {
+        static std::string format_message(size_t line, const std::string &msg) {
             return "Error:: line " + std::to_string(line) + ": " + msg;
         }
     };
 
-    void unexpected_token(size_t line, std::string token, std::string expected = "") {
+    [[noreturn]] inline void unexpected_token(size_t line, std::string token, std::string expected = "") {
         std::string msg = "Unexpected token: " + token;
         if (!expected.empty()) msg += ", expected: " + expected;
         throw error_t(line, msg);
     }
 
-    void unexpected_token(size_t line, std::string_view token, std::string_view expected = "") {
+    [[noreturn]] inline void unexpected_token(size_t line, std::string_view token, std::string_view expected = "") {
         std::string msg = "Unexpected token: " + std::string(token);
         if (!expected.empty()) msg += ", expected: " + std::string(expected);
         throw error_t(line, msg);
@@ -0,0 +1,62 @@
+#!/bin/sh
+# regression checks. every run/NAME.tl prints run/NAME.out at each -O level,
+# and through the register bytecode at -O2 where that supports the program.
+# every errors/NAME.tl fails to compile with the message its first line names
+# after "# error: ".
+# a program in profile/ built from its own profile passes the bytecode
+# verifier, prints what the instrumented build printed, and profiling that
+# build again reports the same counts under the same if numbers
+TOY=${TOY:-$(pwd)/bin/toy}
+OUT=${OUT:-bin/tests}
+SRC=$(pwd)/tests
+mkdir -p "$OUT"
+cd "$OUT" || exit 1
+failed=0
+fail() {
+    echo "FAIL $1: $2"
+    failed=1
+    ok=0
+}
+for src in "$SRC"/run/*.tl; do
+    name=$(basename "$src" .tl)
+    ok=1
+    for level in -O0 -O1 -O2; do
+        "$TOY" --no-cache $level -o "$name.exe" "$src" > /dev/null || { fail "$name" "$level build"; continue; }
+        ./"$name.exe" > "$name.txt"
+        cmp -s "$name.txt" "${src%.tl}.out" || fail "$name" "$level output differs"
+    done
+    if "$TOY" --no-cache --regcode -O2 -o "$name.reg.exe" "$src" > /dev/null 2> "$name.err"; then
+        ./"$name.reg.exe" > "$name.txt"
+        cmp -s "$name.txt" "${src%.tl}.out" || fail "$name" "--regcode -O2 output differs"
+    elif ! grep -q "The register bytecode has no" "$name.err"; then
+        fail "$name" "--regcode -O2 build"
+    fi
+    [ $ok = 1 ] && echo "ok $name"
+done
+for src in "$SRC"/errors/*.tl; do
+    name=$(basename "$src" .tl)
+    ok=1
+    expected=$(sed -n '1s/^# error: //p' "$src")
+    if "$TOY" --no-cache -o "$name.exe" "$src" > /dev/null 2> "$name.err"; then
+        fail "$name" "compiled"
+    elif ! grep -qF "$expected" "$name.err"; then
+        fail "$name" "expected \"$expected\", got \"$(cat "$name.err")\""
+    fi
+    [ $ok = 1 ] && echo "ok $name"
+done
+for src in "$SRC"/profile/*.tl; do
+    name=$(basename "$src" .tl)
+    ok=1
+    "$TOY" --no-cache --profile --profile-out "$name.prof" -o "$name.prof.exe" "$src" > /dev/null || { fail "$name" "profile build"; continue; }
+    expected=$(./"$name.prof.exe")
+    "$TOY" --disasm --profile-use "$name.prof" "$src" > /dev/null || fail "$name" "profile-use bytecode rejected"
+    "$TOY" --no-cache --profile-use "$name.prof" -o "$name.pgo.exe" "$src" > /dev/null || { fail "$name" "profile-use build"; continue; }
+    [ "$(./"$name.pgo.exe")" = "$expected" ] || fail "$name" "profile-use output differs"
+    "$TOY" --no-cache --profile-use "$name.prof" --profile --profile-out "$name.2.prof" -o "$name.pgo2.exe" "$src" > /dev/null || { fail "$name" "profile-use profile build"; continue; }
+    [ "$(./"$name.pgo2.exe")" = "$expected" ] || fail "$name" "instrumented profile-use output differs"
+    "$TOY" --profile-report "$name.prof" "$src" | grep '^if' > "$name.ids"
+    "$TOY" --profile-report "$name.2.prof" "$src" | grep '^if' > "$name.2.ids"
+    cmp -s "$name.ids" "$name.2.ids" || fail "$name" "if numbers differ between the builds"
+    [ $ok = 1 ] && echo "ok $name"
+done
+exit $failed